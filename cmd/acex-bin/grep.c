@@ -159,6 +159,7 @@ int main(int argc, char **argv)
 	
 	for (i = optind; i < argc; i++)
 		do_grep(argv[i]);
+	regfree(rx);
 	
 	if (!found && !xcode)
 		xcode = 1;
@@ -29,6 +29,7 @@
 #include <wingui.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <errno.h>
 #include <time.h>
 #include <err.h>
@@ -36,6 +37,8 @@
 #define WIDTH	256
 #define HEIGHT	256
 
+#define BENCH_TIME	2
+
 static win_color bmp[WIDTH * HEIGHT];
 
 static struct form *f;
@@ -45,13 +48,84 @@ static int f_close(struct form *f)
 	exit(0);
 }
 
+static void b_fill(int i)
+{
+	win_rect(f->wd, bmp[i & 255], 0, 0, WIDTH, HEIGHT);
+}
+
+static void b_copy(int i)
+{
+	win_copy(f->wd, 0, 0, 0, 1, WIDTH, HEIGHT - 1);
+}
+
+static void b_copy_rev(int i)
+{
+	win_copy(f->wd, 0, 1, 0, 0, WIDTH, HEIGHT - 1);
+}
+
+static void b_bitmap(int i)
+{
+	win_bitmap(f->wd, bmp, 0, 0, WIDTH, HEIGHT);
+}
+
+static void bench(const char *name, void (*proc)(int i))
+{
+	clock_t t0, t;
+	long cnt = 0;
+	int i;
+	
+	win_clip(f->wd,
+		 f->workspace_rect.x, f->workspace_rect.y, WIDTH, HEIGHT,
+		 f->workspace_rect.x, f->workspace_rect.y);
+	win_paint();
+	t0 = clock();
+	do
+	{
+		for (i = 0; i < 16; i++)
+			proc(cnt++);
+		t = clock();
+	} while (t - t0 < BENCH_TIME * CLOCKS_PER_SEC);
+	win_end_paint();
+	
+	t -= t0;
+	printf("%-10s %8li ops/s %8li KiB/s\n", name,
+		cnt * CLOCKS_PER_SEC / t,
+		(long)(cnt * CLOCKS_PER_SEC / t * WIDTH * HEIGHT * sizeof(win_color) / 1024));
+}
+
+static void microbench(void)
+{
+	int i;
+	
+	for (i = 0; i < WIDTH * HEIGHT; i++)
+		win_rgb2color(&bmp[i], i & 255, (i >> 8) & 255, 128);
+	
+	bench("fill",	  b_fill);
+	bench("copy",	  b_copy);
+	bench("copy-rev", b_copy_rev);
+	bench("bitmap",	  b_bitmap);
+	exit(0);
+}
+
 int main(int argc, char **argv)
 {
 	win_color bg, fg;
 	char buf[256];
 	time_t pt, ct;
+	int mflag = 0;
 	int w, h;
 	int fps;
+	int c;
+	
+	while (c = getopt(argc, argv, "m"), c > 0)
+		switch (c)
+		{
+		case 'm':
+			mflag = 1;
+			break;
+		default:
+			return 1;
+		}
 	
 	if (win_attach())
 		err(255, NULL);
@@ -70,6 +144,12 @@ int main(int argc, char **argv)
 	}
 	form_on_close(f, f_close);
 	
+	if (mflag)
+	{
+		win_idle();
+		microbench();
+	}
+	
 	for (pt = 0, fps = 0; ; )
 	{
 		win_idle();
@@ -71,7 +71,7 @@ static void ptasks(int max)
 	if (qflag)
 		printf("QUEUE     ");
 	if (eflag)
-		printf("MAXEV ");
+		printf("MAXEV MERGED DROP  ");
 	if (bigP)
 		printf("PRIO ");
 	printf("COMM\n");
@@ -102,7 +102,9 @@ static void ptasks(int max)
 		if (eflag)
 		{
 			printf("%-5u ", task[i].maxev);
-			len -= 6;
+			printf("%-6u ", task[i].evmerged);
+			printf("%-5u ", task[i].evdropped);
+			len -= 19;
 		}
 		
 		if (bigP)
@@ -24,9 +24,11 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/wait.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <signal.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <stdint.h>
@@ -50,6 +52,10 @@ static int mode;
 
 static int xit;
 
+static pid_t pump_pid = -1;
+
+static char iobuf[TAR_BUFSIZE];
+
 struct namenode
 {
 	struct namenode *next;
@@ -58,7 +64,7 @@ struct namenode
 	char		 pathname[PATH_MAX];
 } *namenodes;
 
-static void store1(int fd, const char *pathname);
+static void store1(struct tar_stream *ts, const char *pathname);
 
 static void add_namenode(const char *pathname, dev_t dev, ino_t ino)
 {
@@ -258,11 +264,10 @@ static void list1(const struct tar_file *tf, int vl)
 	printf("%s\n", tf->pathname);
 }
 
-static void sreg(int fd, struct tar_hdr *hd, const char *pathname, const struct stat *st)
+static void sreg(struct tar_stream *ts, struct tar_hdr *hd, const char *pathname, const struct stat *st)
 {
-	char buf[32768];
-	ssize_t rwcnt, wcnt;
-	ssize_t rcnt;
+	off_t left = st->st_size;
+	ssize_t rcnt = 0;
 	int sfd;
 	
 	sfd = open(pathname, O_RDONLY);
@@ -270,30 +275,42 @@ static void sreg(int fd, struct tar_hdr *hd, const char *pathname, const struct
 	{
 		warn("%s: open", pathname);
 		xit = 1;
-		return;
+		goto pad;
 	}
 	
-	while (rcnt = read(sfd, buf, sizeof buf), rcnt > 0)
+	while (left)
 	{
-		rwcnt = (rcnt + 511) & ~511;
-		memset(buf + rcnt, 0, rwcnt - rcnt);
+		rcnt = sizeof iobuf;
+		if (rcnt > left)
+			rcnt = left;
+		
+		rcnt = read(sfd, iobuf, rcnt);
+		if (rcnt <= 0)
+			break;
 		
-		wcnt = write(fd, buf, rwcnt);
-		if (wcnt < 0)
+		if (tar_swrite(ts, iobuf, rcnt))
 			err(1, "%s: write", tar_pathname);
-		if (wcnt != rwcnt)
-			errx(1, "%s: write: Short write", tar_pathname);
+		left -= rcnt;
 	}
 	if (rcnt < 0)
 	{
 		warn("%s: read", pathname);
 		xit = 1;
 	}
+	else if (left)
+	{
+		warnx("%s: File shrank", pathname);
+		xit = 1;
+	}
 	
 	close(sfd);
+pad:
+	/* keep the archive consistent with the header */
+	if (tar_swrite(ts, NULL, left) || tar_spad(ts))
+		err(1, "%s: write", tar_pathname);
 }
 
-static void sdir(int fd, struct tar_hdr *hd, const char *pathname)
+static void sdir(struct tar_stream *ts, struct tar_hdr *hd, const char *pathname)
 {
 	struct dirent *de;
 	char *pathname2;
@@ -313,7 +330,7 @@ static void sdir(int fd, struct tar_hdr *hd, const char *pathname)
 		if (asprintf(&pathname2, "%s/%s", pathname, de->d_name) < 0)
 			err(1, "asprintf");
 		
-		store1(fd, pathname2);
+		store1(ts, pathname2);
 		
 		free(pathname2);
 	}
@@ -326,7 +343,7 @@ static void sdir(int fd, struct tar_hdr *hd, const char *pathname)
 	closedir(d);
 }
 
-static void sspec(int fd, struct tar_hdr *hd, const char *pathname, const struct stat *st)
+static void sspec(struct tar_stream *ts, struct tar_hdr *hd, const char *pathname, const struct stat *st)
 {
 }
 
@@ -376,16 +393,11 @@ static void cksum(struct tar_hdr *hd)
 	sprintf(hd->cksum, "%06o ", cksum);
 }
 
-static void store1(int fd, const char *pathname)
+static void store1(struct tar_stream *ts, const char *pathname)
 {
-	union
-	{
-		struct tar_hdr hd;
-		char buf[512];
-	} u;
 	struct namenode *nn;
+	struct tar_hdr hd;
 	struct stat st;
-	ssize_t wcnt;
 	int link = 0;
 	
 	if (stat(pathname, &st))
@@ -398,111 +410,217 @@ static void store1(int fd, const char *pathname)
 	if (!S_ISREG(st.st_mode))
 		st.st_size = 0;
 	
-	memset(&u, 0, sizeof u);
-	init_head(&u.hd, &st, pathname);
+	memset(&hd, 0, sizeof hd);
+	init_head(&hd, &st, pathname);
 	
 	if (st.st_nlink > 1)
 	{
 		nn = find_namenode(st.st_dev, st.st_ino);
 		if (nn)
 		{
-			strcpy(u.hd.size, "00000000000");
-			strcpy(u.hd.link, nn->pathname);
-			u.hd.link_type = TAR_LT_HARD;
+			strcpy(hd.size, "00000000000");
+			strcpy(hd.link, nn->pathname);
+			hd.link_type = TAR_LT_HARD;
 			link = 1;
 		}
 		else
 			add_namenode(pathname, st.st_dev, st.st_ino);
 	}
 	
-	cksum(&u.hd);
+	cksum(&hd);
 	
-	wcnt = write(fd, &u, sizeof u);
-	if (wcnt < 0)
+	if (tar_swrhdr(ts, &hd))
 		err(1, "%s: write", tar_pathname);
-	if (wcnt != sizeof u)
-		errx(1, "%s: write: Short write", tar_pathname);
 	
 	if (!link)
 		switch (st.st_mode & S_IFMT)
 		{
 		case S_IFREG:
-			sreg(fd, &u.hd, pathname, &st);
+			sreg(ts, &hd, pathname, &st);
 			break;
 		case S_IFDIR:
-			sdir(fd, &u.hd, pathname);
+			sdir(ts, &hd, pathname);
 			break;
 		default:
-			sspec(fd, &u.hd, pathname, &st);
+			sspec(ts, &hd, pathname, &st);
 			break;
 		}
 }
 
-static void store(int fd)
+/*
+ * Moves the archive through a pipe from or to a child process, so that
+ * archive I/O overlaps with the file I/O done here.  Archives that are
+ * already pipes are used as they are.
+ */
+static int pump(int fd, int wr)
 {
-	char endblk[1024];
+	struct stat st;
+	ssize_t rcnt;
 	ssize_t wcnt;
+	int pfd[2];
+	int in, out;
 	int i;
 	
-	if (!*members)
-		warnx("no members");
+	if (fstat(fd, &st) || S_ISFIFO(st.st_mode))
+		return fd;
+	if (pipe(pfd))
+		return fd;
 	
-	for (i = 0; members[i]; i++)
-		store1(fd, members[i]);
+	signal(SIGCHLD, SIG_DFL);
+	pump_pid = fork();
+	if (pump_pid < 0)
+	{
+		close(pfd[0]);
+		close(pfd[1]);
+		return fd;
+	}
+	
+	if (!pump_pid)
+	{
+		in  = wr ? pfd[0] : fd;
+		out = wr ? fd	  : pfd[1];
+		close(wr ? pfd[1] : pfd[0]);
+		
+		while (rcnt = read(in, iobuf, sizeof iobuf), rcnt > 0)
+			for (i = 0; i < rcnt; i += wcnt)
+			{
+				wcnt = write(out, iobuf + i, rcnt - i);
+				if (wcnt <= 0)
+				{
+					if (wr)
+						warn("%s: write", tar_pathname);
+					_exit(1);
+				}
+			}
+		if (rcnt < 0)
+		{
+			warn("%s: read", tar_pathname);
+			_exit(1);
+		}
+		if (close(out))
+		{
+			warn("%s: close", tar_pathname);
+			_exit(1);
+		}
+		_exit(0);
+	}
+	
+	close(fd);
+	if (wr)
+	{
+		close(pfd[0]);
+		return pfd[1];
+	}
+	close(pfd[1]);
+	return pfd[0];
+}
+
+/*
+ * Only a writer's status is checked: a reader is cut off by SIGPIPE when
+ * it reads past the end of the archive, and its read errors show up as
+ * a truncated archive anyway.
+ */
+static void pump_wait(int wr)
+{
+	int st;
 	
-	memset(endblk, 0, sizeof endblk);
+	if (pump_pid < 0)
+		return;
 	
-	wcnt = write(fd, endblk, sizeof endblk);
-	if (wcnt < 0)
-		err(1, "%s: write", tar_pathname);
-	if (wcnt != sizeof endblk)
-		errx(1, "%s: write: Short write", tar_pathname);
+	while (waitpid(pump_pid, &st, 0) < 0)
+		if (errno != EINTR)
+			err(1, "waitpid");
+	if (wr && (!WIFEXITED(st) || WEXITSTATUS(st)))
+		xit = 1;
+	pump_pid = -1;
 }
 
-static void create(void)
+static int open_archive(int flags, int stdfd)
 {
 	int fd;
 	
-	fd = open(tar_pathname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (!strcmp(tar_pathname, "-"))
+		return stdfd;
+	
+	fd = open(tar_pathname, flags, 0666);
 	if (fd < 0)
 		err(1, "%s: open", tar_pathname);
+	return fd;
+}
+
+static void store(int fd)
+{
+	struct tar_stream *ts;
+	int i;
 	
-	store(fd);
+	if (!*members)
+		warnx("no members");
+	
+	fd = pump(fd, 1);
+	
+	ts = tar_sopen(fd, 1);
+	if (!ts)
+		err(1, NULL);
+	
+	for (i = 0; members[i]; i++)
+		store1(ts, members[i]);
+	
+	if (tar_sclose(ts))
+		err(1, "%s: write", tar_pathname);
 	
 	if (close(fd))
 		err(1, "%s: close", tar_pathname);
+	pump_wait(1);
+}
+
+static void create(void)
+{
+	store(open_archive(O_WRONLY | O_CREAT | O_TRUNC, 1));
 }
 
 static void append(void)
 {
-	struct tar *tar;
+	const struct tar_file *tf;
+	struct tar_stream *ts;
+	int fd;
+	int r;
 	
-	tar = tar_openw(tar_pathname);
-	if (!tar)
-		err(1, "%s: open", tar_pathname);
+	fd = open_archive(O_RDWR, -1);
+	if (fd < 0)
+		errx(1, "%s: Cannot append to a stream", tar_pathname);
 	
-	if (lseek(tar->fd, tar->append_offset, SEEK_SET) < 0)
-		err(1, "%s: lseek", tar_pathname);
+	ts = tar_sopen(fd, 0);
+	if (!ts)
+		err(1, NULL);
+	while (r = tar_snext(ts, &tf), r > 0)
+		;
+	if (r < 0)
+		err(1, "%s", tar_pathname);
 	
-	store(tar->fd);
+	if (lseek(fd, ts->append_offset, SEEK_SET) < 0)
+		err(1, "%s: lseek", tar_pathname);
+	tar_sclose(ts);
 	
-	tar_close(tar);
+	store(fd);
 }
 
 static void list(void)
 {
-	struct tar *tar;
-	int i;
-	
-	tar = tar_open(tar_pathname);
-	if (!tar)
+	const struct tar_file *tf;
+	struct tar_stream *ts;
+	int r;
+	
+	ts = tar_sopen(open_archive(O_RDONLY, 0), 0);
+	if (!ts)
+		err(1, NULL);
+	
+	while (r = tar_snext(ts, &tf), r > 0)
+		if (mused(tf->pathname))
+			list1(tf, vflag);
+	if (r < 0)
 		err(1, "%s", tar_pathname);
 	
-	for (i = 0; i < tar->file_cnt; i++)
-		if (mused(tar->files[i].pathname))
-			list1(&tar->files[i], vflag);
-	
-	tar_close(tar);
+	tar_sclose(ts);
 }
 
 static void preserve(const struct tar_file *tf, int fd, const char *pathname)
@@ -542,7 +660,7 @@ clean:
 		close(fd);
 }
 
-static void xdir(const struct tar *tar, const struct tar_file *tf, const char *pathname)
+static void xdir(struct tar_stream *ts, const struct tar_file *tf, const char *pathname)
 {
 	if (mkdir(pathname, tf->mode) && errno != EEXIST)
 	{
@@ -554,18 +672,12 @@ static void xdir(const struct tar *tar, const struct tar_file *tf, const char *p
 	preserve(tf, -1, pathname);
 }
 
-static void xreg(const struct tar *tar, const struct tar_file *tf, const char *pathname)
+static void xreg(struct tar_stream *ts, const struct tar_file *tf, const char *pathname)
 {
-	static char buf[32768];
-	
+	const void *buf;
 	ssize_t isz, osz;
-	off_t size;
-	off_t off;
 	int fd;
 	
-	size = tf->size;
-	off = 0;
-	
 	fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC, tf->mode & 04777);
 	if (fd < 0)
 	{
@@ -574,26 +686,24 @@ static void xreg(const struct tar *tar, const struct tar_file *tf, const char *p
 		return;
 	}
 	
-	while (off < size)
+	while (isz = tar_sdata(ts, &buf), isz > 0)
 	{
-		if (size - off > sizeof buf)
-			isz = sizeof buf;
-		else
-			isz = size - off;
-		
-		isz = tar_read(tar, tf, buf, isz, off);
-		if (isz < 0)
-			err(1, "%s", tar_pathname);
-		
 		osz = write(fd, buf, isz);
 		if (osz < 0)
 		{
 			warn("%s: write", pathname);
+			xit = 1;
+			break;
+		}
+		if (osz != isz)
+		{
+			warnx("%s: write: Short write", pathname);
+			xit = 1;
 			break;
 		}
-		
-		off += osz;
 	}
+	if (isz < 0)
+		err(1, "%s", tar_pathname);
 	
 	preserve(tf, fd, pathname);
 	if (close(fd))
@@ -603,7 +713,7 @@ static void xreg(const struct tar *tar, const struct tar_file *tf, const char *p
 	}
 }
 
-static void xlink(const struct tar *tar, const struct tar_file *tf, const char *pathname)
+static void xlink(struct tar_stream *ts, const struct tar_file *tf, const char *pathname)
 {
 	char npathname[PATH_MAX];
 	char *opathname;
@@ -626,19 +736,19 @@ static void xlink(const struct tar *tar, const struct tar_file *tf, const char *
 	}
 }
 
-static void xspec(const struct tar *tar, const struct tar_file *tf, const char *pathname)
+static void xspec(struct tar_stream *ts, const struct tar_file *tf, const char *pathname)
 {
 	warnx("%s: Special file", pathname);
 	xit = 1;
 }
 
-static void xfifo(const struct tar *tar, const struct tar_file *tf, const char *pathname)
+static void xfifo(struct tar_stream *ts, const struct tar_file *tf, const char *pathname)
 {
 	warnx("%s: FIFO file", pathname);
 	xit = 1;
 }
 
-static void extract1(struct tar *tar, const struct tar_file *tf)
+static void extract1(struct tar_stream *ts, const struct tar_file *tf)
 {
 	char *spn;
 	
@@ -649,20 +759,20 @@ static void extract1(struct tar *tar, const struct tar_file *tf)
 	{
 	case TAR_LT_REG:
 	case 0:
-		xreg(tar, tf, spn);
+		xreg(ts, tf, spn);
 		break;
 	case TAR_LT_CHR:
 	case TAR_LT_BLK:
-		xspec(tar, tf, spn);
+		xspec(ts, tf, spn);
 		break;
 	case TAR_LT_FIFO:
-		xfifo(tar, tf, spn);
+		xfifo(ts, tf, spn);
 		break;
 	case TAR_LT_DIR:
-		xdir(tar, tf, spn);
+		xdir(ts, tf, spn);
 		break;
 	case TAR_LT_HARD:
-		xlink(tar, tf, spn);
+		xlink(ts, tf, spn);
 		break;
 	default:
 		;
@@ -671,18 +781,26 @@ static void extract1(struct tar *tar, const struct tar_file *tf)
 
 static void extract(void)
 {
-	struct tar *tar;
-	int i;
+	const struct tar_file *tf;
+	struct tar_stream *ts;
+	int fd;
+	int r;
 	
-	tar = tar_open(tar_pathname);
-	if (!tar)
-		err(1, "%s", tar_pathname);
+	fd = pump(open_archive(O_RDONLY, 0), 0);
 	
-	for (i = 0; i < tar->file_cnt; i++)
-		if (mused(tar->files[i].pathname))
-			extract1(tar, &tar->files[i]);
+	ts = tar_sopen(fd, 0);
+	if (!ts)
+		err(1, NULL);
+	
+	while (r = tar_snext(ts, &tf), r > 0)
+		if (mused(tf->pathname))
+			extract1(ts, tf);
+	if (r < 0)
+		err(1, "%s", tar_pathname);
 	
-	tar_close(tar);
+	tar_sclose(ts);
+	close(fd);
+	pump_wait(0);
 }
 
 static void usage(void)
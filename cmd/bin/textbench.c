@@ -29,6 +29,7 @@
 #include <wingui.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <errno.h>
 #include <time.h>
 #include <err.h>
@@ -39,11 +40,35 @@
 
 static struct form *f;
 
+static int cflag;
+static int tflag;
+
 static int f_close(struct form *f)
 {
 	exit(0);
 }
 
+static void draw_line(win_color bg, win_color fg, int y, const char *text, int cw, int ch)
+{
+	int x;
+	
+	if (tflag)
+	{
+		win_rect(f->wd, bg, 0, y, cw * COLS, ch);
+		win_text(f->wd, fg, 0, y, text);
+		return;
+	}
+	
+	if (cflag)
+	{
+		for (x = 0; x < COLS && text[x]; x++)
+			win_bchr(f->wd, bg, fg, x * cw, y, (unsigned char)text[x]);
+		return;
+	}
+	
+	win_btext(f->wd, bg, fg, 0, y, text);
+}
+
 int main(int argc, char **argv)
 {
 	win_color bg, fg;
@@ -54,8 +79,22 @@ int main(int argc, char **argv)
 	int w, h;
 	int fps;
 	int cnt;
+	int c;
 	int i;
 	
+	while (c = getopt(argc, argv, "ct"), c > 0)
+		switch (c)
+		{
+		case 'c':
+			cflag = 1;
+			break;
+		case 't':
+			tflag = 1;
+			break;
+		default:
+			return 1;
+		}
+	
 	if (win_attach())
 		err(255, NULL);
 	
@@ -82,7 +121,7 @@ int main(int argc, char **argv)
 			 f->workspace_rect.x, f->workspace_rect.y);
 		win_paint();
 		for (i = 0; i < LINES; i++)
-			win_btext(f->wd, bg, fg, 0, i * ch, text + i + cnt % COLS);
+			draw_line(bg, fg, i * ch, text + i + cnt % COLS, cw, ch);
 		win_end_paint();
 		fps++;
 		
@@ -476,7 +476,7 @@ static void find_click(struct gadget *btn, int x, int y)
 	
 	goto clean;
 clean:
-	free(content_rx);
+	regfree(content_rx);
 	
 	content_rx = NULL;
 	content = NULL;
@@ -35,9 +35,11 @@
 #include <stdlib.h>
 #include <mount.h>
 #include <stdint.h>
+#include <sys/time.h>
 #include <err.h>
 
 #define BLK_SIZE		512
+#define BLK_MAXSIZE		(BLK_SIZE << NAT_BSHIFT_MAX)
 
 #define NAT_FAT_FREE		0
 #define NAT_FAT_EOF		(-1)
@@ -48,10 +50,14 @@
 #define NAT_FILE_SIZE_MAX	(0x7fffffff)
 #define NAT_DIR_SIZE_MAX	(0x00100000)
 
-#define NAT_D_PER_BLOCK		(BLK_SIZE / sizeof(struct nat_dirent))
+#define NAT_D_MAX		(BLK_MAXSIZE / sizeof(struct nat_dirent))
 
 #define ICHECK_MAX		16
 
+#define FHASH_SIZE		1024
+#define SCAN_RUN		128
+#define SCAN_GAP		16
+
 static struct _mtab *	mount;
 
 static char *		dev_name;
@@ -64,10 +70,15 @@ static int		enable_write;
 static int		show_names;
 static int		qflag;
 static int		sflag;
+static int		bflag;
 static int		fix;
 
 static uint8_t *	rbam;
 
+static int		bsize = BLK_SIZE;
+static int		ishift = 7;
+static int		dents = BLK_SIZE / sizeof(struct nat_dirent);
+
 static struct nat_super	sb;
 
 static struct file
@@ -75,16 +86,56 @@ static struct file
 	struct	 nat_header hd;
 	uint32_t first_block;
 	uint32_t true_nlink;
+	uint32_t nblocks;
 	int	 checked;
+	int	 walked;
+	int	 next;
+	int	 dfirst;
+	int	 dcount;
 } *file;
 
 static int file_count;
+static int fhash[FHASH_SIZE];
+
+#define SCAN_HDR		0
+#define SCAN_IMAP		1
+#define SCAN_DIR		2
+
+static struct scan
+{
+	uint32_t bn;
+	uint64_t log;
+	int	 file;
+	int	 kind;
+	int	 indl;
+} *scan, *scan_next;
+
+static int scan_count;
+static int scan_max;
+static int scan_next_count;
+static int scan_next_max;
+
+static struct dent
+{
+	struct	 nat_dirent de;
+	uint32_t bn;
+	uint32_t log;
+	int	 slot;
+	int	 dir;
+} *dent;
+
+static int dent_count;
+static int dent_max;
+
+static struct timeval	phase_tv;
 
 static void	load_super(void);
+static void	replay_log(void);
 static struct file *
 		load_hdr(uint32_t first_block);
 static void	save_hdr(struct file *file);
 static uint32_t	check_bmap(struct file *file);
+static uint32_t	check_ext(struct file *file, int *dirty);
 static void	check_file(unsigned first_block, int depth, char *name);
 static void	check_dir(unsigned first_block, int depth, char *name);
 static void	check_nlink(void);
@@ -119,6 +170,7 @@ static void load_super(void)
 	size_t bdai, edai;
 	uint32_t edata;
 	size_t rbamsz;
+	uint32_t bn;
 	
 	lseek(dev_fd, BLK_SIZE, SEEK_SET);
 	errno = EINVAL;
@@ -145,7 +197,19 @@ static void load_super(void)
 			exit_fsck(255);
 	}
 	
-	rbamsz = sb.bam_size * BLK_SIZE;
+	if (NAT_FEATURES(&sb) & NAT_F_BSIZE)
+	{
+		if (sb.bshift > NAT_BSHIFT_MAX)
+		{
+			warnx("superblock: bad block size");
+			exit_fsck(255);
+		}
+		bsize  = BLK_SIZE << sb.bshift;
+		ishift = 7 + sb.bshift;
+		dents  = bsize / sizeof(struct nat_dirent);
+	}
+	
+	rbamsz = sb.bam_size * bsize;
 	
 	rbam = calloc(rbamsz, 1);
 	if (!rbam)
@@ -172,6 +236,112 @@ static void load_super(void)
 		rbam[bdai] =   255 >> (8 - (sb.data_block & 7));
 	if (edata & 7)
 		rbam[edai] = ~(255 >> (8 - (edata	  & 7)));
+	
+	if (NAT_FEATURES(&sb) & NAT_F_LOG)
+	{
+		if (sb.log_block < sb.data_block || sb.log_block + sb.log_size > edata)
+		{
+			warnx("superblock: bad log area");
+			exit_fsck(255);
+		}
+		for (bn = sb.log_block; bn < sb.log_block + sb.log_size; bn++)
+			bused(bn);
+	}
+}
+
+static uint32_t log_sum(uint32_t sum, const void *buf, int len)
+{
+	const uint32_t *p = buf;
+	int i;
+	
+	for (i = 0; i < len / 4; i++)
+		sum = ((sum << 1) | (sum >> 31)) + p[i];
+	return sum;
+}
+
+static void read_log(uint32_t pos, void *buf, int len)
+{
+	lseek(dev_fd, (off_t)(sb.log_block + pos) * bsize, SEEK_SET);
+	errno = EINVAL;
+	if (read(dev_fd, buf, len) != len)
+	{
+		warn("reading log");
+		exit_fsck(errno);
+	}
+}
+
+/*
+ * Apply the complete groups left in the intent log, as mount would,
+ * so that the check sees the filesystem the log describes.
+ */
+static void replay_log(void)
+{
+	static char img[NAT_LOG_NBLK * BLK_MAXSIZE];
+	struct nat_log_head hd;
+	uint32_t start = 0;
+	uint32_t pos = 0;
+	int replayed = 0;
+	int records = 0;
+	uint32_t sum;
+	int i;
+	
+	while (pos < sb.log_size)
+	{
+		read_log(pos, &hd, sizeof hd);
+		if (hd.magic != NAT_LOG_MAGIC || hd.seq != sb.log_seq + records)
+			break;
+		if (hd.count > NAT_LOG_NBLK || pos + 1 + hd.count > sb.log_size)
+			break;
+		read_log(pos + 1, img, hd.count * bsize);
+		
+		sum    = hd.sum;
+		hd.sum = 0;
+		hd.sum = log_sum(0, &hd, sizeof hd);
+		for (i = 0; i < hd.count; i++)
+			hd.sum = log_sum(hd.sum, img + i * bsize, bsize);
+		if (hd.sum != sum)
+			break;
+		
+		pos += hd.count + 1;
+		records++;
+		if (!hd.commit || !fix)
+			continue;
+		
+		while (start < pos)
+		{
+			read_log(start, &hd, sizeof hd);
+			read_log(start + 1, img, hd.count * bsize);
+			for (i = 0; i < hd.count; i++)
+			{
+				lseek(dev_fd, (off_t)hd.blocks[i] * bsize, SEEK_SET);
+				if (write(dev_fd, img + i * bsize, bsize) != bsize)
+				{
+					warn("writing block %lu", (unsigned long)hd.blocks[i]);
+					exit_fsck(errno);
+				}
+			}
+			start += hd.count + 1;
+			replayed++;
+		}
+	}
+	
+	if (!records)
+		return;
+	
+	if (!fix)
+	{
+		warnx("%i log records not replayed", records);
+		return;
+	}
+	
+	sb.log_seq += records;
+	lseek(dev_fd, BLK_SIZE, SEEK_SET);
+	if (write(dev_fd, &sb, sizeof sb) != sizeof sb)
+	{
+		warn("writing superblock");
+		exit_fsck(errno);
+	}
+	warnx("replayed %i log records, discarded %i", replayed, records - replayed);
 }
 
 static void mark_clean(void)
@@ -188,39 +358,62 @@ static void mark_clean(void)
 	warnx("filesystem marked clean");
 }
 
-static struct file *load_hdr(uint32_t first_block)
+static struct file *find_file(uint32_t first_block)
 {
-	int cnt;
 	int i;
 	
-	for (i = 0; i < file_count; i++)
-		if (file[i].first_block == first_block)
-			return &file[i];
+	for (i = fhash[first_block % FHASH_SIZE]; i; i = file[i - 1].next)
+		if (file[i - 1].first_block == first_block)
+			return &file[i - 1];
+	return NULL;
+}
+
+static struct file *new_file(uint32_t first_block)
+{
+	struct file *f;
 	
-	file_count++;
-	file = realloc(file, file_count * sizeof(struct file));
-	if (!file)
+	if (file_count % 256 == 0)
 	{
-		warn("realloc");
-		exit_fsck(errno);
+		file = realloc(file, (file_count + 256) * sizeof(struct file));
+		if (!file)
+		{
+			warn("realloc");
+			exit_fsck(errno);
+		}
 	}
 	
-	lseek(dev_fd, first_block * BLK_SIZE, SEEK_SET);
-	cnt = read(dev_fd, &file[file_count - 1].hd, sizeof(struct nat_header));
+	f = &file[file_count++];
+	memset(f, 0, sizeof *f);
+	f->first_block = first_block;
+	f->next	       = fhash[first_block % FHASH_SIZE];
+	fhash[first_block % FHASH_SIZE] = file_count;
+	return f;
+}
+
+static struct file *load_hdr(uint32_t first_block)
+{
+	struct file *f;
+	int cnt;
+	
+	f = find_file(first_block);
+	if (f)
+		return f;
+	
+	f = new_file(first_block);
+	
+	lseek(dev_fd, (off_t)first_block * bsize, SEEK_SET);
+	cnt = read(dev_fd, &f->hd, sizeof(struct nat_header));
 	if (cnt < 0)
 	{
 		warn("reading header of %i", first_block);
 		exit_fsck(errno);
 	}
-	file[file_count - 1].first_block = first_block;
-	file[file_count - 1].true_nlink  = 0;
-	file[file_count - 1].checked     = 0;
-	return &file[file_count - 1];
+	return f;
 }
 
 static void save_hdr(struct file *file)
 {
-	lseek(dev_fd, file->first_block * BLK_SIZE, SEEK_SET);
+	lseek(dev_fd, (off_t)file->first_block * bsize, SEEK_SET);
 	if (write(dev_fd, &file->hd, sizeof file->hd) != sizeof file->hd)
 	{
 		warn("writing header of %i", file->first_block);
@@ -230,20 +423,20 @@ static void save_hdr(struct file *file)
 
 static uint32_t check_imap(uint32_t mbn, int indl)
 {
-	uint32_t imap[BLK_SIZE / 4];
+	uint32_t imap[BLK_MAXSIZE / 4];
 	uint32_t bcnt = 0;
 	uint32_t bn;
 	int dirty;
 	int i;
 	
-	lseek(dev_fd, mbn * BLK_SIZE, SEEK_SET);
-	if (read(dev_fd, imap, sizeof imap) < 0)
+	lseek(dev_fd, (off_t)mbn * bsize, SEEK_SET);
+	if (read(dev_fd, imap, bsize) < 0)
 	{
 		warn("reading block %i", (int)mbn);
 		exit_fsck(errno);
 	}
 	
-	for (i = 0; i < BLK_SIZE / 4; i++)
+	for (i = 0; i < bsize / 4; i++)
 	{
 		bn = imap[i];
 		if (!bn)
@@ -285,8 +478,8 @@ static uint32_t check_imap(uint32_t mbn, int indl)
 	
 	if (dirty)
 	{
-		lseek(dev_fd, mbn * BLK_SIZE, SEEK_SET);
-		if (write(dev_fd, imap, sizeof imap) < 0)
+		lseek(dev_fd, (off_t)mbn * bsize, SEEK_SET);
+		if (write(dev_fd, imap, bsize) < 0)
 		{
 			warn("writing block %i", (int)mbn);
 			exit_fsck(errno);
@@ -345,6 +538,7 @@ static void check_file(unsigned first_block, int depth, char *name)
 {
 	struct file *file;
 	uint32_t size;
+	int dirty;
 	int i;
 	
 	if (show_names)
@@ -405,7 +599,15 @@ static void check_file(unsigned first_block, int depth, char *name)
 		/* return; */
 	}
 	
-	size = check_bmap(file);
+	if (file->hd.flags & NAT_HF_EXTENT)
+	{
+		dirty = 0;
+		size  = check_ext(file, &dirty);
+		if (dirty)
+			save_hdr(file);
+	}
+	else
+		size = check_bmap(file);
 	if (file->hd.blocks != size)
 	{
 		warnx("%li has incorrect block count (is %i, should be %i)", (long)first_block, file->hd.blocks, size);
@@ -420,7 +622,7 @@ static void check_file(unsigned first_block, int depth, char *name)
 
 static uint32_t bmap(struct file *f, uint32_t log)
 {
-	uint32_t imap[128];
+	uint32_t imap[BLK_MAXSIZE / 4];
 	uint32_t bn;
 	uint32_t i;
 	int shift;
@@ -432,25 +634,25 @@ static uint32_t bmap(struct file *f, uint32_t log)
 		return f->hd.bmap[log];
 	}
 	
-	shift = 7 * f->hd.nindirlev;
-	i     = f->hd.ndirblks + (log >> shift);
+	shift = ishift * f->hd.nindirlev;
+	i     = f->hd.ndirblks + (shift < 32 ? log >> shift : 0);
 	if (i >= sizeof f->hd.bmap / sizeof *f->hd.bmap)
 		goto too_big;
 	bn = f->hd.bmap[i];
-	shift -= 7;
+	shift -= ishift;
 	
 	while (bn && shift >= 0)
 	{
-		lseek(dev_fd, bn * BLK_SIZE, SEEK_SET);
-		if (read(dev_fd, imap, sizeof imap) < 0)
+		lseek(dev_fd, (off_t)bn * bsize, SEEK_SET);
+		if (read(dev_fd, imap, bsize) < 0)
 		{
 			warnx("error reading block %lu",
 				(unsigned long)bn);
 			exit_fsck(errno);
 		}
 		
-		bn = imap[(bn >> shift) & 127];
-		shift -= 7;
+		bn = imap[(log >> shift) & (bsize / 4 - 1)];
+		shift -= ishift;
 	}
 	return bn;
 too_big:
@@ -460,9 +662,212 @@ too_big:
 	return 0;
 }
 
+static uint32_t hdir_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+	
+	while (*name)
+	{
+		h ^= (unsigned char)*name++;
+		h *= 16777619;
+	}
+	return h;
+}
+
+static void read_dblk(uint32_t bn, void *buf, int len)
+{
+	lseek(dev_fd, (off_t)bn * bsize, SEEK_SET);
+	errno = EINVAL;
+	if (read(dev_fd, buf, len) != len)
+	{
+		warn("reading directory");
+		exit_fsck(errno);
+	}
+}
+
+/*
+ * Mark logical block log of a hashed directory as referenced by the
+ * index and return its physical block, or zero if the reference is bad.
+ */
+static uint32_t hdir_ref(struct file *f, uint8_t *seen, uint32_t cnt, uint32_t log)
+{
+	uint32_t phys;
+	
+	if (log >= cnt || seen[log])
+	{
+		warnx("%lu hash index refers to bad block %lu",
+			(unsigned long)f->first_block, (unsigned long)log);
+		return 0;
+	}
+	seen[log] = 1;
+	
+	phys = bmap(f, log);
+	if (!phys)
+		warnx("%lu hash index refers to a hole at %lu",
+			(unsigned long)f->first_block, (unsigned long)log);
+	return phys;
+}
+
+/*
+ * Check an entry of a level 0 index block: its slot must hold a live
+ * directory entry with a matching hash that no other index entry
+ * refers to.
+ */
+static int check_hslot(struct file *f, uint8_t *ref, uint32_t cnt, uint32_t slot, uint32_t hash)
+{
+	struct nat_dirent dir[NAT_D_MAX];
+	struct nat_dirent *d;
+	uint32_t phys;
+	
+	if (slot < dents || slot / dents >= cnt || ref[slot])
+	{
+		warnx("%lu hash index refers to bad slot %lu",
+			(unsigned long)f->first_block, (unsigned long)slot);
+		return 1;
+	}
+	ref[slot] = 1;
+	
+	phys = bmap(f, slot / dents);
+	if (!phys)
+	{
+		warnx("%lu hash index refers to a hole at %lu",
+			(unsigned long)f->first_block, (unsigned long)(slot / dents));
+		return 1;
+	}
+	
+	read_dblk(phys, dir, bsize);
+	d = &dir[slot % dents];
+	if (!d->first_block || d->name[NAT_NAME_MAX] || hdir_hash(d->name) != hash)
+	{
+		warnx("%lu hash index entry for slot %lu does not match",
+			(unsigned long)f->first_block, (unsigned long)slot);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Check an index block covering the hashes in [lo, hi) and the blocks
+ * below it.  A level of -1 stands for the root.
+ */
+static int check_hnode(struct file *f, uint8_t *seen, uint8_t *ref, uint32_t cnt, uint32_t phys, int level, uint32_t lo, uint64_t hi)
+{
+	struct nat_hnode n;
+	uint32_t clo, h;
+	uint64_t chi;
+	int i;
+	
+	read_dblk(phys, &n, sizeof n);
+	if (n.magic != NAT_HDIR_MAGIC || n.count > NAT_HDIR_MAX || (n.level && !n.count))
+	{
+		warnx("%lu bad hash index block", (unsigned long)f->first_block);
+		return 1;
+	}
+	
+	if (level < 0 ? n.level >= NAT_HDIR_DEPTH : n.level != level)
+	{
+		warnx("%lu bad hash index level", (unsigned long)f->first_block);
+		return 1;
+	}
+	
+	for (i = 0; i < n.count; i++)
+	{
+		h = NAT_HENT(&n, i).hash;
+		if (h < lo || h >= hi || (i && h < NAT_HENT(&n, i - 1).hash) ||
+		    (i && n.level && h == NAT_HENT(&n, i - 1).hash))
+		{
+			warnx("%lu hash index out of order", (unsigned long)f->first_block);
+			return 1;
+		}
+	}
+	
+	for (i = 0; i < n.count; i++)
+	{
+		if (!n.level)
+		{
+			if (check_hslot(f, ref, cnt, NAT_HENT(&n, i).log, NAT_HENT(&n, i).hash))
+				return 1;
+			continue;
+		}
+		
+		clo = i ? NAT_HENT(&n, i).hash : lo;
+		chi = i + 1 < n.count ? NAT_HENT(&n, i + 1).hash : hi;
+		
+		phys = hdir_ref(f, seen, cnt, NAT_HENT(&n, i).log);
+		if (!phys)
+			return 1;
+		
+		if (check_hnode(f, seen, ref, cnt, phys, n.level - 1, clo, chi))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Check the hash index of a directory.  A broken index is dropped, the
+ * kernel then searches the directory linearly.
+ */
+static void check_hdir(struct file *f)
+{
+	struct nat_dirent dir[NAT_D_MAX];
+	uint8_t *seen, *ref;
+	uint32_t log, cnt;
+	uint32_t phys;
+	int broken;
+	int i;
+	
+	cnt = (f->hd.size + bsize - 1) / bsize;
+	if (!cnt || cnt > NAT_DIR_SIZE_MAX / bsize)
+	{
+		warnx("%lu bad hashed directory size", (unsigned long)f->first_block);
+		broken = 1;
+		goto fini;
+	}
+	
+	seen = calloc(cnt, 1);
+	ref  = calloc(cnt, dents);
+	if (!seen || !ref)
+	{
+		warn("calloc");
+		exit_fsck(errno);
+	}
+	
+	phys   = hdir_ref(f, seen, cnt, 0);
+	broken = !phys || check_hnode(f, seen, ref, cnt, phys, -1, 0, (uint64_t)1 << 32);
+	
+	for (log = 1; log < cnt && !broken; log++)
+	{
+		if (seen[log])
+			continue;
+		
+		phys = bmap(f, log);
+		if (!phys)
+			continue;
+		
+		read_dblk(phys, dir, bsize);
+		for (i = 0; i < dents; i++)
+			if (dir[i].first_block && !ref[log * dents + i])
+			{
+				warnx("%lu has entries outside of the hash index",
+					(unsigned long)f->first_block);
+				broken = 1;
+				break;
+			}
+	}
+	free(seen);
+	free(ref);
+fini:
+	if (broken && fix)
+	{
+		f->hd.flags &= ~NAT_HF_HASHED;
+		save_hdr(f);
+		warnx("hash index dropped");
+	}
+}
+
 static void check_dir(unsigned first_block, int depth, char *name)
 {
-	struct nat_dirent dir[NAT_D_PER_BLOCK];
+	struct nat_dirent dir[NAT_D_MAX];
 	struct file *file;
 	uint32_t log, phys, cnt;
 	uint32_t size;
@@ -481,7 +886,10 @@ static void check_dir(unsigned first_block, int depth, char *name)
 		}
 	}
 	
-	cnt = (file->hd.size + BLK_SIZE - 1) / BLK_SIZE;
+	if (file->hd.flags & NAT_HF_HASHED)
+		check_hdir(file);
+	
+	cnt = (file->hd.size + bsize - 1) / bsize;
 	for (log = 0; log < cnt; log++)
 	{
 		int i;
@@ -490,15 +898,15 @@ static void check_dir(unsigned first_block, int depth, char *name)
 		if (!phys)
 			continue;
 		
-		lseek(dev_fd, phys * BLK_SIZE, SEEK_SET);
+		lseek(dev_fd, (off_t)phys * bsize, SEEK_SET);
 		errno = EINVAL;
-		if (read(dev_fd, &dir, sizeof dir) != sizeof dir)
+		if (read(dev_fd, &dir, bsize) != bsize)
 		{
 			warn("reading directory");
 			exit_fsck(errno);
 		}
 		
-		for (i = 0; i < NAT_D_PER_BLOCK; i++)
+		for (i = 0; i < dents; i++)
 		{
 			if (!dir[i].first_block)
 				continue;
@@ -510,8 +918,8 @@ static void check_dir(unsigned first_block, int depth, char *name)
 				{
 					dir[i].name[NAT_NAME_MAX] = 0;
 					
-					lseek(dev_fd, phys * BLK_SIZE, SEEK_SET);
-					if (write(dev_fd, &dir, sizeof dir) < 0)
+					lseek(dev_fd, (off_t)phys * bsize, SEEK_SET);
+					if (write(dev_fd, &dir, bsize) < 0)
 					{
 						warn("writing directory");
 						exit_fsck(errno);
@@ -529,8 +937,8 @@ static void check_dir(unsigned first_block, int depth, char *name)
 				{
 					while ((p = strchr(dir[i].name, '/')))
 						*p = '_';
-					lseek(dev_fd, phys * BLK_SIZE, SEEK_SET);
-					if (write(dev_fd, &dir, sizeof dir) < 0)
+					lseek(dev_fd, (off_t)phys * bsize, SEEK_SET);
+					if (write(dev_fd, &dir, bsize) < 0)
 					{
 						warn("writing directory");
 						exit_fsck(errno);
@@ -546,8 +954,8 @@ static void check_dir(unsigned first_block, int depth, char *name)
 				{
 					memset(dir[i].name, 0, sizeof dir[i].name);
 					
-					lseek(dev_fd, phys * BLK_SIZE, SEEK_SET);
-					if (write(dev_fd, &dir, sizeof dir) < 0)
+					lseek(dev_fd, (off_t)phys * bsize, SEEK_SET);
+					if (write(dev_fd, &dir, bsize) < 0)
 					{
 						warn("writing directory");
 						exit_fsck(errno);
@@ -565,9 +973,9 @@ static void check_dir(unsigned first_block, int depth, char *name)
 				{
 					memset(dir[i].name, 0, sizeof dir[i].name);
 					
-					lseek(dev_fd, phys * BLK_SIZE, SEEK_SET);
+					lseek(dev_fd, (off_t)phys * bsize, SEEK_SET);
 					errno = EINVAL;
-					if (write(dev_fd, &dir, sizeof dir) < 0)
+					if (write(dev_fd, &dir, bsize) < 0)
 					{
 						warn("writing directory");
 						exit_fsck(errno);
@@ -606,7 +1014,7 @@ static void comp_bam(uint8_t *rbam, uint8_t *dbam, uint32_t bbn)
 	uint8_t xor;
 	int i, n;
 	
-	for (i = 0; i < BLK_SIZE; i++)
+	for (i = 0; i < bsize; i++)
 	{
 		if (rbam[i] == dbam[i])
 			continue;
@@ -617,7 +1025,7 @@ static void comp_bam(uint8_t *rbam, uint8_t *dbam, uint32_t bbn)
 		{
 			if (xor & 1)
 			{
-				dbn  = bbn * BLK_SIZE * 8;
+				dbn  = bbn * bsize * 8;
 				dbn |= i * 8;
 				dbn |= n;
 				
@@ -634,27 +1042,27 @@ static void comp_bam(uint8_t *rbam, uint8_t *dbam, uint32_t bbn)
 
 static void check_bam(void)
 {
-	uint8_t dbam[BLK_SIZE];
+	uint8_t dbam[BLK_MAXSIZE];
 	uint8_t *p;
 	uint32_t i;
 	int bad = 0;
 	
-	lseek(dev_fd, sb.bam_block * BLK_SIZE, SEEK_SET);
+	lseek(dev_fd, (off_t)sb.bam_block * bsize, SEEK_SET);
 	p = rbam;
 	for (i = 0; i < sb.bam_size; i++)
 	{
-		if (read(dev_fd, dbam, sizeof dbam) < 0)
+		if (read(dev_fd, dbam, bsize) < 0)
 		{
 			warn("reading BAM");
 			exit_fsck(255);
 		}
 		
-		if (memcmp(p, dbam, sizeof dbam))
+		if (memcmp(p, dbam, bsize))
 		{
 			if (fix)
 			{
-				lseek(dev_fd, (sb.bam_block + i) * BLK_SIZE, SEEK_SET);
-				if (write(dev_fd, p, sizeof dbam) < 0)
+				lseek(dev_fd, (off_t)(sb.bam_block + i) * bsize, SEEK_SET);
+				if (write(dev_fd, p, bsize) < 0)
 				{
 					warnx("bad BAM");
 					warn("writing BAM");
@@ -665,7 +1073,7 @@ static void check_bam(void)
 				comp_bam(p, dbam, i);
 			bad = 1;
 		}
-		p += sizeof dbam;
+		p += bsize;
 	}
 	if (bad)
 	{
@@ -675,6 +1083,597 @@ static void check_bam(void)
 	}
 }
 
+static void phase_begin(const char *msg)
+{
+	if (!qflag)
+		warnx("%s", msg);
+	gettimeofday(&phase_tv, NULL);
+}
+
+static void phase_end(void)
+{
+	struct timeval tv;
+	long ms;
+	
+	if (qflag)
+		return;
+	
+	gettimeofday(&tv, NULL);
+	ms  = (tv.tv_sec  - phase_tv.tv_sec)  * 1000;
+	ms += (tv.tv_usec - phase_tv.tv_usec) / 1000;
+	warnx("done in %li.%03li s", ms / 1000, ms % 1000);
+}
+
+static void put_blk(uint32_t bn, void *buf, int len)
+{
+	lseek(dev_fd, (off_t)bn * bsize, SEEK_SET);
+	if (write(dev_fd, buf, len) != len)
+	{
+		warn("writing block %lu", (unsigned long)bn);
+		exit_fsck(errno);
+	}
+}
+
+static void scan_add(uint32_t bn, int kind, int fi, int indl, uint64_t log)
+{
+	struct scan *s;
+	
+	if (scan_next_count >= scan_next_max)
+	{
+		scan_next_max += 1024;
+		scan_next = realloc(scan_next, scan_next_max * sizeof *scan_next);
+		if (!scan_next)
+		{
+			warn("realloc");
+			exit_fsck(errno);
+		}
+	}
+	
+	s = &scan_next[scan_next_count++];
+	s->bn	= bn;
+	s->log	= log;
+	s->file	= fi;
+	s->kind	= kind;
+	s->indl	= indl;
+}
+
+static int scan_cmp(const void *a, const void *b)
+{
+	const struct scan *s1 = a;
+	const struct scan *s2 = b;
+	
+	if (s1->bn < s2->bn)
+		return -1;
+	return s1->bn > s2->bn;
+}
+
+static int scan_ref(uint32_t *bp, int *dirty, const char *what, uint32_t where)
+{
+	if (!blk_in_range(*bp))
+	{
+		warnx("incorrect bn %lu in %s %lu",
+			(unsigned long)*bp, what,
+			(unsigned long)where);
+		if (fix)
+		{
+			*bp = 0;
+			*dirty = 1;
+			warnx("punched a hole");
+		}
+		return 0;
+	}
+	
+	if (bdupref(*bp))
+	{
+		warnx("block %lu in %s %lu is referenced elsewhere",
+			(unsigned long)*bp, what,
+			(unsigned long)where);
+		if (fix)
+		{
+			*bp = 0;
+			*dirty = 1;
+			warnx("punched a hole");
+		}
+		return 0;
+	}
+	return 1;
+}
+
+static uint32_t check_ext_list(struct nat_extent *e, int n, int *dirty, const char *what, uint32_t where)
+{
+	uint32_t bcnt = 0;
+	uint32_t i;
+	
+	for (; n; n--, e++)
+	{
+		if (!e->len)
+			continue;
+		
+		if (!blk_in_range(e->phys) || e->len > sb.data_size || !blk_in_range(e->phys + e->len - 1))
+		{
+			warnx("incorrect extent %lu+%lu in %s %lu",
+				(unsigned long)e->phys, (unsigned long)e->len,
+				what, (unsigned long)where);
+			if (fix)
+			{
+				e->len = 0;
+				*dirty = 1;
+				warnx("punched a hole");
+			}
+			continue;
+		}
+		
+		for (i = 0; i < e->len; i++)
+		{
+			if (!bdupref(e->phys + i))
+			{
+				bcnt++;
+				continue;
+			}
+			
+			warnx("block %lu in %s %lu is referenced elsewhere",
+				(unsigned long)e->phys + i, what,
+				(unsigned long)where);
+			if (fix)
+			{
+				e->len = i;
+				*dirty = 1;
+				warnx("punched a hole");
+				break;
+			}
+		}
+	}
+	return bcnt;
+}
+
+/*
+ * Check the extent map of a file and return the number of blocks it
+ * uses, including the header.  The overflow blocks are few even for
+ * large files, so they are read here rather than queued for a pass.
+ */
+static uint32_t check_ext(struct file *f, int *dirty)
+{
+	uint32_t count = f->hd.bmap[NAT_EXT_COUNT];
+	struct nat_extblk xb;
+	uint32_t bcnt = 1;
+	uint32_t prev = 0;
+	uint32_t bn;
+	int xdirty;
+	int n;
+	
+	n = count < NAT_EXT_INLINE ? count : NAT_EXT_INLINE;
+	bcnt  += check_ext_list(NAT_EXTENTS(f->hd.bmap), n, dirty, "file", f->first_block);
+	count -= n;
+	
+	bn = f->hd.bmap[NAT_EXT_NEXT];
+	while (bn && count)
+	{
+		xdirty = 0;
+		if (!scan_ref(&bn, &xdirty, "extent chain of", f->first_block))
+		{
+			if (!fix)
+				break;
+			
+			if (prev)
+			{
+				xb.next = 0;
+				put_blk(prev, &xb, sizeof xb);
+			}
+			else
+			{
+				f->hd.bmap[NAT_EXT_NEXT] = 0;
+				*dirty = 1;
+			}
+			f->hd.bmap[NAT_EXT_COUNT] -= count;
+			*dirty = 1;
+			break;
+		}
+		bcnt++;
+		
+		lseek(dev_fd, (off_t)bn * bsize, SEEK_SET);
+		if (read(dev_fd, &xb, sizeof xb) != sizeof xb)
+		{
+			warn("reading block %lu", (unsigned long)bn);
+			exit_fsck(errno);
+		}
+		
+		n = count < NAT_EXT_PER_BLOCK ? count : NAT_EXT_PER_BLOCK;
+		bcnt  += check_ext_list(xb.ext, n, &xdirty, "extent block", bn);
+		count -= n;
+		if (xdirty)
+			put_blk(bn, &xb, sizeof xb);
+		
+		prev = bn;
+		bn   = xb.next;
+	}
+	return bcnt;
+}
+
+static void scan_data(int fi, uint32_t bn, uint64_t log)
+{
+	struct file *f = &file[fi];
+	
+	if ((f->hd.mode & 070000) != 030000)
+		return;
+	if (log < (f->hd.size + bsize - 1) / bsize)
+		scan_add(bn, SCAN_DIR, fi, 0, log);
+}
+
+static void scan_hdr(struct scan *s, void *blk)
+{
+	struct file *f;
+	int dirty = 0;
+	int fi;
+	int i;
+	
+	if (find_file(s->bn))
+		return;
+	f = new_file(s->bn);
+	memcpy(&f->hd, blk, sizeof f->hd);
+	
+	if (f->hd.nindirlev < 1 || f->hd.nindirlev > 8)
+	{
+		warnx("%lu bad block map indirection level %i -- cannot fix", (unsigned long)s->bn, (int)f->hd.nindirlev);
+		return;
+	}
+	
+	if (bdupref(s->bn))
+	{
+		warnx("%lu shared with a data block -- cannot fix", (unsigned long)s->bn);
+		return;
+	}
+	
+	switch (f->hd.mode & 070000)
+	{
+	case 040000:
+	case 020000:
+	case 010000:
+		return;
+	case 030000:
+	case 0:
+		break;
+	default:
+		warnx("%li has incorrect file type in mode field", (long)s->bn);
+		if (fix)
+		{
+			f->hd.mode &= ~070000;
+			dirty = 1;
+			warnx("converted to regular file");
+		}
+	}
+	
+	fi = f - file;
+	f->walked  = 1;
+	f->nblocks = 1;
+	if (f->hd.flags & NAT_HF_EXTENT)
+	{
+		f->nblocks = check_ext(f, &dirty);
+		if (dirty)
+			save_hdr(f);
+		return;
+	}
+	for (i = 0; i < sizeof f->hd.bmap / 4; i++)
+	{
+		if (!f->hd.bmap[i])
+			continue;
+		if (!scan_ref(&f->hd.bmap[i], &dirty, "file", s->bn))
+			continue;
+		f->nblocks++;
+		
+		if (i < f->hd.ndirblks)
+			scan_data(fi, f->hd.bmap[i], i);
+		else
+			scan_add(f->hd.bmap[i], SCAN_IMAP, fi, f->hd.nindirlev - 1,
+				 (uint64_t)(i - f->hd.ndirblks) << (ishift * f->hd.nindirlev));
+	}
+	
+	if (dirty)
+		save_hdr(f);
+}
+
+static void scan_imap(struct scan *s, void *blk)
+{
+	uint32_t *imap = blk;
+	uint64_t log;
+	int dirty = 0;
+	int i;
+	
+	for (i = 0; i < bsize / 4; i++)
+	{
+		if (!imap[i])
+			continue;
+		if (!scan_ref(&imap[i], &dirty, "map", s->bn))
+			continue;
+		file[s->file].nblocks++;
+		
+		log = s->log + ((uint64_t)i << (ishift * s->indl));
+		if (s->indl)
+			scan_add(imap[i], SCAN_IMAP, s->file, s->indl - 1, log);
+		else
+			scan_data(s->file, imap[i], log);
+	}
+	
+	if (dirty)
+		put_blk(s->bn, blk, bsize);
+}
+
+static void scan_dir(struct scan *s, void *blk)
+{
+	struct nat_dirent *de = blk;
+	struct dent *d;
+	int i;
+	
+	for (i = 0; i < dents; i++)
+	{
+		if (!de[i].first_block)
+			continue;
+		
+		if (dent_count >= dent_max)
+		{
+			dent_max += 1024;
+			dent = realloc(dent, dent_max * sizeof *dent);
+			if (!dent)
+			{
+				warn("realloc");
+				exit_fsck(errno);
+			}
+		}
+		
+		d = &dent[dent_count++];
+		d->de	= de[i];
+		d->bn	= s->bn;
+		d->log	= s->log;
+		d->slot	= i;
+		d->dir	= s->file;
+		
+		if (!*de[i].name || !blk_in_range(de[i].first_block))
+			continue;
+		if (!find_file(de[i].first_block))
+			scan_add(de[i].first_block, SCAN_HDR, -1, 0, 0);
+	}
+}
+
+/*
+ * Read the i-nodes, indirect blocks and directory blocks in passes.
+ * Each pass sorts the blocks found by the previous one and reads them
+ * in ascending order, merging nearby blocks into a single large read
+ * rather than seeking over short gaps.
+ */
+static void scan_disk(void)
+{
+	static char buf[SCAN_RUN * BLK_MAXSIZE];
+	unsigned long nread = 0;
+	uint32_t first, last;
+	struct scan *tmp;
+	ssize_t size;
+	int pass = 0;
+	int runs;
+	int i, n;
+	char *p;
+	
+	scan_add(sb.root_block, SCAN_HDR, -1, 0, 0);
+	
+	while (scan_next_count)
+	{
+		tmp	  = scan;
+		scan	  = scan_next;
+		scan_next = tmp;
+		
+		n	      = scan_max;
+		scan_max      = scan_next_max;
+		scan_next_max = n;
+		
+		scan_count	= scan_next_count;
+		scan_next_count	= 0;
+		
+		qsort(scan, scan_count, sizeof *scan, scan_cmp);
+		
+		runs = 0;
+		for (i = 0; i < scan_count; )
+		{
+			first = scan[i].bn;
+			for (n = i + 1; n < scan_count; n++)
+			{
+				if (scan[n].bn - first >= SCAN_RUN)
+					break;
+				if (scan[n].bn - scan[n - 1].bn > SCAN_GAP)
+					break;
+			}
+			last = scan[n - 1].bn;
+			size = (last - first + 1) * bsize;
+			
+			lseek(dev_fd, (off_t)first * bsize, SEEK_SET);
+			errno = EINVAL;
+			if (read(dev_fd, buf, size) != size)
+			{
+				warn("reading blocks %lu-%lu",
+					(unsigned long)first,
+					(unsigned long)last);
+				exit_fsck(errno);
+			}
+			nread += last - first + 1;
+			runs++;
+			
+			for (; i < n; i++)
+			{
+				p = buf + (scan[i].bn - first) * bsize;
+				
+				switch (scan[i].kind)
+				{
+				case SCAN_HDR:
+					scan_hdr(&scan[i], p);
+					break;
+				case SCAN_IMAP:
+					scan_imap(&scan[i], p);
+					break;
+				case SCAN_DIR:
+					scan_dir(&scan[i], p);
+					break;
+				}
+			}
+		}
+		
+		pass++;
+		if (!qflag)
+			warnx("pass %i: %i blocks in %i reads, %i files, %lu blocks read so far",
+				pass, scan_count, runs, file_count, nread);
+	}
+}
+
+static int dent_cmp(const void *a, const void *b)
+{
+	const struct dent *d1 = a;
+	const struct dent *d2 = b;
+	
+	if (d1->dir != d2->dir)
+		return d1->dir < d2->dir ? -1 : 1;
+	if (d1->log != d2->log)
+		return d1->log < d2->log ? -1 : 1;
+	return d1->slot - d2->slot;
+}
+
+static void put_dent(struct dent *d)
+{
+	lseek(dev_fd, (off_t)d->bn * bsize + d->slot * sizeof d->de, SEEK_SET);
+	if (write(dev_fd, &d->de, sizeof d->de) != sizeof d->de)
+	{
+		warn("writing directory");
+		exit_fsck(errno);
+	}
+}
+
+static int index_dent(struct dent *d)
+{
+	char *p;
+	
+	if (d->de.name[NAT_NAME_MAX])
+	{
+		warnx("directory entry name too long");
+		d->de.name[NAT_NAME_MAX] = 0;
+		if (fix)
+		{
+			put_dent(d);
+			warnx("name truncated");
+		}
+	}
+	
+	if (strchr(d->de.name, '/'))
+	{
+		warnx("slash character in file name");
+		if (fix)
+		{
+			while ((p = strchr(d->de.name, '/')))
+				*p = '_';
+			put_dent(d);
+			warnx("replaced with underscore");
+		}
+	}
+	
+	if (!*d->de.name)
+	{
+		warnx("directory entry with no name");
+		if (fix)
+		{
+			memset(d->de.name, 0, sizeof d->de.name);
+			put_dent(d);
+			warnx("cleared");
+		}
+		return 0;
+	}
+	
+	if (!blk_in_range(d->de.first_block))
+	{
+		warnx("directory entry has bad first_block member");
+		if (fix)
+		{
+			memset(d->de.name, 0, sizeof d->de.name);
+			put_dent(d);
+			warnx("cleared");
+		}
+		return 0;
+	}
+	return 1;
+}
+
+static void index_file(struct file *f, int depth, char *name)
+{
+	struct file *c;
+	int i;
+	
+	if (show_names)
+	{
+		for (i = 0; i < depth; i++)
+			fputc(' ', stderr);
+		fprintf(stderr, "%s (%lu)\n", name, (unsigned long)f->first_block);
+	}
+	
+	for (i = 0; i < icheck_cnt; i++)
+		if (icheck[i] == f->first_block)
+		{
+			for (i = 0; i < depth; i++)
+				fputc(' ', stderr);
+			fprintf(stderr, "%s (%lu)\n", name, (unsigned long)f->first_block);
+		}
+	
+	f->true_nlink++;
+	
+	if (f->checked)
+		return;
+	f->checked = 1;
+	
+	if (!f->walked)
+		return;
+	
+	if (f->hd.blocks != f->nblocks)
+	{
+		warnx("%lu has incorrect block count (is %lu, should be %lu)",
+			(unsigned long)f->first_block,
+			(unsigned long)f->hd.blocks,
+			(unsigned long)f->nblocks);
+		if (fix)
+		{
+			f->hd.blocks = f->nblocks;
+			save_hdr(f);
+			warnx("fixed");
+		}
+	}
+	
+	if ((f->hd.mode & 070000) == 030000 && (f->hd.flags & NAT_HF_HASHED))
+		check_hdir(f);
+	
+	for (i = f->dfirst; i < f->dfirst + f->dcount; i++)
+	{
+		if (!index_dent(&dent[i]))
+			continue;
+		
+		c = find_file(dent[i].de.first_block);
+		if (c)
+			index_file(c, depth + 1, dent[i].de.name);
+	}
+}
+
+/*
+ * Check the directory tree using the entries collected by scan_disk.
+ * Only repairs touch the disk.
+ */
+static void check_index(void)
+{
+	struct file *f;
+	int i, n;
+	
+	qsort(dent, dent_count, sizeof *dent, dent_cmp);
+	for (i = 0; i < dent_count; i = n)
+	{
+		for (n = i + 1; n < dent_count && dent[n].dir == dent[i].dir; n++);
+		file[dent[i].dir].dfirst = i;
+		file[dent[i].dir].dcount = n - i;
+	}
+	
+	f = find_file(sb.root_block);
+	if (f)
+		index_file(f, 0, "/");
+}
+
 static void find_mount(void)
 {
 	static struct _mtab m[MOUNT_MAX];
@@ -730,7 +1729,7 @@ static void procopt(int argc, char **argv)
 {
 	int opt;
 	
-	while (opt = getopt(argc, argv, "Fvwqrs"), opt > 0)
+	while (opt = getopt(argc, argv, "Fvwqrsb"), opt > 0)
 		switch (opt)
 		{
 		case 'F':
@@ -748,6 +1747,9 @@ static void procopt(int argc, char **argv)
 		case 's':
 			sflag = 1;
 			break;
+		case 'b':
+			bflag = 1;
+			break;
 		default:
 			exit(255);
 		}
@@ -773,7 +1775,8 @@ int main(int argc, char **argv)
 				"    -F   try to repair the filesystem\n"
 				"    -v   be verbose\n"
 				"    -q   quiet mode\n"
-				"    -w   remount the filesystem read/write after successfull check\n\n"
+				"    -w   remount the filesystem read/write after successfull check\n"
+				"    -b   read metadata in block order, then check directories\n\n"
 				"Default is not to modify the filesystem even if errors are detected.\n\n"
 				"The filesystem is not accessible during a check.\n\n");
 		return 0;
@@ -813,9 +1816,19 @@ int main(int argc, char **argv)
 	if (!qflag)
 		warnx("loading superblock");
 	load_super();
+	if (NAT_FEATURES(&sb) & NAT_F_LOG)
+		replay_log();
 	
 	if (sflag)
 	{
+		/* the kernel leaves the log of a read-only mount to us */
+		if (sb.dirty && fix && (NAT_FEATURES(&sb) & NAT_F_LOG))
+		{
+			if (!qflag)
+				warnx("intent log replayed -- not checking");
+			mark_clean();
+			goto fini;
+		}
 		if (sb.dirty)
 			warnx("filesystem is not clean -- checking");
 		else
@@ -826,17 +1839,30 @@ int main(int argc, char **argv)
 		}
 	}
 	
-	if (!qflag)
-		warnx("checking files and directories");
-	check_file(sb.root_block, 0, "/");
+	if (bflag)
+	{
+		phase_begin("scanning i-nodes and indirect blocks");
+		scan_disk();
+		phase_end();
+		
+		phase_begin("checking directories");
+		check_index();
+		phase_end();
+	}
+	else
+	{
+		phase_begin("checking files and directories");
+		check_file(sb.root_block, 0, "/");
+		phase_end();
+	}
 	
-	if (!qflag)
-		warnx("checking link counts");
+	phase_begin("checking link counts");
 	check_nlink();
+	phase_end();
 	
-	if (!qflag)
-		warnx("checking BAM for orphaned blocks");
+	phase_begin("checking BAM for orphaned blocks");
 	check_bam();
+	phase_end();
 	
 	if (!qflag)
 		warnx("%i files checked", file_count);
@@ -554,7 +554,7 @@ static void fsck(void)
 	int status;
 	pid_t pid;
 	
-	pid = _newtaskl(_PATH_B_FSCK, _PATH_B_FSCK, "-sqwF", NULL);
+	pid = _newtaskl(_PATH_B_FSCK, _PATH_B_FSCK, "-sqwFb", NULL);
 	if (pid < 0)
 		perror(_PATH_B_FSCK);
 	
@@ -39,6 +39,9 @@
 static blk_t	reserved_count;
 static blk_t	block_count;
 static char *	dev_path;
+static int	bshift;
+static int	bsize = BLK_SIZE;
+static int	eflag;
 static int	qflag;
 static int	fd;
 
@@ -59,7 +62,7 @@ static void mkroot(struct nat_super *sb)
 	root_hd.ndirblks  = 114;
 	root_hd.nindirlev = 1;
 	
-	lseek(fd, (long)sb->root_block * (long)BLK_SIZE, SEEK_SET);
+	lseek(fd, (long)sb->root_block * (long)bsize, SEEK_SET);
 	if (write(fd, &root_hd, sizeof root_hd) != sizeof root_hd)
 	{
 		fputc('\n', stderr);
@@ -70,7 +73,7 @@ static void mkroot(struct nat_super *sb)
 
 static void newbam(struct nat_super *sb)
 {
-	char zero[BLK_SIZE];
+	char zero[BLK_SIZE << NAT_BSHIFT_MAX];
 	blk_t edata;
 	int bisplit, bysplit;
 	int dbamb;
@@ -79,46 +82,46 @@ static void newbam(struct nat_super *sb)
 	int bami;
 	int i;
 	
-	lseek(fd, sb->bam_block * BLK_SIZE, SEEK_SET);
-	memset(zero, 255, BLK_SIZE);
+	lseek(fd, (long)sb->bam_block * bsize, SEEK_SET);
+	memset(zero, 255, bsize);
 	
 	edata = sb->data_block + sb->data_size;
-	rbamb = sb->root_block / BLK_SIZE / 8;
-	dbamb = sb->data_block / BLK_SIZE / 8;
-	ebamb = edata	       / BLK_SIZE / 8;
+	rbamb = sb->root_block / bsize / 8;
+	dbamb = sb->data_block / bsize / 8;
+	ebamb = edata	       / bsize / 8;
 	bami  = 0;
 	
 	for (i = 0; i < sb->bam_size; i++)
 	{
 		if (i == dbamb)
 		{
-			bisplit = sb->data_block % (BLK_SIZE * 8);
+			bisplit = sb->data_block % (bsize * 8);
 			bysplit = bisplit / 8;
 			
-			memset(zero + bysplit, 0, sizeof zero - bysplit);
+			memset(zero + bysplit, 0, bsize - bysplit);
 			zero[bysplit] = 255 >> (8 - (sb->data_block & 7));
 		}
 		else if (i == dbamb + 1)
-			bzero(zero, sizeof zero);
+			bzero(zero, bsize);
 		
 		if (i == ebamb)
 		{
-			bisplit = edata % (BLK_SIZE * 8);
+			bisplit = edata % (bsize * 8);
 			bysplit = bisplit / 8;
 			
-			memset(zero + bysplit, 255, sizeof zero - bysplit);
+			memset(zero + bysplit, 255, bsize - bysplit);
 			zero[bysplit] = ~(255 >> (8 - (edata & 7)));
 		}
 		else if (i == ebamb + 1)
-			memset(zero, 255, sizeof zero);
+			memset(zero, 255, bsize);
 		
 		if (i == rbamb)
 		{
-			bami = (sb->root_block / 8) % BLK_SIZE;
+			bami = (sb->root_block / 8) % bsize;
 			zero[bami] |= 1 << (sb->root_block & 7);
 		}
 		
-		if (write(fd, zero, BLK_SIZE) != BLK_SIZE)
+		if (write(fd, zero, bsize) != bsize)
 			err(errno, "%s: write", dev_path);
 		
 		if (i == rbamb)
@@ -139,12 +142,19 @@ static int mkfs(void)
 	bzero(&sb, sizeof sb);
 	memcpy(sb.magic, NAT_MAGIC, 8);
 	sb.bam_block	= reserved_count;
-	sb.bam_size	= (block_count + 8 * BLK_SIZE - 1) / BLK_SIZE / 8;
+	sb.bam_size	= (block_count + 8 * bsize - 1) / bsize / 8;
 	sb.data_block	= sb.bam_block + sb.bam_size;
 	sb.data_size	= block_count - sb.data_block;
 	sb.root_block	= sb.data_block;
 	sb.ndirblks	= 110;
-	sb.nindirlev	= 3;
+	sb.nindirlev	= bshift >= 3 ? 2 : 3;
+	sb.bshift	= bshift;
+	
+	if (eflag)
+		sb.features = NAT_F_EXTENT;
+	if (bshift)
+		sb.features |= NAT_F_BSIZE;
+	sb.features_chk = ~sb.features;
 	
 	if (!qflag)
 		warnx("writing superblock");
@@ -173,7 +183,7 @@ static int mkfs(void)
 static void usage(void)
 {
 	fprintf(stderr, "usage:\n\n"
-			" mkfs [-q] DEVICE NBLOCKS [RESERVED]\n");
+			" mkfs [-qe] [-b BSIZE] DEVICE NBLOCKS [RESERVED]\n");
 	exit(255);
 }
 
@@ -181,12 +191,23 @@ int main(int argc, char **argv)
 {
 	int c;
 	
-	while (c = getopt(argc, argv, "q"), c > 0)
+	while (c = getopt(argc, argv, "qeb:"), c > 0)
 		switch (c)
 		{
+		case 'b':
+			bsize = strtoul(optarg, NULL, 0);
+			for (bshift = 0; bshift <= NAT_BSHIFT_MAX; bshift++)
+				if (BLK_SIZE << bshift == bsize)
+					break;
+			if (bshift > NAT_BSHIFT_MAX)
+				errx(1, "%s: invalid block size", optarg);
+			break;
 		case 'q':
 			qflag = 1;
 			break;
+		case 'e':
+			eflag = 1;
+			break;
 		default:
 			return 1;
 		}
@@ -204,6 +225,10 @@ int main(int argc, char **argv)
 	else
 		reserved_count = 2;
 	
+	/* the counts are in 512-byte sectors */
+	block_count  >>= bshift;
+	reserved_count = (reserved_count + (1 << bshift) - 1) >> bshift;
+	
 	mkfs();
 	return 0;
 }
@@ -25,22 +25,424 @@
  */
 
 #include <priv/natfs.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
+#include <mount.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <err.h>
 
+#define BLK_SIZE	512
+#define BLK_MAXSIZE	(BLK_SIZE << NAT_BSHIFT_MAX)
+
+static struct nat_super sb;
+static char *		dev_path;
+static uint8_t *	bam;
+static int		bsize = BLK_SIZE;
+static int		ishift = 7;
+static int		dents;
+static int		fd;
+
+static void check_mounted(void)
+{
+	static struct _mtab m[MOUNT_MAX];
+	const char *name = dev_path;
+	int i;
+	
+	if (!strncmp(name, "/dev/", 5))
+		name += 5;
+	
+	if (_mtab(m, sizeof m))
+		err(errno, "_mtab");
+	
+	for (i = 0; i < MOUNT_MAX; i++)
+		if (m[i].mounted && !strcmp(m[i].device, name))
+			errx(1, "%s: filesystem is mounted", dev_path);
+	
+	if (sb.dirty)
+		errx(1, "%s: filesystem is not clean -- run fsck first", dev_path);
+}
+
+static void load_bam(void)
+{
+	size_t size = sb.bam_size * bsize;
+	
+	bam = malloc(size);
+	if (!bam)
+		err(1, "malloc");
+	
+	lseek(fd, (off_t)sb.bam_block * bsize, SEEK_SET);
+	errno = EINVAL;
+	if (read(fd, bam, size) != size)
+		err(1, "%s: reading BAM", dev_path);
+}
+
+static void save_bam(void)
+{
+	size_t size = sb.bam_size * bsize;
+	
+	lseek(fd, (off_t)sb.bam_block * bsize, SEEK_SET);
+	if (write(fd, bam, size) != size)
+		err(1, "%s: writing BAM", dev_path);
+}
+
+static int bam_used(uint32_t bn)
+{
+	return (bam[bn / 8] >> (bn & 7)) & 1;
+}
+
+static void bam_set(uint32_t bn, int used)
+{
+	if (used)
+		bam[bn / 8] |=  1 << (bn & 7);
+	else
+		bam[bn / 8] &= ~(1 << (bn & 7));
+}
+
+static void enable_log(uint32_t size)
+{
+	char zero[BLK_MAXSIZE];
+	uint32_t bn, run = 0;
+	uint32_t i;
+	
+	if (NAT_FEATURES(&sb) & NAT_F_LOG)
+		errx(1, "%s: log already enabled", dev_path);
+	if (size < NAT_LOG_MIN)
+		errx(1, "log size must be at least %i blocks", NAT_LOG_MIN);
+	
+	load_bam();
+	
+	/* the log goes into the last free run of the data area */
+	for (bn = sb.data_block + sb.data_size; bn > sb.data_block; bn--)
+	{
+		if (bam_used(bn - 1))
+		{
+			run = 0;
+			continue;
+		}
+		if (++run == size)
+			break;
+	}
+	if (run < size)
+		errx(1, "%s: no room for a %lu block log", dev_path, (unsigned long)size);
+	bn--;
+	
+	for (i = 0; i < size; i++)
+		bam_set(bn + i, 1);
+	save_bam();
+	
+	memset(zero, 0, bsize);
+	lseek(fd, (off_t)bn * bsize, SEEK_SET);
+	if (write(fd, zero, bsize) != bsize)
+		err(1, "%s", dev_path);
+	
+	sb.features	|= NAT_F_LOG;
+	sb.features_chk	 = ~sb.features;
+	sb.log_block	 = bn;
+	sb.log_size	 = size;
+	sb.log_seq	 = 1;
+}
+
+static void disable_log(void)
+{
+	uint32_t i;
+	
+	if (!(NAT_FEATURES(&sb) & NAT_F_LOG))
+		errx(1, "%s: log not enabled", dev_path);
+	
+	load_bam();
+	for (i = 0; i < sb.log_size; i++)
+		bam_set(sb.log_block + i, 0);
+	save_bam();
+	
+	sb.features	&= ~NAT_F_LOG;
+	sb.features_chk	 = ~sb.features;
+	sb.log_block	 = 0;
+	sb.log_size	 = 0;
+	sb.log_seq	 = 0;
+}
+
+static void read_blk(uint32_t bn, void *buf, int len)
+{
+	lseek(fd, (off_t)bn * bsize, SEEK_SET);
+	errno = EINVAL;
+	if (read(fd, buf, len) != len)
+		err(1, "%s: reading block %lu", dev_path, (unsigned long)bn);
+}
+
+static void write_blk(uint32_t bn, const void *buf, int len)
+{
+	lseek(fd, (off_t)bn * bsize, SEEK_SET);
+	if (write(fd, buf, len) != len)
+		err(1, "%s: writing block %lu", dev_path, (unsigned long)bn);
+}
+
+static uint32_t balloc(void)
+{
+	static const char zero[BLK_MAXSIZE];
+	uint32_t bn;
+	
+	for (bn = sb.data_block; bn < sb.data_block + sb.data_size; bn++)
+		if (!bam_used(bn))
+		{
+			bam_set(bn, 1);
+			write_blk(bn, zero, bsize);
+			return bn;
+		}
+	errx(1, "%s: no space left on device", dev_path);
+}
+
+static uint32_t file_bmap(struct nat_header *hd, uint32_t log)
+{
+	uint32_t imap[BLK_MAXSIZE / 4];
+	uint32_t *bnp;
+	uint32_t bn;
+	int shift;
+	int indl;
+	
+	shift = ishift * hd->nindirlev;
+	if (log < hd->ndirblks)
+		bnp = &hd->bmap[log];
+	else
+		bnp = &hd->bmap[hd->ndirblks + (shift < 32 ? log >> shift : 0)];
+	
+	if (!*bnp)
+	{
+		*bnp = balloc();
+		hd->blocks++;
+	}
+	bn = *bnp;
+	
+	if (log < hd->ndirblks)
+		return bn;
+	
+	for (indl = hd->nindirlev, shift -= ishift; indl; indl--, shift -= ishift)
+	{
+		read_blk(bn, imap, bsize);
+		bnp = &imap[(log >> shift) & (bsize / 4 - 1)];
+		if (!*bnp)
+		{
+			*bnp = balloc();
+			hd->blocks++;
+			write_blk(bn, imap, bsize);
+		}
+		bn = *bnp;
+	}
+	return bn;
+}
+
+static uint32_t hdir_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+	
+	while (*name)
+	{
+		h ^= (unsigned char)*name++;
+		h *= 16777619;
+	}
+	return h;
+}
+
+struct hdir_ent
+{
+	struct nat_dirent de;
+	uint32_t hash;
+	uint32_t slot;
+};
+
+static int hdir_cmp(const void *a, const void *b)
+{
+	const struct hdir_ent *ea = a;
+	const struct hdir_ent *eb = b;
+	
+	if (ea->hash < eb->hash)
+		return -1;
+	return ea->hash > eb->hash;
+}
+
+/*
+ * Build the index blocks of the given level and above for n entries
+ * of ent, appending them to img.  The top node goes into block 0,
+ * which is reserved for the root.
+ */
+static void hdir_index(char *img, uint32_t *nblk, struct nat_hent *ent, int n, int level)
+{
+	struct nat_hnode *node;
+	int i, j, k;
+	
+	while (n > NAT_HDIR_MAX)
+	{
+		for (i = k = 0; i < n; i += NAT_HDIR_MAX * 3 / 4, k++)
+		{
+			node = (void *)(img + *nblk * bsize);
+			node->magic = NAT_HDIR_MAGIC;
+			node->level = level;
+			for (j = i; j < n && j < i + NAT_HDIR_MAX * 3 / 4; j++)
+				NAT_HENT(node, j - i) = ent[j];
+			node->count = j - i;
+			ent[k].hash = ent[i].hash;
+			ent[k].log  = (*nblk)++;
+		}
+		n = k;
+		level++;
+	}
+	
+	node = (void *)img;
+	node->magic = NAT_HDIR_MAGIC;
+	node->level = level;
+	node->count = n;
+	for (i = 0; i < n; i++)
+		NAT_HENT(node, i) = ent[i];
+}
+
+static void hash_dir(uint32_t hd_bn)
+{
+	struct nat_header hd;
+	struct nat_hnode *node;
+	struct nat_dirent *d;
+	struct hdir_ent *ent;
+	struct nat_hent *lent;
+	uint32_t nblk, oblk;
+	char *img;
+	int cnt = 0;
+	int nleaf;
+	int i, n;
+	
+	read_blk(hd_bn, &hd, sizeof hd);
+	if (hd.flags & NAT_HF_HASHED)
+		return;
+	
+	oblk = hd.size / bsize;
+	ent  = calloc(oblk * dents + 1, sizeof *ent);
+	lent = calloc(oblk * dents + 1, sizeof *lent);
+	img  = calloc(oblk + oblk * dents / 16 + 8, bsize);
+	if (!ent || !lent || !img)
+		err(1, "malloc");
+	
+	for (i = 0; i < oblk; i++)
+	{
+		read_blk(file_bmap(&hd, i), img, bsize);
+		for (d = (void *)img, n = 0; n < dents; n++, d++)
+			if (d->first_block)
+			{
+				ent[cnt].de   = *d;
+				ent[cnt].hash = hdir_hash(d->name);
+				cnt++;
+			}
+	}
+	
+	/*
+	 * Pack the entries into blocks 1 and up, where they stay, and
+	 * index them by hash.
+	 */
+	memset(img, 0, bsize);
+	for (i = 0; i < cnt; i++)
+	{
+		d = (void *)(img + (i / dents + 1) * bsize);
+		d[i % dents] = ent[i].de;
+		ent[i].slot  = dents + i;
+	}
+	nblk = cnt ? (cnt - 1) / dents + 2 : 1;
+	qsort(ent, cnt, sizeof *ent, hdir_cmp);
+	
+	if (cnt <= NAT_HDIR_MAX)
+	{
+		for (i = 0; i < cnt; i++)
+		{
+			lent[i].hash = ent[i].hash;
+			lent[i].log  = ent[i].slot;
+		}
+		hdir_index(img, &nblk, lent, cnt, 0);
+	}
+	else
+	{
+		/*
+		 * Fill level 0 index blocks to 3/4 so that the first
+		 * insertions do not split them, and never split a run of
+		 * equal hashes.
+		 */
+		for (i = nleaf = 0; i < cnt; nleaf++, nblk++)
+		{
+			node = (void *)(img + nblk * bsize);
+			node->magic = NAT_HDIR_MAGIC;
+			lent[nleaf].hash = nleaf ? ent[i].hash : 0;
+			lent[nleaf].log	 = nblk;
+			for (n = 0; i < cnt; n++, i++)
+			{
+				if (n >= NAT_HDIR_MAX * 3 / 4 && ent[i].hash != ent[i - 1].hash)
+					break;
+				if (n >= NAT_HDIR_MAX)
+					errx(1, "%s: too many colliding names in directory %lu",
+						dev_path, (unsigned long)hd_bn);
+				NAT_HENT(node, n).hash = ent[i].hash;
+				NAT_HENT(node, n).log  = ent[i].slot;
+			}
+			node->count = n;
+		}
+		hdir_index(img, &nblk, lent, nleaf, 1);
+	}
+	
+	if (nblk < oblk)
+		nblk = oblk;
+	if (nblk * bsize > NAT_DIR_SIZE_MAX)
+		errx(1, "%s: directory %lu is too large", dev_path, (unsigned long)hd_bn);
+	
+	for (i = 0; i < nblk; i++)
+		write_blk(file_bmap(&hd, i), img + i * bsize, bsize);
+	
+	hd.size   = nblk * bsize;
+	hd.flags |= NAT_HF_HASHED;
+	write_blk(hd_bn, &hd, sizeof hd);
+	free(lent);
+	free(img);
+	
+	for (i = 0; i < cnt; i++)
+	{
+		struct nat_header chd;
+		
+		read_blk(ent[i].de.first_block, &chd, sizeof chd);
+		if (S_ISDIR(chd.mode))
+			hash_dir(ent[i].de.first_block);
+	}
+	free(ent);
+}
+
+static void enable_hdir(void)
+{
+	if (NAT_FEATURES(&sb) & NAT_F_HDIR)
+		errx(1, "%s: hashed directories already enabled", dev_path);
+	
+	load_bam();
+	hash_dir(sb.root_block);
+	save_bam();
+	
+	sb.features	|= NAT_F_HDIR;
+	sb.features_chk	 = ~sb.features;
+}
+
+static void enable_extent(void)
+{
+	if (NAT_FEATURES(&sb) & NAT_F_EXTENT)
+		errx(1, "%s: extent maps already enabled", dev_path);
+	
+	sb.features	|= NAT_F_EXTENT;
+	sb.features_chk	 = ~sb.features;
+}
+
 int main(int argc, char **argv)
 {
-	struct nat_super sb;
-	char *dev_path;
+	uint32_t log_size = 0;
+	int nolog = 0;
+	int hdir = 0;
+	int ext = 0;
 	int indl = -1;
 	int ndir = -1;
-	int fd;
 	int c;
 	
-	while (c = getopt(argc, argv, "I:D:"), c > 0)
+	while (c = getopt(argc, argv, "I:D:j:JHe"), c > 0)
 		switch (c)
 		{
 		case 'I':
@@ -49,6 +451,18 @@ int main(int argc, char **argv)
 		case 'D':
 			ndir = atoi(optarg);
 			break;
+		case 'j':
+			log_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'J':
+			nolog = 1;
+			break;
+		case 'H':
+			hdir = 1;
+			break;
+		case 'e':
+			ext = 1;
+			break;
 		default:
 			return 255;
 		}
@@ -64,15 +478,44 @@ int main(int argc, char **argv)
 	if (read(fd, &sb, sizeof sb) < 0)
 		err(1, "%s", dev_path);
 	
+	if (NAT_FEATURES(&sb) & NAT_F_BSIZE)
+	{
+		if (sb.bshift > NAT_BSHIFT_MAX)
+			errx(1, "%s: bad block size", dev_path);
+		bsize  = BLK_SIZE << sb.bshift;
+		ishift = 7 + sb.bshift;
+	}
+	dents = bsize / sizeof(struct nat_dirent);
+	
+	if (log_size || nolog || hdir || ext)
+		check_mounted();
+	if (log_size)
+		enable_log(log_size);
+	if (nolog)
+		disable_log();
+	if (hdir)
+		enable_hdir();
+	if (ext)
+		enable_extent();
+	
 	if (indl >= 0)
 		sb.nindirlev = indl;
 	if (ndir >= 0)
 		sb.ndirblks = ndir;
 	
+	printf("bsize     = %i\n", bsize);
 	printf("nindirlev = %i\n", (int)sb.nindirlev);
 	printf("ndirblks  = %i\n", (int)sb.ndirblks);
+	if (NAT_FEATURES(&sb) & NAT_F_LOG)
+		printf("log       = %lu blocks at %lu\n",
+			(unsigned long)sb.log_size,
+			(unsigned long)sb.log_block);
+	if (NAT_FEATURES(&sb) & NAT_F_HDIR)
+		printf("hdir      = on\n");
+	if (NAT_FEATURES(&sb) & NAT_F_EXTENT)
+		printf("extent    = on\n");
 	
-	if (indl >= 0 || ndir >= 0)
+	if (indl >= 0 || ndir >= 0 || log_size || nolog || hdir || ext)
 	{
 		lseek(fd, 512, SEEK_SET);
 		if (write(fd, &sb, sizeof sb) < 0)
@@ -0,0 +1,210 @@
+/* Copyright (c) 2017, Piotr Durlej
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Thin client for the tcc compile server (see "tcc -server").
+ *
+ * The arguments are sent to the server named by TCC_SERVER together with
+ * the working directory and the name of a fresh pty slave.  The server
+ * writes the output of the compilation to the slave, followed by a NUL
+ * and the exit status, or sends SIGHUP if it cannot answer the request.
+ * Without a server, or for the options a server cannot handle, tcc is
+ * run directly.
+ */
+
+#include <sys/ioctl.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <os386.h>
+#include <paths.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define TCC	"/usr/bin/tcc"
+
+struct tcc_req
+{
+	int	size;
+	int	argc;
+	int	pid;
+};
+
+static volatile int hup;
+static int hup_fd = -1;
+
+static char *local_opts[] =
+{
+	"-", "-E", "-ar", "-dumpversion", "-h", "-hh", "-server",
+	NULL
+};
+
+/*
+ * Closing the master also stops a read that has not blocked yet when
+ * the signal comes in.
+ */
+static void sighup(int nr)
+{
+	hup = 1;
+	close(hup_fd);
+}
+
+static void local(char **argv)
+{
+	argv[0] = TCC;
+	execv(TCC, argv);
+	err(127, "%s", TCC);
+}
+
+static int islocal(char **argv)
+{
+	char **pp;
+	int i;
+	
+	if (!argv[1])
+		return 1;
+	for (i = 1; argv[i]; i++)
+	{
+		if (!strncmp(argv[i], "-run", 4))
+			return 1;
+		for (pp = local_opts; *pp; pp++)
+			if (!strcmp(argv[i], *pp))
+				return 1;
+	}
+	return 0;
+}
+
+static int request(int sfd, int ptm, char **argv)
+{
+	static char buf[PIPE_BUF];
+	struct tcc_req *rq = (void *)buf;
+	char *p = buf + sizeof *rq;
+	char *end = buf + sizeof buf;
+	size_t len;
+	int i;
+	
+	strcpy(p, _PATH_M_PTY "/");
+	if (ioctl(ptm, PTY_PTSNAME, p + sizeof _PATH_M_PTY))
+		return -1;
+	if (ioctl(ptm, PTY_UNLOCK, NULL))
+		return -1;
+	p += strlen(p) + 1;
+	
+	if (!getcwd(p, end - p))
+		return -1;
+	p += strlen(p) + 1;
+	
+	for (i = 1; argv[i]; i++)
+	{
+		len = strlen(argv[i]) + 1;
+		if (len > end - p)
+			return -1;
+		memcpy(p, argv[i], len);
+		p += len;
+	}
+	
+	rq->size = p - buf;
+	rq->argc = i - 1;
+	rq->pid	 = getpid();
+	if (write(sfd, buf, rq->size) != rq->size)
+		return -1;
+	return 0;
+}
+
+static int reply(int ptm)
+{
+	char buf[512];
+	int status = 0;
+	int eor = 0;
+	char *p;
+	int cnt;
+	int i;
+	
+	for (;;)
+	{
+		cnt = read(ptm, buf, sizeof buf);
+		if (hup)
+			errx(1, "server: request not answered");
+		if (cnt < 0 && errno == EINTR)
+			continue;
+		if (cnt <= 0)
+			err(1, "server");
+		
+		if (eor)
+			p = buf;
+		else
+		{
+			p = memchr(buf, 0, cnt);
+			if (!p)
+			{
+				write(2, buf, cnt);
+				continue;
+			}
+			write(2, buf, p - buf);
+			eor = 1;
+			p++;
+		}
+		
+		for (i = p - buf; i < cnt; i++)
+		{
+			if (buf[i] == '\n')
+				return status;
+			status = status * 10 + buf[i] - '0';
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char *s;
+	int sfd;
+	int ptm;
+	
+	s = getenv("TCC_SERVER");
+	if (!s || !*s || islocal(argv))
+		local(argv);
+	sfd = atoi(s);
+	
+	signal(SIGPIPE, SIG_IGN);
+	
+	ptm = open(_PATH_D_PTMX, O_RDWR);
+	if (ptm < 0)
+		local(argv);
+	fcntl(ptm, F_SETFD, FD_CLOEXEC);
+	
+	hup_fd = ptm;
+	signal(SIGHUP, sighup);
+	
+	if (request(sfd, ptm, argv))
+	{
+		close(ptm);
+		local(argv);
+	}
+	return reply(ptm);
+}
@@ -32,6 +32,9 @@ ST_DATA int tcc_ext = 1;
 /* XXX: get rid of this ASAP */
 ST_DATA struct TCCState *tcc_state;
 
+/* if set, fatal errors jump here instead of exiting (compile server) */
+ST_DATA jmp_buf *tcc_exit_jmp;
+
 static int nb_states;
 
 /********************************************************/
@@ -551,6 +554,8 @@ PUB_FUNC void tcc_error(const char *fmt, ...)
         longjmp(s1->error_jmp_buf, 1);
     } else {
         /* XXX: eliminate this someday */
+        if (tcc_exit_jmp)
+            longjmp(*tcc_exit_jmp, 1);
         exit(1);
     }
 }
@@ -633,6 +638,7 @@ static int tcc_compile(TCCState *s1)
         s1->nb_errors = 0;
         s1->error_set_jmp_enabled = 1;
 
+        hcache_start(s1);
         preprocess_start(s1);
         tccgen_start(s1);
 
@@ -654,6 +660,7 @@ static int tcc_compile(TCCState *s1)
         tccgen_end(s1);
     }
     s1->error_set_jmp_enabled = 0;
+    hcache_end(s1, s1->nb_errors);
 
     free_inline_functions(s1);
     /* reset define stack, but keep -D and built-ins */
@@ -904,6 +911,7 @@ LIBTCCAPI void tcc_delete(TCCState *s1)
     dynarray_reset(&s1->cmd_include_files, &s1->nb_cmd_include_files);
 
     tcc_free(s1->tcc_lib_path);
+    tcc_free(s1->hcache_dir);
     tcc_free(s1->soname);
     tcc_free(s1->rpath);
     tcc_free(s1->init_symbol);
@@ -1486,6 +1494,7 @@ enum {
     TCC_OPTION_E,
     TCC_OPTION_MD,
     TCC_OPTION_MF,
+    TCC_OPTION_hcache,
     TCC_OPTION_x,
     TCC_OPTION_ar,
     TCC_OPTION_impdef
@@ -1550,6 +1559,7 @@ static const TCCOption tcc_options[] = {
     { "E", TCC_OPTION_E, 0},
     { "MD", TCC_OPTION_MD, 0},
     { "MF", TCC_OPTION_MF, TCC_OPTION_HAS_ARG },
+    { "hcache", TCC_OPTION_hcache, TCC_OPTION_HAS_ARG },
     { "x", TCC_OPTION_x, TCC_OPTION_HAS_ARG },
     { "ar", TCC_OPTION_ar, 0},
 #ifdef TCC_TARGET_PE
@@ -1888,6 +1898,10 @@ reparse:
         case TCC_OPTION_MF:
             s->deps_outfile = tcc_strdup(optarg);
             break;
+        case TCC_OPTION_hcache:
+            tcc_free(s->hcache_dir);
+            s->hcache_dir = tcc_strdup(optarg);
+            break;
         case TCC_OPTION_dumpversion:
             printf ("%s\n", TCC_VERSION);
             exit(0);
@@ -17,3 +17,4 @@
 #define CONFIG_TCCDIR			"/usr/lib"
 #define CONFIG_TCC_ELFINTERP		"/lib/load"
 #undef	TCC_IS_NATIVE
+#define CONFIG_TCC_SERVER
@@ -77,6 +77,10 @@ static const char help2[] =
     "  -Bdir       set tcc's private include/library dir\n"
     "  -MD         generate dependency file for make\n"
     "  -MF file    specify dependency file name\n"
+    "  -hcache dir keep a cache of included headers in 'dir'\n"
+#ifdef CONFIG_TCC_SERVER
+    "  -server [opts] -- cmd  run 'cmd' with a compile server (see tccc)\n"
+#endif
     "Debugger options:\n"
     "  -g          generate runtime debug info\n"
 #ifdef CONFIG_TCC_BCHECK
@@ -239,7 +243,7 @@ static unsigned getclock_ms(void)
 #endif
 }
 
-int main(int argc, char **argv)
+static int tcc_main(int argc, char **argv)
 {
     TCCState *s;
     int ret, opt, n = 0;
@@ -356,3 +360,187 @@ redo:
         goto redo; /* compile more files with -c */
     return ret;
 }
+
+#ifdef CONFIG_TCC_SERVER
+/* ------------------------------------------------------------- */
+/* compile server
+
+   tcc -server [options] -- command [args...]
+
+   runs 'command' with TCC_SERVER set to the write end of a request pipe
+   and runs the compilations requested there by tccc, one after another,
+   until the last writer is gone.  A request is written in one piece: a
+   struct tcc_req followed by the name of a pty slave, the working
+   directory and the arguments, each NUL terminated.  The output of the
+   compilation goes to the pty slave, followed by a NUL and the exit
+   status in decimal.  A request that cannot be answered that way gets
+   SIGHUP sent to the client instead.  'options' are put in front of
+   the arguments of every request, and the headers read stay cached
+   between them. */
+
+#include <sys/wait.h>
+#include <newtask.h>
+#include <limits.h>
+#include <signal.h>
+
+struct tcc_req {
+    int size; /* of the whole request */
+    int argc;
+    int pid; /* of the client */
+};
+
+static int server_read(int fd, void *buf, int len)
+{
+    char *p = buf;
+    int n;
+
+    while (len) {
+        n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* tell a client whose request got no reply not to wait for one */
+static void server_hup(struct tcc_req *rq)
+{
+    if (rq->pid > 0)
+        kill(rq->pid, SIGHUP);
+}
+
+static int server_serve(char *req, int size, int argc,
+                        char **opts, int nopts)
+{
+    char **argv, *pts, *cwd, *p, st[16];
+    jmp_buf jmp;
+    int fd, i, n, ret;
+
+    if (!size || req[size - 1])
+        return -1;
+    pts = req;
+    cwd = pts + strlen(pts) + 1;
+    p = cwd;
+    argv = tcc_malloc((nopts + argc + 2) * sizeof *argv);
+    n = 0;
+    argv[n++] = "tcc";
+    for (i = 0; i < nopts; i++)
+        argv[n++] = opts[i];
+    for (i = 0; i < argc; i++) {
+        p += strlen(p) + 1;
+        if (p >= req + size)
+            goto done;
+        argv[n++] = p;
+    }
+    argv[n] = NULL;
+
+    ret = -1;
+    fd = open(pts, O_WRONLY);
+    if (fd < 0)
+        goto done;
+    fflush(stdout);
+    dup2(fd, 1);
+    dup2(fd, 2);
+    close(fd);
+
+    if (chdir(cwd) < 0) {
+        fprintf(stderr, "tcc: %s: %s\n", cwd, strerror(errno));
+        ret = 1;
+    } else {
+        tcc_exit_jmp = &jmp;
+        if (setjmp(jmp) == 0) {
+            ret = tcc_main(n, argv);
+        } else {
+            /* fatal error, only this request is lost */
+            if (tcc_state)
+                tcc_delete(tcc_state);
+            ret = 1;
+        }
+        tcc_exit_jmp = NULL;
+    }
+    fflush(stdout);
+    st[0] = 0;
+    sprintf(st + 1, "%d\n", ret);
+    write(2, st, strlen(st + 1) + 1);
+    ret = 0;
+done:
+    tcc_free(argv);
+    return ret;
+}
+
+static int tcc_server(int argc, char **argv)
+{
+    struct tcc_req rq;
+    char buf[16], *req = NULL;
+    int pfd[2], so, se, st, i;
+    pid_t pid;
+
+    for (i = 2; i < argc && strcmp(argv[i], "--"); i++)
+        ;
+    if (i + 1 >= argc) {
+        fprintf(stderr, "usage: tcc -server [options] -- command [args...]\n");
+        return 1;
+    }
+    if (pipe(pfd) < 0) {
+        perror("tcc: pipe");
+        return 1;
+    }
+    fcntl(pfd[0], F_SETFD, FD_CLOEXEC);
+    sprintf(buf, "%d", pfd[1]);
+    setenv("TCC_SERVER", buf, 1);
+
+    signal(SIGCHLD, SIG_DFL);
+    pid = _newtaskvp(argv[i + 1], argv + i + 1);
+    if (pid < 0) {
+        perror(argv[i + 1]);
+        return 1;
+    }
+    close(pfd[1]);
+
+    /* a client may go away while its output is being written */
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    so = dup(1);
+    se = dup(2);
+    hcache_keep = 1;
+
+    while (server_read(pfd[0], &rq, sizeof rq) == 0) {
+        /* the pipe is out of step after a bad header, stop serving */
+        if (rq.size <= sizeof rq || rq.size > PIPE_BUF || rq.argc < 0) {
+            server_hup(&rq);
+            break;
+        }
+        req = tcc_realloc(req, rq.size - sizeof rq);
+        if (server_read(pfd[0], req, rq.size - sizeof rq)) {
+            server_hup(&rq);
+            break;
+        }
+        if (server_serve(req, rq.size - sizeof rq, rq.argc, argv + 2, i - 2))
+            server_hup(&rq);
+        dup2(so, 1);
+        dup2(se, 2);
+    }
+    tcc_free(req);
+    close(pfd[0]);
+
+    while (waitpid(pid, &st, 0) < 0)
+        if (errno != EINTR)
+            return 1;
+    if (WIFEXITED(st))
+        return WEXITSTATUS(st);
+    return WTERMSIG(st) + 128;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+#ifdef CONFIG_TCC_SERVER
+    if (argc > 1 && !strcmp(argv[1], "-server"))
+        return tcc_server(argc, argv);
+#endif
+    return tcc_main(argc, argv);
+}
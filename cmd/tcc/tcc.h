@@ -36,6 +36,7 @@
 
 #ifndef _WIN32
 # include <unistd.h>
+# include <sys/stat.h>
 # include <sys/time.h>
 # ifndef CONFIG_TCC_STATIC
 #  include <dlfcn.h>
@@ -609,6 +610,7 @@ struct TCCState {
     int alacarte_link; /* if true, only link in referenced objects from archive */
 
     char *tcc_lib_path; /* CONFIG_TCCDIR or -B option */
+    char *hcache_dir; /* -hcache option, NULL if no header cache */
     char *soname; /* as specified on the command line (-soname) */
     char *rpath; /* as specified on the command line (-Wl,-rpath=) */
     int enable_new_dtags; /* ditto, (-Wl,--enable-new-dtags) */
@@ -1045,6 +1047,8 @@ ST_DATA int gnu_ext;
 ST_DATA int tcc_ext;
 /* XXX: get rid of this ASAP */
 ST_DATA struct TCCState *tcc_state;
+/* fatal error exit for the compile server */
+ST_DATA jmp_buf *tcc_exit_jmp;
 
 /* public functions currently used by the tcc main function */
 ST_FUNC char *pstrcpy(char *buf, int buf_size, const char *s);
@@ -1157,6 +1161,8 @@ ST_DATA int total_lines;
 ST_DATA int total_bytes;
 ST_DATA int tok_ident;
 ST_DATA TokenSym **table_ident;
+/* keep the header cache between compilations */
+ST_DATA int hcache_keep;
 
 #define TOK_FLAG_BOL   0x0001 /* beginning of line before */
 #define TOK_FLAG_BOF   0x0002 /* beginning of file before */
@@ -1204,6 +1210,8 @@ ST_FUNC void next_nomacro(void);
 ST_FUNC void next(void);
 ST_INLN void unget_tok(int last_tok);
 ST_FUNC void preprocess_start(TCCState *s1);
+ST_FUNC void hcache_start(TCCState *s1);
+ST_FUNC void hcache_end(TCCState *s1, int ret);
 ST_FUNC void tccpp_new(TCCState *s);
 ST_FUNC void tccpp_delete(TCCState *s);
 ST_FUNC int tcc_preprocess(TCCState *s1);
@@ -38,6 +38,9 @@ ST_DATA int total_bytes;
 ST_DATA int tok_ident;
 ST_DATA TokenSym **table_ident;
 
+/* keep the header cache between compilations */
+ST_DATA int hcache_keep;
+
 /* ------------------------------------------------------------------------- */
 
 static TokenSym *hash_ident[TOK_HASH_SIZE];
@@ -1682,6 +1685,392 @@ pragma_err:
     return;
 }
 
+/* ------------------------------------------------------------------------- */
+/* header cache (-hcache dir)
+
+   The headers included by a source file are kept with comments stripped
+   and blanks folded in one pack file per source, which is loaded with a
+   single read when the source is compiled again.  An entry is used only
+   while the size and mtime of its header still match.  Comments that
+   span lines, '//' comments continued with a backslash and the text of
+   #include, #error and #warning lines are kept as they are, so line
+   numbers and diagnostics do not change.  With hcache_keep set the
+   headers also stay in memory from one compilation to the next. */
+
+typedef struct HCacheEnt {
+    struct HCacheEnt *next; /* hash chain */
+    struct HCacheEnt *unext; /* used by the current compilation */
+    long long mtime, size; /* of the header file */
+    int len, used;
+    char *text;
+    char name[1];
+} HCacheEnt;
+
+typedef struct HCacheRec {
+    long long mtime, size;
+    int name_len, len;
+} HCacheRec;
+
+#define HCACHE_MAGIC "TCH1"
+#define HCACHE_HASH_SIZE 256
+
+static HCacheEnt *hcache_hash[HCACHE_HASH_SIZE];
+static HCacheEnt *hcache_used, **hcache_utail;
+static char hcache_src[1024];
+static char *hcache_pack;
+static int hcache_on, hcache_run, hcache_loaded, hcache_nused;
+static int hcache_hits, hcache_misses;
+
+static unsigned hcache_hashof(const char *s)
+{
+    unsigned h = 2166136261u;
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static HCacheEnt **hcache_find(const char *name)
+{
+    HCacheEnt **pe;
+
+    pe = &hcache_hash[hcache_hashof(name) & (HCACHE_HASH_SIZE - 1)];
+    while (*pe && strcmp((*pe)->name, name))
+        pe = &(*pe)->next;
+    return pe;
+}
+
+static HCacheEnt *hcache_add(const char *name, long long mtime, long long size,
+                             char *text, int len)
+{
+    HCacheEnt *e, **pe;
+
+    pe = hcache_find(name);
+    if (*pe) {
+        e = *pe;
+        *pe = e->next;
+        tcc_free(e->text);
+        tcc_free(e);
+    }
+    e = tcc_malloc(sizeof(HCacheEnt) + strlen(name));
+    strcpy(e->name, name);
+    e->mtime = mtime;
+    e->size = size;
+    e->text = text;
+    e->len = len;
+    e->used = 0;
+    e->next = *pe;
+    *pe = e;
+    return e;
+}
+
+static void hcache_free(void)
+{
+    HCacheEnt *e;
+    int i;
+
+    for (i = 0; i < HCACHE_HASH_SIZE; i++) {
+        while ((e = hcache_hash[i]) != NULL) {
+            hcache_hash[i] = e->next;
+            tcc_free(e->text);
+            tcc_free(e);
+        }
+    }
+}
+
+/* lines of these directives are taken as raw text by preprocess() */
+static int hcache_rawline(const char *p, const char *e)
+{
+    static const char * const dirs[] = { "include", "error", "warning" };
+    int i, n;
+
+    while (p < e && (*p == ' ' || *p == '\t'))
+        p++;
+    for (i = 0; i < 3; i++) {
+        n = strlen(dirs[i]);
+        if (e - p >= n && !memcmp(p, dirs[i], n))
+            return 1;
+    }
+    return 0;
+}
+
+static int hcache_compact(char *d0, const char *p, int len)
+{
+    const char *e = p + len, *r;
+    int c, q = 0, bol = 1;
+    char *d = d0;
+
+    while (p < e) {
+        c = *p;
+        if (q) {
+            /* inside a string or character constant */
+            *d++ = *p++;
+            if (c == '\\' && p < e)
+                *d++ = *p++;
+            else if (c == q || c == '\n')
+                q = 0, bol = c == '\n';
+            continue;
+        }
+        if (c == '\n') {
+            *d++ = *p++;
+            bol = 1;
+            continue;
+        }
+        if (c == ' ' || c == '\t') {
+            while (p < e && (*p == ' ' || *p == '\t'))
+                p++;
+            if (d == d0 || d[-1] != ' ')
+                *d++ = ' ';
+            continue;
+        }
+        if (bol && c == '#' && hcache_rawline(p + 1, e)) {
+            /* copy the whole (possibly continued) line */
+            while (p < e && (*p != '\n' || p[-1] == '\\'))
+                *d++ = *p++;
+            bol = 0;
+            continue;
+        }
+        bol = 0;
+        if (c == '\"' || c == '\'') {
+            *d++ = *p++;
+            q = c;
+            continue;
+        }
+        if (c == '/' && p + 1 < e && p[1] == '*') {
+            for (r = p + 2; r + 1 < e && (r[0] != '*' || r[1] != '/'); r++)
+                ;
+            if (r + 1 >= e || memchr(p, '\n', r - p)) {
+                r = r + 1 >= e ? e : r + 2;
+                while (p < r)
+                    *d++ = *p++;
+            } else {
+                if (d == d0 || d[-1] != ' ')
+                    *d++ = ' ';
+                p = r + 2;
+            }
+            continue;
+        }
+        if (c == '/' && p + 1 < e && p[1] == '/') {
+            r = memchr(p, '\n', e - p);
+            if (!r)
+                r = e;
+            if (r[-1] == '\\' || (r[-1] == '\r' && r[-2] == '\\')) {
+                while (p < r)
+                    *d++ = *p++;
+            } else
+                p = r;
+            continue;
+        }
+        *d++ = *p++;
+    }
+    return d - d0;
+}
+
+static int hcache_read(const char *filename, char **text, long long size)
+{
+    char *buf;
+    int fd, len, n;
+
+    fd = open(filename, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return -1;
+    buf = tcc_malloc(size + 1);
+    for (len = 0; len < size; len += n) {
+        n = read(fd, buf + len, size - len);
+        if (n <= 0)
+            break;
+    }
+    close(fd);
+    if (len != size) {
+        tcc_free(buf);
+        return -1;
+    }
+    len = hcache_compact(buf, buf, len);
+    *text = tcc_realloc(buf, len + 1);
+    return len;
+}
+
+/* open an #include'd file through the header cache */
+static int hcache_open(TCCState *s1, const char *filename)
+{
+    char fmt[16];
+    struct stat st;
+    HCacheEnt *e;
+    char *text;
+    int len, hit;
+
+    if (!hcache_on || stat(filename, &st) < 0 || !S_ISREG(st.st_mode))
+        return tcc_open(s1, filename);
+
+    e = *hcache_find(filename);
+    hit = e && e->mtime == st.st_mtime && e->size == st.st_size;
+    if (hit) {
+        hcache_hits++;
+    } else {
+        len = hcache_read(filename, &text, st.st_size);
+        if (len < 0)
+            return tcc_open(s1, filename);
+        e = hcache_add(filename, st.st_mtime, st.st_size, text, len);
+        hcache_misses++;
+    }
+    if (e->used != hcache_run) {
+        e->used = hcache_run;
+        e->unext = NULL;
+        *hcache_utail = e;
+        hcache_utail = &e->unext;
+        hcache_nused++;
+    }
+
+    if (s1->verbose >= 2) {
+        sprintf(fmt, "%%s %i%%s %%s\n", (int)(s1->include_stack_ptr - s1->include_stack));
+        printf(fmt, "->", hit ? " (cached)" : "", filename);
+    }
+    tcc_open_bf(s1, filename, e->len);
+    memcpy(file->buffer, e->text, e->len);
+    return 0;
+}
+
+static void hcache_load(void)
+{
+    HCacheRec rec;
+    HCacheEnt *e;
+    struct stat st;
+    const char *p, *end;
+    char *buf, *text;
+    int fd, n, len, src_len;
+
+    fd = open(hcache_pack, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return;
+    if (fstat(fd, &st) < 0 || st.st_size < 12) {
+        close(fd);
+        return;
+    }
+    buf = tcc_malloc(st.st_size);
+    len = read(fd, buf, st.st_size);
+    close(fd);
+    p = buf;
+    end = buf + len;
+    if (len != st.st_size || memcmp(p, HCACHE_MAGIC, 4))
+        goto done;
+    memcpy(&n, p + 4, sizeof n);
+    memcpy(&src_len, p + 8, sizeof src_len);
+    p += 12;
+    if (src_len != strlen(hcache_src) || end - p < src_len
+        || memcmp(p, hcache_src, src_len))
+        goto done;
+    p += src_len;
+    while (n-- > 0) {
+        if (end - p < sizeof rec)
+            break;
+        memcpy(&rec, p, sizeof rec);
+        p += sizeof rec;
+        if (rec.name_len <= 0 || rec.len < 0
+            || end - p < rec.name_len || end - p - rec.name_len < rec.len)
+            break;
+        if (rec.name_len > STRING_MAX_SIZE)
+            break;
+        pstrncpy(token_buf, p, rec.name_len);
+        e = *hcache_find(token_buf);
+        if (!e || e->mtime != rec.mtime || e->size != rec.size) {
+            text = tcc_malloc(rec.len + 1);
+            memcpy(text, p + rec.name_len, rec.len);
+            hcache_add(token_buf, rec.mtime, rec.size, text, rec.len);
+        }
+        p += rec.name_len + rec.len;
+        hcache_loaded++;
+    }
+done:
+    tcc_free(buf);
+}
+
+static void hcache_save(void)
+{
+    HCacheRec rec;
+    HCacheEnt *e;
+    CString cs;
+    char *tmp;
+    int fd, n;
+
+    cstr_new(&cs);
+    cstr_cat(&cs, HCACHE_MAGIC, 4);
+    cstr_cat(&cs, (char *)&hcache_nused, sizeof hcache_nused);
+    n = strlen(hcache_src);
+    cstr_cat(&cs, (char *)&n, sizeof n);
+    cstr_cat(&cs, hcache_src, n);
+    for (e = hcache_used; e; e = e->unext) {
+        memset(&rec, 0, sizeof rec);
+        rec.mtime = e->mtime;
+        rec.size = e->size;
+        rec.name_len = strlen(e->name);
+        rec.len = e->len;
+        cstr_cat(&cs, (char *)&rec, sizeof rec);
+        cstr_cat(&cs, e->name, rec.name_len);
+        cstr_cat(&cs, e->text, e->len);
+    }
+
+    /* write a private file and rename it so that readers never see
+       a partial pack */
+    tmp = tcc_malloc(strlen(hcache_pack) + 16);
+    sprintf(tmp, "%s.%d", hcache_pack, (int)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd >= 0) {
+        n = write(fd, cs.data, cs.size);
+        if (close(fd) < 0 || n != cs.size || rename(tmp, hcache_pack) < 0)
+            unlink(tmp);
+    }
+    tcc_free(tmp);
+    cstr_free(&cs);
+}
+
+/* called before compiling the file in 'file' */
+ST_FUNC void hcache_start(TCCState *s1)
+{
+    const char *name = file->filename;
+    unsigned h;
+    int n;
+
+    hcache_on = 0;
+    if ((!s1->hcache_dir && !hcache_keep) || name[0] == '<')
+        return;
+
+    hcache_on = 1;
+    hcache_run++;
+    hcache_used = NULL;
+    hcache_utail = &hcache_used;
+    hcache_loaded = hcache_nused = 0;
+    hcache_hits = hcache_misses = 0;
+    tcc_free(hcache_pack);
+    hcache_pack = NULL;
+    if (!s1->hcache_dir)
+        return;
+
+    hcache_src[0] = 0;
+    if (!IS_ABSPATH(name) && getcwd(hcache_src, sizeof hcache_src - 1))
+        pstrcat(hcache_src, sizeof hcache_src, "/");
+    pstrcat(hcache_src, sizeof hcache_src, name);
+
+    h = hcache_hashof(hcache_src);
+    n = strlen(s1->hcache_dir) + 16;
+    hcache_pack = tcc_malloc(n);
+    snprintf(hcache_pack, n, "%s/%08x.tch", s1->hcache_dir, h);
+    hcache_load();
+}
+
+/* called after the compilation, 'ret' is its result */
+ST_FUNC void hcache_end(TCCState *s1, int ret)
+{
+    if (!hcache_on)
+        return;
+    hcache_on = 0;
+    if (hcache_pack && ret == 0
+        && (hcache_misses || hcache_nused != hcache_loaded))
+        hcache_save();
+    if (s1->verbose)
+        printf("hcache: %d hits, %d misses, %s\n",
+               hcache_hits, hcache_misses,
+               hcache_pack ? hcache_pack : "in memory");
+}
+
 /* is_bof is true if first non space token at beginning of file */
 ST_FUNC void preprocess(int is_bof)
 {
@@ -1813,7 +2202,7 @@ ST_FUNC void preprocess(int is_bof)
                 goto include_done;
             }
 
-            if (tcc_open(s1, buf1) < 0)
+            if (hcache_open(s1, buf1) < 0)
                 continue;
 
             file->include_next_index = i + 1;
@@ -3581,6 +3970,12 @@ ST_FUNC void tccpp_delete(TCCState *s)
     tokstr_alloc = NULL;
     tal_delete(cstr_alloc);
     cstr_alloc = NULL;
+
+    /* free the header cache */
+    if (!hcache_keep)
+        hcache_free();
+    tcc_free(hcache_pack);
+    hcache_pack = NULL;
 }
 
 /* ------------------------------------------------------------------------- */
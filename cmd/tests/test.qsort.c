@@ -0,0 +1,118 @@
+/* Copyright (c) 2017, Piotr Durlej
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <err.h>
+
+#define COUNT	100000
+
+struct rec
+{
+	int key;
+	int pad[5];
+};
+
+static unsigned long ncmp;
+
+static int cmp_int(const void *a, const void *b)
+{
+	int x = *(const int *)a;
+	int y = *(const int *)b;
+	
+	ncmp++;
+	return x < y ? -1 : x > y;
+}
+
+static int cmp_rec(const void *a, const void *b)
+{
+	return cmp_int(&((const struct rec *)a)->key, &((const struct rec *)b)->key);
+}
+
+static const char *names[] = { "sorted", "reversed", "equal", "organpipe", "random" };
+
+static int key(int input, int i)
+{
+	switch (input)
+	{
+	case 0:
+		return i;
+	case 1:
+		return COUNT - i;
+	case 2:
+		return 7;
+	case 3:
+		return i < COUNT / 2 ? i : COUNT - i;
+	default:
+		return rand();
+	}
+}
+
+static void bench(int input, size_t size)
+{
+	struct rec *r;
+	clock_t t0, t;
+	int *k;
+	int i;
+	
+	r = malloc(COUNT * sizeof *r);
+	k = malloc(COUNT * sizeof *k);
+	if (r == NULL || k == NULL)
+		err(1, "malloc");
+	
+	for (i = 0; i < COUNT; i++)
+		r[i].key = k[i] = key(input, i);
+	
+	ncmp = 0;
+	t0 = clock();
+	if (size == sizeof *k)
+		qsort(k, COUNT, sizeof *k, cmp_int);
+	else
+		qsort(r, COUNT, sizeof *r, cmp_rec);
+	t = clock() - t0;
+	
+	for (i = 1; i < COUNT; i++)
+		if (size == sizeof *k ? k[i - 1] > k[i] : r[i - 1].key > r[i].key)
+			errx(1, "%s: not sorted at %i", names[input], i);
+	
+	printf("%-10s %4u %10lu %6li ms\n", names[input], (unsigned)size, ncmp, (long)(t * 1000 / CLOCKS_PER_SEC));
+	free(r);
+	free(k);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+	
+	printf("INPUT      SIZE   COMPARES   TIME\n");
+	for (i = 0; i < sizeof names / sizeof *names; i++)
+	{
+		bench(i, sizeof(int));
+		bench(i, sizeof(struct rec));
+	}
+	return 0;
+}
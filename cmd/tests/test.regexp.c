@@ -35,9 +35,31 @@ struct rxtest
 	int	result;
 } rxt[] =
 {
-	{ ".*",		"abc",		0 },
-	{ "^test",	"test",		0 },
-	{ "^test",	"xtest",	1 },
+	{ ".*",		"abc",		1 },
+	{ "^test",	"test",		1 },
+	{ "^test",	"xtest",	0 },
+	{ "a+$",	"ab",		0 },
+	{ "^(ab|cd)+x",	"ababcdabx",	1 },
+	{ "^(ab|cd)+x",	"ababcdab",	0 },
+	{ "x(a|b)*y$",	"zzxababy",	1 },
+	{ "(a*)*b",	"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaac", 0 },
+	{ "foo.*bar",	"a foo and a bar", 1 },
+	{ "foo.*bar",	"a bar and a foo", 0 },
+};
+
+struct rxsub
+{
+	char *	pattern;
+	char *	string;
+	int	sub;
+	int	start;
+	int	end;
+} rxs[] =
+{
+	{ "(a*)(b*)",		"aabbb",	1, 2, 5 },
+	{ "x(a|b)*y",		"zzxaby",	0, 4, 5 },
+	{ "(a|ab)(c|bcd)",	"abcd",		1, 1, 4 },
+	{ "(foo)|(bar)",	"xbar",		1, 1, 4 },
 };
 
 int main(int argc, char **argv)
@@ -54,6 +76,21 @@ int main(int argc, char **argv)
 		if (!!regexec(rx, rxt[i].string) != rxt[i].result)
 			errx(1, "mismatch for pattern \"%s\", string \"%s\"",
 				rxt[i].pattern, rxt[i].string);
+		regfree(rx);
+	}
+	
+	for (i = 0; i < sizeof rxs / sizeof *rxs; i++)
+	{
+		rx = regcomp(rxs[i].pattern);
+		if (rx == NULL)
+			errx(1, "regcomp failed for \"%s\"", rxs[i].pattern);
+		
+		if (!regexec(rx, rxs[i].string) ||
+		    rx->startp[rxs[i].sub] != rxs[i].string + rxs[i].start ||
+		    rx->endp[rxs[i].sub]   != rxs[i].string + rxs[i].end)
+			errx(1, "bad subexpression %i for pattern \"%s\", string \"%s\"",
+				rxs[i].sub, rxs[i].pattern, rxs[i].string);
+		regfree(rx);
 	}
 	return 0;
 }
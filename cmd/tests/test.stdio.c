@@ -0,0 +1,151 @@
+/* Copyright (c) 2017, Piotr Durlej
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <err.h>
+
+#define FILE_SIZE	(4 * 1024 * 1024)
+
+static const char *pathname = "/tmp/test.stdio";
+static char *data;
+static char *back;
+
+static void w_putc(FILE *f, size_t chunk)
+{
+	size_t i;
+	
+	for (i = 0; i < FILE_SIZE; i++)
+		if (putc(data[i], f) == EOF)
+			err(1, "%s: putc", pathname);
+}
+
+static void w_fwrite(FILE *f, size_t chunk)
+{
+	size_t i, n;
+	
+	for (i = 0; i < FILE_SIZE; i += n)
+	{
+		n = FILE_SIZE - i;
+		if (n > chunk)
+			n = chunk;
+		
+		if (fwrite(data + i, 1, n, f) != n)
+			err(1, "%s: fwrite", pathname);
+	}
+}
+
+static void r_getc(FILE *f, size_t chunk)
+{
+	size_t i;
+	int c;
+	
+	for (i = 0; i < FILE_SIZE; i++)
+	{
+		c = getc(f);
+		if (c == EOF)
+			errx(1, "%s: unexpected EOF", pathname);
+		back[i] = c;
+	}
+}
+
+static void r_fread(FILE *f, size_t chunk)
+{
+	size_t i, n;
+	
+	for (i = 0; i < FILE_SIZE; i += n)
+	{
+		n = FILE_SIZE - i;
+		if (n > chunk)
+			n = chunk;
+		
+		if (fread(back + i, 1, n, f) != n)
+			errx(1, "%s: short read", pathname);
+	}
+}
+
+static void bench(const char *name, const char *mode, void (*proc)(FILE *f, size_t chunk), size_t chunk, size_t bufsz)
+{
+	clock_t t0, t;
+	FILE *f;
+	
+	f = fopen(pathname, mode);
+	if (f == NULL)
+		err(1, "%s", pathname);
+	if (bufsz && setvbuf(f, NULL, _IOFBF, bufsz))
+		err(1, "%s: setvbuf", pathname);
+	
+	t0 = clock();
+	proc(f, chunk);
+	if (fclose(f))
+		err(1, "%s", pathname);
+	t = clock() - t0;
+	
+	if (*mode == 'r' && memcmp(data, back, FILE_SIZE))
+		errx(1, "%s: data mismatch", name);
+	memset(back, 0, FILE_SIZE);
+	
+	if (!t)
+		t = 1;
+	printf("%-8s %6u %6u %8li KiB/s\n", name, (unsigned)chunk, (unsigned)(bufsz ? bufsz : BUFSIZ),
+		(long)((long long)FILE_SIZE * CLOCKS_PER_SEC / t / 1024));
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t chunks[] = { 1, 16, 512, 4096, 65536 };
+	int i;
+	
+	if (argc > 1)
+		pathname = argv[1];
+	
+	data = malloc(FILE_SIZE);
+	back = malloc(FILE_SIZE);
+	if (data == NULL || back == NULL)
+		err(1, "malloc");
+	
+	for (i = 0; i < FILE_SIZE; i++)
+		data[i] = rand();
+	
+	printf("TEST      CHUNK BUFSIZ    SPEED\n");
+	bench("putc",	"w", w_putc,  1, 0);
+	bench("getc",	"r", r_getc,  1, 0);
+	
+	for (i = 0; i < sizeof chunks / sizeof *chunks; i++)
+	{
+		bench("fwrite",	"w", w_fwrite, chunks[i], 0);
+		bench("fread",	"r", r_fread,  chunks[i], 0);
+	}
+	
+	bench("fwrite",	"w", w_fwrite, 512, 65536);
+	bench("fread",	"r", r_fread,  512, 65536);
+	
+	unlink(pathname);
+	return 0;
+}
@@ -0,0 +1,177 @@
+/* Copyright (c) 2017, Piotr Durlej
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <err.h>
+
+#define BUF_SIZE	(1024 * 1024)
+#define TOTAL		(64 * 1024 * 1024)
+
+static char *src;
+static char *dst;
+static char *cpy;
+static volatile int sink;
+
+static void t_memcpy(size_t size, int off)
+{
+	memcpy(dst + off, src, size);
+}
+
+static void t_memmove(size_t size, int off)
+{
+	memmove(dst + off + 1, dst + off, size);
+}
+
+static void t_memset(size_t size, int off)
+{
+	memset(dst + off, off, size);
+}
+
+static void t_memcmp(size_t size, int off)
+{
+	sink += memcmp(cpy + off, src + off, size);
+}
+
+static void t_strlen(size_t size, int off)
+{
+	sink += strlen(src + off + BUF_SIZE - size);
+}
+
+static void check(void)
+{
+	char tmp[300];
+	char *ref;
+	int s, d;
+	int n;
+	int i;
+	
+	ref = malloc(4096);
+	if (ref == NULL)
+		err(1, "malloc");
+	
+	for (n = 0; n < 300; n++)
+		for (s = 0; s < 16; s++)
+			for (d = 0; d < 16; d++)
+			{
+				for (i = 0; i < 4096; i++)
+					src[i] = ref[i] = dst[i] = rand();
+				
+				memcpy(dst + d, src + s, n);
+				for (i = 0; i < n; i++)
+					ref[d + i] = src[s + i];
+				if (memcmp(dst, ref, 4096))
+					errx(1, "memcpy: size %i, offsets %i, %i", n, s, d);
+				
+				memmove(dst + d, dst + s + 8, n);
+				for (i = 0; i < n; i++)
+					tmp[i] = ref[s + 8 + i];
+				for (i = 0; i < n; i++)
+					ref[d + i] = tmp[i];
+				if (memcmp(dst, ref, 4096))
+					errx(1, "memmove: size %i, offsets %i, %i", n, s + 8, d);
+				
+				memmove(dst + s + 8, dst + d, n);
+				for (i = 0; i < n; i++)
+					tmp[i] = ref[d + i];
+				for (i = 0; i < n; i++)
+					ref[s + 8 + i] = tmp[i];
+				if (memcmp(dst, ref, 4096))
+					errx(1, "memmove: size %i, offsets %i, %i", n, d, s + 8);
+				
+				memset(dst + d, s, n);
+				for (i = 0; i < n; i++)
+					ref[d + i] = s;
+				if (memcmp(dst, ref, 4096))
+					errx(1, "memset: size %i, offset %i", n, d);
+				
+				if (n)
+				{
+					ref[d + n - 1] ^= 0x80;
+					if ((memcmp(dst + d, ref + d, n) < 0) != !!(ref[d + n - 1] & 0x80))
+						errx(1, "memcmp: size %i, offset %i", n, d);
+				}
+				
+				src[s + n] = 0;
+				for (i = 0; i < n; i++)
+					if (!src[s + i])
+						src[s + i] = 1;
+				if (strlen(src + s) != n)
+					errx(1, "strlen: size %i, offset %i", n, s);
+			}
+	free(ref);
+}
+
+static void bench(const char *name, void (*proc)(size_t size, int off), size_t size, int off)
+{
+	clock_t t0, t;
+	size_t cnt;
+	size_t i;
+	
+	cnt = TOTAL / size;
+	
+	t0 = clock();
+	for (i = 0; i < cnt; i++)
+		proc(size, off);
+	t = clock() - t0;
+	
+	if (!t)
+		t = 1;
+	printf("%-8s %8u %3i %8li KiB/s\n", name, (unsigned)size, off,
+		(long)((long long)cnt * size * CLOCKS_PER_SEC / t / 1024));
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t sizes[] = { 8, 64, 512, 4096, 65536, BUF_SIZE - 64 };
+	int i;
+	
+	src = malloc(BUF_SIZE);
+	dst = malloc(BUF_SIZE);
+	cpy = malloc(BUF_SIZE);
+	if (src == NULL || dst == NULL || cpy == NULL)
+		err(1, "malloc");
+	
+	check();
+	
+	memset(src, 'x', BUF_SIZE);
+	src[BUF_SIZE - 1] = 0;
+	memcpy(cpy, src, BUF_SIZE);
+	
+	printf("TEST         SIZE OFF    SPEED\n");
+	for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+	{
+		bench("memcpy",  t_memcpy,  sizes[i], 0);
+		bench("memcpy",  t_memcpy,  sizes[i], 3);
+		bench("memmove", t_memmove, sizes[i], 0);
+		bench("memset",  t_memset,  sizes[i], 0);
+		bench("memcmp",  t_memcmp,  sizes[i], 0);
+		bench("strlen",  t_strlen,  sizes[i] - 1, 0);
+	}
+	return 0;
+}
@@ -6,6 +6,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <newtask.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
@@ -18,6 +20,48 @@
 
 #define TIMESPEC	0
 
+#define JOBS_MAX	64
+#define ARGV_MAX	256
+#define SCACHE_SIZE	256
+
+#define SHELL_CHARS	"\"'`\\$&|;<>()*?[]{}~=#!\n"
+
+#define J_WAIT		0
+#define J_RUN		1
+#define J_DONE		2
+#define J_FAIL		3
+
+/*
+ * A job is one invocation of a rule for a target. The planning pass
+ * links jobs into a dependency graph; a job is started as soon as all
+ * the jobs it depends on are done, earliest planned first.
+ */
+struct job
+{
+	struct job *	next;
+	struct rule *	rule;
+	char *		src;
+	char *		target;
+	
+	struct job **	waiters;
+	int		nwaiters;
+	int		pending;
+	int		planning;
+	int		state;
+	
+	char **		cmd;
+	int		iexit;
+	pid_t		pid;
+};
+
+struct scent
+{
+	struct scent *	next;
+	char *		name;
+	struct stat	st;
+	int		err;
+};
+
 static char *mfnames[] =
 {
 	"umakefile",
@@ -33,12 +77,84 @@ static int nflag;
 static int rflag;
 static int fail;
 static int depth;
+static int jflag = 1;
+static int running;
+
+static struct scent *scache[SCACHE_SIZE];
+static struct job *jobs;
+static struct job **jobtail = &jobs;
 
 const char **incpaths;
 int incpathcnt;
 int vflag;
 
-int makebyname(const char *name);
+int makebyname(const char *name, struct job *parent);
+
+static unsigned schash(const char *name)
+{
+	unsigned h = 0;
+	
+	while (*name)
+		h = h * 31 + (unsigned char)*name++;
+	return h % SCACHE_SIZE;
+}
+
+static int cstat(const char *name, struct stat *st)
+{
+	struct scent *sc;
+	unsigned h;
+	
+	h = schash(name);
+	for (sc = scache[h]; sc != NULL; sc = sc->next)
+		if (!strcmp(sc->name, name))
+			break;
+	
+	if (sc == NULL)
+	{
+		sc = calloc(1, sizeof *sc);
+		if (sc == NULL)
+			err(1, NULL);
+		sc->name = strdup(name);
+		if (sc->name == NULL)
+			err(1, NULL);
+		
+		if (stat(name, &sc->st))
+			sc->err = errno;
+		
+		sc->next  = scache[h];
+		scache[h] = sc;
+	}
+	
+	if (sc->err)
+	{
+		errno = sc->err;
+		return -1;
+	}
+	*st = sc->st;
+	return 0;
+}
+
+static void cinval(const char *name)
+{
+	struct scent **psc;
+	struct scent *sc;
+	
+	for (psc = &scache[schash(name)]; sc = *psc, sc != NULL; psc = &sc->next)
+		if (!strcmp(sc->name, name))
+		{
+			*psc = sc->next;
+			free(sc->name);
+			free(sc);
+			return;
+		}
+}
+
+static int exists(const char *name)
+{
+	struct stat st;
+	
+	return !cstat(name, &st);
+}
 
 static char *mkinput(const char *target)
 {
@@ -124,18 +240,55 @@ static char *mkinput(const char *target)
 	return buf;
 }
 
-int docmd(const char *cmd, const char *target, struct rule *rule)
+static pid_t spawn(const char *cmd)
 {
-	struct rule *r;
+	char *argv[ARGV_MAX];
+	char buf[4096];
+	char *p = buf;
+	pid_t pid;
+	int i = 0;
+	
+	if (strpbrk(cmd, SHELL_CHARS) != NULL || strlen(cmd) >= sizeof buf)
+		goto shell;
+	strcpy(buf, cmd);
+	
+	for (;;)
+	{
+		while (*p == ' ' || *p == '\t')
+			*p++ = 0;
+		if (!*p)
+			break;
+		if (i >= ARGV_MAX - 1)
+			goto shell;
+		argv[i++] = p;
+		while (*p && *p != ' ' && *p != '\t')
+			p++;
+	}
+	argv[i] = NULL;
+	
+	if (!i)
+		return 0;
+	
+	pid = _newtaskvp(argv[0], argv);
+	if (pid > 0)
+		return pid;
+	
+	/* not a program, maybe a shell builtin */
+shell:
+	return _newtaskl("/bin/sh", "/bin/sh", "-c", cmd, (void *)NULL);
+}
+
+static int docmd(struct job *j)
+{
+	const char *target = j->target;
 	char buf[4096];
 	char *sbuf;
 	const char *sp;
 	int noecho = 0;
 	int iexit = 0;
-	int f = 0;
 	char *dp;
 	
-	sbuf = substvars(cmd);
+	sbuf = substvars(*j->cmd);
 	
 	for (dp = buf, sp = sbuf; *sp; sp++)
 		switch (*sp)
@@ -178,14 +331,21 @@ int docmd(const char *cmd, const char *target, struct rule *rule)
 		fputs(sp, stderr);
 		fputc('\n', stderr);
 	}
-
+	
+	j->iexit = iexit;
+	j->pid	 = 0;
+	
 	if (nflag)
 		return 0;
-
-	f = !!system(sp);
-	if (iexit)
-		return 0;
-	return f;
+	
+	j->pid = spawn(sp);
+	if (j->pid < 0)
+	{
+		warn("%s", sp);
+		j->pid = 0;
+		return !iexit;
+	}
+	return 0;
 }
 
 static void trace(struct rule *r, const char *src, const char *target)
@@ -220,86 +380,88 @@ static int older(time_t t1, time_t t2)
 }
 #endif
 
-int make(struct rule *r, const char *src, const char *target)
+static struct job *findjob(struct rule *r, const char *target)
 {
-#if TIMESPEC
-	struct timespec stv = { 0, 0 };
-#else
-	time_t stv;
-#endif
-	struct stat st;
+	struct job *j;
+	
+	for (j = jobs; j != NULL; j = j->next)
+		if (j->rule == r && !strcmp(j->target, target))
+			return j;
+	return NULL;
+}
+
+static void depend(struct job *parent, struct job *j)
+{
+	if (parent == NULL)
+		return;
+	
+	j->waiters = realloc(j->waiters, (j->nwaiters + 1) * sizeof *j->waiters);
+	if (j->waiters == NULL)
+		err(1, NULL);
+	j->waiters[j->nwaiters++] = parent;
+	parent->pending++;
+}
+
+int make(struct rule *r, const char *src, const char *target, struct job *parent)
+{
+	struct job *j;
 	char **input;
-	char **cmd;
 	int f = 0;
 	
-	if (r->done)
-		return 0;
+	if (target == NULL)
+		target = r->output;
+	
+	j = findjob(r, target);
+	if (j != NULL)
+	{
+		if (j->planning)
+		{
+			warnx("%s: circular dependency", target);
+			fail = 1;
+			return 1;
+		}
+		depend(parent, j);
+		return j->state == J_FAIL;
+	}
 	
 	if (++depth > 10)
 	{
 		warnx("recursion limit exceeded");
+		depth--;
 		return 1;
 	}
 	
-	if (target == NULL)
-		target = r->output;
-	
 	if (src == NULL && r->input)
 		src = r->input[0];
 	
 	trace(r, src, target);
 	
-	for (input = r->input; *input; input++)
-	{
-		f |= makebyname(*input);
-#if TIMESPEC
-		if (!stat(*input, &st) && older(&stv, &st.st_mtim))
-			stv = st.st_mtim;
-#else
-		if (!stat(*input, &st) && older(stv, st.st_mtime))
-			stv = st.st_mtime;
-#endif
-	}
-#if TIMESPEC
-	if (!stat(src, &st) && older(&stv, &st.st_mtim))
-		stv = st.st_mtim;
-#else
-	if (!stat(src, &st) && older(stv, st.st_mtime))
-		stv = st.st_mtime;
-#endif
-	
-	if (f)
-	{
-		depth--;
-		return 1;
-	}
+	j = calloc(1, sizeof *j);
+	if (j == NULL)
+		err(1, NULL);
+	j->rule	    = r;
+	j->target   = strdup(target);
+	j->src	    = src ? strdup(src) : NULL;
+	j->planning = 1;
+	if (j->target == NULL || (src != NULL && j->src == NULL))
+		err(1, NULL);
 	
-#if TIMESPEC
-	if (src != NULL && !stat(target, &st) && !older(&st.st_mtim, &stv))
-	{
-		depth--;
-		return 0;
-	}
-#else
-	if (src != NULL && !stat(target, &st) && !older(st.st_mtime, stv))
-	{
-		depth--;
-		return 0;
-	}
-#endif
+	*jobtail = j;
+	jobtail	 = &j->next;
 	
-	if (r->cmds)
-		for (cmd = r->cmds; *cmd; cmd++)
-			docmd(*cmd, target, r);
+	for (input = r->input; *input; input++)
+		f |= makebyname(*input, j);
 	
-	if (*r->output != '.')
-		r->done = 1;
+	if (f)
+		j->state = J_FAIL;
+	j->planning = 0;
 	
+	depend(parent, j);
 	depth--;
-	return 0;
+	return f ? 1 : 0;
 }
 
-int makebyname(const char *name)
+int makebyname(const char *name, struct job *parent)
 {
 	struct rule *r;
 	const char *tx;
@@ -313,7 +475,7 @@ int makebyname(const char *name)
 		if (*r->output != '.' && !strcmp(r->output, name))
 		{
 			found = 1;
-			if (make(r, NULL, NULL))
+			if (make(r, NULL, NULL, parent))
 				return -1;
 			if (r->cmds)
 				return 0;
@@ -344,13 +506,13 @@ int makebyname(const char *name)
 			memcpy(src + blen, r->output, xlen);
 			src[blen + xlen] = 0;
 			
-			if (access(src, 0))
+			if (!exists(src))
 			{
 				free(src);
 				continue;
 			}
 			
-			if (make(r, src, name))
+			if (make(r, src, name, parent))
 				return -1;
 			if (r->cmds)
 				return 0;
@@ -371,19 +533,19 @@ int makebyname(const char *name)
 		if (asprintf(&src, "%s%s", name, r->output) < 0)
 			err(1, NULL);
 		
-		if (access(src, 0))
+		if (!exists(src))
 		{
 			free(src);
 			continue;
 		}
 		
-		if (make(r, src, name))
+		if (make(r, src, name, parent))
 			return -1;
 		if (r->cmds)
 			return 0;
 	}
 	
-	if (!access(name, 0))
+	if (exists(name))
 		return 0;
 	
 	if (found)
@@ -395,6 +557,164 @@ int makebyname(const char *name)
 	return -1;
 }
 
+static int outdated(struct job *j)
+{
+#if TIMESPEC
+	struct timespec stv = { 0, 0 };
+#else
+	time_t stv = 0;
+#endif
+	struct stat st;
+	char **input;
+	
+	for (input = j->rule->input; *input; input++)
+#if TIMESPEC
+		if (!cstat(*input, &st) && older(&stv, &st.st_mtim))
+			stv = st.st_mtim;
+#else
+		if (!cstat(*input, &st) && older(stv, st.st_mtime))
+			stv = st.st_mtime;
+#endif
+	
+	if (j->src == NULL)
+		return 1;
+	
+#if TIMESPEC
+	if (!cstat(j->src, &st) && older(&stv, &st.st_mtim))
+		stv = st.st_mtim;
+	if (!cstat(j->target, &st) && !older(&st.st_mtim, &stv))
+		return 0;
+#else
+	if (!cstat(j->src, &st) && older(stv, st.st_mtime))
+		stv = st.st_mtime;
+	if (!cstat(j->target, &st) && !older(st.st_mtime, stv))
+		return 0;
+#endif
+	return 1;
+}
+
+static void failjob(struct job *j)
+{
+	int i;
+	
+	if (j->state == J_FAIL)
+		return;
+	j->state = J_FAIL;
+	
+	for (i = 0; i < j->nwaiters; i++)
+		failjob(j->waiters[i]);
+}
+
+static void finish(struct job *j, int failed)
+{
+	int i;
+	
+	if (j->cmd != NULL)
+		cinval(j->target);
+	
+	if (failed)
+	{
+		fail = 1;
+		failjob(j);
+		return;
+	}
+	
+	j->state = J_DONE;
+	for (i = 0; i < j->nwaiters; i++)
+		j->waiters[i]->pending--;
+}
+
+static void nextcmd(struct job *j)
+{
+	for (; *j->cmd; j->cmd++)
+	{
+		if (docmd(j))
+		{
+			finish(j, 1);
+			return;
+		}
+		if (j->pid)
+		{
+			running++;
+			return;
+		}
+	}
+	finish(j, 0);
+}
+
+static void startjob(struct job *j)
+{
+	j->state = J_RUN;
+	
+	if (j->rule->cmds != NULL && outdated(j))
+	{
+		j->cmd = j->rule->cmds;
+		nextcmd(j);
+		return;
+	}
+	finish(j, 0);
+}
+
+static struct job *nextjob(void)
+{
+	struct job *j;
+	
+	for (j = jobs; j != NULL; j = j->next)
+		if (j->state == J_WAIT && !j->pending)
+			return j;
+	return NULL;
+}
+
+static void reap(void)
+{
+	struct job *j;
+	int status;
+	pid_t pid;
+	
+	pid = waitpid(-1, &status, 0);
+	if (pid < 0)
+	{
+		if (errno == EINTR)
+			return;
+		err(1, "waitpid");
+	}
+	
+	for (j = jobs; j != NULL; j = j->next)
+		if (j->state == J_RUN && j->pid == pid)
+			break;
+	if (j == NULL)
+		return;
+	
+	running--;
+	j->pid = 0;
+	
+	if (status && !j->iexit)
+	{
+		if (WIFEXITED(status))
+			warnx("%s: exit status %i", j->target, WEXITSTATUS(status));
+		else
+			warnx("%s: signal %i", j->target, WTERMSIG(status));
+		finish(j, 1);
+		return;
+	}
+	j->cmd++;
+	nextcmd(j);
+}
+
+static void run(void)
+{
+	struct job *j;
+	
+	for (;;)
+	{
+		while (running < jflag && (j = nextjob()) != NULL)
+			startjob(j);
+		if (!running)
+			break;
+		reap();
+	}
+}
+
 static void linkrule(struct rule *r)
 {
 	const char *output = r->output;
@@ -478,9 +798,14 @@ int main(int argc, char **argv)
 			break;
 		}
 	
-	while (c = getopt(argc, argv, "nrsvd:f:i:I:"), c > 0)
+	while (c = getopt(argc, argv, "nrsvd:f:i:I:j:"), c > 0)
 		switch (c)
 		{
+		case 'j':
+			jflag = atoi(optarg);
+			if (jflag < 1 || jflag > JOBS_MAX)
+				errx(1, "-j: job count must be between 1 and %i", JOBS_MAX);
+			break;
 		case 'i':
 			defpath = optarg;
 			break;
@@ -545,11 +870,12 @@ int main(int argc, char **argv)
 		
 		if (def == NULL)
 			errx(1, "no default target");
-		make(def, NULL, NULL);
+		make(def, NULL, NULL, NULL);
 	}
 	
 	for (i = 0; i < argc; i++)
-		makebyname(argv[i]);
+		makebyname(argv[i], NULL);
 	
+	run();
 	return fail;
 }
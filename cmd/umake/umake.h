@@ -6,7 +6,6 @@ extern struct rule
 {
 	struct rule *next;
 	struct rule *chain;
-	int done;
 	
 	char *output;
 	char **input;
@@ -20,13 +19,15 @@ extern struct var
 	char *val;
 } *vars;
 
+struct job;
+
 extern const char **incpaths;
 extern int incpathcnt;
 extern int vflag;
 
 static struct rule *find_rule(const char *output);
 int load(const char *pathname);
-int make(struct rule *r, const char *src, const char *target);
+int make(struct rule *r, const char *src, const char *target, struct job *parent);
 void setvar(const char *name, const char *value);
 char *substvars(const char *s);
 
@@ -3,7 +3,10 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dev/rd.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <mount.h>
@@ -16,9 +19,6 @@
 #define RD	"rd7"
 #define IMAGE	"/lib/sys/root"
 
-typedef void outfunc(const void *data, size_t sz);
-
-static off_t image_size;
 static int rd_fd;
 
 static void fail(const char *msg)
@@ -31,70 +31,109 @@ static void fail(const char *msg)
 		pause();
 }
 
-static void zread(const char *pathname, outfunc *out)
+static void zread(int fd, void *buf, size_t sz)
+{
+	if (read(fd, buf, sz) != sz)
+		fail("cannot read compressed image");
+}
+
+/*
+ * Hands the compressed image to the ramdisk driver, which keeps it
+ * compressed and inflates chunks as they are read.
+ */
+static int zload(int fd)
 {
-	static char ibuf[32768];
-	static char obuf[32768];
+	struct rd_zimage zi;
+	struct stat st;
+	char *buf;
+	int err;
 	
-	z_stream zs;
-	ssize_t cnt;
-	int fd;
+	if (fstat(fd, &st))
+		return -1;
 	
-	fd = open(pathname, O_RDONLY);
-	if (fd < 0)
-		fail("cannot open compressed image");
+	buf = malloc(st.st_size);
+	if (buf == NULL)
+		return -1;
+	zread(fd, buf, st.st_size);
 	
-	bzero(&zs, sizeof zs);
+	zi.data = buf;
+	zi.size = st.st_size;
+	err = ioctl(rd_fd, RDIOCZIMG, &zi);
+	free(buf);
 	
-	if (inflateInit(&zs))
-		fail("cannot initialize zlib");
+	if (!err && (_boot_flags() & BOOT_VERBOSE))
+		_cprintf("zinit: compressed image: %li bytes\n", (long)st.st_size);
+	return err;
+}
+
+static void load(int fd)
+{
+	struct zimg_chunk *chunks;
+	struct zimg_head head;
+	uint32_t zmax;
+	uint32_t i;
+	uLongf len;
+	size_t sz;
+	blk_t bcnt;
+	char *ibuf;
+	char *obuf;
 	
-	while (cnt = read(fd, ibuf, sizeof ibuf), cnt)
+	zread(fd, &head, sizeof head);
+	if (memcmp(head.magic, ZIMG_MAGIC, sizeof head.magic))
+		fail("bad image magic");
+	if (head.size & 511)
+		fail("image size not multiple of 512");
+	if (!head.chunk_size || head.chunk_count != (head.size + head.chunk_size - 1) / head.chunk_size)
+		fail("bad image chunk table");
+	
+	if (_boot_flags() & BOOT_VERBOSE)
+		_cprintf("zinit: image size: %li bytes, %li chunks\n",
+			(long)head.size, (long)head.chunk_count);
+	
+	bcnt = head.size / 512;
+	if (ioctl(rd_fd, RDIOCNEW, &bcnt))
+		fail("cannot allocate ramdisk memory");
+	
+	chunks = malloc(head.chunk_count * sizeof *chunks);
+	if (chunks == NULL)
+		fail("cannot allocate chunk table");
+	zread(fd, chunks, head.chunk_count * sizeof *chunks);
+	
+	for (zmax = 0, i = 0; i < head.chunk_count; i++)
+		if (zmax < chunks[i].zsize)
+			zmax = chunks[i].zsize;
+	
+	ibuf = malloc(zmax);
+	obuf = malloc(head.chunk_size);
+	if (ibuf == NULL || obuf == NULL)
+		fail("cannot allocate buffers");
+	
+	for (i = 0; i < head.chunk_count; i++)
 	{
-		if (cnt < 0)
-			fail("cannot read compressed image");
+		sz = head.size - i * head.chunk_size;
+		if (sz > head.chunk_size)
+			sz = head.chunk_size;
+		
+		zread(fd, ibuf, chunks[i].zsize);
 		
-		zs.next_in  = (void *)ibuf;
-		zs.avail_in = cnt;
+		len = sz;
+		if (uncompress((void *)obuf, &len, (void *)ibuf, chunks[i].zsize) != Z_OK || len != sz)
+			fail("cannot inflate");
+		if (adler32(adler32(0, NULL, 0), (void *)obuf, sz) != chunks[i].adler)
+			fail("image checksum error");
 		
-		for (;;)
-		{
-			zs.avail_out = sizeof obuf;
-			zs.next_out  = (void *)obuf;
-			
-			switch (inflate(&zs, Z_NO_FLUSH))
-			{
-			case Z_STREAM_END:
-			case Z_OK:
-				break;
-			default:
-				fail("cannot inflate");
-			}
-			
-			if (zs.avail_out < sizeof obuf)
-				out(obuf, sizeof obuf - zs.avail_out);
-			
-			if (!zs.avail_in)
-				break;
-		}
+		if (write(rd_fd, obuf, sz) != sz)
+			fail("cannot write to ramdisk");
 	}
-	close(fd);
-}
-
-static void count(const void *buf, size_t sz)
-{
-	image_size += sz;
-}
-
-static void init(const void *buf, size_t sz)
-{
-	if (write(rd_fd, buf, sz) != sz)
-		fail("cannot write to ramdisk");
+	
+	free(chunks);
+	free(ibuf);
+	free(obuf);
 }
 
 int main(int argc, char **argv)
 {
-	blk_t bcnt;
+	int fd;
 	int i;
 	
 	for (i = 0; i < OPEN_MAX; i++)
@@ -103,23 +142,23 @@ int main(int argc, char **argv)
 	if (_mod_load(RD_DRV, NULL, 0))
 		fail("cannot load " RD_DRV);
 	
-	zread(IMAGE, count);
-	if (_boot_flags() & BOOT_VERBOSE)
-		_cprintf("zinit: image size: %li bytes\n", (long)image_size);
-	
-	if (image_size & 511)
-		fail("image size not multiple of 512");
-	bcnt = image_size / 512;
-	
 	if (_mount(_PATH_M_DEV, "nodev", "dev", 0))
 		fail("cannot mount /dev");
 	
 	rd_fd = open("/dev/rdsk/" RD, O_RDWR);
 	if (rd_fd < 0)
 		fail("cannot open /dev/rdsk/" RD);
-	if (ioctl(rd_fd, RDIOCNEW, &bcnt))
-		fail("cannot allocate ramdisk memory");
-	zread(IMAGE, init);
+	
+	fd = open(IMAGE, O_RDONLY);
+	if (fd < 0)
+		fail("cannot open compressed image");
+	if (zload(fd))
+	{
+		if (lseek(fd, 0, SEEK_SET))
+			fail("cannot seek compressed image");
+		load(fd);
+	}
+	close(fd);
 	close(rd_fd);
 	
 	if (_umount(""))
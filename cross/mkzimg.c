@@ -0,0 +1,113 @@
+/* Copyright (c) 2017, Piotr Durlej
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <zlib.h>
+#include <err.h>
+
+#define ZIMG_MAGIC	"OS386ZI1"
+#define ZIMG_CHUNK	(256 * 1024)
+
+struct zimg_head
+{
+	char	 magic[8];
+	uint32_t size;
+	uint32_t chunk_size;
+	uint32_t chunk_count;
+};
+
+struct zimg_chunk
+{
+	uint32_t zsize;
+	uint32_t adler;
+};
+
+int main(int argc, char **argv)
+{
+	struct zimg_chunk *chunks;
+	struct zimg_head head;
+	unsigned char *zbuf;
+	unsigned char *buf;
+	size_t size, cnt;
+	size_t zoff;
+	size_t len;
+	uLongf zlen;
+	uint32_t i;
+	
+	if (argc != 1)
+	{
+		fputs("mkzimg usage: mkzimg < source > dest\n", stderr);
+		return 1;
+	}
+	
+	buf  = NULL;
+	size = 0;
+	do
+	{
+		buf = realloc(buf, size + ZIMG_CHUNK);
+		if (buf == NULL)
+			err(1, "realloc");
+		cnt   = fread(buf + size, 1, ZIMG_CHUNK, stdin);
+		size += cnt;
+	} while (cnt == ZIMG_CHUNK);
+	if (ferror(stdin))
+		err(1, "stdin");
+	
+	memset(&head, 0, sizeof head);
+	memcpy(head.magic, ZIMG_MAGIC, sizeof head.magic);
+	head.size	 = size;
+	head.chunk_size	 = ZIMG_CHUNK;
+	head.chunk_count = (size + ZIMG_CHUNK - 1) / ZIMG_CHUNK;
+	
+	chunks = calloc(head.chunk_count, sizeof *chunks);
+	zbuf   = malloc(head.chunk_count * compressBound(ZIMG_CHUNK));
+	if ((chunks == NULL || zbuf == NULL) && head.chunk_count)
+		err(1, "malloc");
+	
+	for (zoff = 0, i = 0; i < head.chunk_count; i++)
+	{
+		len = size - (size_t)i * ZIMG_CHUNK;
+		if (len > ZIMG_CHUNK)
+			len = ZIMG_CHUNK;
+		
+		zlen = compressBound(ZIMG_CHUNK);
+		if (compress2(zbuf + zoff, &zlen, buf + (size_t)i * ZIMG_CHUNK, len, Z_BEST_COMPRESSION) != Z_OK)
+			errx(1, "cannot compress chunk %lu", (unsigned long)i);
+		
+		chunks[i].zsize = zlen;
+		chunks[i].adler = adler32(adler32(0, NULL, 0), buf + (size_t)i * ZIMG_CHUNK, len);
+		zoff += zlen;
+	}
+	
+	if (fwrite(&head, sizeof head, 1, stdout) != 1 ||
+	    fwrite(chunks, sizeof *chunks, head.chunk_count, stdout) != head.chunk_count ||
+	    fwrite(zbuf, 1, zoff, stdout) != zoff || fflush(stdout))
+		err(1, "stdout");
+	return 0;
+}
@@ -56,6 +56,8 @@ static void color2rgba_8(void *dd, int *r, int *g, int *b, int *a, win_color c);
 static void invert_8(void *dd, win_color *c);
 
 static void setcte_8(void *dd, win_color c, int r, int g, int b);
+static int  swapctl_8(void *dd, int ena);
+static void swap_8(void *dd);
 
 static void no_op();
 
@@ -116,6 +118,9 @@ static struct win_display disp =
 	.color2rgba	= color2rgba_32,
 	.invert		= invert_32,
 	
+	.bmp_hline	= fb_bmp_hline_32,
+	.span		= fb_span_32,
+	
 	.setcte		= NULL,
 };
 
@@ -206,8 +211,11 @@ static void copybuf_32_line(void *dd, struct win_pixbuf *pb, int dy, int sy, int
 static void copybuf_32(void *dd, struct win_pixbuf *pb, int x, int y)
 {
 	int yy, y0, y1;
+	int hit;
 	
-	fb_hideptr_32(dd);
+	hit = fb_ptr_hit(fb, x, y, pb->width, pb->height);
+	if (hit)
+		fb_hideptr_32(dd);
 	
 	y0 = y;
 	y1 = y + pb->height;
@@ -222,7 +230,9 @@ static void copybuf_32(void *dd, struct win_pixbuf *pb, int x, int y)
 		y0++;
 	}
 	
-	fb_showptr_32(dd);
+	fb_dirty(fb, x, y, pb->width, pb->height);
+	if (hit)
+		fb_showptr_32(dd);
 }
 
 static void combpix_32(win_color *a, uint32_t v)
@@ -277,11 +287,14 @@ static void combbuf_32_line(void *dd, struct win_pixbuf *pb, int dy, int sy, int
 static void combbuf_32(void *dd, struct win_pixbuf *pb, int x, int y)
 {
 	int yy, y0, y1;
+	int hit;
 	
 	if (x > fb->width)
 		return;
 	
-	fb_hideptr_32(dd);
+	hit = fb_ptr_hit(fb, x, y, pb->width, pb->height);
+	if (hit)
+		fb_hideptr_32(dd);
 	
 	y0 = y;
 	y1 = y + pb->height;
@@ -296,16 +309,19 @@ static void combbuf_32(void *dd, struct win_pixbuf *pb, int x, int y)
 		y0++;
 	}
 	
-	fb_showptr_32(dd);
+	fb_dirty(fb, x, y, pb->width, pb->height);
+	if (hit)
+		fb_showptr_32(dd);
 }
 
 static int swapctl_32(void *dd, int ena)
 {
-	return ENOSYS;
+	return fb_swapctl(mfb, 4, ena);
 }
 
 static void swap_32(void *dd)
 {
+	fb_swap(mfb);
 }
 
 static void rgba2color_32(void *dd, int r, int g, int b, int a, win_color *c)
@@ -353,6 +369,16 @@ static void setcte_8(void *dd, win_color c, int r, int g, int b)
 		setdac_8(NULL, 256 + 215 - c, (255 - r) >> 2, (255 - g) >> 2, (255 - b) >> 2);
 }
 
+static int swapctl_8(void *dd, int ena)
+{
+	return fb_swapctl(mfb, 1, ena);
+}
+
+static void swap_8(void *dd)
+{
+	fb_swap(mfb);
+}
+
 static void rgba2color_8(void *dd, int r, int g, int b, int a, win_color *c)
 {
 	*c = (r / 51) + (g / 51) * 6 + (b / 51) * 36;
@@ -403,6 +429,9 @@ static int setup_8(struct kfb *kfb)
 		return err;
 	
 	fb = mfb = fb_creat5(&disp, fbuf, kfb->xres, kfb->yres, kfb->bytes_per_line);
+	if (!mfb)
+		return ENOMEM;
+	mfb->vmem_size = fbuf_size;
 	
 	i = 0;
 	for (b = 0; b < 6; b++)
@@ -437,8 +466,10 @@ static int setup_8(struct kfb *kfb)
 	disp.setbuf	= NULL;
 	disp.copybuf	= NULL;
 	disp.combbuf	= NULL;
-	disp.swapctl	= NULL;
-	disp.swap	= NULL;
+	disp.swapctl	= swapctl_8;
+	disp.swap	= swap_8;
+	disp.bmp_hline	= fb_bmp_hline_8;
+	disp.span	= fb_span_8;
 	return 0;
 }
 
@@ -460,6 +491,9 @@ static int setup_32(struct kfb *kfb)
 		return err;
 	
 	fb = mfb = fb_creat5(&disp, fbuf, kfb->xres, kfb->yres, kfb->bytes_per_line / 4);
+	if (!mfb)
+		return ENOMEM;
+	mfb->vmem_size = fbuf_size;
 	
 	// memset(fbuf, 0, kfb->bytes_per_line * kfb->yres);
 	
@@ -491,6 +525,8 @@ static int setup_32(struct kfb *kfb)
 	disp.combbuf	= combbuf_32;
 	disp.swapctl	= swapctl_32;
 	disp.swap	= swap_32;
+	disp.bmp_hline	= fb_bmp_hline_32;
+	disp.span	= fb_span_32;
 	return 0;
 }
 
@@ -573,6 +609,9 @@ static int bootfb_init(int md)
 	if (err)
 		return err;
 	
+	/* draw to system memory, fall back to video memory if short of it */
+	disp.swapctl(mfb, 1);
+	
 	err = win_display(md, &disp);
 	if (err)
 		return err;
@@ -618,6 +657,8 @@ int mod_onunload(unsigned md)
 {
 	if (disp_installed)
 		win_uninstall_display(desktop, &disp);
+	if (mfb)
+		disp.swapctl(mfb, 0);
 	if (fbuf)
 		phys_unmap(fbuf, fbuf_size);
 	return 0;
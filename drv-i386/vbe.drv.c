@@ -145,6 +145,7 @@ static struct win_display disp =
 	.invert		= invert_32,
 	
 	.bmp_hline	= fb_bmp_hline_32,
+	.span		= fb_span_32,
 	
 	.setcte		= NULL,
 };
@@ -236,8 +237,11 @@ static void copybuf_32_line(void *dd, struct win_pixbuf *pb, int dy, int sy, int
 static void copybuf_32(void *dd, struct win_pixbuf *pb, int x, int y)
 {
 	int yy, y0, y1;
+	int hit;
 	
-	fb_hideptr_32(dd);
+	hit = fb_ptr_hit(fb, x, y, pb->width, pb->height);
+	if (hit)
+		fb_hideptr_32(dd);
 	
 	y0 = y;
 	y1 = y + pb->height;
@@ -252,7 +256,8 @@ static void copybuf_32(void *dd, struct win_pixbuf *pb, int x, int y)
 		y0++;
 	}
 	
-	fb_showptr_32(dd);
+	if (hit)
+		fb_showptr_32(dd);
 }
 
 static void combpix_32(win_color *a, uint32_t v)
@@ -307,11 +312,14 @@ static void combbuf_32_line(void *dd, struct win_pixbuf *pb, int dy, int sy, int
 static void combbuf_32(void *dd, struct win_pixbuf *pb, int x, int y)
 {
 	int yy, y0, y1;
+	int hit;
 	
 	if (x > fb->width)
 		return;
 	
-	fb_hideptr_32(dd);
+	hit = fb_ptr_hit(fb, x, y, pb->width, pb->height);
+	if (hit)
+		fb_hideptr_32(dd);
 	
 	y0 = y;
 	y1 = y + pb->height;
@@ -326,7 +334,8 @@ static void combbuf_32(void *dd, struct win_pixbuf *pb, int x, int y)
 		y0++;
 	}
 	
-	fb_showptr_32(dd);
+	if (hit)
+		fb_showptr_32(dd);
 }
 
 static int swapctl_32(void *dd, int ena)
@@ -595,6 +604,7 @@ static int setmode_8(struct modeinfo *m)
 	disp.swapctl	= NULL;
 	disp.swap	= NULL;
 	disp.bmp_hline	= fb_bmp_hline_8;
+	disp.span	= fb_span_8;
 	return 0;
 }
 
@@ -740,6 +750,7 @@ static int setmode(void *dd, int mode, int refresh)
 	disp.swapctl	= swapctl_32;
 	disp.swap	= swap_32;
 	disp.bmp_hline	= fb_bmp_hline_32;
+	disp.span	= fb_span_32;
 	return 0;
 }
 
@@ -85,6 +85,9 @@ static struct win_display disp =
 	invert:		invert,
 	
 	setcte:		setcte,
+	
+	bmp_hline:	fb_bmp_hline_8,
+	span:		fb_span_8,
 };
 
 static void setdac(int i, int r, int g, int b)
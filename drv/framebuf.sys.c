@@ -25,19 +25,16 @@
  */
 
 #include <kern/wingui.h>
+#include <kern/clock.h>
+#include <kern/intr.h>
 #include <kern/lib.h>
 #include <dev/framebuf.h>
 #include <stdint.h>
+#include <errno.h>
 
 #define min(a, b)	((a) < (b) ? (a) : (b))
 #define max(a, b)	((a) > (b) ? (a) : (b))
 
-static void fb_putpix_p_32(void *dd, int x, int y, win_color c);
-static void fb_getpix_p_32(void *dd, int x, int y, win_color *c);
-
-static void fb_putpix_p_8(void *dd, int x, int y, win_color c);
-static void fb_getpix_p_8(void *dd, int x, int y, win_color *c);
-
 struct framebuf *fb_creat5(struct win_display *disp, void *buf, int w, int h, int vw)
 {
 	struct framebuf *fb;
@@ -69,202 +66,289 @@ void fb_free(struct framebuf *fb)
 	free(fb);
 }
 
-/* ---- 32-bit display support functions ----------------------------------- */
+/* ---- pointer layer ------------------------------------------------------ */
 
-void fb_setptr_32(void *dd, const win_color *shape, const unsigned *mask)
+/*
+ * The pointer shape is kept as a list of opaque spans per row, in display
+ * pixel format. Only the pixels covered by these spans are ever saved from
+ * or restored to the frame buffer, one span at a time.
+ *
+ * Drawing functions do not hide the pointer; they paint the frame buffer
+ * and then restamp the part of the pointer they overlapped, if any.
+ */
+
+typedef void fb_ptr_proc(struct framebuf *fb, int bpp, int x, int y, int len, int i);
+
+static inline uint8_t *fb_addr(struct framebuf *fb, int bpp, int x, int y)
 {
-	struct framebuf *fb = dd;
+	return (uint8_t *)fb->fbuf + (x + y * fb->vwidth) * bpp;
+}
+
+static inline void fb_cpypix(uint8_t *dst, const uint8_t *src, int bpp)
+{
+	if (bpp == 4)
+		*(uint32_t *)dst = *(const uint32_t *)src;
+	else
+		*dst = *src;
+}
+
+static int fb_ptr_masked(struct framebuf *fb, int px, int py, int x, int y)
+{
+	x -= px;
+	y -= py;
 	
-	fb_hideptr_32(dd);
-	memcpy(fb->ptr_shape, shape, sizeof fb->ptr_shape);
-	memcpy(fb->ptr_mask,  mask,  sizeof fb->ptr_mask);
-	fb_showptr_32(dd);
+	if (x < 0 || x >= PTR_WIDTH)
+		return 0;
+	if (y < 0 || y >= PTR_HEIGHT)
+		return 0;
+	
+	return fb->ptr_mask[x + y * PTR_WIDTH];
 }
 
-void fb_moveptr_32(void *dd, int x, int y)
+static void fb_ptr_scan(struct framebuf *fb)
 {
-	win_color oback[PTR_WIDTH * PTR_HEIGHT];
-	struct framebuf *fb = dd;
-	int x0, y0, x1, y1, x2, y2;
-	int px, py;
-	int i;
+	struct win_span *sp = fb->ptr_span;
+	const unsigned *mp = fb->ptr_mask;
+	int x, y;
 	
-	if (fb->ptr_hide_count)
+	for (y = 0; y < PTR_HEIGHT; y++, mp += PTR_WIDTH)
 	{
-		fb->ptr_x = x;
-		fb->ptr_y = y;
-		return;
+		fb->ptr_span_index[y] = sp - fb->ptr_span;
+		
+		for (x = 0; x < PTR_WIDTH; x++)
+		{
+			if (!mp[x])
+				continue;
+			
+			sp->x = x;
+			while (x < PTR_WIDTH && mp[x])
+				x++;
+			sp->len = x - sp->x;
+			sp++;
+		}
 	}
+	fb->ptr_span_index[y] = sp - fb->ptr_span;
+}
+
+/*
+ * Call proc for every span of the pointer at px, py that falls within
+ * the rectangle x0, y0, x1, y1 and within the screen.
+ */
+static void fb_ptr_spans(struct framebuf *fb, int bpp, int px, int py,
+			 int x0, int y0, int x1, int y1, fb_ptr_proc *proc)
+{
+	struct win_span *sp, *se;
+	int row;
+	int s, e;
+	int y;
 	
-	memcpy(oback, fb->ptr_back, sizeof oback);
-	x0 = fb->ptr_x;
-	y0 = fb->ptr_y;
-	
-	fb->ptr_hide_count = 1;
-	fb->ptr_x = x;
-	fb->ptr_y = y;
-	fb_showptr_32(dd);
-	
-	x1 = x0;
-	y1 = y0;
-	
-	x2 = x0 + PTR_WIDTH;
-	y2 = y0 + PTR_WIDTH;
-	
-	if (x1 < 0)		x1 = 0;
-	if (y1 < 0)		y1 = 0;
+	x0 = max(x0, max(px, 0));
+	y0 = max(y0, max(py, 0));
+	x1 = min(x1, min(px + PTR_WIDTH,  fb->width));
+	y1 = min(y1, min(py + PTR_HEIGHT, fb->height));
 	
-	if (x2 > fb->width)	x2 = fb->width;
-	if (y2 > fb->height)	y2 = fb->height;
+	if (x1 <= x0)
+		return;
 	
-	for (y = y1; y < y2; y++)
-		for (x = x1; x < x2; x++)
+	for (y = y0; y < y1; y++)
+	{
+		row = y - py;
+		sp  = fb->ptr_span + fb->ptr_span_index[row];
+		se  = fb->ptr_span + fb->ptr_span_index[row + 1];
+		
+		for (; sp < se; sp++)
 		{
-			i = (x - x0) + (y - y0) * PTR_WIDTH;
+			s = max(x0, px + sp->x);
+			e = min(x1, px + sp->x + sp->len);
 			
-			if (fb->ptr_mask[i])
-				fb_putpix_32(dd, x, y, oback[i]);
+			if (s < e)
+				proc(fb, bpp, s, y, e - s, s - px + row * PTR_WIDTH);
 		}
+	}
 }
 
-void fb_showptr_32(void *dd)
+static void fb_ptr_stamp(struct framebuf *fb, int bpp, int x, int y, int len, int i)
 {
-	struct framebuf *fb = dd;
-	int x0, x1, y0, y1;
-	int xs, ys;
-	int x, y;
-	int i;
+	uint8_t *save = (uint8_t *)fb->ptr_save[fb->ptr_page];
+	uint8_t *dp = fb_addr(fb, bpp, x, y);
 	
-	if (!fb->ptr_hide_count)
-		panic("fb_showptr_32: !fb->ptr_hide_count");
-	
-	fb->ptr_hide_count--;
-	if (fb->ptr_hide_count)
-		return;
+	memcpy(save + i * bpp, dp, len * bpp);
+	memcpy(dp, (uint8_t *)fb->ptr_pix + i * bpp, len * bpp);
+}
+
+static void fb_ptr_restore(struct framebuf *fb, int bpp, int x, int y, int len, int i)
+{
+	uint8_t *save = (uint8_t *)fb->ptr_save[fb->ptr_page];
 	
-	x0 = fb->ptr_x;
-	x1 = fb->ptr_x + PTR_WIDTH;
-	y0 = fb->ptr_y;
-	y1 = fb->ptr_y + PTR_HEIGHT;
+	memcpy(fb_addr(fb, bpp, x, y), save + i * bpp, len * bpp);
+}
+
+/*
+ * Stamp the pointer at its new position. Where the old pointer still
+ * covers the frame buffer, the background comes from the old save-under.
+ */
+static void fb_ptr_move_new(struct framebuf *fb, int bpp, int x, int y, int len, int i)
+{
+	uint8_t *osave = (uint8_t *)fb->ptr_save[fb->ptr_page];
+	uint8_t *nsave = (uint8_t *)fb->ptr_save[!fb->ptr_page];
+	uint8_t *dp = fb_addr(fb, bpp, x, y);
+	int ox = fb->ptr_ox;
+	int oy = fb->ptr_oy;
+	int n;
+	
+	if (y < oy || y >= oy + PTR_HEIGHT || x + len <= ox || x >= ox + PTR_WIDTH)
+		memcpy(nsave + i * bpp, dp, len * bpp);
+	else
+		for (n = 0; n < len; n++)
+		{
+			if (fb_ptr_masked(fb, ox, oy, x + n, y))
+				fb_cpypix(nsave + (i + n) * bpp,
+					  osave + (x + n - ox + (y - oy) * PTR_WIDTH) * bpp, bpp);
+			else
+				fb_cpypix(nsave + (i + n) * bpp, dp + n * bpp, bpp);
+		}
 	
-	if (x0 > fb->width)
-		x0 = fb->width;
-	if (x0 < 0)
-		x0 = 0;
+	memcpy(dp, (uint8_t *)fb->ptr_pix + i * bpp, len * bpp);
+}
+
+/*
+ * Restore the background under the old pointer, except where the pointer
+ * at its new position covers it.
+ */
+static void fb_ptr_move_old(struct framebuf *fb, int bpp, int x, int y, int len, int i)
+{
+	uint8_t *osave = (uint8_t *)fb->ptr_save[fb->ptr_page];
+	uint8_t *dp = fb_addr(fb, bpp, x, y);
+	int nx = fb->ptr_x;
+	int ny = fb->ptr_y;
+	int n;
 	
-	if (x1 > fb->width)
-		x1 = fb->width;
-	if (x1 < 0)
-		x1 = 0;
+	if (y < ny || y >= ny + PTR_HEIGHT || x + len <= nx || x >= nx + PTR_WIDTH)
+	{
+		memcpy(dp, osave + i * bpp, len * bpp);
+		return;
+	}
 	
-	if (y0 > fb->height)
-		y0 = fb->height;
-	if (y0 < 0)
-		y0 = 0;
+	for (n = 0; n < len; n++)
+		if (!fb_ptr_masked(fb, nx, ny, x + n, y))
+			fb_cpypix(dp + n * bpp, osave + (i + n) * bpp, bpp);
+}
+
+static void fb_ptr_move(struct framebuf *fb, int bpp, int x, int y)
+{
+	fb->ptr_ox = fb->ptr_x;
+	fb->ptr_oy = fb->ptr_y;
+	fb->ptr_x  = x;
+	fb->ptr_y  = y;
 	
-	if (y1 > fb->height)
-		y1 = fb->height;
-	if (y1 < 0)
-		y1 = 0;
+	fb_ptr_spans(fb, bpp, x, y, x, y, x + PTR_WIDTH, y + PTR_HEIGHT, fb_ptr_move_new);
+	fb_ptr_spans(fb, bpp, fb->ptr_ox, fb->ptr_oy,
+		     fb->ptr_ox, fb->ptr_oy, fb->ptr_ox + PTR_WIDTH, fb->ptr_oy + PTR_HEIGHT,
+		     fb_ptr_move_old);
 	
-	xs = fb->ptr_x;
-	ys = fb->ptr_y;
+	fb->ptr_page = !fb->ptr_page;
 	
-	for (y = y0; y < y1; y++)
-		for (x = x0; x < x1; x++)
-		{
-			i = x - xs + (y - ys) * PTR_WIDTH;
-			
-			fb_getpix_p_32(dd, x, y, &fb->ptr_back[i]);
-			if (fb->ptr_mask[i])
-				fb_putpix_p_32(dd, x, y, fb->ptr_shape[i]);
-		}
+	fb_dirty(fb, fb->ptr_ox, fb->ptr_oy, PTR_WIDTH, PTR_HEIGHT);
+	fb_dirty(fb, x, y, PTR_WIDTH, PTR_HEIGHT);
 }
 
-void fb_hideptr_32(void *dd)
+static void fb_ptr_show(struct framebuf *fb, int bpp)
 {
-	struct framebuf *fb = dd;
-	int x0, x1, y0, y1;
-	int xs, ys;
-	int x, y;
-	int i;
+	fb_ptr_spans(fb, bpp, fb->ptr_x, fb->ptr_y,
+		     fb->ptr_x, fb->ptr_y, fb->ptr_x + PTR_WIDTH, fb->ptr_y + PTR_HEIGHT,
+		     fb_ptr_stamp);
+	fb_dirty(fb, fb->ptr_x, fb->ptr_y, PTR_WIDTH, PTR_HEIGHT);
+}
+
+static void fb_ptr_hide(struct framebuf *fb, int bpp)
+{
+	fb_ptr_spans(fb, bpp, fb->ptr_x, fb->ptr_y,
+		     fb->ptr_x, fb->ptr_y, fb->ptr_x + PTR_WIDTH, fb->ptr_y + PTR_HEIGHT,
+		     fb_ptr_restore);
+	fb_dirty(fb, fb->ptr_x, fb->ptr_y, PTR_WIDTH, PTR_HEIGHT);
+}
+
+/*
+ * Called after an area has been painted: queue it for flushing and
+ * restamp the pointer over it, saving the new background first.
+ */
+static void fb_painted(struct framebuf *fb, int bpp, int x, int y, int w, int h)
+{
+	fb_dirty(fb, x, y, w, h);
 	
-	fb->ptr_hide_count++;
-	if (fb->ptr_hide_count > 1)
+	if (fb->ptr_hide_count)
 		return;
 	
-	x0 = fb->ptr_x;
-	x1 = fb->ptr_x + PTR_WIDTH;
-	y0 = fb->ptr_y;
-	y1 = fb->ptr_y + PTR_HEIGHT;
-	
-	if (x0 > fb->width)
-		x0 = fb->width;
-	if (x0 < 0)
-		x0 = 0;
-	
-	if (x1 > fb->width)
-		x1 = fb->width;
-	if (x1 < 0)
-		x1 = 0;
+	fb_ptr_spans(fb, bpp, fb->ptr_x, fb->ptr_y, x, y, x + w, y + h, fb_ptr_stamp);
+}
+
+int fb_ptr_hit(struct framebuf *fb, int x, int y, int w, int h)
+{
+	if (fb->ptr_hide_count)
+		return 0;
 	
-	if (y0 > fb->height)
-		y0 = fb->height;
-	if (y0 < 0)
-		y0 = 0;
+	if (x >= fb->ptr_x + PTR_WIDTH || x + w <= fb->ptr_x)
+		return 0;
+	if (y >= fb->ptr_y + PTR_HEIGHT || y + h <= fb->ptr_y)
+		return 0;
+	return 1;
+}
+
+/* ---- 32-bit display support functions ----------------------------------- */
+
+void fb_setptr_32(void *dd, const win_color *shape, const unsigned *mask)
+{
+	struct framebuf *fb = dd;
 	
-	if (y1 > fb->height)
-		y1 = fb->height;
-	if (y1 < 0)
-		y1 = 0;
+	fb_hideptr_32(dd);
+	memcpy(fb->ptr_pix,  shape, sizeof fb->ptr_pix);
+	memcpy(fb->ptr_mask, mask,  sizeof fb->ptr_mask);
+	fb_ptr_scan(fb);
+	fb_showptr_32(dd);
+}
+
+void fb_moveptr_32(void *dd, int x, int y)
+{
+	struct framebuf *fb = dd;
 	
-	xs = fb->ptr_x;
-	ys = fb->ptr_y;
+	if (fb->ptr_hide_count)
+	{
+		fb->ptr_x = x;
+		fb->ptr_y = y;
+		return;
+	}
 	
-	for (y = y0; y < y1; y++)
-		for (x = x0; x < x1; x++)
-		{
-			i = x - xs + (y - ys) * PTR_WIDTH;
-			
-			if (fb->ptr_mask[i])
-				fb_putpix_p_32(dd, x, y, fb->ptr_back[i]);
-			i++;
-		}
+	fb_ptr_move(fb, 4, x, y);
 }
 
-static void fb_rptr_32(void *dd, int x, int y, int w, int h)
+void fb_showptr_32(void *dd)
 {
 	struct framebuf *fb = dd;
-	uint32_t *fbuf = fb->fbuf;
-	uint32_t *p;
-	int x0, x1, y0, y1;
-	int xs, ys;
-	int cx, cy;
-	int i;
 	
+	if (!fb->ptr_hide_count)
+		panic("fb_showptr_32: !fb->ptr_hide_count");
+	
+	fb->ptr_hide_count--;
 	if (fb->ptr_hide_count)
 		return;
 	
-	x0 = max(x,	fb->ptr_x);
-	x1 = min(x + w, fb->ptr_x + PTR_WIDTH);
-	y0 = max(y,	fb->ptr_y);
-	y1 = min(y + h, fb->ptr_y + PTR_HEIGHT);
+	fb_ptr_show(fb, 4);
+}
+
+void fb_hideptr_32(void *dd)
+{
+	struct framebuf *fb = dd;
 	
-	if (x1 <= x0)
+	fb->ptr_hide_count++;
+	if (fb->ptr_hide_count > 1)
 		return;
 	
-	for (cy = y0; cy < y1; cy++)
-	{
-		i = (x0 - fb->ptr_x) + (cy - fb->ptr_y) * PTR_WIDTH;
-		p = fbuf + x0 + cy * fb->vwidth;
-		
-		for (cx = x0; cx < x1; cx++, i++, p++)
-			if (fb->ptr_mask[i])
-			{
-				fb->ptr_back[i] = *p;
-				*p = fb->ptr_shape[i];
-			}
-	}
+	fb_ptr_hide(fb, 4);
+}
+
+static void fb_painted_32(void *dd, int x, int y, int w, int h)
+{
+	fb_painted(dd, 4, x, y, w, h);
 }
 
 #ifdef __ARCH_I386__
@@ -336,7 +420,7 @@ asm(
 "	ret;			"
 );
 #else
-static void cpy32fw(volatile uint32_t *dst, volatile uint32_t *src, unsigned len)
+static void cpy32fw_c(volatile uint32_t *dst, volatile uint32_t *src, unsigned len)
 {
 	unsigned i;
 	
@@ -344,7 +428,7 @@ static void cpy32fw(volatile uint32_t *dst, volatile uint32_t *src, unsigned len
 		dst[i] = src[i];
 }
 
-static void cpy32bk(volatile uint32_t *dst, volatile uint32_t *src, unsigned len)
+static void cpy32bk_c(volatile uint32_t *dst, volatile uint32_t *src, unsigned len)
 {
 	int i;
 	
@@ -352,83 +436,402 @@ static void cpy32bk(volatile uint32_t *dst, volatile uint32_t *src, unsigned len
 		dst[i] = src[i];
 }
 
-static void fill32(volatile uint32_t *p, unsigned c, unsigned len)
+static void fill32_c(volatile uint32_t *p, unsigned c, unsigned len)
 {
 	unsigned i;
 	
 	for (i = 0; i < len; i++)
 		p[i] = c;
 }
+
+static void cpy32fw_rep(volatile uint32_t *dst, volatile uint32_t *src, unsigned len);
+asm(
+".text;				"
+"cpy32fw_rep:			"
+"	cld;			"
+"	movl	%edx, %ecx;	"
+"	rep;			"
+"	movsl;			"
+"	ret;			"
+);
+
+static void fill32_rep(volatile uint32_t *p, unsigned c, unsigned len);
+asm(
+".text;				"
+"fill32_rep:			"
+"	cld;			"
+"	movl	%esi, %eax;	"
+"	movl	%edx, %ecx;	"
+"	rep;			"
+"	stosl;			"
+"	ret;			"
+);
+
+/*
+ * The SSE2 routines run in the context of the current task, so the XMM
+ * registers they use are saved on the stack and restored before return.
+ * The destination is aligned to 16 bytes with single dword moves, then
+ * the bulk is moved 64 bytes at a time.
+ */
+
+static void fill32_sse2(volatile uint32_t *p, unsigned c, unsigned len);
+asm(
+".text;					"
+"fill32_sse2:				"
+"	movl	%edx, %ecx;		"
+"	movl	%esi, %eax;		"
+"1:	testq	$15, %rdi;		"
+"	jz	2f;			"
+"	testl	%ecx, %ecx;		"
+"	jz	5f;			"
+"	movl	%eax, (%rdi);		"
+"	addq	$4, %rdi;		"
+"	decl	%ecx;			"
+"	jmp	1b;			"
+"2:	cmpl	$16, %ecx;		"
+"	jb	4f;			"
+"	subq	$16, %rsp;		"
+"	movdqu	%xmm0, (%rsp);		"
+"	movd	%eax, %xmm0;		"
+"	pshufd	$0, %xmm0, %xmm0;	"
+"3:	movdqa	%xmm0,   (%rdi);	"
+"	movdqa	%xmm0, 16(%rdi);	"
+"	movdqa	%xmm0, 32(%rdi);	"
+"	movdqa	%xmm0, 48(%rdi);	"
+"	addq	$64, %rdi;		"
+"	subl	$16, %ecx;		"
+"	cmpl	$16, %ecx;		"
+"	jae	3b;			"
+"	movdqu	(%rsp), %xmm0;		"
+"	addq	$16, %rsp;		"
+"4:	testl	%ecx, %ecx;		"
+"	jz	5f;			"
+"	movl	%eax, (%rdi);		"
+"	addq	$4, %rdi;		"
+"	decl	%ecx;			"
+"	jmp	4b;			"
+"5:	ret;				"
+);
+
+static void cpy32fw_sse2(volatile uint32_t *dst, volatile uint32_t *src, unsigned len);
+asm(
+".text;					"
+"cpy32fw_sse2:				"
+"	movl	%edx, %ecx;		"
+"1:	testq	$15, %rdi;		"
+"	jz	2f;			"
+"	testl	%ecx, %ecx;		"
+"	jz	5f;			"
+"	movl	(%rsi), %eax;		"
+"	movl	%eax, (%rdi);		"
+"	addq	$4, %rsi;		"
+"	addq	$4, %rdi;		"
+"	decl	%ecx;			"
+"	jmp	1b;			"
+"2:	cmpl	$16, %ecx;		"
+"	jb	4f;			"
+"	subq	$64, %rsp;		"
+"	movdqu	%xmm0,   (%rsp);	"
+"	movdqu	%xmm1, 16(%rsp);	"
+"	movdqu	%xmm2, 32(%rsp);	"
+"	movdqu	%xmm3, 48(%rsp);	"
+"3:	movdqu	  (%rsi), %xmm0;	"
+"	movdqu	16(%rsi), %xmm1;	"
+"	movdqu	32(%rsi), %xmm2;	"
+"	movdqu	48(%rsi), %xmm3;	"
+"	movdqa	%xmm0,   (%rdi);	"
+"	movdqa	%xmm1, 16(%rdi);	"
+"	movdqa	%xmm2, 32(%rdi);	"
+"	movdqa	%xmm3, 48(%rdi);	"
+"	addq	$64, %rsi;		"
+"	addq	$64, %rdi;		"
+"	subl	$16, %ecx;		"
+"	cmpl	$16, %ecx;		"
+"	jae	3b;			"
+"	movdqu	  (%rsp), %xmm0;	"
+"	movdqu	16(%rsp), %xmm1;	"
+"	movdqu	32(%rsp), %xmm2;	"
+"	movdqu	48(%rsp), %xmm3;	"
+"	addq	$64, %rsp;		"
+"4:	testl	%ecx, %ecx;		"
+"	jz	5f;			"
+"	movl	(%rsi), %eax;		"
+"	movl	%eax, (%rdi);		"
+"	addq	$4, %rsi;		"
+"	addq	$4, %rdi;		"
+"	decl	%ecx;			"
+"	jmp	4b;			"
+"5:	ret;				"
+);
+
+static void cpy32bk_sse2(volatile uint32_t *dst, volatile uint32_t *src, unsigned len);
+asm(
+".text;					"
+"cpy32bk_sse2:				"
+"	movl	%edx, %ecx;		"
+"	leaq	(%rdi,%rcx,4), %rdi;	"
+"	leaq	(%rsi,%rcx,4), %rsi;	"
+"1:	testq	$15, %rdi;		"
+"	jz	2f;			"
+"	testl	%ecx, %ecx;		"
+"	jz	5f;			"
+"	subq	$4, %rsi;		"
+"	subq	$4, %rdi;		"
+"	movl	(%rsi), %eax;		"
+"	movl	%eax, (%rdi);		"
+"	decl	%ecx;			"
+"	jmp	1b;			"
+"2:	cmpl	$16, %ecx;		"
+"	jb	4f;			"
+"	subq	$64, %rsp;		"
+"	movdqu	%xmm0,   (%rsp);	"
+"	movdqu	%xmm1, 16(%rsp);	"
+"	movdqu	%xmm2, 32(%rsp);	"
+"	movdqu	%xmm3, 48(%rsp);	"
+"3:	subq	$64, %rsi;		"
+"	subq	$64, %rdi;		"
+"	movdqu	48(%rsi), %xmm3;	"
+"	movdqu	32(%rsi), %xmm2;	"
+"	movdqu	16(%rsi), %xmm1;	"
+"	movdqu	  (%rsi), %xmm0;	"
+"	movdqa	%xmm3, 48(%rdi);	"
+"	movdqa	%xmm2, 32(%rdi);	"
+"	movdqa	%xmm1, 16(%rdi);	"
+"	movdqa	%xmm0,   (%rdi);	"
+"	subl	$16, %ecx;		"
+"	cmpl	$16, %ecx;		"
+"	jae	3b;			"
+"	movdqu	  (%rsp), %xmm0;	"
+"	movdqu	16(%rsp), %xmm1;	"
+"	movdqu	32(%rsp), %xmm2;	"
+"	movdqu	48(%rsp), %xmm3;	"
+"	addq	$64, %rsp;		"
+"4:	testl	%ecx, %ecx;		"
+"	jz	5f;			"
+"	subq	$4, %rsi;		"
+"	subq	$4, %rdi;		"
+"	movl	(%rsi), %eax;		"
+"	movl	%eax, (%rdi);		"
+"	decl	%ecx;			"
+"	jmp	4b;			"
+"5:	ret;				"
+);
+
+static void expand32_sse2(uint32_t *dp, const uint8_t *p, unsigned n, uint32_t bg, uint32_t xr, uint32_t (*tab)[4]);
+asm(
+".text;					"
+"expand32_sse2:				"
+"	testl	%edx, %edx;		"
+"	jz	2f;			"
+"	subq	$48, %rsp;		"
+"	movdqu	%xmm0,   (%rsp);	"
+"	movdqu	%xmm1, 16(%rsp);	"
+"	movdqu	%xmm2, 32(%rsp);	"
+"	movd	%ecx, %xmm0;		"
+"	pshufd	$0, %xmm0, %xmm0;	"
+"	movd	%r8d, %xmm1;		"
+"	pshufd	$0, %xmm1, %xmm1;	"
+"1:	movzbl	(%rsi), %eax;		"
+"	movl	%eax, %r10d;		"
+"	andl	$15, %eax;		"
+"	shll	$4, %eax;		"
+"	movdqu	(%r9,%rax), %xmm2;	"
+"	pand	%xmm1, %xmm2;		"
+"	pxor	%xmm0, %xmm2;		"
+"	movdqu	%xmm2, (%rdi);		"
+"	shrl	$4, %r10d;		"
+"	shll	$4, %r10d;		"
+"	movdqu	(%r9,%r10), %xmm2;	"
+"	pand	%xmm1, %xmm2;		"
+"	pxor	%xmm0, %xmm2;		"
+"	movdqu	%xmm2, 16(%rdi);	"
+"	incq	%rsi;			"
+"	addq	$32, %rdi;		"
+"	decl	%edx;			"
+"	jnz	1b;			"
+"	movdqu	  (%rsp), %xmm0;	"
+"	movdqu	16(%rsp), %xmm1;	"
+"	movdqu	32(%rsp), %xmm2;	"
+"	addq	$48, %rsp;		"
+"2:	ret;				"
+);
+
+static void cpuid(unsigned leaf, unsigned *r)
+{
+	asm volatile("cpuid" : "=a" (r[0]), "=b" (r[1]), "=c" (r[2]), "=d" (r[3]) : "a" (leaf), "c" (0));
+}
+
+static void (*cpy32fw)(volatile uint32_t *dst, volatile uint32_t *src, unsigned len) = cpy32fw_c;
+static void (*cpy32bk)(volatile uint32_t *dst, volatile uint32_t *src, unsigned len) = cpy32bk_c;
+static void (*fill32)(volatile uint32_t *p, unsigned c, unsigned len) = fill32_c;
 #endif
 
-static void fb_putpix_p_32(void *dd, int x, int y, win_color c)
+static uint32_t bmp_mask[16][4];
+
+static void expand32_c(uint32_t *dp, const uint8_t *p, unsigned n, uint32_t bg, uint32_t xr, uint32_t (*tab)[4])
 {
-	struct framebuf *fb = dd;
-	uint32_t *fbuf_32 = fb->fbuf;
+	const uint32_t *m;
 	
-	if (x < 0 || x >= fb->width)
-		return;
-	if (y < 0 || y >= fb->height)
+	while (n--)
+	{
+		m = tab[*p & 15];
+		dp[0] = bg ^ (xr & m[0]);
+		dp[1] = bg ^ (xr & m[1]);
+		dp[2] = bg ^ (xr & m[2]);
+		dp[3] = bg ^ (xr & m[3]);
+		
+		m = tab[*p++ >> 4];
+		dp[4] = bg ^ (xr & m[0]);
+		dp[5] = bg ^ (xr & m[1]);
+		dp[6] = bg ^ (xr & m[2]);
+		dp[7] = bg ^ (xr & m[3]);
+		dp += 8;
+	}
+}
+
+static void (*expand32)(uint32_t *dp, const uint8_t *p, unsigned n, uint32_t bg, uint32_t xr, uint32_t (*tab)[4]) = expand32_c;
+
+static void fb_cpu_init(void)
+{
+	int i, n;
+#ifdef __ARCH_AMD64__
+	unsigned r[4];
+	int ermsb = 0;
+	
+	cpuid(0, r);
+	if (r[0] >= 7)
+	{
+		cpuid(7, r);
+		ermsb = (r[1] >> 9) & 1;
+	}
+	
+	cpuid(1, r);
+	if (r[3] & (1 << 26))
+	{
+		cpy32fw	 = cpy32fw_sse2;
+		cpy32bk	 = cpy32bk_sse2;
+		fill32	 = fill32_sse2;
+		expand32 = expand32_sse2;
+	}
+	
+	if (ermsb)
+	{
+		cpy32fw	= cpy32fw_rep;
+		fill32	= fill32_rep;
+	}
+#endif
+	
+	for (i = 0; i < 16; i++)
+		for (n = 0; n < 4; n++)
+			bmp_mask[i][n] = (i & (1 << n)) ? 0xffffffff : 0;
+}
+
+static void fill8(volatile uint8_t *p, unsigned c, unsigned len)
+{
+	c &= 255;
+	
+	while (len && ((uintptr_t)p & 3))
+	{
+		*p++ = c;
+		len--;
+	}
+	
+	if (len >= 4)
+	{
+		fill32((volatile uint32_t *)p, c * 0x01010101, len / 4);
+		p   += len & ~3;
+		len &= 3;
+	}
+	
+	while (len--)
+		*p++ = c;
+}
+
+static void cpy8fw(volatile uint8_t *dst, volatile uint8_t *src, unsigned len)
+{
+	if (((uintptr_t)dst ^ (uintptr_t)src) & 3)
+	{
+		while (len--)
+			*dst++ = *src++;
 		return;
+	}
 	
-	fbuf_32[x + y * fb->vwidth] = c;
+	while (len && ((uintptr_t)dst & 3))
+	{
+		*dst++ = *src++;
+		len--;
+	}
+	
+	if (len >= 4)
+	{
+		cpy32fw((volatile uint32_t *)dst, (volatile uint32_t *)src, len / 4);
+		dst += len & ~3;
+		src += len & ~3;
+		len &= 3;
+	}
+	
+	while (len--)
+		*dst++ = *src++;
 }
 
-static void fb_getpix_p_32(void *dd, int x, int y, win_color *c)
+static void cpy8bk(volatile uint8_t *dst, volatile uint8_t *src, unsigned len)
 {
-	struct framebuf *fb = dd;
-	uint32_t *fbuf_32 = fb->fbuf;
+	dst += len;
+	src += len;
+	
+	if (((uintptr_t)dst ^ (uintptr_t)src) & 3)
+	{
+		while (len--)
+			*--dst = *--src;
+		return;
+	}
+	
+	while (len && ((uintptr_t)dst & 3))
+	{
+		*--dst = *--src;
+		len--;
+	}
 	
-	if (x < 0 || x >= fb->width)
-		goto badpos;
-	if (y < 0 || y >= fb->height)
-		goto badpos;
+	if (len >= 4)
+	{
+		dst -= len & ~3;
+		src -= len & ~3;
+		cpy32bk((volatile uint32_t *)dst, (volatile uint32_t *)src, len / 4);
+		len &= 3;
+	}
 	
-	*c = fbuf_32[x + y * fb->vwidth];
-	return;
-badpos:
-	*c = 0;
+	while (len--)
+		*--dst = *--src;
 }
 
 void fb_putpix_32(void *dd, int x, int y, win_color c)
 {
 	struct framebuf *fb = dd;
 	uint32_t *fbuf_32 = fb->fbuf;
-	int i;
+	uint32_t *save;
 	
-	if (!fb->ptr_hide_count &&
-	    x >= fb->ptr_x && x < fb->ptr_x + PTR_WIDTH &&
-	    y >= fb->ptr_y && y < fb->ptr_y + PTR_WIDTH)
+	if (!fb->ptr_hide_count && fb_ptr_masked(fb, fb->ptr_x, fb->ptr_y, x, y))
 	{
-		i = (x - fb->ptr_x) + (y - fb->ptr_y) * PTR_WIDTH;
-		
-		if (fb->ptr_mask[i])
-		{
-			fb->ptr_back[i] = c;
-			return;
-		}
+		save = fb->ptr_save[fb->ptr_page];
+		save[(x - fb->ptr_x) + (y - fb->ptr_y) * PTR_WIDTH] = c;
+		return;
 	}
 	
 	fbuf_32[x + y * fb->vwidth] = c;
+	fb_dirty(fb, x, y, 1, 1);
 }
 
 void fb_getpix_32(void *dd, int x, int y, win_color *c)
 {
 	struct framebuf *fb = dd;
 	uint32_t *fbuf_32 = fb->fbuf;
-	static int i;
+	uint32_t *save;
 	
-	if (!fb->ptr_hide_count &&
-	    x >= fb->ptr_x && x < fb->ptr_x + PTR_WIDTH &&
-	    y >= fb->ptr_y && y < fb->ptr_y + PTR_WIDTH)
+	if (!fb->ptr_hide_count && fb_ptr_masked(fb, fb->ptr_x, fb->ptr_y, x, y))
 	{
-		i = (x - fb->ptr_x) + (y - fb->ptr_y) * PTR_WIDTH;
-		
-		if (fb->ptr_mask[i])
-		{
-			*c = fb->ptr_back[i];
-			return;
-		}
+		save = fb->ptr_save[fb->ptr_page];
+		*c = save[(x - fb->ptr_x) + (y - fb->ptr_y) * PTR_WIDTH];
+		return;
 	}
 	
 	*c = fbuf_32[x + y * fb->vwidth];
@@ -438,33 +841,34 @@ void fb_hline_32(void *dd, int x, int y, int len, win_color c)
 {
 	struct framebuf *fb = dd;
 	uint32_t *fbuf_32 = fb->fbuf;
-	static int i;
 	
-	if (y >= fb->ptr_y && y < fb->ptr_y + PTR_HEIGHT)
-		for (i = x; i < x + len; i++)
-			fb_putpix_32(dd, i, y, c);
-	else
-		fill32(&fbuf_32[x + y * fb->vwidth], c, len);
+	fill32(&fbuf_32[x + y * fb->vwidth], c, len);
+	fb_painted_32(dd, x, y, len, 1);
 }
 
 void fb_vline_32(void *dd, int x, int y, int len, win_color c)
 {
 	struct framebuf *fb = dd;
-	static int i;
+	uint32_t *p = fb->fbuf;
+	int i;
 	
-	for (i = y; i < y + len; i++)
-		fb_putpix_32(dd, x, i, c);
+	p += x + y * fb->vwidth;
+	for (i = 0; i < len; i++, p += fb->vwidth)
+		*p = c;
+	fb_painted_32(dd, x, y, 1, len);
 }
 
 void fb_rect_32(void *dd, int x0, int y0, int w, int h, win_color c)
 {
 	struct framebuf *fb = dd;
+	uint32_t *fbuf_32 = fb->fbuf;
 	static int y1;
 	static int y;
 	
 	y1 = y0 + h;
 	for (y = y0; y < y1; y++)
-		fb_hline_32(dd, x0, y, w, c);
+		fill32(&fbuf_32[x0 + y * fb->vwidth], c, w);
+	fb_painted_32(dd, x0, y0, w, h);
 }
 
 static void fb_copy_rev_32(void *dd, int x0, int y0, int x1, int y1, int w, int h)
@@ -484,8 +888,11 @@ void fb_copy_32(void *dd, int x0, int y0, int x1, int y1, int w, int h)
 	struct framebuf *fb = dd;
 	uint32_t *fbuf_32 = fb->fbuf;
 	static int y;
+	int hit;
 	
-	fb_hideptr_32(dd);
+	hit = fb_ptr_hit(fb, x0, y0, w, h) || fb_ptr_hit(fb, x1, y1, w, h);
+	if (hit)
+		fb_hideptr_32(dd);
 	if (y0 > y1 || (y0 == y1 && x0 > x1))
 		fb_copy_rev_32(dd, x0, y0, x1, y1, w, h);
 	else
@@ -495,7 +902,9 @@ void fb_copy_32(void *dd, int x0, int y0, int x1, int y1, int w, int h)
 				&fbuf_32[x1 + (y + y1) * fb->vwidth],
 				w);
 	}
-	fb_showptr_32(dd);
+	fb_dirty(fb, x0, y0, w, h);
+	if (hit)
+		fb_showptr_32(dd);
 }
 
 void fb_bmp_hline_32(void *dd, int x, int y, int w, const uint8_t *data, int off, win_color bg, win_color fg)
@@ -514,95 +923,129 @@ void fb_bmp_hline_32(void *dd, int x, int y, int w, const uint8_t *data, int off
 	dp += fb->vwidth * y;
 	dp += x;
 	
-	b  = *p++ >> (off & 7);
-	nb = 8 - (off & 7);
-	for (; w; x++, w--)
+	if (off & 7)
 	{
-		if (b & 1)
-			*dp++ = fg;
-		else
-			*dp++ = bg;
-		
-		if (!--nb)
-		{
-			b  = *p++;
-			nb = 8;
-		}
-		else
-			b >>= 1;
+		b = *p++ >> (off & 7);
+		for (nb = 8 - (off & 7); nb && w; nb--, w--, b >>= 1)
+			*dp++ = (b & 1) ? fg : bg;
 	}
 	
-	fb_rptr_32(dd, x0, y, w0, 1);
+	if (w >= 8)
+	{
+		expand32(dp, p, w / 8, bg, bg ^ fg, bmp_mask);
+		dp += w & ~7;
+		p  += w / 8;
+		w  &= 7;
+	}
+	
+	for (b = w ? *p : 0; w; w--, b >>= 1)
+		*dp++ = (b & 1) ? fg : bg;
+	
+	fb_painted_32(dd, x0, y, w0, 1);
+}
+
+void fb_span_32(void *dd, int x, int y, int w, const win_color *pix)
+{
+	struct framebuf *fb = dd;
+	uint32_t *dp;
+	
+	dp  = fb->fbuf;
+	dp += fb->vwidth * y;
+	dp += x;
+	
+	cpy32fw(dp, (uint32_t *)pix, w);
+	
+	fb_painted_32(dd, x, y, w, 1);
 }
 
 /* ---- 8-bit display support functions ------------------------------------ */
 
-static void fb_putpix_p_8(void *dd, int x, int y, win_color c)
+void fb_setptr_8(void *dd, const win_color *shape, const unsigned *mask)
+{
+	struct framebuf *fb = dd;
+	uint8_t *pix = (uint8_t *)fb->ptr_pix;
+	int i;
+	
+	fb_hideptr_8(dd);
+	for (i = 0; i < PTR_WIDTH * PTR_HEIGHT; i++)
+		pix[i] = shape[i];
+	memcpy(fb->ptr_mask, mask, sizeof fb->ptr_mask);
+	fb_ptr_scan(fb);
+	fb_showptr_8(dd);
+}
+
+void fb_moveptr_8(void *dd, int x, int y)
+{
+	struct framebuf *fb = dd;
+	
+	if (fb->ptr_hide_count)
+	{
+		fb->ptr_x = x;
+		fb->ptr_y = y;
+		return;
+	}
+	
+	fb_ptr_move(fb, 1, x, y);
+}
+
+void fb_showptr_8(void *dd)
 {
 	struct framebuf *fb = dd;
-	uint8_t *fbuf_8 = fb->fbuf;
 	
-	if (x < 0 || x >= fb->width)
+	if (!fb->ptr_hide_count)
 		return;
-	if (y < 0 || y >= fb->height)
+	
+	fb->ptr_hide_count--;
+	if (fb->ptr_hide_count)
 		return;
 	
-	fbuf_8[x + y * fb->vwidth] = c;
+	fb_ptr_show(fb, 1);
 }
 
-static void fb_getpix_p_8(void *dd, int x, int y, win_color *c)
+void fb_hideptr_8(void *dd)
 {
 	struct framebuf *fb = dd;
-	uint8_t *fbuf_8 = fb->fbuf;
 	
-	if (x < 0 || x >= fb->width)
-		goto badpos;
-	if (y < 0 || y >= fb->height)
-		goto badpos;
+	fb->ptr_hide_count++;
+	if (fb->ptr_hide_count > 1)
+		return;
 	
-	*c = fbuf_8[x + y * fb->vwidth];
-	return;
-badpos:
-	*c = 0;
+	fb_ptr_hide(fb, 1);
+}
+
+static void fb_painted_8(void *dd, int x, int y, int w, int h)
+{
+	fb_painted(dd, 1, x, y, w, h);
 }
 
 void fb_putpix_8(void *dd, int x, int y, win_color c)
 {
 	struct framebuf *fb = dd;
 	uint8_t *fbuf_8 = fb->fbuf;
-	static int i;
+	uint8_t *save;
 	
-	if (x >= fb->ptr_x && x < fb->ptr_x + PTR_WIDTH &&
-	    y >= fb->ptr_y && y < fb->ptr_y + PTR_WIDTH)
+	if (!fb->ptr_hide_count && fb_ptr_masked(fb, fb->ptr_x, fb->ptr_y, x, y))
 	{
-		i = (x - fb->ptr_x) + (y - fb->ptr_y) * PTR_WIDTH;
-		
-		if (fb->ptr_mask[i])
-		{
-			fb->ptr_back[i] = c;
-			return;
-		}
+		save = (uint8_t *)fb->ptr_save[fb->ptr_page];
+		save[(x - fb->ptr_x) + (y - fb->ptr_y) * PTR_WIDTH] = c;
+		return;
 	}
 	
 	fbuf_8[x + y * fb->vwidth] = c;
+	fb_dirty(fb, x, y, 1, 1);
 }
 
 void fb_getpix_8(void *dd, int x, int y, win_color *c)
 {
 	struct framebuf *fb = dd;
 	uint8_t *fbuf_8 = fb->fbuf;
-	static int i;
+	uint8_t *save;
 	
-	if (x >= fb->ptr_x && x < fb->ptr_x + PTR_WIDTH &&
-	    y >= fb->ptr_y && y < fb->ptr_y + PTR_WIDTH)
+	if (!fb->ptr_hide_count && fb_ptr_masked(fb, fb->ptr_x, fb->ptr_y, x, y))
 	{
-		i = (x - fb->ptr_x) + (y - fb->ptr_y) * PTR_WIDTH;
-		
-		if (fb->ptr_mask[i])
-		{
-			*c = fb->ptr_back[i];
-			return;
-		}
+		save = (uint8_t *)fb->ptr_save[fb->ptr_page];
+		*c = save[(x - fb->ptr_x) + (y - fb->ptr_y) * PTR_WIDTH];
+		return;
 	}
 	
 	*c = fbuf_8[x + y * fb->vwidth];
@@ -612,32 +1055,33 @@ void fb_hline_8(void *dd, int x, int y, int len, win_color c)
 {
 	struct framebuf *fb = dd;
 	uint8_t *fbuf_8 = fb->fbuf;
-	int i;
 	
-	if (y >= fb->ptr_y && y < fb->ptr_y + PTR_HEIGHT)
-		for (i = x; i < x + len; i++)
-			fb_putpix_8(dd, i, y, c);
-	else
-		memset((void *)&fbuf_8[x + y * fb->vwidth], c, len);
+	fill8(&fbuf_8[x + y * fb->vwidth], c, len);
+	fb_painted_8(dd, x, y, len, 1);
 }
 
 void fb_vline_8(void *dd, int x, int y, int len, win_color c)
 {
 	struct framebuf *fb = dd;
+	uint8_t *p = fb->fbuf;
 	int i;
 	
-	for (i = y; i < y + len; i++)
-		fb_putpix_8(dd, x, i, c);
+	p += x + y * fb->vwidth;
+	for (i = 0; i < len; i++, p += fb->vwidth)
+		*p = c;
+	fb_painted_8(dd, x, y, 1, len);
 }
 
 void fb_rect_8(void *dd, int x0, int y0, int w, int h, win_color c)
 {
 	struct framebuf *fb = dd;
+	uint8_t *fbuf_8 = fb->fbuf;
 	int y1 = y0 + h;
 	int y;
 	
 	for (y = y0; y < y1; y++)
-		fb_hline_8(dd, x0, y, w, c);
+		fill8(&fbuf_8[x0 + y * fb->vwidth], c, w);
+	fb_painted_8(dd, x0, y0, w, h);
 }
 
 static void fb_copy_rev_8(void *dd, int x0, int y0, int x1, int y1,
@@ -648,211 +1092,339 @@ static void fb_copy_rev_8(void *dd, int x0, int y0, int x1, int y1,
 	int y;
 	
 	for (y = h - 1; y >= 0; y--)
-		memmove((void *)&fbuf_8[x0 + (y + y0) * fb->vwidth],
-			(void *)&fbuf_8[x1 + (y + y1) * fb->vwidth],
-			w);
+		cpy8bk(&fbuf_8[x0 + (y + y0) * fb->vwidth],
+		       &fbuf_8[x1 + (y + y1) * fb->vwidth],
+		       w);
 }
 
 void fb_copy_8(void *dd, int x0, int y0, int x1, int y1, int w, int h)
 {
 	struct framebuf *fb = dd;
 	uint8_t *fbuf_8 = fb->fbuf;
+	int hit;
 	int y;
 	
-	fb_hideptr_8(dd);
+	hit = fb_ptr_hit(fb, x0, y0, w, h) || fb_ptr_hit(fb, x1, y1, w, h);
+	if (hit)
+		fb_hideptr_8(dd);
 	if (y0 > y1 || (y0 == y1 && x0 > x1))
 		fb_copy_rev_8(dd, x0, y0, x1, y1, w, h);
 	else
 	{
 		for (y = 0; y < h; y++)
-			memmove((void *)&fbuf_8[x0 + (y + y0) * fb->vwidth],
-				(void *)&fbuf_8[x1 + (y + y1) * fb->vwidth],
-				w);
+			cpy8fw(&fbuf_8[x0 + (y + y0) * fb->vwidth],
+			       &fbuf_8[x1 + (y + y1) * fb->vwidth],
+			       w);
 	}
-	fb_showptr_8(dd);
+	fb_dirty(fb, x0, y0, w, h);
+	if (hit)
+		fb_showptr_8(dd);
 }
 
-void fb_setptr_8(void *dd, const win_color *shape, const unsigned *mask)
+void fb_bmp_hline_8(void *dd, int x, int y, int w, const uint8_t *data, int off, win_color bg, win_color fg)
 {
+	const uint8_t *p = data + (off >> 3);
 	struct framebuf *fb = dd;
+	uint8_t *dp;
+	uint8_t b;
+	int x0, w0;
+	int nb;
 	
-	fb_hideptr_8(dd);
-	memcpy(fb->ptr_shape, shape, sizeof fb->ptr_shape);
-	memcpy(fb->ptr_mask,  mask,  sizeof fb->ptr_mask);
-	fb_showptr_8(dd);
+	x0 = x;
+	w0 = w;
+	
+	dp  = fb->fbuf;
+	dp += fb->vwidth * y;
+	dp += x;
+	
+	b  = *p++ >> (off & 7);
+	nb = 8 - (off & 7);
+	for (; w; x++, w--)
+	{
+		if (b & 1)
+			*dp++ = fg;
+		else
+			*dp++ = bg;
+		
+		if (!--nb)
+		{
+			b  = *p++;
+			nb = 8;
+		}
+		else
+			b >>= 1;
+	}
+	
+	fb_painted_8(dd, x0, y, w0, 1);
 }
 
-void fb_moveptr_8(void *dd, int x, int y)
+void fb_span_8(void *dd, int x, int y, int w, const win_color *pix)
 {
-	win_color oback[PTR_WIDTH * PTR_HEIGHT];
 	struct framebuf *fb = dd;
-	int x0, y0, x1, y1, x2, y2;
-	int px, py;
+	uint8_t *dp;
 	int i;
 	
-	if (fb->ptr_hide_count)
-	{
-		fb->ptr_x = x;
-		fb->ptr_y = y;
-		return;
-	}
-	
-	memcpy(oback, fb->ptr_back, sizeof oback);
-	x0 = fb->ptr_x;
-	y0 = fb->ptr_y;
+	dp  = fb->fbuf;
+	dp += fb->vwidth * y;
+	dp += x;
 	
-	fb->ptr_hide_count = 1;
-	fb->ptr_x = x;
-	fb->ptr_y = y;
-	fb_showptr_8(dd);
+	for (i = 0; i < w; i++)
+		dp[i] = pix[i];
 	
-	x1 = x0;
-	y1 = y0;
+	fb_painted_8(dd, x, y, w, 1);
+}
+
+/* ---- shadow buffer ------------------------------------------------------ */
+
+/*
+ * In shadow mode all drawing goes to a copy of the frame buffer in system
+ * memory. The areas painted are collected as a short list of rectangles
+ * and copied to video memory FB_REFRESH times per second from the clock
+ * interrupt, so that video memory is only ever written in long sequential
+ * runs and never read.
+ *
+ * The clock handler copies at most FB_SWAP_MAX bytes per tick and picks
+ * up the rest on the following ticks, so a full screen update does not
+ * hold off interrupts for milliseconds.
+ */
+
+static struct framebuf *fb_shadow[FB_SHADOW_MAX];
+static int fb_clock_installed;
+
+void fb_dirty(struct framebuf *fb, int x, int y, int w, int h)
+{
+	struct fb_rect *r;
+	int x1, y1;
+	int s;
+	int i;
 	
-	x2 = x0 + PTR_WIDTH;
-	y2 = y0 + PTR_WIDTH;
+	if (!fb->vbuf)
+		return;
 	
-	if (x1 < 0)		x1 = 0;
-	if (y1 < 0)		y1 = 0;
+	x1 = min(x + w, fb->width);
+	y1 = min(y + h, fb->height);
+	x  = max(x, 0);
+	y  = max(y, 0);
+	if (x1 <= x || y1 <= y)
+		return;
 	
-	if (x2 > fb->width)	x2 = fb->width;
-	if (y2 > fb->height)	y2 = fb->height;
+	s = intr_dis();
+	for (i = 0; i < fb->dirty_cnt; i++)
+	{
+		r = &fb->dirty[i];
+		
+		if (x > r->x1 || x1 < r->x0 || y > r->y1 || y1 < r->y0)
+			continue;
+		
+		r->x0 = min(r->x0, x);
+		r->y0 = min(r->y0, y);
+		r->x1 = max(r->x1, x1);
+		r->y1 = max(r->y1, y1);
+		intr_res(s);
+		return;
+	}
 	
-	for (y = y1; y < y2; y++)
-		for (x = x1; x < x2; x++)
+	if (fb->dirty_cnt >= FB_DIRTY_MAX)
+	{
+		r = &fb->dirty[0];
+		for (i = 1; i < fb->dirty_cnt; i++)
 		{
-			i = (x - x0) + (y - y0) * PTR_WIDTH;
-			
-			if (fb->ptr_mask[i])
-				fb_putpix_8(dd, x, y, oback[i]);
+			r->x0 = min(r->x0, fb->dirty[i].x0);
+			r->y0 = min(r->y0, fb->dirty[i].y0);
+			r->x1 = max(r->x1, fb->dirty[i].x1);
+			r->y1 = max(r->y1, fb->dirty[i].y1);
 		}
+		fb->dirty_cnt = 1;
+	}
+	
+	r = &fb->dirty[fb->dirty_cnt++];
+	r->x0 = x;
+	r->y0 = y;
+	r->x1 = x1;
+	r->y1 = y1;
+	intr_res(s);
 }
 
-void fb_showptr_8(void *dd)
+static void fb_copy(struct framebuf *fb, int x0, int y0, int x1, int y1)
 {
-	struct framebuf *fb = dd;
-	int x, y;
-	int i;
-	
-	if (!fb->ptr_hide_count)
-		return;
+	int bpp = fb->shadow_bpp;
+	uint8_t *sp, *dp;
+	int y;
 	
-	fb->ptr_hide_count--;
-	if (fb->ptr_hide_count)
-		return;
+	sp = (uint8_t *)fb->fbuf + (x0 + y0 * fb->vwidth) * bpp;
+	dp = (uint8_t *)fb->vbuf + (x0 + y0 * fb->vwidth) * bpp;
 	
-	if (!fb->ptr_hide_count)
+	for (y = y0; y < y1; y++)
 	{
-		i = 0;
-		for (y = 0; y < PTR_HEIGHT; y++)
-			for (x = 0; x < PTR_WIDTH; x++)
-			{
-				fb_getpix_p_8(dd, x + fb->ptr_x, y + fb->ptr_y, &fb->ptr_back[i]);
-				if (fb->ptr_mask[i])
-					fb_putpix_p_8(dd, x + fb->ptr_x, y + fb->ptr_y, fb->ptr_shape[i]);
-				i++;
-			}
+		if (bpp == 4)
+			cpy32fw((uint32_t *)dp, (uint32_t *)sp, x1 - x0);
+		else
+			cpy8fw(dp, sp, x1 - x0);
+		
+		sp += fb->vwidth * bpp;
+		dp += fb->vwidth * bpp;
 	}
 }
 
-void fb_hideptr_8(void *dd)
+void fb_swap(struct framebuf *fb)
 {
-	struct framebuf *fb = dd;
-	int x, y;
-	int i;
+	struct fb_rect dirty[FB_DIRTY_MAX];
+	struct fb_rect *r;
+	int cnt;
+	int s;
 	
-	fb->ptr_hide_count++;
-	if (fb->ptr_hide_count > 1)
+	s = intr_dis();
+	if (!fb->vbuf)
+	{
+		intr_res(s);
 		return;
+	}
+	cnt = fb->dirty_cnt;
+	memcpy(dirty, fb->dirty, cnt * sizeof *dirty);
+	fb->dirty_cnt = 0;
+	intr_res(s);
 	
-	i = 0;
-	for (y = 0; y < PTR_HEIGHT; y++)
-		for (x = 0; x < PTR_WIDTH; x++)
-		{
-			if (fb->ptr_mask[i])
-				fb_putpix_p_8(dd, x + fb->ptr_x, y + fb->ptr_y, fb->ptr_back[i]);
-			i++;
-		}
+	for (r = dirty; r < dirty + cnt; r++)
+		fb_copy(fb, r->x0, r->y0, r->x1, r->y1);
 }
 
-static void fb_rptr_8(void *dd, int x, int y, int w, int h)
+/*
+ * Copies whole rows of the dirty rectangles until about max bytes have
+ * been written, trimming or dropping the rectangles done. Returns the
+ * budget left. Runs in the clock interrupt.
+ */
+static int fb_swap_some(struct framebuf *fb, int max)
 {
-	struct framebuf *fb = dd;
-	uint8_t *fbuf = fb->fbuf;
-	uint8_t *p;
-	int x0, x1, y0, y1;
-	int xs, ys;
-	int cx, cy;
+	struct fb_rect *r;
+	int rowsz;
+	int rows;
+	
+	while (fb->dirty_cnt && max > 0)
+	{
+		r = &fb->dirty[0];
+		
+		rowsz = (r->x1 - r->x0) * fb->shadow_bpp;
+		rows  = max / rowsz;
+		if (!rows)
+			rows = 1;
+		if (rows > r->y1 - r->y0)
+			rows = r->y1 - r->y0;
+		
+		fb_copy(fb, r->x0, r->y0, r->x1, r->y0 + rows);
+		max -= rows * rowsz;
+		
+		r->y0 += rows;
+		if (r->y0 >= r->y1)
+			*r = fb->dirty[--fb->dirty_cnt];
+	}
+	return max;
+}
+
+static void fb_clock(void)
+{
+	static int div;
+	
+	int max = FB_SWAP_MAX;
 	int i;
 	
-	if (fb->ptr_hide_count)
+	if (++div < clock_hz() / FB_REFRESH)
 		return;
 	
-	x0 = max(x,	fb->ptr_x);
-	x1 = min(x + w, fb->ptr_x + PTR_WIDTH);
-	y0 = max(y,	fb->ptr_y);
-	y1 = min(y + h, fb->ptr_y + PTR_HEIGHT);
+	for (i = 0; i < FB_SHADOW_MAX; i++)
+		if (fb_shadow[i] && fb_shadow[i]->vbuf)
+			max = fb_swap_some(fb_shadow[i], max);
 	
-	if (x1 <= x0)
-		return;
+	/* out of budget, go on with the next tick */
+	if (max > 0)
+		div = 0;
+	else
+		div--;
+}
+
+int fb_swapctl(struct framebuf *fb, int bpp, int ena)
+{
+	size_t sz = (size_t)fb->vwidth * fb->height * bpp;
+	size_t csz = sz;
+	void *sbuf;
+	int err;
+	int s;
+	int i;
 	
-	for (cy = y0; cy < y1; cy++)
+	if (!ena)
 	{
-		i = (x0 - fb->ptr_x) + (cy - fb->ptr_y) * PTR_WIDTH;
-		p = fbuf + x0 + cy * fb->vwidth;
+		if (!fb->vbuf)
+			return 0;
+		
+		fb_swap(fb);
+		
+		s = intr_dis();
+		for (i = 0; i < FB_SHADOW_MAX; i++)
+			if (fb_shadow[i] == fb)
+				fb_shadow[i] = NULL;
+		sbuf	 = fb->fbuf;
+		fb->fbuf = fb->vbuf;
+		fb->vbuf = NULL;
+		intr_res(s);
 		
-		for (cx = x0; cx < x1; cx++, i++, p++)
-			if (fb->ptr_mask[i])
-			{
-				fb->ptr_back[i] = *p;
-				*p = fb->ptr_shape[i];
-			}
+		free(sbuf);
+		return 0;
 	}
-}
-
-void fb_bmp_hline_8(void *dd, int x, int y, int w, const uint8_t *data, int off, win_color bg, win_color fg)
-{
-	const uint8_t *p = data + (off >> 3);
-	struct framebuf *fb = dd;
-	uint8_t *dp;
-	uint8_t b;
-	int x0, w0;
-	int nb;
 	
-	x0 = x;
-	w0 = w;
+	if (fb->vbuf)
+		return 0;
 	
-	dp  = fb->fbuf;
-	dp += fb->vwidth * y;
-	dp += x;
+	for (i = 0; i < FB_SHADOW_MAX; i++)
+		if (!fb_shadow[i])
+			break;
+	if (i >= FB_SHADOW_MAX)
+		return ENOMEM;
 	
-	b  = *p++ >> (off & 7);
-	nb = 8 - (off & 7);
-	for (; w; x++, w--)
+	if (!fb_clock_installed)
 	{
-		if (b & 1)
-			*dp++ = fg;
-		else
-			*dp++ = bg;
-		
-		if (!--nb)
-		{
-			b  = *p++;
-			nb = 8;
-		}
-		else
-			b >>= 1;
+		err = clock_ihand(fb_clock); /* XXX */
+		if (err)
+			return err;
+		fb_clock_installed = 1;
 	}
 	
-	fb_rptr_8(dd, x0, y, w0, 1);
+	err = kmalloc(&sbuf, sz, "fb: shadow");
+	if (err)
+		return err;
+	
+	/* the driver may have mapped less than vwidth * height */
+	if (fb->vmem_size && csz > fb->vmem_size)
+		csz = fb->vmem_size;
+	memcpy(sbuf, fb->fbuf, csz);
+	memset((char *)sbuf + csz, 0, sz - csz);
+	
+	s = intr_dis();
+	fb->shadow_bpp = bpp;
+	fb->dirty_cnt  = 0;
+	fb->vbuf       = fb->fbuf;
+	fb->fbuf       = sbuf;
+	fb_shadow[i]   = fb;
+	intr_res(s);
+	return 0;
 }
 
 int mod_onload(unsigned md, const char *pathname, void *data, unsigned sz)
 {
+	fb_cpu_init();
 	return 0;
 }
 
 int mod_onunload(unsigned md)
 {
+	int i;
+	
+	for (i = 0; i < FB_SHADOW_MAX; i++)
+		if (fb_shadow[i])
+			return EBUSY;
+	
+	if (fb_clock_installed)
+	{
+		clock_iunhand(fb_clock);
+		fb_clock_installed = 0;
+	}
 	return 0;
 }
@@ -33,18 +33,49 @@
 #include <overflow.h>
 #include <bioctl.h>
 #include <errno.h>
+#include <zlib.h>
 
-#define RD_MAX	8
+#define RD_MAX		8
+#define RD_ZCACHE	4
 
 static struct bdev rd_bdevs[RD_MAX];
 static char rd_names[RD_MAX][4];
 
+struct rd_zchunk
+{
+	uint32_t	offset;
+	uint32_t	zsize;
+	char *		data;
+};
+
+struct rd_zcache
+{
+	char *		buf;
+	int		chunk;
+	unsigned	stamp;
+};
+
+/*
+ * A unit has either an uncompressed image or a compressed one (zimage),
+ * which is inflated a chunk at a time into a small LRU cache. Chunks that
+ * get written to are inflated into a private copy and stay inflated.
+ */
 static struct rd_unit
 {
 	char *	image;
 	blk_t	size;
+	
+	char *			zimage;
+	struct rd_zchunk *	zchunks;
+	uint32_t		zchunk_size;
+	uint32_t		zchunk_count;
+	struct rd_zcache	zcache[RD_ZCACHE];
+	unsigned		zstamp;
 } rd_units[RD_MAX];
 
+static z_stream rd_zs;
+static int rd_zs_init;
+
 static int rd_open(int unit);
 static int rd_close(int unit);
 static int rd_read(int unit, blk_t blk, void *buf);
@@ -73,9 +104,213 @@ static int rd_close(int unit)
 	return 0;
 }
 
+static voidpf rd_zalloc(voidpf opaque, uInt items, uInt size)
+{
+	void *p;
+	
+	if (ov_mul_u(items, size))
+		return Z_NULL;
+	if (kmalloc(&p, items * size, "rd: zlib"))
+		return Z_NULL;
+	return p;
+}
+
+static void rd_zfree(voidpf opaque, voidpf p)
+{
+	free(p);
+}
+
+static void rd_free(struct rd_unit *u)
+{
+	int i;
+	
+	if (u->zchunks != NULL)
+		for (i = 0; i < u->zchunk_count; i++)
+			free(u->zchunks[i].data);
+	for (i = 0; i < RD_ZCACHE; i++)
+		free(u->zcache[i].buf);
+	free(u->zchunks);
+	free(u->zimage);
+	free(u->image);
+	
+	memset(u, 0, sizeof *u);
+}
+
+static int rd_zload(struct rd_unit *u, const struct rd_zimage *zi)
+{
+	struct rd_zchunk *zchunks;
+	struct zimg_chunk *zc;
+	struct zimg_head *zh;
+	struct rd_zchunk *c;
+	uint32_t off;
+	char *p;
+	int err;
+	int i;
+	
+	if (zi->size < sizeof *zh)
+		return EINVAL;
+	
+	if (!rd_zs_init)
+	{
+		rd_zs.zalloc = rd_zalloc;
+		rd_zs.zfree  = rd_zfree;
+		if (inflateInit(&rd_zs) != Z_OK)
+			return ENOMEM;
+		rd_zs_init = 1;
+	}
+	
+	err = kmalloc(&p, zi->size, "rd: zimage");
+	if (err)
+		return err;
+	err = fucpy(p, zi->data, zi->size);
+	if (err)
+		goto fail;
+	
+	err = EINVAL;
+	zh = (void *)p;
+	if (memcmp(zh->magic, ZIMG_MAGIC, sizeof zh->magic))
+		goto fail;
+	if (!zh->size || zh->size % BLK_SIZE)
+		goto fail;
+	if (!zh->chunk_size || zh->chunk_size % BLK_SIZE)
+		goto fail;
+	if (zh->chunk_count != (zh->size - 1) / zh->chunk_size + 1)
+		goto fail;
+	if (zh->chunk_count > (zi->size - sizeof *zh) / sizeof *zc)
+		goto fail;
+	
+	err = kmalloc(&zchunks, zh->chunk_count * sizeof *zchunks, "rd: zchunks");
+	if (err)
+		goto fail;
+	memset(zchunks, 0, zh->chunk_count * sizeof *zchunks);
+	
+	zc  = (void *)(zh + 1);
+	off = sizeof *zh + zh->chunk_count * sizeof *zc;
+	for (i = 0; i < zh->chunk_count; i++)
+	{
+		c = &zchunks[i];
+		
+		if (zc[i].zsize > zi->size - off)
+		{
+			free(zchunks);
+			err = EINVAL;
+			goto fail;
+		}
+		c->offset = off;
+		c->zsize  = zc[i].zsize;
+		off += zc[i].zsize;
+	}
+	
+	rd_free(u);
+	
+	u->zchunks = zchunks;
+	for (i = 0; i < RD_ZCACHE; i++)
+		u->zcache[i].chunk = -1;
+	u->zimage	= p;
+	u->zchunk_size	= zh->chunk_size;
+	u->zchunk_count	= zh->chunk_count;
+	u->size		= zh->size / BLK_SIZE;
+	return 0;
+fail:
+	free(p);
+	return err;
+}
+
+/*
+ * The chunks are zlib streams, so inflate also verifies their adler32
+ * before returning Z_STREAM_END.
+ */
+static int rd_inflate(struct rd_unit *u, int chunk, char *buf)
+{
+	struct rd_zchunk *c = &u->zchunks[chunk];
+	uint32_t len;
+	
+	len = u->size * BLK_SIZE - chunk * u->zchunk_size;
+	if (len > u->zchunk_size)
+		len = u->zchunk_size;
+	
+	if (inflateReset(&rd_zs) != Z_OK)
+		return EIO;
+	rd_zs.next_in	= (Bytef *)u->zimage + c->offset;
+	rd_zs.avail_in	= c->zsize;
+	rd_zs.next_out	= (Bytef *)buf;
+	rd_zs.avail_out	= len;
+	
+	if (inflate(&rd_zs, Z_FINISH) != Z_STREAM_END || rd_zs.avail_out)
+	{
+		printk("rd.drv: chunk %i is corrupt\n", chunk);
+		return EIO;
+	}
+	return 0;
+}
+
+static int rd_zchunk(struct rd_unit *u, int chunk, char **buf)
+{
+	struct rd_zcache *zc, *victim = NULL;
+	int err;
+	int i;
+	
+	if (u->zchunks[chunk].data != NULL)
+	{
+		*buf = u->zchunks[chunk].data;
+		return 0;
+	}
+	
+	for (i = 0; i < RD_ZCACHE; i++)
+	{
+		zc = &u->zcache[i];
+		if (zc->chunk == chunk)
+		{
+			zc->stamp = ++u->zstamp;
+			*buf = zc->buf;
+			return 0;
+		}
+		if (victim == NULL || zc->stamp < victim->stamp)
+			victim = zc;
+	}
+	
+	if (victim->buf == NULL)
+	{
+		err = kmalloc(&victim->buf, u->zchunk_size, "rd: zcache");
+		if (err)
+			return err;
+	}
+	
+	victim->chunk = -1;
+	err = rd_inflate(u, chunk, victim->buf);
+	if (err)
+		return err;
+	victim->chunk = chunk;
+	victim->stamp = ++u->zstamp;
+	*buf = victim->buf;
+	return 0;
+}
+
+static int rd_zwrite(struct rd_unit *u, int chunk, char **buf)
+{
+	struct rd_zchunk *c = &u->zchunks[chunk];
+	char *p;
+	int err;
+	
+	if (c->data == NULL)
+	{
+		err = rd_zchunk(u, chunk, &p);
+		if (err)
+			return err;
+		
+		err = kmalloc(&c->data, u->zchunk_size, "rd: zchunk");
+		if (err)
+			return err;
+		memcpy(c->data, p, u->zchunk_size);
+	}
+	*buf = c->data;
+	return 0;
+}
+
 static int rd_ioctl(int unit, int cmd, void *buf)
 {
 	struct rd_unit *u = &rd_units[unit];
+	struct rd_zimage zi;
 	struct bio_info bi;
 	size_t sz;
 	blk_t bc;
@@ -99,8 +334,7 @@ static int rd_ioctl(int unit, int cmd, void *buf)
 			return EINVAL;
 		sz = bc * BLK_SIZE;
 		
-		free(u->image);
-		u->size = 0;
+		rd_free(u);
 		if (!bc)
 			return 0;
 		
@@ -112,6 +346,11 @@ static int rd_ioctl(int unit, int cmd, void *buf)
 		u->image = p;
 		u->size  = bc;
 		return 0;
+	case RDIOCZIMG:
+		err = fucpy(&zi, buf, sizeof zi);
+		if (err)
+			return err;
+		return rd_zload(u, &zi);
 	default:
 		;
 	}
@@ -121,10 +360,23 @@ static int rd_ioctl(int unit, int cmd, void *buf)
 static int rd_read(int unit, blk_t blk, void *buf)
 {
 	struct rd_unit *u = &rd_units[unit];
+	uint32_t off;
+	char *p;
+	int err;
 	
 	if (blk < 0 || blk >= u->size)
 		return EINVAL;
 	
+	if (u->zimage != NULL)
+	{
+		off = blk * BLK_SIZE;
+		err = rd_zchunk(u, off / u->zchunk_size, &p);
+		if (err)
+			return err;
+		memcpy(buf, p + off % u->zchunk_size, BLK_SIZE);
+		return 0;
+	}
+	
 	memcpy(buf, u->image + BLK_SIZE * blk, BLK_SIZE);
 	return 0;
 }
@@ -132,10 +384,23 @@ static int rd_read(int unit, blk_t blk, void *buf)
 static int rd_write(int unit, blk_t blk, const void *buf)
 {
 	struct rd_unit *u = &rd_units[unit];
+	uint32_t off;
+	char *p;
+	int err;
 	
 	if (blk < 0 || blk >= u->size)
 		return EINVAL;
 	
+	if (u->zimage != NULL)
+	{
+		off = blk * BLK_SIZE;
+		err = rd_zwrite(u, off / u->zchunk_size, &p);
+		if (err)
+			return err;
+		memcpy(p + off % u->zchunk_size, buf, BLK_SIZE);
+		return 0;
+	}
+	
 	memcpy(u->image + BLK_SIZE * blk, buf, BLK_SIZE);
 	return 0;
 }
@@ -175,7 +440,9 @@ int mod_onunload(unsigned md)
 	for (i = 0; i < RD_MAX; i++)
 	{
 		blk_uinstall(&rd_bdevs[i]);
-		free(rd_units[i].image);
+		rd_free(&rd_units[i]);
 	}
+	if (rd_zs_init)
+		inflateEnd(&rd_zs);
 	return 0;
 }
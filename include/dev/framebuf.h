@@ -27,17 +27,38 @@
 #ifndef _DEV_FRAMEBUF_H
 #define _DEV_FRAMEBUF_H
 
+#define FB_REFRESH	60
+#define FB_SWAP_MAX	262144
+#define FB_DIRTY_MAX	8
+#define FB_SHADOW_MAX	4
+
+struct fb_rect
+{
+	int x0, y0;
+	int x1, y1;
+};
+
 struct framebuf
 {
 	struct win_display *	disp;
 	void *			fbuf;
 	int			width, height;
 	int			vwidth;
+	size_t			vmem_size;
+	
+	void *			vbuf;
+	int			shadow_bpp;
+	struct fb_rect		dirty[FB_DIRTY_MAX];
+	int			dirty_cnt;
 	
 	unsigned		ptr_mask[PTR_WIDTH * PTR_HEIGHT];
-	win_color		ptr_shape[PTR_WIDTH * PTR_HEIGHT];
-	win_color		ptr_back[PTR_WIDTH * PTR_HEIGHT];
+	uint32_t		ptr_pix[PTR_WIDTH * PTR_HEIGHT];
+	uint32_t		ptr_save[2][PTR_WIDTH * PTR_HEIGHT];
+	struct win_span		ptr_span[PTR_WIDTH * PTR_HEIGHT / 2];
+	unsigned		ptr_span_index[PTR_HEIGHT + 1];
+	int			ptr_page;
 	int			ptr_x, ptr_y;
+	int			ptr_ox, ptr_oy;
 	int			ptr_hide_count;
 };
 
@@ -46,6 +67,12 @@ struct framebuf *fb_creat(struct win_display *disp, void *buf, int w, int h);
 void fb_reset(struct framebuf *fb);
 void fb_free(struct framebuf *fb);
 
+int fb_ptr_hit(struct framebuf *fb, int x, int y, int w, int h);
+
+int  fb_swapctl(struct framebuf *fb, int bpp, int ena);
+void fb_swap(struct framebuf *fb);
+void fb_dirty(struct framebuf *fb, int x, int y, int w, int h);
+
 void fb_setptr_32(void *dd, const win_color *shape, const unsigned *mask);
 void fb_moveptr_32(void *dd, int x, int y);
 void fb_showptr_32(void *dd);
@@ -59,6 +86,7 @@ void fb_rect_32(void *dd, int x, int y, int w, int h, win_color c);
 void fb_copy_32(void *dd, int x0, int y0, int x1, int y1, int w, int h);
 
 void fb_bmp_hline_32(void *dd, int x, int y, int w, const uint8_t *data, int off, win_color bg, win_color fg);
+void fb_span_32(void *dd, int x, int y, int w, const win_color *pix);
 
 void fb_putpix_8(void *dd, int x, int y, win_color c);
 void fb_getpix_8(void *dd, int x, int y, win_color *c);
@@ -73,5 +101,6 @@ void fb_showptr_8(void *dd);
 void fb_hideptr_8(void *dd);
 
 void fb_bmp_hline_8(void *dd, int x, int y, int w, const uint8_t *data, int off, win_color bg, win_color fg);
+void fb_span_8(void *dd, int x, int y, int w, const win_color *pix);
 
 #endif
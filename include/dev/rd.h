@@ -27,6 +27,38 @@
 #ifndef _DEV_RD_H
 #define _DEV_RD_H
 
+#include <sys/types.h>
+#include <stdint.h>
+
 #define RDIOCNEW	0x7201
+#define RDIOCZIMG	0x7202
+
+/*
+ * Compressed image as written by cross/mkzimg: a zimg_head, chunk_count
+ * zimg_chunk entries and the chunks, each a separate zlib stream of
+ * chunk_size uncompressed bytes (the last one may be shorter).
+ */
+#define ZIMG_MAGIC	"OS386ZI1"
+
+struct zimg_head
+{
+	char	 magic[8];
+	uint32_t size;
+	uint32_t chunk_size;
+	uint32_t chunk_count;
+};
+
+struct zimg_chunk
+{
+	uint32_t zsize;
+	uint32_t adler;
+};
+
+/* RDIOCZIMG: keep the image compressed, inflate chunks on demand */
+struct rd_zimage
+{
+	const void *	data;
+	size_t		size;
+};
 
 #endif
@@ -38,6 +38,8 @@
 #define BLK_NBLK	1024
 
 #define BLK_SIZE	512
+#define BLK_MAXSHIFT	4
+#define BLK_MAXSIZE	(BLK_SIZE << BLK_MAXSHIFT)
 
 #define BLK_MAGIC	0xd15cb10c /* disk block */
 
@@ -55,6 +57,10 @@ struct bdev
 	int	(*read)(int unit, blk_t blk, void *buf);
 	int	(*write)(int unit, blk_t blk, const void *buf);
 	
+	int	bshift;
+	blk_t	(*remap)(struct bdev *dev, blk_t blk);
+	void *	remap_data;
+	
 	uint64_t	read_cnt;
 	uint64_t	write_cnt;
 	uint64_t	error_cnt;
@@ -77,7 +83,7 @@ struct block
 	struct bdev *	dev;
 	blk_t		nr;
 	
-	char		data[BLK_SIZE];
+	char *		data;
 };
 
 struct blk_stat
@@ -100,6 +106,9 @@ int blk_uinstall(struct bdev *dev);
 int blk_open(struct bdev *dev);
 int blk_close(struct bdev *dev);
 
+int blk_view(struct bdev **view, struct bdev *dev, int bshift);
+void blk_unview(struct bdev *view);
+
 int blk_get(struct block **blkp, struct bdev *dev, blk_t nr);
 int blk_read(struct block **blkp, struct bdev *dev, blk_t nr);
 int blk_put(struct block *blk);
@@ -42,6 +42,7 @@ int	clock_hz(void);
 
 int	clock_ihand2(void (*proc)(void *), void *cx);
 int	clock_ihand(void (*proc)(void));
+int	clock_iunhand(void (*proc)(void));
 
 void	set_alarm(time_t time, unsigned ticks);
 
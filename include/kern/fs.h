@@ -40,6 +40,9 @@
 #define FS_MAXFSO	256
 #define FS_MAXFILE	256
 
+#define NAT_BMC_SIZE	4
+#define NAT_LOG_ORPHANS	4
+
 #define R_OK		4
 #define W_OK		2
 #define X_OK		1
@@ -61,6 +64,19 @@ struct fs_desc
 	int		close_on_exec;
 };
 
+struct fs_pollent
+{
+	struct fs_pollent *	next;
+	struct fs_pollent *	prev;
+	struct fs_pollent *	tnext;
+	struct fso *		fso;
+	struct task *		task;
+	int			fd;
+	int			events;
+	int			flags;
+	volatile int		pending;
+};
+
 struct fs_rwreq
 {
 	void *		buf;
@@ -96,8 +112,7 @@ struct fso
 	int			reader_count;
 	int			writer_count;
 	
-	struct task *volatile	polling;
-	volatile int		pollcnt;
+	struct fs_pollent *	polls;
 	volatile int		state;
 	
 	void *			extra;
@@ -109,9 +124,21 @@ struct fso
 			int	bmap_valid;
 			blk_t	bmap_log;
 			blk_t	bmap_phys;
+			blk_t	bmap_run;
 			blk_t	bmap[114];
+			
+			struct
+			{
+				blk_t log;
+				blk_t phys;
+				blk_t len;
+			} bmc[NAT_BMC_SIZE];
+			int	bmc_next;
+			
 			int	ndirblks;
 			int	nindirlev;
+			int	flags;
+			blk_t	hfree;
 		} nat;
 		
 		struct
@@ -120,6 +147,8 @@ struct fso
 			struct task_queue writers;
 			int		  write_p;
 			int		  read_p;
+			int		  buf_size;
+			int		  buf_max;
 			char *		  buf;
 		} pipe;
 	};
@@ -147,6 +176,7 @@ struct fs
 	
 	struct fstype *	type;
 	struct bdev *	dev;
+	int		bshift;
 	
 	void *		extra;
 	
@@ -154,6 +184,8 @@ struct fs
 	{
 		struct
 		{
+			struct bdev *dev;
+			
 			blk_t	bam_block;
 			blk_t	bam_size;
 			blk_t	data_block;
@@ -161,13 +193,30 @@ struct fs
 			blk_t	root_block;
 			blk_t	free_block;
 			
-			char	bam_buf[BLK_SIZE];
+			char *	bam_buf;
 			blk_t	bam_curr;
 			int	bam_dirty;
 			int	bam_busy;
 			
 			int	ndirblks;
 			int	nindirlev;
+			int	hdir;
+			int	extent;
+			
+			blk_t	log_block;
+			blk_t	log_size;
+			blk_t	log_head;
+			unsigned log_seq;
+			int	log_active;
+			int	log_count;
+			struct block **log_pin;
+			blk_t	log_orphan[NAT_LOG_ORPHANS];
+			int	log_norphan;
+			blk_t	*log_map;
+			unsigned log_mapmask;
+			blk_t	*log_ovl;
+			unsigned log_ovlmask;
+			int	log_ckpt;
 		} nat;
 		
 		struct
@@ -220,8 +269,6 @@ extern int		fs_fso_high;
 
 extern struct fs_file	fs_file[FS_MAXFILE];
 
-extern struct task_queue fs_pollq;
-
 void fs_init(void);
 
 void fs_clock(void);
@@ -249,6 +296,11 @@ void fs_setstate(struct fso *fso, int state);
 void fs_clrstate(struct fso *fso, int state);
 void fs_state(struct fso *fso, int state);
 
+void fs_pollreg(struct fs_pollent *pe);
+void fs_pollunreg(struct fs_pollent *pe);
+void fs_psetclose(unsigned fd);
+void fs_psetclean(void);
+
 int  fs_creat(struct fso **fso, const char *pathname, mode_t mode, dev_t rdev);
 int  fs_chk_perm(struct fso *fso, int mode, uid_t uid, gid_t gid);
 int  fs_access(const char *pathname, int mode);
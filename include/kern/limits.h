@@ -35,3 +35,6 @@
 #define OPEN_MAX	64
 
 #define PIPE_BUF	8184
+#define PIPE_SIZE_DEF	(2 * PIPE_BUF)
+#define PIPE_SIZE	65536
+#define PIPE_SIZE_MAX	1048576
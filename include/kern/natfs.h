@@ -31,6 +31,11 @@
 #include <sys/types.h>
 #include <kern/fs.h>
 
+#define NAT_BSIZE(fs)		(BLK_SIZE << (fs)->bshift)
+#define NAT_ISHIFT(fs)		(7 + (fs)->bshift)
+#define NAT_I_PER_BLOCK(fs)	(1 << NAT_ISHIFT(fs))
+#define NAT_DENTS(fs)		(NAT_BSIZE(fs) / sizeof(struct nat_dirent))
+
 void nat_init(void);
 
 int nat_mount(struct fs *fs);
@@ -66,8 +71,23 @@ int nat_write_bam(struct fs *fs, blk_t blk, int bused);
 int nat_sync_bam(struct fs *fs);
 
 int nat_balloc(struct fs *fs, blk_t *blk);
+int nat_balloc_at(struct fs *fs, blk_t blk);
 int nat_bfree(struct fs *fs, blk_t blk);
 int nat_bmap(struct fso *fso, blk_t log, int alloc);
+void nat_bmc_clear(struct fso *fso);
+
+int nat_ext_bmap(struct fso *fso, blk_t log, int alloc);
+int nat_ext_trunc(struct fso *fso);
+
+int nat_log_mount(struct fs *fs, struct nat_super *sb);
+int nat_log_umount(struct fs *fs);
+int nat_log_add(struct fs *fs, blk_t nr);
+int nat_log_held(struct fs *fs, blk_t nr);
+int nat_log_commit(struct fs *fs);
+int nat_log_split(struct fs *fs);
+int nat_log_orphan(struct fso *fso);
+int nat_log_begin(struct fs *fs);
+int nat_log_end(struct fs *fs);
 
 int nat_chdir(struct fs *fs, const char *name);
 int nat_mkdir(struct fs *fs, const char *name, mode_t mode);
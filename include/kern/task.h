@@ -116,7 +116,8 @@ struct task
 	struct fs_desc		file_desc[OPEN_MAX];
 	char			cwd[PATH_MAX];
 	char			tty[PATH_MAX];
-	int			multipoll;
+	struct fs_pollent *	pset;
+	volatile int		pollwait;
 	int			ocwd;
 	
 	struct win_task		win_task;
@@ -140,6 +141,8 @@ struct task
 	volatile int		event_high;
 	int			first_event;
 	volatile int		last_event;
+	unsigned		event_merged;
+	unsigned		event_dropped;
 };
 
 struct task_uargs
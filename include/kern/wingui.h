@@ -42,6 +42,9 @@
 
 #define DEFAULT_FTD		1
 
+#define GCACHE_MAX		8
+#define GCACHE_MAXSZ		262144
+
 struct win_glyph
 {
 	unsigned	nr;
@@ -50,6 +53,12 @@ struct win_glyph
 	unsigned	height;
 };
 
+struct win_span
+{
+	uint16_t	x;
+	uint16_t	len;
+};
+
 extern struct win_font
 {
 	char *		  data;
@@ -57,8 +66,23 @@ extern struct win_font
 	struct win_glyph *glyph[256];
 	uint8_t *	  bitmap;
 	unsigned	  linelen;
+	unsigned	  height;
+	
+	struct win_span * span;
+	unsigned *	  span_index;
 } win_font[FONT_MAX];
 
+struct win_gcache
+{
+	struct win_font *	font;
+	win_color		bg;
+	win_color		fg;
+	unsigned		stamp;
+	unsigned		stride;
+	uint32_t		valid[256 / 32];
+	win_color *		pixels;
+};
+
 struct win_pixbuf
 {
 	unsigned	width, height;
@@ -108,6 +132,7 @@ struct win_display
 	void (*swap)(void *dd);
 	
 	void (*bmp_hline)(void *dd, int x, int y, int w, const uint8_t *data, int off, win_color bg, win_color fg);
+	void (*span)(void *dd, int x, int y, int w, const win_color *pix);
 };
 
 struct win_pointer
@@ -218,6 +243,9 @@ void	win_broadcast_resize(struct win_desktop *d);
 
 int	win_chk_ftd(int ftd);
 
+struct win_gcache *win_gcache_get(struct win_font *f, win_color bg, win_color fg);
+const win_color *win_gcache_glyph(struct win_gcache *gc, unsigned ch);
+
 int	win_redraw(int wd);
 int	win_chkwd(int wd);
 
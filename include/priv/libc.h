@@ -72,6 +72,13 @@ char **	_get_environ(void);
 
 size_t __libc_mkarg(struct arg_buf **buf, char * const* argv, char * const* envp);
 
+/* poll and pset_wait */
+
+struct pollfd;
+
+int	__libc_poll_wait(int (*wait)(struct pollfd *pfd, int cnt, int ndelay),
+			 struct pollfd *pfd, unsigned cnt, int timeout);
+
 /* stdio */
 
 #if FLOAT
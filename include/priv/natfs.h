@@ -40,6 +40,31 @@
 
 #define NAT_D_PER_BLOCK		(BLK_SIZE / sizeof(struct nat_dirent)) /* XXX */
 
+#define NAT_F_LOG		1
+#define NAT_F_HDIR		2
+#define NAT_F_EXTENT		4
+#define NAT_F_BSIZE		8
+
+#define NAT_HF_HASHED		1
+#define NAT_HF_EXTENT		2
+
+#define NAT_BSHIFT_MAX		4
+
+#define NAT_FEATURES(sb)	((sb)->features_chk == ~(sb)->features ? (sb)->features : 0)
+
+#define NAT_LOG_MAGIC		0x474f4c4e
+#define NAT_LOG_NBLK		123
+#define NAT_LOG_MIN		256
+
+#define NAT_HDIR_MAGIC		0x52494448
+#define NAT_HDIR_MAX		45
+#define NAT_HDIR_DEPTH		4
+
+#define NAT_EXT_INLINE		37
+#define NAT_EXT_PER_BLOCK	42
+#define NAT_EXT_NEXT		111
+#define NAT_EXT_COUNT		112
+
 #include <sys/types.h>
 #include <stdint.h>
 
@@ -54,6 +79,12 @@ struct nat_super
 	uint8_t	 ndirblks;
 	uint8_t	 nindirlev;
 	int	 dirty;
+	uint32_t features;
+	uint32_t features_chk;
+	uint32_t log_block;
+	uint32_t log_size;
+	uint32_t log_seq;
+	uint32_t bshift;
 };
 
 struct nat_dirent
@@ -76,8 +107,74 @@ struct nat_header
 	uint32_t rdev;
 	uint8_t	 ndirblks;
 	uint8_t	 nindirlev;
-	uint16_t padding;
+	uint16_t flags;
 	uint32_t bmap[114];
 };
 
+/*
+ * Index block of a hashed directory.  Each 32-byte slot keeps the
+ * first_block member of a directory entry zero, so programs that read
+ * the directory as a flat array of entries see an empty block.  An
+ * entry of a level 0 block holds the hash of a name and the number of
+ * its directory entry counted from the start of the directory; in
+ * upper levels it holds the lowest hash below a child block and the
+ * logical block number of the child.
+ */
+struct nat_hent
+{
+	uint32_t hash;
+	uint32_t log;
+};
+
+struct nat_hslot
+{
+	struct nat_hent ent[3];
+	uint32_t spare;
+	uint32_t zero;
+};
+
+struct nat_hnode
+{
+	uint32_t magic;
+	uint32_t level;
+	uint32_t count;
+	uint32_t spare[4];
+	uint32_t zero;
+	struct nat_hslot slot[15];
+};
+
+#define NAT_HENT(n, i)		((n)->slot[(i) / 3].ent[(i) % 3])
+
+/*
+ * In a file with NAT_HF_EXTENT set, bmap holds NAT_EXT_INLINE extents,
+ * the number of the first overflow extent block in bmap[NAT_EXT_NEXT]
+ * and the total number of extents in bmap[NAT_EXT_COUNT].  Extents are
+ * kept in allocation order, not sorted by logical block.
+ */
+struct nat_extent
+{
+	uint32_t log;
+	uint32_t phys;
+	uint32_t len;
+};
+
+struct nat_extblk
+{
+	struct nat_extent ext[NAT_EXT_PER_BLOCK];
+	uint32_t next;
+	uint32_t spare;
+};
+
+#define NAT_EXTENTS(bmap)	((struct nat_extent *)(bmap))
+
+struct nat_log_head
+{
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t count;
+	uint32_t commit;
+	uint32_t sum;
+	uint32_t blocks[NAT_LOG_NBLK];
+};
+
 #endif
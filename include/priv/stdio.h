@@ -31,4 +31,6 @@
 
 extern FILE files[OPEN_MAX];
 
+int __libc_fbuf(FILE *f);
+
 #endif
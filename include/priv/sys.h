@@ -44,6 +44,8 @@ int _exec(const char *name, const void *arg, int arg_size);
 /* filesystem */
 
 int _poll(struct pollfd *pfd, int cnt, int ndelay);
+int _pset_ctl(int fd, int events, int flags);
+int _pset_wait(struct pollfd *pfd, int cnt, int ndelay);
 
 int _mknod(const char *path, mode_t mode, dev_t dev);
 int _mkdir(const char *path, mode_t mode);
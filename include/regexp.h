@@ -37,6 +37,7 @@ typedef struct
 
 regexp *regcomp(const char *rxs);
 int	regexec(regexp *rx, const char *str);
+void	regfree(regexp *rx);
 void	regdump(regexp *rx);
 
 #endif
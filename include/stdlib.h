@@ -71,6 +71,7 @@ void *		malloc(size_t size);
 void		free(void *ptr);
 void *		realloc(void *ptr, size_t size);
 void *		calloc(size_t n, size_t m);
+void		malloc_stats(void);
 
 unsigned long long
 		strtoull(const char *nptr, char **endptr, int base);
@@ -32,4 +32,7 @@ int ioctl(int fd, int cmd, void *buf);
 #define FIOCBMAP	0xff01
 #define FIOCXSTAT	0xff02
 
+#define PIOCGSIZE	0xff10
+#define PIOCSSIZE	0xff11
+
 #endif
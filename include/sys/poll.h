@@ -34,6 +34,8 @@
 #define POLLERR		16
 #define POLLHUP		32
 
+#define PS_EDGE		1	/* report only on a newly set condition */
+
 struct pollfd
 {
 	int revents;
@@ -43,4 +45,7 @@ struct pollfd
 
 int poll(struct pollfd *fd, unsigned cnt, int timeout);
 
+int pset_ctl(int fd, int events, int flags);
+int pset_wait(struct pollfd *fd, unsigned cnt, int timeout);
+
 #endif
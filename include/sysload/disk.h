@@ -42,6 +42,7 @@ struct disk
 	int	 unit;
 	
 	int	(*read)(struct disk *dk, blk_t blk, void *buf);
+	int	(*readn)(struct disk *dk, blk_t blk, unsigned cnt, void *buf);
 	
 	long	l_data;
 	void *	p_data;
@@ -53,6 +54,7 @@ extern struct disk *disk_list;
 struct disk *disk_find(const char *name);
 
 int  disk_read(struct disk *dk, blk_t blk, void *buf);
+int  disk_readn(struct disk *dk, blk_t blk, unsigned cnt, void *buf);
 void disk_init();
 
 #endif
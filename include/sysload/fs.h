@@ -50,6 +50,7 @@ struct fs
 	struct disk *	disk;
 	
 	struct nat_super sb;
+	int		bshift;
 };
 
 struct file
@@ -80,6 +80,8 @@ struct taskinfo
 	unsigned	maxev;
 	int		prio;
 	int		cpu;
+	unsigned	evmerged;
+	unsigned	evdropped;
 };
 
 struct modinfo
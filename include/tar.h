@@ -27,6 +27,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#define TAR_BLKSIZE	512
+#define TAR_BUFSIZE	65536
+
 #define TAR_LT_REG	'0'
 #define TAR_LT_HARD	'1'
 #define TAR_LT_SYMBOLIC	'2'
@@ -71,8 +74,40 @@ struct tar
 	int	fd;
 };
 
+struct tar_stream
+{
+	struct tar_file file;
+	char		pathname[101];
+	char		link[101];
+	
+	off_t		append_offset;
+	off_t		off;
+	off_t		left;
+	off_t		pad;
+	
+	char *		buf;
+	size_t		pos;
+	size_t		len;
+	
+	int		seekable;
+	int		zero;
+	int		eof;
+	int		wr;
+	int		fd;
+};
+
 struct tar *tar_openw(const char *pathname);
 struct tar *tar_open(const char *pathname);
 void tar_close(struct tar *tar);
 
 ssize_t tar_read(const struct tar *tar, const struct tar_file *file, void *buf, size_t len, off_t off);
+
+struct tar_stream *tar_sopen(int fd, int wr);
+int tar_sclose(struct tar_stream *ts);
+
+int tar_snext(struct tar_stream *ts, const struct tar_file **file);
+ssize_t tar_sdata(struct tar_stream *ts, const void **buf);
+
+int tar_swrhdr(struct tar_stream *ts, const struct tar_hdr *hd);
+int tar_swrite(struct tar_stream *ts, const void *buf, size_t len);
+int tar_spad(struct tar_stream *ts);
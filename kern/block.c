@@ -36,16 +36,20 @@
 #include <list.h>
 
 #define BLK_NR_LISTS	64
+#define BLK_NVIEW	512
 
 #define SYNC_PWRITE	0
 
 struct bdev *blk_dev[BLK_MAXDEV];
 
 static struct list blk_lists[BLK_NR_LISTS];
-static struct list blk_lru;
+static struct list blk_lru[BLK_MAXSHIFT + 1];
 
 static struct block **blk_blk;
 static int blk_count;
+static struct block *blk_vpool[BLK_MAXSHIFT + 1];
+static int blk_nview[BLK_MAXSHIFT + 1];
+static int blk_vcount;
 
 void blk_stat(struct blk_stat *buf)
 {
@@ -86,6 +90,32 @@ static void blk_check(void)
 #define blk_check()
 #endif
 
+static int blk_alloc(struct block **bp, int bshift, int count)
+{
+	unsigned size = BLK_SIZE << bshift;
+	struct block *b;
+	char *data;
+	int err;
+	int i;
+	
+	err = kmalloc(&b, sizeof *b * count, "block");
+	if (err)
+		return err;
+	
+	err = kmalloc(&data, size * count, "blkdata");
+	if (err)
+	{
+		free(b);
+		return err;
+	}
+	memset(b, 0, sizeof *b * count);
+	
+	for (i = 0; i < count; i++)
+		b[i].data = data + size * i;
+	*bp = b;
+	return 0;
+}
+
 void blk_init(void)
 {
 	struct block *p;
@@ -96,19 +126,19 @@ void blk_init(void)
 	if (err)
 		panic("blk_init: could not allocate blk_blk");
 	
-	err = kmalloc(&p, sizeof(struct block) * BLK_NBLK, "block");
+	err = blk_alloc(&p, 0, BLK_NBLK);
 	if (err)
 		panic("blk_init: could not allocate memory for disk cache");
-	memset(p, 0, sizeof(struct block) * BLK_NBLK);
 	
 	for (i = 0; i < BLK_NR_LISTS; i++)
 		list_init(&blk_lists[i], struct block, list_item);
-	list_init(&blk_lru, struct block, lru_item);
+	for (i = 0; i <= BLK_MAXSHIFT; i++)
+		list_init(&blk_lru[i], struct block, lru_item);
 	
 	for (i = 0; i < BLK_NBLK; i++, p++)
 	{
 		list_app(&blk_lists[0], p); /* XXX */
-		list_app(&blk_lru, p);
+		list_app(&blk_lru[0], p);
 		blk_blk[i] = p;
 	}
 	blk_count = BLK_NBLK;
@@ -184,13 +214,14 @@ int blk_find(struct bdev **dev, const char *name)
 
 int blk_get(struct block **blkp, struct bdev *dev, blk_t nr)
 {
+	struct list *lru = &blk_lru[dev->bshift];
 	struct block *b;
 	struct list *l;
 	int loop_det;
 	
 	blk_check();
 	
-	loop_det = blk_count;
+	loop_det = blk_count + blk_vcount;
 	l = &blk_lists[nr % BLK_NR_LISTS];
 	for (b = list_first(l); b; b = list_next(l, b))
 	{
@@ -200,7 +231,7 @@ int blk_get(struct block **blkp, struct bdev *dev, blk_t nr)
 		if ((b->refcnt || b->valid) && b->nr == nr && b->dev == dev)
 		{
 			if (!b->refcnt)
-				list_rm(&blk_lru, b);
+				list_rm(lru, b);
 			
 			b->refcnt++;
 			*blkp = b;
@@ -209,14 +240,14 @@ int blk_get(struct block **blkp, struct bdev *dev, blk_t nr)
 		}
 	}
 	
-	b = list_first(&blk_lru);
+	b = list_first(lru);
 	if (!b)
 	{
 		printk("blk_get: out of disk buffers\n");
 		return ENOMEM;
 	}
 	list_rm(&blk_lists[b->nr % BLK_NR_LISTS], b);
-	list_rm(&blk_lru, b);
+	list_rm(lru, b);
 	
 	if (b->dirty)
 		blk_write(b);
@@ -233,6 +264,47 @@ int blk_get(struct block **blkp, struct bdev *dev, blk_t nr)
 	return 0;
 }
 
+/*
+ * A block of a view spans several device blocks. A view may also read
+ * its blocks from other locations, through its remap hook; such a view
+ * is only used for reading.
+ */
+static int blk_devread(struct block *b)
+{
+	struct bdev *dev = b->dev;
+	blk_t nr = b->nr;
+	int err;
+	int i;
+	
+	if (dev->remap)
+		nr = dev->remap(dev, nr);
+	nr <<= dev->bshift;
+	
+	for (i = 0; i < 1 << dev->bshift; i++)
+	{
+		err = dev->read(dev->unit, nr + i, b->data + i * BLK_SIZE);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int blk_devwrite(struct block *b)
+{
+	struct bdev *dev = b->dev;
+	blk_t nr = b->nr << dev->bshift;
+	int err;
+	int i;
+	
+	for (i = 0; i < 1 << dev->bshift; i++)
+	{
+		err = dev->write(dev->unit, nr + i, b->data + i * BLK_SIZE);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
 int blk_read(struct block **blkp, struct bdev *dev, blk_t nr)
 {
 	struct block *b = NULL;
@@ -245,7 +317,7 @@ int blk_read(struct block **blkp, struct bdev *dev, blk_t nr)
 	if (b->valid)
 		goto fini;
 	
-	err = dev->read(dev->unit, b->nr, b->data);
+	err = blk_devread(b);
 	if (err)
 	{
 		dev->error_cnt++;
@@ -271,7 +343,7 @@ int blk_put(struct block *blk)
 		panic("blk_put: !blk->refcnt");
 	blk->refcnt--;
 	if (!blk->refcnt)
-		list_app(&blk_lru, blk);
+		list_app(&blk_lru[blk->dev->bshift], blk);
 	blk_check();
 	return 0;
 }
@@ -288,7 +360,7 @@ int blk_write(struct block *b)
 	
 	b->dirty = 0;
 	
-	err = b->dev->write(b->dev->unit, b->nr, b->data);
+	err = blk_devwrite(b);
 	
 	if (err)
 		b->dev->error_cnt++;
@@ -332,6 +404,85 @@ int blk_close(struct bdev *dev)
 	return 0;
 }
 
+/*
+ * Create a view of dev with blocks of BLK_SIZE << bshift bytes, for a
+ * filesystem with blocks larger than the device's.  The blocks of a
+ * view are cached apart from those of the device, in a pool of buffers
+ * of their own size shared by the views of that size.  The pool is
+ * freed with the last of them.
+ */
+int blk_view(struct bdev **view, struct bdev *dev, int bshift)
+{
+	struct block *b;
+	int err;
+	int i;
+	
+	if (bshift < 0 || bshift > BLK_MAXSHIFT || dev->bshift)
+		return EINVAL;
+	
+	err = kmalloc(view, sizeof **view, "bview");
+	if (err)
+		return err;
+	
+	if (bshift && !blk_nview[bshift])
+	{
+		err = blk_alloc(&b, bshift, BLK_NVIEW);
+		if (err)
+		{
+			free(*view);
+			return err;
+		}
+		blk_vpool[bshift] = b;
+		
+		for (i = 0; i < BLK_NVIEW; i++, b++)
+		{
+			list_app(&blk_lists[0], b);
+			list_app(&blk_lru[bshift], b);
+		}
+		blk_vcount += BLK_NVIEW;
+	}
+	if (bshift)
+		blk_nview[bshift]++;
+	
+	**view = *dev;
+	(*view)->bshift	   = bshift;
+	(*view)->remap	   = NULL;
+	(*view)->refcnt	   = 0;
+	(*view)->read_cnt  = 0;
+	(*view)->write_cnt = 0;
+	(*view)->error_cnt = 0;
+	return 0;
+}
+
+void blk_unview(struct bdev *view)
+{
+	int bshift = view->bshift;
+	struct block *b;
+	int i;
+	
+	blk_syncdev(view, SYNC_WRITE | SYNC_INVALIDATE);
+	free(view);
+	
+	if (!bshift || --blk_nview[bshift])
+		return;
+	
+	b = blk_vpool[bshift];
+	for (i = 0; i < BLK_NVIEW; i++)
+		if (b[i].refcnt)
+			panic("blk_unview: view in use");
+	
+	for (i = 0; i < BLK_NVIEW; i++)
+	{
+		list_rm(&blk_lists[b[i].nr % BLK_NR_LISTS], &b[i]);
+		list_rm(&blk_lru[bshift], &b[i]);
+	}
+	blk_vcount -= BLK_NVIEW;
+	blk_vpool[bshift] = NULL;
+	
+	free(b->data);
+	free(b);
+}
+
 int blk_pread(struct bdev *dev, blk_t nr, unsigned off, unsigned len, void *buf)
 {
 	struct block *b;
@@ -351,7 +502,7 @@ int blk_pwrite(struct bdev *dev, blk_t nr, unsigned off, unsigned len, void *buf
 	struct block *b;
 	int err;
 	
-	if (len != BLK_SIZE)
+	if (len != BLK_SIZE << dev->bshift)
 		err = blk_read(&b, dev, nr);
 	else
 		err = blk_get(&b, dev, nr);
@@ -375,9 +526,10 @@ int blk_pwrite(struct bdev *dev, blk_t nr, unsigned off, unsigned len, void *buf
 
 int blk_syncdev(struct bdev *dev, int flags)
 {
+	struct list *lru = &blk_lru[dev->bshift];
 	struct block *b;
 	
-	for (b = list_first(&blk_lru); b; b = list_next(&blk_lru, b)) /* XXX */
+	for (b = list_first(lru); b; b = list_next(lru, b)) /* XXX */
 		if (b->dev == dev)
 		{
 			if ((flags & SYNC_WRITE) && b->dirty)
@@ -391,14 +543,16 @@ int blk_syncdev(struct bdev *dev, int flags)
 int blk_syncall(int flags)
 {
 	struct block *b;
+	int i;
 	
-	for (b = list_first(&blk_lru); b; b = list_next(&blk_lru, b)) /* XXX */
-	{
-		if ((flags & SYNC_WRITE) && b->dirty)
-			blk_write(b);
-		if ((flags & SYNC_INVALIDATE) && !b->dirty)
-			b->valid = 0;
-	}
+	for (i = 0; i <= BLK_MAXSHIFT; i++)
+		for (b = list_first(&blk_lru[i]); b; b = list_next(&blk_lru[i], b)) /* XXX */
+		{
+			if ((flags & SYNC_WRITE) && b->dirty)
+				blk_write(b);
+			if ((flags & SYNC_INVALIDATE) && !b->dirty)
+				b->valid = 0;
+		}
 	return 0;
 }
 
@@ -420,14 +574,13 @@ int blk_add(int count)
 		return err;
 	blk_blk = p;
 	
-	err = kmalloc(&b, sizeof *b * (count - blk_count), "block");
+	err = blk_alloc(&b, 0, count - blk_count);
 	if (err)
 		return err;
-	memset(b, 0, sizeof *b * (count - blk_count));
 	
 	for (i = blk_count; i < count; i++, b++)
 	{
-		list_pre(&blk_lru, b);
+		list_pre(&blk_lru[0], b);
 		blk_blk[i] = b;
 	}
 	blk_count = count;
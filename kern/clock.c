@@ -29,6 +29,7 @@
 #include <kern/sched.h>
 #include <kern/clock.h>
 #include <kern/intr.h>
+#include <kern/errno.h>
 #include <kern/task.h>
 #include <kern/lib.h>
 
@@ -239,3 +240,25 @@ int clock_ihand(void (*proc)(void))
 {
 	return clock_ihand2((void *)proc, NULL); /* XXX */
 }
+
+/*
+ * Remove a handler installed with clock_ihand, so that a module can be
+ * unloaded.  The table is shortened in place.
+ */
+int clock_iunhand(void (*proc)(void))
+{
+	int s;
+	int i;
+	
+	s = intr_dis();
+	for (i = 0; i < clock_proc_cnt; i++)
+		if (clock_procs[i].proc == (void *)proc)
+		{
+			memmove(&clock_procs[i], &clock_procs[i + 1], (clock_proc_cnt - i - 1) * sizeof *clock_procs);
+			clock_proc_cnt--;
+			intr_res(s);
+			return 0;
+		}
+	intr_res(s);
+	return ENOENT;
+}
@@ -28,8 +28,99 @@
 #include <kern/errno.h>
 #include <kern/task.h>
 #include <kern/intr.h>
+#include <wingui.h>
 #include <event.h>
 
+static int merge_redraw(volatile struct event *qe, struct event *e)
+{
+	int x0, y0, x1, y1;
+	
+	if (qe->win.redraw_x > e->win.redraw_x + e->win.redraw_w)
+		return 0;
+	if (qe->win.redraw_y > e->win.redraw_y + e->win.redraw_h)
+		return 0;
+	if (e->win.redraw_x > qe->win.redraw_x + qe->win.redraw_w)
+		return 0;
+	if (e->win.redraw_y > qe->win.redraw_y + qe->win.redraw_h)
+		return 0;
+	
+	x0 = qe->win.redraw_x;
+	y0 = qe->win.redraw_y;
+	x1 = qe->win.redraw_x + qe->win.redraw_w;
+	y1 = qe->win.redraw_y + qe->win.redraw_h;
+	
+	if (x0 > e->win.redraw_x)
+		x0 = e->win.redraw_x;
+	if (y0 > e->win.redraw_y)
+		y0 = e->win.redraw_y;
+	if (x1 < e->win.redraw_x + e->win.redraw_w)
+		x1 = e->win.redraw_x + e->win.redraw_w;
+	if (y1 < e->win.redraw_y + e->win.redraw_h)
+		y1 = e->win.redraw_y + e->win.redraw_h;
+	
+	qe->win.redraw_x = x0;
+	qe->win.redraw_y = y0;
+	qe->win.redraw_w = x1 - x0;
+	qe->win.redraw_h = y1 - y0;
+	return 1;
+}
+
+/*
+ * Try to fold a pointer move or redraw request into an event already in
+ * the queue. The event at first_event may be in the middle of being
+ * copied out by _evt_wait, so it is never modified.
+ *
+ * Must be called with interrupts disabled.
+ */
+static int coalesce_event(struct task *task, struct event *e)
+{
+	volatile struct event *qe;
+	int cnt;
+	int i;
+	
+	if (e->type != E_WINGUI)
+		return 0;
+	
+	cnt = task->event_count - 1;
+	i   = task->last_event;
+	
+	switch (e->win.type)
+	{
+	case WIN_E_PTR_MOVE:
+		if (cnt <= 0)
+			return 0;
+		
+		qe = &task->event[i];
+		if (qe->type != E_WINGUI || qe->win.type != WIN_E_PTR_MOVE)
+			return 0;
+		if (qe->win.wd != e->win.wd || qe->proc != e->proc)
+			return 0;
+		
+		*qe = *e;
+		return 1;
+	case WIN_E_REDRAW:
+		for (; cnt > 0; cnt--)
+		{
+			qe = &task->event[i];
+			
+			if (qe->type == E_WINGUI && qe->win.wd == e->win.wd && qe->proc == e->proc)
+			{
+				if (qe->win.type != WIN_E_REDRAW)
+					return 0;
+				
+				if (merge_redraw(qe, e))
+					return 1;
+			}
+			
+			if (!i--)
+				i = EVT_MAX - 1;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
 int send_event(struct task *task, struct event *event)
 {
 	int cnt;
@@ -37,8 +128,18 @@ int send_event(struct task *task, struct event *event)
 	int i;
 	
 	s = intr_dis();
+	if (coalesce_event(task, event))
+	{
+		task->event_merged++;
+		task->unseen_events++;
+		intr_res(s);
+		signal_send_k(task, SIGEVT);
+		return 0;
+	}
+	
 	if (task->event_count >= EVT_MAX)
 	{
+		task->event_dropped++;
 		intr_res(s);
 		return EAGAIN;
 	}
@@ -46,11 +147,13 @@ int send_event(struct task *task, struct event *event)
 	task->unseen_events++;
 	task->last_event++;
 	i = task->last_event %= EVT_MAX;
+	
+	/* coalesce_event may merge into this slot as soon as it is queued */
+	task->event[i] = *event;
 	intr_res(s);
 	
 	if (cnt > task->event_high)
 		task->event_high = cnt;
-	task->event[i] = *event;
 	signal_send_k(task, SIGEVT);
 	return 0;
 }
@@ -198,6 +198,7 @@ int do_exec(void)
 	for (i = 0; i < OPEN_MAX; i++)
 		if (curr->file_desc[i].close_on_exec)
 			fs_putfd(i);
+	fs_psetclean();
 	
 	curr->alarm_repeat = 0;
 	curr->alarm = 0;
@@ -210,6 +211,9 @@ int do_exec(void)
 	curr->event_count = 0;
 	curr->last_event  = -1;
 	
+	curr->event_merged  = 0;
+	curr->event_dropped = 0;
+	
 	if (!ldr_image)
 	{
 		load_ldr();
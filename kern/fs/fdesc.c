@@ -124,6 +124,7 @@ int fs_putfd(unsigned fd)
 	if (!curr->file_desc[fd].file)
 		return EBADF;
 	
+	fs_psetclose(fd);
 	fs_putfile(curr->file_desc[fd].file);
 	memset(&curr->file_desc[fd], 0, sizeof(struct fs_desc));
 	return 0;
@@ -340,7 +340,8 @@ void fs_clrstate(struct fso *fso, int state)
 
 void fs_state(struct fso *f, int state)
 {
-	struct task *t;
+	struct fs_pollent *pe;
+	int changed;
 	int s;
 	
 	s = intr_dis();
@@ -349,17 +350,92 @@ void fs_state(struct fso *f, int state)
 		intr_res(s);
 		return;
 	}
+	changed = state & ~f->state;
 	f->state = state;
+	
+	/*
+	 * Only the tasks interested in this object are woken; an edge
+	 * triggered entry is marked pending only on a newly set bit.
+	 */
+	for (pe = f->polls; pe != NULL; pe = pe->next)
+	{
+		if (pe->flags & PS_EDGE)
+		{
+			if (!(changed & pe->events))
+				continue;
+			pe->pending = 1;
+		}
+		else if (!(state & pe->events))
+			continue;
+		
+		if (pe->task->pollwait)
+		{
+			pe->task->pollwait = 0;
+			task_resume(pe->task);
+		}
+	}
+	intr_res(s);
+}
+
+void fs_pollreg(struct fs_pollent *pe)
+{
+	struct fso *f = pe->fso;
+	int s;
+	
+	s = intr_dis();
+	pe->prev = NULL;
+	pe->next = f->polls;
+	if (f->polls != NULL)
+		f->polls->prev = pe;
+	f->polls = pe;
+	intr_res(s);
+}
+
+void fs_pollunreg(struct fs_pollent *pe)
+{
+	int s;
+	
+	s = intr_dis();
+	if (pe->prev != NULL)
+		pe->prev->next = pe->next;
+	else
+		pe->fso->polls = pe->next;
+	if (pe->next != NULL)
+		pe->next->prev = pe->prev;
+	pe->next = NULL;
+	pe->prev = NULL;
 	intr_res(s);
+}
+
+void fs_psetclose(unsigned fd)
+{
+	struct fs_pollent **pp;
+	struct fs_pollent *pe;
 	
-	if (f->polling != NULL)
+	pp = &curr->pset;
+	while (pe = *pp, pe != NULL)
 	{
-		task_resume(f->polling);
-		return;
+		if (pe->fd != fd)
+		{
+			pp = &pe->tnext;
+			continue;
+		}
+		*pp = pe->tnext;
+		fs_pollunreg(pe);
+		free(pe);
+	}
+}
+
+void fs_psetclean(void)
+{
+	struct fs_pollent *pe;
+	
+	while (pe = curr->pset, pe != NULL)
+	{
+		curr->pset = pe->tnext;
+		fs_pollunreg(pe);
+		free(pe);
 	}
-	if (f->pollcnt)
-		while (t = task_dequeue(&fs_pollq), t != NULL)
-			task_resume(t);
 }
 
 int fs_sync(struct fs *fs)
@@ -428,6 +504,8 @@ void fs_newtask(struct task *p)
 	strcpy(p->cwd, curr->cwd);
 	strcpy(p->tty, curr->tty);
 	p->ocwd = curr->ocwd;
+	p->pollwait = 0;
+	p->pset = NULL;
 	
 	for (i = 0; i < OPEN_MAX; i++)
 		if (p->file_desc[i].file)
@@ -438,7 +516,7 @@ void fs_clean(void)
 {
 	int i;
 	
-	curr->multipoll = 0;
+	fs_psetclean();
 	
 	for (i = 0; i < OPEN_MAX; i++)
 		if (curr->file_desc[i].file)
@@ -32,8 +32,6 @@
 #include <kern/lib.h>
 #include <sys/stat.h>
 
-#define BLK_PER_BLK	(BLK_SIZE / sizeof(blk_t))
-
 int nat_switch_bam(struct fs *fs, blk_t blk)
 {
 	int err;
@@ -42,7 +40,7 @@ int nat_switch_bam(struct fs *fs, blk_t blk)
 		return 0;
 	
 	nat_sync_bam(fs);
-	err = blk_pread(fs->dev, blk, 0, BLK_SIZE, fs->nat.bam_buf);
+	err = blk_pread(fs->nat.dev, blk, 0, NAT_BSIZE(fs), fs->nat.bam_buf);
 	if (err)
 	{
 		fs->nat.bam_curr = 0;
@@ -57,12 +55,12 @@ int nat_read_bam(struct fs *fs, blk_t blk, int *bused)
 	int mask, i;
 	int err;
 	
-	err = nat_switch_bam(fs, fs->nat.bam_block + blk / BLK_SIZE / 8);
+	err = nat_switch_bam(fs, fs->nat.bam_block + blk / NAT_BSIZE(fs) / 8);
 	if (err)
 		return err;
 	
 	mask = (1 << (blk & 7));
-	i    = (blk / 8) % BLK_SIZE;
+	i    = (blk / 8) % NAT_BSIZE(fs);
 	
 	*bused = !!(fs->nat.bam_buf[i] & mask);
 	return 0;
@@ -73,13 +71,13 @@ int nat_write_bam(struct fs *fs, blk_t blk, int bused)
 	int mask, val, i;
 	int err;
 	
-	err = nat_switch_bam(fs, fs->nat.bam_block + blk / BLK_SIZE / 8);
+	err = nat_switch_bam(fs, fs->nat.bam_block + blk / NAT_BSIZE(fs) / 8);
 	if (err)
 		return err;
 	
 	mask =   ~(1 << (blk & 7));
 	val  = bused << (blk & 7);
-	i    = (blk / 8) % BLK_SIZE;
+	i    = (blk / 8) % NAT_BSIZE(fs);
 	
 	fs->nat.bam_buf[i] &= mask;
 	fs->nat.bam_buf[i] |= val;
@@ -89,22 +87,29 @@ int nat_write_bam(struct fs *fs, blk_t blk, int bused)
 
 int nat_sync_bam(struct fs *fs)
 {
+	int err;
+	
 	if (!fs->nat.bam_dirty)
 		return 0;
 	fs->nat.bam_dirty = 0;
 	
-	return blk_pwrite(fs->dev, fs->nat.bam_curr, 0, BLK_SIZE, fs->nat.bam_buf);
+	err = blk_pwrite(fs->nat.dev, fs->nat.bam_curr, 0, NAT_BSIZE(fs), fs->nat.bam_buf);
+	if (err)
+		return err;
+	return nat_log_add(fs, fs->nat.bam_curr);
 }
 
 int nat_balloc(struct fs *fs, blk_t *blk)
 {
-	uint32_t *bamp, *ebam = (void *)(fs->nat.bam_buf + BLK_SIZE);
+	uint32_t *bamp, *ebam = (void *)(fs->nat.bam_buf + NAT_BSIZE(fs));
 	uint32_t bamw;
+	int held = 0;
 	blk_t bn;
 	blk_t i;
+	int bit;
 	int err;
 	
-	i = fs->nat.data_block / BLK_SIZE / 8;
+	i = fs->nat.data_block / NAT_BSIZE(fs) / 8;
 	for (; i < fs->nat.bam_size; i++)
 	{
 		err = nat_switch_bam(fs, fs->nat.bam_block + i);
@@ -115,32 +120,56 @@ int nat_balloc(struct fs *fs, blk_t *blk)
 		{
 			if (*bamp == 0xffffffff)
 				continue;
-			bamw = *bamp;
-			break;
-		}
-		if (bamp == ebam)
-			continue;
-		
-		bn = 0;
-		while (bamw & 1)
-		{
-			bamw >>= 1;
-			bn++;
+			
+			bn  = ((char *)bamp - fs->nat.bam_buf) * 8;
+			bn += i * NAT_BSIZE(fs) * 8;
+			
+			for (bamw = *bamp, bit = 0; bit < 32; bamw >>= 1, bit++)
+			{
+				if (bamw & 1)
+					continue;
+				
+				/* a log replay would overwrite it */
+				if (nat_log_held(fs, bn + bit))
+				{
+					held = 1;
+					continue;
+				}
+				
+				*bamp |= 1 << bit;
+				fs->nat.bam_dirty = 1;
+				
+				*blk = bn + bit;
+				return 0;
+			}
 		}
-		*bamp |= 1 << (bn & 31);
-		fs->nat.bam_dirty = 1;
-		
-		bn += ((char *)bamp - fs->nat.bam_buf) * 8;
-		bn += i * BLK_SIZE * 8;
-		
-		*blk = bn;
-		return 0;
 	}
 	
+	/* the held blocks are released by the next checkpoint */
+	if (held)
+		fs->nat.log_ckpt = 1;
+	
 	printk("nat_balloc: no space left on device %s\n", fs->dev->name);
 	return ENOSPC;
 }
 
+int nat_balloc_at(struct fs *fs, blk_t blk)
+{
+	int bused;
+	int err;
+	
+	if (blk < fs->nat.data_block || blk >= fs->nat.data_block + fs->nat.data_size)
+		return ENOSPC;
+	
+	err = nat_read_bam(fs, blk, &bused);
+	if (err)
+		return err;
+	if (bused || nat_log_held(fs, blk))
+		return ENOSPC;
+	
+	return nat_write_bam(fs, blk, 1);
+}
+
 int nat_bfree(struct fs *fs, blk_t blk)
 {
 	if (fs->nat.free_block > blk)
@@ -162,14 +191,18 @@ int nat_bmap_dir(struct fso *fso, blk_t log, int alloc, blk_t *blk)
 		if (err)
 			return err;
 		
-		err = blk_get(&bb, fso->fs->dev, bn);
+		err = blk_get(&bb, fso->fs->nat.dev, bn);
 		if (err)
 			return err;
 		
-		memset(bb->data, 0, BLK_SIZE);
+		memset(bb->data, 0, NAT_BSIZE(fso->fs));
 		bb->dirty = 1;
 		bb->valid = 1;
+		if (log >= fso->nat.ndirblks || S_ISDIR(fso->mode))
+			err = nat_log_add(fso->fs, bn);
 		blk_put(bb);
+		if (err)
+			return err;
 		
 		fso->nat.bmap[log] = bn;
 		fso->blocks++;
@@ -179,18 +212,28 @@ int nat_bmap_dir(struct fso *fso, blk_t log, int alloc, blk_t *blk)
 	return 0;
 }
 
-int nat_bmap(struct fso *fso, blk_t log, int alloc)
+static blk_t nat_bmap_run(uint32_t *map, int i, int n, blk_t bn)
+{
+	blk_t run = 1;
+	
+	if (!bn)
+		return 1;
+	
+	while (i + run < n && map[i + run] == bn + run)
+		run++;
+	return run;
+}
+
+static int nat_bmap_blk(struct fso *fso, blk_t log, int alloc)
 {
 	struct block *bb = NULL, *bb1 = NULL;
 	uint32_t *imap;
+	blk_t run = 1;
 	blk_t bn;
 	int shift;
 	int indl;
 	int err;
 	
-	if (fso->nat.bmap_valid && fso->nat.bmap_log == log && (!alloc || fso->nat.bmap_phys))
-		return 0;
-	
 	if (log < fso->nat.ndirblks)
 	{
 		err = nat_bmap_dir(fso, log, alloc, &bn);
@@ -198,27 +241,29 @@ int nat_bmap(struct fso *fso, blk_t log, int alloc)
 			return err;
 		
 		fso->nat.bmap_phys  = bn;
+		fso->nat.bmap_run   = nat_bmap_run(fso->nat.bmap, log, fso->nat.ndirblks, bn);
 		fso->nat.bmap_log   = log;
 		fso->nat.bmap_valid = 1;
 		return 0;
 	}
 	
 	indl  = fso->nat.nindirlev;
-	shift = 7 * indl;
+	shift = NAT_ISHIFT(fso->fs) * indl;
 	
-	err = nat_bmap_dir(fso, fso->nat.ndirblks + (log >> shift), alloc, &bn);
+	/* with large blocks the indirect levels may cover more than log */
+	err = nat_bmap_dir(fso, fso->nat.ndirblks + (shift < 32 ? log >> shift : 0), alloc, &bn);
 	if (err)
 		return err;
-	shift -= 7;
+	shift -= NAT_ISHIFT(fso->fs);
 	
 	while (bn && indl)
 	{
-		err = blk_read(&bb, fso->fs->dev, bn);
+		err = blk_read(&bb, fso->fs->nat.dev, bn);
 		if (err)
 			return err;
 		imap = (void *)bb->data;
 		
-		bn = imap[(log >> shift) & 127];
+		bn = imap[(log >> shift) & (NAT_I_PER_BLOCK(fso->fs) - 1)];
 		if (!bn)
 		{
 			if (!alloc)
@@ -228,27 +273,38 @@ int nat_bmap(struct fso *fso, blk_t log, int alloc)
 			if (err)
 				goto err;
 			
-			err = blk_get(&bb1, fso->fs->dev, bn);
+			err = blk_get(&bb1, fso->fs->nat.dev, bn);
 			if (err)
 				goto err;
-			memset(bb1->data, 0, BLK_SIZE);
+			memset(bb1->data, 0, NAT_BSIZE(fso->fs));
 			bb1->valid = 1;
 			bb1->dirty = 1;
+			if (indl > 1 || S_ISDIR(fso->mode))
+				err = nat_log_add(fso->fs, bn);
 			blk_put(bb1);
 			bb1 = NULL;
+			if (err)
+				goto err;
 			
-			imap[(log >> shift) & 127] = bn;
+			imap[(log >> shift) & (NAT_I_PER_BLOCK(fso->fs) - 1)] = bn;
 			bb->dirty = 1;
+			err = nat_log_add(fso->fs, bb->nr);
+			if (err)
+				goto err;
 			fso->blocks++;
 			fso->dirty = 1;
 		}
+		if (indl == 1)
+			run = nat_bmap_run(imap, (log >> shift) & (NAT_I_PER_BLOCK(fso->fs) - 1),
+				NAT_I_PER_BLOCK(fso->fs), bn);
 		blk_put(bb);
 		bb = NULL;
-		shift -= 7;
+		shift -= NAT_ISHIFT(fso->fs);
 		indl--;
 	}
 	
 	fso->nat.bmap_phys  = bn;
+	fso->nat.bmap_run   = run;
 	fso->nat.bmap_log   = log;
 	fso->nat.bmap_valid = 1;
 err:
@@ -259,48 +315,165 @@ err:
 	return err;
 }
 
-static int nat_trunc_indir(struct fs *fs, blk_t bn, int indl)
+/*
+ * Translations of recently used runs of contiguous blocks are kept in
+ * a small per-file cache, so that a file read in several places at
+ * once does not walk its indirect blocks again for every block.
+ * Allocation only fills holes and holes are never cached, so the
+ * entries stay valid until the file is truncated.
+ */
+static int nat_bmc_lookup(struct fso *fso, blk_t log)
 {
-	struct block *bb;
-	uint32_t *imap;
-	int err1;
-	int err;
+	blk_t d;
+	int i;
+	
+	for (i = 0; i < NAT_BMC_SIZE; i++)
+	{
+		d = log - fso->nat.bmc[i].log;
+		if (log < fso->nat.bmc[i].log || d >= fso->nat.bmc[i].len)
+			continue;
+		
+		fso->nat.bmap_phys  = fso->nat.bmc[i].phys + d;
+		fso->nat.bmap_run   = fso->nat.bmc[i].len - d;
+		fso->nat.bmap_log   = log;
+		fso->nat.bmap_valid = 1;
+		return 1;
+	}
+	return 0;
+}
+
+static void nat_bmc_add(struct fso *fso)
+{
+	blk_t phys = fso->nat.bmap_phys;
+	blk_t log  = fso->nat.bmap_log;
 	int i;
 	
-	err = blk_read(&bb, fs->dev, bn);
+	for (i = 0; i < NAT_BMC_SIZE; i++)
+		if (fso->nat.bmc[i].len &&
+		    fso->nat.bmc[i].log  + fso->nat.bmc[i].len == log &&
+		    fso->nat.bmc[i].phys + fso->nat.bmc[i].len == phys)
+		{
+			fso->nat.bmc[i].len += fso->nat.bmap_run;
+			return;
+		}
+	
+	i = fso->nat.bmc_next++ % NAT_BMC_SIZE;
+	fso->nat.bmc[i].log  = log;
+	fso->nat.bmc[i].phys = phys;
+	fso->nat.bmc[i].len  = fso->nat.bmap_run;
+}
+
+void nat_bmc_clear(struct fso *fso)
+{
+	memset(fso->nat.bmc, 0, sizeof fso->nat.bmc);
+	fso->nat.bmap_valid = 0;
+}
+
+/*
+ * Map logical block log of fso, allocating it if alloc is set and the
+ * block is a hole.  On return bmap_phys is the physical block, or zero
+ * for a hole, and bmap_run the number of blocks from log on that are
+ * mapped contiguously (one for a hole).
+ */
+int nat_bmap(struct fso *fso, blk_t log, int alloc)
+{
+	int err;
+	
+	if (fso->nat.bmap_valid && fso->nat.bmap_log == log && (!alloc || fso->nat.bmap_phys))
+		return 0;
+	
+	if (nat_bmc_lookup(fso, log))
+		return 0;
+	
+	if (fso->nat.flags & NAT_HF_EXTENT)
+		err = nat_ext_bmap(fso, log, alloc);
+	else
+		err = nat_bmap_blk(fso, log, alloc);
 	if (err)
 		return err;
-	imap = (void *)bb->data;
 	
-	for (i = 0; i < BLK_SIZE / sizeof *imap; i++)
-		if (imap[i])
+	if (fso->nat.bmap_phys)
+		nat_bmc_add(fso);
+	return 0;
+}
+
+/*
+ * Each block is freed and unlinked from its parent before the next one
+ * is looked at, so that the truncation of a large file can be split
+ * into several commits without leaving freed blocks referenced.
+ */
+static int nat_trunc_indir(struct fso *fso, blk_t bn, int indl)
+{
+	struct fs *fs = fso->fs;
+	struct block *bb;
+	uint32_t *imap;
+	blk_t cbn;
+	int err1;
+	int err = 0;
+	int i;
+	
+	for (i = 0; i < NAT_I_PER_BLOCK(fs); i++)
+	{
+		err1 = blk_pread(fs->nat.dev, bn, i * sizeof cbn, sizeof cbn, &cbn);
+		if (err1)
+			return err1;
+		if (!cbn)
+			continue;
+		
+		if (indl)
 		{
-			if (indl)
+			err1 = nat_trunc_indir(fso, cbn, indl - 1);
+			if (err1)
 			{
-				err1 = nat_trunc_indir(fs, imap[i], indl - 1);
 				if (!err)
 					err = err1;
+				continue;
 			}
-			
-			err1 = nat_bfree(fs, imap[i]);
-			if (!err)
-				err = err1;
 		}
-	
-	blk_put(bb);
+		
+		err1 = nat_bfree(fs, cbn);
+		if (err1)
+			return err1;
+		
+		err1 = blk_read(&bb, fs->nat.dev, bn);
+		if (err1)
+			return err1;
+		imap = (void *)bb->data;
+		
+		imap[i]	  = 0;
+		bb->dirty = 1;
+		err1 = nat_log_add(fs, bn);
+		blk_put(bb);
+		if (err1)
+			return err1;
+		
+		fso->blocks--;
+		fso->dirty = 1;
+		
+		err1 = nat_log_split(fs);
+		if (err1)
+			return err1;
+	}
 	return err;
 }
 
 int nat_trunc(struct fso *fso)
 {
+	int err1;
+	int err = 0;
 	blk_t bn;
 	int indl;
 	int i;
 	
+	if (fso->nat.flags & NAT_HF_EXTENT)
+		return nat_ext_trunc(fso);
+	
 	indl = fso->nat.nindirlev;
 	if (indl < 1 || indl > 8)
 		return EINVAL;
 	
+	nat_bmc_clear(fso);
+	
 	for (i = 0; i < sizeof fso->nat.bmap / sizeof *fso->nat.bmap; i++)
 	{
 		bn = fso->nat.bmap[i];
@@ -308,12 +481,31 @@ int nat_trunc(struct fso *fso)
 			continue;
 		
 		if (i >= fso->nat.ndirblks)
-			nat_trunc_indir(fso->fs, bn, indl - 1);
-		nat_bfree(fso->fs, bn);
+		{
+			err1 = nat_trunc_indir(fso, bn, indl - 1);
+			if (err1)
+			{
+				if (!err)
+					err = err1;
+				continue;
+			}
+		}
+		
+		err1 = nat_bfree(fso->fs, bn);
+		if (err1)
+			return err1;
 		
 		fso->nat.bmap[i] = 0;
+		fso->blocks--;
+		fso->dirty = 1;
+		
+		err1 = nat_log_split(fso->fs);
+		if (err1)
+			return err1;
 	}
-	fso->nat.bmap_valid = 0;
+	if (err)
+		return err;
+	
 	fso->dirty  = 1;
 	fso->blocks = 1;
 	fso->size   = 0;
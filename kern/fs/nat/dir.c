@@ -37,6 +37,7 @@ struct dirent_ptr
 {
 	struct nat_dirent *dirent;
 	struct block *block;
+	blk_t slot;
 };
 
 static const char *basename(const char *pathname)
@@ -49,6 +50,525 @@ static const char *basename(const char *pathname)
 	return pathname;
 }
 
+static uint32_t hdir_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+	
+	while (*name)
+	{
+		h ^= (unsigned char)*name++;
+		h *= 16777619;
+	}
+	return h;
+}
+
+static int hdir_read(struct block **b, struct fso *dir, blk_t log_nr)
+{
+	int err;
+	
+	err = nat_bmap(dir, log_nr, 0);
+	if (err)
+		return err;
+	
+	if (!dir->nat.bmap_phys)
+		return EINVAL;
+	
+	return blk_read(b, dir->fs->nat.dev, dir->nat.bmap_phys);
+}
+
+static int hdir_grow(struct block **b, struct fso *dir, blk_t *log_nr)
+{
+	int err;
+	
+	*log_nr = dir->size / NAT_BSIZE(dir->fs);
+	
+	err = nat_bmap(dir, *log_nr, 1);
+	if (err)
+		return err;
+	
+	err = blk_get(b, dir->fs->nat.dev, dir->nat.bmap_phys);
+	if (err)
+		return err;
+	
+	memset((*b)->data, 0, NAT_BSIZE(dir->fs));
+	(*b)->valid = 1;
+	
+	dir->size += NAT_BSIZE(dir->fs);
+	dir->dirty = 1;
+	return 0;
+}
+
+static int hdir_done(struct block *b, struct fso *dir)
+{
+	int err;
+	
+	b->dirty = 1;
+	err = nat_log_add(dir->fs, b->nr);
+	blk_put(b);
+	return err;
+}
+
+/*
+ * A hashed directory keeps its entries where they were first written
+ * and indexes them separately.  Logical block 0 is the root of a tree
+ * of index blocks; the entries of a level 0 index block map the hash
+ * of a name to the slot of its entry, counted in entries from the
+ * start of the directory.  Splitting an index block only moves index
+ * entries, so readdir, which walks the slots, sees every entry once.
+ */
+static int hdir_isindex(struct block *b)
+{
+	struct nat_dirent *d = (void *)b->data;
+	struct nat_hnode *n = (void *)b->data;
+	
+	return n->magic == NAT_HDIR_MAGIC && !d->first_block;
+}
+
+static int hdir_entry(struct block **b, struct nat_dirent **d, struct fso *dir, blk_t slot)
+{
+	int err;
+	
+	err = hdir_read(b, dir, slot / NAT_DENTS(dir->fs));
+	if (err)
+		return err;
+	
+	if (hdir_isindex(*b))
+	{
+		blk_put(*b);
+		return EINVAL;
+	}
+	
+	*d = (struct nat_dirent *)(*b)->data + slot % NAT_DENTS(dir->fs);
+	return 0;
+}
+
+/*
+ * Descend the index from the root at logical block 0 to the level 0
+ * block that covers hash.  The index blocks and entries passed on the
+ * way are recorded in path and pent so that a split can be linked
+ * into the parents.  At level 0, pent is the last entry with a hash
+ * not above hash, or -1.
+ */
+static int hdir_walk(struct fso *dir, uint32_t hash, blk_t *path, int *pent, int *depth)
+{
+	struct nat_hnode *n;
+	struct block *b;
+	blk_t log_nr = 0;
+	int err;
+	int d, i;
+	
+	for (d = 0; d < NAT_HDIR_DEPTH; d++)
+	{
+		err = hdir_read(&b, dir, log_nr);
+		if (err)
+			return err;
+		n = (void *)b->data;
+		
+		if (n->magic != NAT_HDIR_MAGIC || n->count > NAT_HDIR_MAX || (n->level && !n->count))
+		{
+			blk_put(b);
+			return EINVAL;
+		}
+		
+		path[d] = log_nr;
+		
+		if (!n->level)
+		{
+			for (i = 0; i < n->count && NAT_HENT(n, i).hash <= hash; i++);
+			pent[d] = i - 1;
+			*depth	= d;
+			blk_put(b);
+			return 0;
+		}
+		
+		for (i = 1; i < n->count && NAT_HENT(n, i).hash <= hash; i++);
+		i--;
+		
+		pent[d] = i;
+		log_nr	= NAT_HENT(n, i).log;
+		blk_put(b);
+	}
+	return EINVAL;
+}
+
+/*
+ * Look the name up among the entries that the level 0 index block
+ * path[depth] lists with its hash.
+ */
+static int hdir_match(struct fso *dir, const char *name, uint32_t hash, blk_t *path, int *pent, int depth, struct dirent_ptr *dptr)
+{
+	struct nat_dirent *d;
+	struct nat_hnode *n;
+	struct block *b, *eb;
+	blk_t slot;
+	int err;
+	int i;
+	
+	err = hdir_read(&b, dir, path[depth]);
+	if (err)
+		return err;
+	n = (void *)b->data;
+	
+	for (i = pent[depth]; i >= 0 && NAT_HENT(n, i).hash == hash; i--)
+	{
+		slot = NAT_HENT(n, i).log;
+		
+		err = hdir_entry(&eb, &d, dir, slot);
+		if (err)
+		{
+			blk_put(b);
+			return err;
+		}
+		
+		if (d->first_block && !strcmp(d->name, name))
+		{
+			blk_put(b);
+			dptr->dirent = d;
+			dptr->block  = eb;
+			dptr->slot   = slot;
+			return 0;
+		}
+		blk_put(eb);
+	}
+	
+	blk_put(b);
+	return ENOENT;
+}
+
+static int hdir_find(struct fso *dir, const char *name, struct dirent_ptr *dptr)
+{
+	blk_t path[NAT_HDIR_DEPTH];
+	int pent[NAT_HDIR_DEPTH];
+	uint32_t h;
+	int depth;
+	int err;
+	
+	h = hdir_hash(name);
+	
+	err = hdir_walk(dir, h, path, pent, &depth);
+	if (err)
+		return err;
+	
+	return hdir_match(dir, name, h, path, pent, depth, dptr);
+}
+
+/*
+ * Insert an index entry for hash and log_nr after entry pent[d] of
+ * index block path[d], splitting full index blocks up to the root.
+ * A level 0 block is split at the hash boundary nearest to its middle,
+ * so that entries with equal hashes stay together.  The root stays at
+ * logical block 0: when it splits, both halves move to new blocks and
+ * the root gains a level.
+ */
+static int hdir_link(struct fso *dir, blk_t *path, int *pent, int d, uint32_t hash, blk_t log_nr)
+{
+	struct nat_hent ent[NAT_HDIR_MAX + 1];
+	struct nat_hnode *n, *nn;
+	struct block *b, *nb;
+	blk_t nlog, llog;
+	int half = -1;
+	int level;
+	int count;
+	int dist;
+	int err;
+	int i;
+	
+	for (;;)
+	{
+		err = hdir_read(&b, dir, path[d]);
+		if (err)
+			return err;
+		n = (void *)b->data;
+		
+		if (n->count < NAT_HDIR_MAX)
+		{
+			for (i = n->count - 1; i > pent[d]; i--)
+				NAT_HENT(n, i + 1) = NAT_HENT(n, i);
+			NAT_HENT(n, pent[d] + 1).hash = hash;
+			NAT_HENT(n, pent[d] + 1).log  = log_nr;
+			n->count++;
+			return hdir_done(b, dir);
+		}
+		
+		count = 0;
+		if (pent[d] < 0)
+		{
+			ent[count].hash = hash;
+			ent[count].log	= log_nr;
+			count++;
+		}
+		for (i = 0; i < n->count; i++)
+		{
+			ent[count++] = NAT_HENT(n, i);
+			if (i == pent[d])
+			{
+				ent[count].hash = hash;
+				ent[count].log	= log_nr;
+				count++;
+			}
+		}
+		level = n->level;
+		
+		for (dist = 0, half = -1; dist <= count / 2 && half < 0; dist++)
+		{
+			i = count / 2 - dist;
+			if (i > 0 && ent[i - 1].hash != ent[i].hash)
+				half = i;
+			
+			i = count / 2 + dist;
+			if (half < 0 && i < count && ent[i - 1].hash != ent[i].hash)
+				half = i;
+		}
+		if (half < 0)
+		{
+			blk_put(b);
+			return EFBIG;
+		}
+		
+		err = hdir_grow(&nb, dir, &nlog);
+		if (err)
+		{
+			blk_put(b);
+			return err;
+		}
+		nn = (void *)nb->data;
+		nn->magic = NAT_HDIR_MAGIC;
+		nn->level = level;
+		nn->count = count - half;
+		for (i = half; i < count; i++)
+			NAT_HENT(nn, i - half) = ent[i];
+		err = hdir_done(nb, dir);
+		if (err)
+		{
+			blk_put(b);
+			return err;
+		}
+		
+		if (!d)
+		{
+			err = hdir_grow(&nb, dir, &llog);
+			if (err)
+			{
+				blk_put(b);
+				return err;
+			}
+			nn = (void *)nb->data;
+			nn->magic = NAT_HDIR_MAGIC;
+			nn->level = level;
+			nn->count = half;
+			for (i = 0; i < half; i++)
+				NAT_HENT(nn, i) = ent[i];
+			err = hdir_done(nb, dir);
+			if (err)
+			{
+				blk_put(b);
+				return err;
+			}
+			
+			memset(n, 0, NAT_BSIZE(dir->fs));
+			n->magic = NAT_HDIR_MAGIC;
+			n->level = level + 1;
+			n->count = 2;
+			NAT_HENT(n, 0).hash = 0;
+			NAT_HENT(n, 0).log  = llog;
+			NAT_HENT(n, 1).hash = ent[half].hash;
+			NAT_HENT(n, 1).log  = nlog;
+			return hdir_done(b, dir);
+		}
+		
+		memset(n, 0, NAT_BSIZE(dir->fs));
+		n->magic = NAT_HDIR_MAGIC;
+		n->level = level;
+		n->count = half;
+		for (i = 0; i < half; i++)
+			NAT_HENT(n, i) = ent[i];
+		err = hdir_done(b, dir);
+		if (err)
+			return err;
+		
+		hash   = ent[half].hash;
+		log_nr = nlog;
+		d--;
+	}
+}
+
+/*
+ * Find a free slot, starting at the first block that may have one.
+ * Index blocks read as empty and are skipped.
+ */
+static int hdir_alloc(struct block **b, struct nat_dirent **d, struct fso *dir, blk_t *slot)
+{
+	int dents = NAT_DENTS(dir->fs);
+	blk_t log_nr;
+	int err;
+	int i;
+	
+	log_nr = dir->nat.hfree ? dir->nat.hfree : 1;
+	for (; log_nr < dir->size / NAT_BSIZE(dir->fs); log_nr++)
+	{
+		err = hdir_read(b, dir, log_nr);
+		if (err)
+			return err;
+		
+		if (!hdir_isindex(*b))
+		{
+			*d = (void *)(*b)->data;
+			for (i = 0; i < dents; i++, (*d)++)
+				if (!(*d)->first_block)
+				{
+					dir->nat.hfree = log_nr;
+					*slot = log_nr * dents + i;
+					return 0;
+				}
+		}
+		blk_put(*b);
+	}
+	
+	err = hdir_grow(b, dir, &log_nr);
+	if (err)
+		return err;
+	
+	dir->nat.hfree = log_nr;
+	*d    = (void *)(*b)->data;
+	*slot = log_nr * dents;
+	return 0;
+}
+
+static int hdir_insert(struct fso *dir, const char *name, int first_block)
+{
+	blk_t path[NAT_HDIR_DEPTH];
+	int pent[NAT_HDIR_DEPTH];
+	struct dirent_ptr dptr;
+	struct nat_dirent *d;
+	struct block *b;
+	blk_t slot;
+	uint32_t h;
+	int depth;
+	int err;
+	
+	h = hdir_hash(name);
+	
+	err = hdir_walk(dir, h, path, pent, &depth);
+	if (err)
+		return err;
+	
+	err = hdir_match(dir, name, h, path, pent, depth, &dptr);
+	if (!err)
+	{
+		blk_put(dptr.block);
+		return EEXIST;
+	}
+	if (err != ENOENT)
+		return err;
+	
+	if (dir->size + (depth + 3) * NAT_BSIZE(dir->fs) > NAT_DIR_SIZE_MAX)
+		return EFBIG;
+	
+	err = hdir_alloc(&b, &d, dir, &slot);
+	if (err)
+		return err;
+	
+	err = hdir_link(dir, path, pent, depth, h, slot);
+	if (err)
+	{
+		blk_put(b);
+		return err;
+	}
+	
+	memset(d, 0, sizeof *d);
+	strcpy(d->name, name);
+	d->first_block = first_block;
+	return hdir_done(b, dir);
+}
+
+/*
+ * Drop the index entry of the entry at slot before it is cleared.
+ */
+static int hdir_remove(struct fso *dir, const char *name, blk_t slot)
+{
+	blk_t path[NAT_HDIR_DEPTH];
+	int pent[NAT_HDIR_DEPTH];
+	struct nat_hnode *n;
+	struct block *b;
+	uint32_t h;
+	int depth;
+	int err;
+	int i;
+	
+	h = hdir_hash(name);
+	
+	err = hdir_walk(dir, h, path, pent, &depth);
+	if (err)
+		return err;
+	
+	err = hdir_read(&b, dir, path[depth]);
+	if (err)
+		return err;
+	n = (void *)b->data;
+	
+	for (i = pent[depth]; i >= 0 && NAT_HENT(n, i).hash == h; i--)
+		if (NAT_HENT(n, i).log == slot)
+		{
+			for (; i < n->count - 1; i++)
+				NAT_HENT(n, i) = NAT_HENT(n, i + 1);
+			n->count--;
+			NAT_HENT(n, i).hash = 0;
+			NAT_HENT(n, i).log  = 0;
+			
+			if (slot / NAT_DENTS(dir->fs) < dir->nat.hfree)
+				dir->nat.hfree = slot / NAT_DENTS(dir->fs);
+			return hdir_done(b, dir);
+		}
+	
+	blk_put(b);
+	return EIO;
+}
+
+static int hdir_init(struct fso *dir)
+{
+	struct nat_hnode *n;
+	struct block *b;
+	blk_t log_nr;
+	int err;
+	
+	err = hdir_grow(&b, dir, &log_nr);
+	if (err)
+		return err;
+	
+	n = (void *)b->data;
+	n->magic = NAT_HDIR_MAGIC;
+	n->level = 0;
+	n->count = 0;
+	
+	err = hdir_done(b, dir);
+	if (err)
+		return err;
+	
+	dir->nat.flags |= NAT_HF_HASHED;
+	dir->dirty = 1;
+	return 0;
+}
+
+/*
+ * Clear the entry at dptr, dropping it from the index of a hashed
+ * directory first.  The block must have been added to the log.
+ */
+static int del_entry(struct fso *dir, struct dirent_ptr *dptr)
+{
+	int err;
+	
+	if (dir->nat.flags & NAT_HF_HASHED)
+	{
+		err = hdir_remove(dir, dptr->dirent->name, dptr->slot);
+		if (err)
+			return err;
+	}
+	
+	memset(dptr->dirent, 0, sizeof *dptr->dirent);
+	dptr->block->dirty = 1;
+	return 0;
+}
+
 static int find_entry(struct fso *dir, const char *name, struct dirent_ptr *dptr)
 {
 	struct nat_dirent *d;
@@ -64,18 +584,21 @@ static int find_entry(struct fso *dir, const char *name, struct dirent_ptr *dptr
 	if (err)
 		return err;
 	
-	for (log_nr = 0; log_nr < dir->size / BLK_SIZE; log_nr++)
+	if (dir->nat.flags & NAT_HF_HASHED)
+		return hdir_find(dir, name, dptr);
+	
+	for (log_nr = 0; log_nr < dir->size / NAT_BSIZE(dir->fs); log_nr++)
 	{
 		err = nat_bmap(dir, log_nr, 0);
 		if (err)
 			return err;
 		
-		err = blk_read(&b, dir->fs->dev, dir->nat.bmap_phys);
+		err = blk_read(&b, dir->fs->nat.dev, dir->nat.bmap_phys);
 		if (err)
 			return err;
 		
 		d = (void *)b->data;
-		for (i = 0; i < NAT_D_PER_BLOCK; i++, d++)
+		for (i = 0; i < NAT_DENTS(dir->fs); i++, d++)
 		{
 			if (d->first_block && !strcmp(d->name, name))
 			{
@@ -113,18 +636,29 @@ static int new_entry(struct fso *dir, const char *name, int first_block)
 	if (strlen(name) > NAT_NAME_MAX)
 		return ENAMETOOLONG;
 	
-	for (log_nr = 0; log_nr < dir->size / BLK_SIZE; log_nr++)
+	if (dir->nat.flags & NAT_HF_HASHED)
+	{
+		err = hdir_insert(dir, name, first_block);
+		if (err)
+			return err;
+		
+		dir->mtime = clock_time();
+		dir->dirty = 1;
+		return 0;
+	}
+	
+	for (log_nr = 0; log_nr < dir->size / NAT_BSIZE(dir->fs); log_nr++)
 	{
 		err = nat_bmap(dir, log_nr, 0);
 		if (err)
 			return err;
 		
-		err = blk_read(&b, dir->fs->dev, dir->nat.bmap_phys);
+		err = blk_read(&b, dir->fs->nat.dev, dir->nat.bmap_phys);
 		if (err)
 			return err;
 		
 		d = (void *)b->data;
-		for (i = 0; i < NAT_D_PER_BLOCK; i++, d++)
+		for (i = 0; i < NAT_DENTS(dir->fs); i++, d++)
 		{
 			if (d->first_block && !strcmp(d->name, name))
 			{
@@ -144,31 +678,31 @@ static int new_entry(struct fso *dir, const char *name, int first_block)
 	
 	if (!free_blk)
 	{
-		if (dir->size + BLK_SIZE > NAT_DIR_SIZE_MAX)
+		if (dir->size + NAT_BSIZE(dir->fs) > NAT_DIR_SIZE_MAX)
 		{
 			return EFBIG;
 		}
 		
-		err = nat_bmap(dir, dir->size / BLK_SIZE, 1);
+		err = nat_bmap(dir, dir->size / NAT_BSIZE(dir->fs), 1);
 		if (err)
 			return err;
 		free_blk = dir->nat.bmap_phys;
 		free_i	 = 0;
 		
-		err = blk_get(&b, dir->fs->dev, free_blk);
+		err = blk_get(&b, dir->fs->nat.dev, free_blk);
 		if (err)
 			return err;
 		
-		memset(b->data, 0, BLK_SIZE);
+		memset(b->data, 0, NAT_BSIZE(dir->fs));
 		b->valid = 1;
 		b->dirty = 1;
 		
-		dir->size += BLK_SIZE;
+		dir->size += NAT_BSIZE(dir->fs);
 		dir->dirty = 1;
 	}
 	else
 	{
-		err = blk_read(&b, dir->fs->dev, free_blk);
+		err = blk_read(&b, dir->fs->nat.dev, free_blk);
 		if (err)
 			return err;
 	}
@@ -184,8 +718,9 @@ static int new_entry(struct fso *dir, const char *name, int first_block)
 	d->first_block = first_block;
 	
 	b->dirty = 1;
+	err = nat_log_add(dir->fs, b->nr);
 	blk_put(b);
-	return 0;
+	return err;
 }
 
 static int is_empty(struct fso *dir)
@@ -199,18 +734,18 @@ static int is_empty(struct fso *dir)
 	if (!S_ISDIR(dir->mode))
 		return ENOTDIR;
 	
-	for (log_nr = 0; log_nr < dir->size / BLK_SIZE; log_nr++)
+	for (log_nr = 0; log_nr < dir->size / NAT_BSIZE(dir->fs); log_nr++)
 	{
 		err = nat_bmap(dir, log_nr, 0);
 		if (err)
 			return err;
 		
-		err = blk_read(&b, dir->fs->dev, dir->nat.bmap_phys);
+		err = blk_read(&b, dir->fs->nat.dev, dir->nat.bmap_phys);
 		if (err)
 			return err;
 		
 		d = (void *)b->data;
-		for (i = 0; i < NAT_D_PER_BLOCK; i++, d++)
+		for (i = 0; i < NAT_DENTS(dir->fs); i++, d++)
 			if (d->first_block)
 			{
 				blk_put(b);
@@ -322,7 +857,7 @@ int nat_creat(struct fso **f, struct fs *fs, const char *name, mode_t mode, dev_
 		return err;
 	}
 	
-	err = blk_get(&hd_block, fs->dev, hd_block_nr);
+	err = blk_get(&hd_block, fs->nat.dev, hd_block_nr);
 	if (err)
 	{
 		nat_bfree(fs, hd_block_nr);
@@ -345,19 +880,42 @@ int nat_creat(struct fso **f, struct fs *fs, const char *name, mode_t mode, dev_
 	hd->ndirblks  = fs->nat.ndirblks;
 	hd->nindirlev = fs->nat.nindirlev;
 	
+	if (fs->nat.extent && S_ISREG(mode))
+		hd->flags = NAT_HF_EXTENT;
+	
 	hd_block->valid = 1;
 	hd_block->dirty = 1;
+	err = nat_log_add(fs, hd_block_nr);
 	blk_put(hd_block);
+	if (err)
+	{
+		nat_bfree(fs, hd_block_nr);
+		fs_putfso(dir);
+		return err;
+	}
 	
-	err = new_entry(dir, basename(name), hd_block_nr);
-	fs_putfso(dir);
+	err = fs_getfso(f, fs, hd_block_nr);
 	if (err)
 	{
 		nat_bfree(fs, hd_block_nr);
+		fs_putfso(dir);
 		return err;
 	}
 	
-	return fs_getfso(f, fs, hd_block_nr);
+	/* a hashed directory is complete before it is linked */
+	if (S_ISDIR(mode) && fs->nat.hdir)
+		err = hdir_init(*f);
+	if (!err)
+		err = new_entry(dir, basename(name), hd_block_nr);
+	fs_putfso(dir);
+	if (err)
+	{
+		(*f)->nlink = 0;
+		fs_putfso(*f);
+		*f = NULL;
+		return err;
+	}
+	return 0;
 }
 
 int nat_readdir(struct fso *dir, struct fs_dirent *de, int index)
@@ -397,14 +955,14 @@ int nat_readdir(struct fso *dir, struct fs_dirent *de, int index)
 	if (i >= dir->size / sizeof(struct nat_dirent))
 		return ENOENT;
 	
-	off    = (i % NAT_D_PER_BLOCK) * sizeof(struct nat_dirent);
-	log_nr =  i / NAT_D_PER_BLOCK;
+	off    = (i % NAT_DENTS(dir->fs)) * sizeof(struct nat_dirent);
+	log_nr =  i / NAT_DENTS(dir->fs);
 	
 	err = nat_bmap(dir, log_nr, 0);
 	if (err)
 		return 0;
 	
-	err = blk_pread(dir->fs->dev, dir->nat.bmap_phys, off, sizeof nde, &nde);
+	err = blk_pread(dir->fs->nat.dev, dir->nat.bmap_phys, off, sizeof nde, &nde);
 	if (err)
 		return 0;
 	
@@ -478,9 +1036,16 @@ int nat_unlink(struct fs *fs, const char *name)
 		return EISDIR;
 	}
 	
-	memset(dptr.dirent, 0, sizeof *dptr.dirent);
-	dptr.block->dirty = 1;
+	err = nat_log_add(fs, dptr.block->nr);
+	if (!err)
+		err = del_entry(dir, &dptr);
 	blk_put(dptr.block);
+	if (err)
+	{
+		fs_putfso(dir);
+		fs_putfso(f);
+		return err;
+	}
 	
 	f->nlink--;
 	f->dirty = 1;
@@ -499,7 +1064,10 @@ int nat_rename(struct fs *fs, const char *oldname, const char *newname)
 	struct dirent_ptr dptr;
 	struct fso *odir = NULL;
 	struct fso *ndir = NULL;
+	struct dirent_ptr ndptr;
 	struct fso *f = NULL;
+	blk_t first_block;
+	struct fso *of;
 	int err;
 	
 	dptr.block = NULL;
@@ -530,43 +1098,71 @@ int nat_rename(struct fs *fs, const char *oldname, const char *newname)
 	if (err)
 		goto clean;
 	
-	err = new_entry(ndir, basename(newname), dptr.dirent->first_block);
+	err = nat_log_add(fs, dptr.block->nr);
 	if (err)
+		goto clean;
+	
+	/*
+	 * Adding the new entry may use the block of the old one, the old
+	 * entry is looked up again afterwards.
+	 */
+	first_block = dptr.dirent->first_block;
+	blk_put(dptr.block);
+	dptr.block = NULL;
+	
+	err = new_entry(ndir, basename(newname), first_block);
+	if (err == EEXIST)
 	{
-		if (err == EEXIST)
+		err = find_entry(ndir, basename(newname), &ndptr);
+		if (err)
+			goto clean;
+		err = nat_log_add(fs, ndptr.block->nr);
+		if (err)
 		{
-			struct dirent_ptr ndptr;
-			struct fso *of;
-			
-			err = find_entry(ndir, basename(newname), &ndptr);
-			if (err)
-				goto clean;
-			err = fs_getfso(&of, fs, ndptr.dirent->first_block);
-			if (err)
-			{
-				blk_put(ndptr.block);
-				goto clean;
-			}
-			if (S_ISDIR(of->mode) && (err = is_empty(of)))
-			{
-				blk_put(ndptr.block);
-				fs_putfso(of);
-				goto clean;
-			}
-			of->nlink--;
-			of->dirty = 1;
-			fs_putfso(of);
-			
-			memset(ndptr.dirent, 0, sizeof *ndptr.dirent);
-			strcpy(ndptr.dirent->name, basename(newname));
-			ndptr.dirent->first_block = dptr.dirent->first_block;
-			ndptr.block->dirty = 1;
 			blk_put(ndptr.block);
+			goto clean;
 		}
+		err = fs_getfso(&of, fs, ndptr.dirent->first_block);
+		if (err)
+		{
+			blk_put(ndptr.block);
+			goto clean;
+		}
+		if (S_ISDIR(of->mode) && (err = is_empty(of)))
+		{
+			blk_put(ndptr.block);
+			fs_putfso(of);
+			goto clean;
+		}
+		of->nlink--;
+		of->dirty = 1;
+		fs_putfso(of);
+		
+		memset(ndptr.dirent, 0, sizeof *ndptr.dirent);
+		strcpy(ndptr.dirent->name, basename(newname));
+		ndptr.dirent->first_block = first_block;
+		ndptr.block->dirty = 1;
+		blk_put(ndptr.block);
 	}
+	else if (err)
+		goto clean;
 	
-	memset(dptr.dirent, 0, sizeof *dptr.dirent);
-	dptr.block->dirty = 1;
+	err = find_entry(odir, basename(oldname), &dptr);
+	if (err)
+		goto clean;
+	if (dptr.dirent->first_block != first_block)
+	{
+		err = EIO;
+		goto clean;
+	}
+	
+	err = nat_log_add(fs, dptr.block->nr);
+	if (err)
+		goto clean;
+	
+	err = del_entry(odir, &dptr);
+	if (err)
+		goto clean;
 	
 	odir->mtime = ndir->mtime = clock_time();
 	odir->dirty = 1;
@@ -657,13 +1253,20 @@ int nat_rmdir(struct fs *fs, const char *name)
 		return err;
 	}
 	
+	err = nat_log_add(fs, dptr.block->nr);
+	if (!err)
+		err = del_entry(parent, &dptr);
+	blk_put(dptr.block);
+	if (err)
+	{
+		fs_putfso(parent);
+		fs_putfso(dir);
+		return err;
+	}
+	
 	parent->mtime = clock_time();
 	parent->dirty = 1;
 	
-	memset(dptr.dirent, 0, sizeof *dptr.dirent);
-	dptr.block->dirty = 1;
-	blk_put(dptr.block);
-	
 	dir->nlink--;
 	dir->dirty = 1;
 	
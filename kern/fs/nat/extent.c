@@ -0,0 +1,428 @@
+/* Copyright (c) 2017, Piotr Durlej
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Extent maps.
+ *
+ * A file with NAT_HF_EXTENT set maps its blocks with extents, each a
+ * run of physically contiguous blocks, instead of the direct and
+ * indirect block maps.  When a file grows by a block adjacent to the
+ * end of an extent, the physical block following that extent is taken
+ * if it is free, so a file written sequentially onto free space maps
+ * in a single extent.  Extents that do not fit in the header go to a
+ * chain of overflow blocks.
+ */
+
+#include <kern/natfs.h>
+#include <kern/errno.h>
+#include <kern/block.h>
+#include <kern/lib.h>
+#include <kern/fs.h>
+
+struct nat_ext_pos
+{
+	struct nat_extent ext;
+	blk_t		  blk;
+	int		  i;
+};
+
+static int nat_ext_find(struct nat_extent *e, int n, blk_t log, blk_t *phys, blk_t *run, struct nat_ext_pos *adj, blk_t blk)
+{
+	int i;
+	
+	for (i = 0; i < n; i++, e++)
+	{
+		if (log >= e->log && log - e->log < e->len)
+		{
+			*phys = e->phys + log - e->log;
+			*run  = e->len - (log - e->log);
+			return 1;
+		}
+		
+		if (e->log + e->len == log)
+		{
+			adj->ext = *e;
+			adj->blk = blk;
+			adj->i	 = i;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Look up log in the extent map.  *phys is zero if log is not mapped;
+ * then adj describes an extent that ends just before log, if any.
+ * Otherwise *run is the number of blocks left in the extent.
+ */
+static int nat_ext_lookup(struct fso *fso, blk_t log, blk_t *phys, blk_t *run, struct nat_ext_pos *adj)
+{
+	int count = fso->nat.bmap[NAT_EXT_COUNT];
+	struct nat_extblk *xb;
+	struct block *b;
+	blk_t bn;
+	int found;
+	int err;
+	int n;
+	
+	*phys  = 0;
+	*run   = 1;
+	adj->i = -1;
+	
+	n = count < NAT_EXT_INLINE ? count : NAT_EXT_INLINE;
+	if (nat_ext_find(NAT_EXTENTS(fso->nat.bmap), n, log, phys, run, adj, 0))
+		return 0;
+	count -= n;
+	
+	bn = fso->nat.bmap[NAT_EXT_NEXT];
+	while (bn && count > 0)
+	{
+		err = blk_read(&b, fso->fs->nat.dev, bn);
+		if (err)
+			return err;
+		xb = (void *)b->data;
+		
+		n = count < NAT_EXT_PER_BLOCK ? count : NAT_EXT_PER_BLOCK;
+		found = nat_ext_find(xb->ext, n, log, phys, run, adj, bn);
+		count -= n;
+		
+		bn = xb->next;
+		blk_put(b);
+		if (found)
+			break;
+	}
+	return 0;
+}
+
+static int nat_ext_zero(struct fs *fs, blk_t bn)
+{
+	struct block *b;
+	int err;
+	
+	err = blk_get(&b, fs->nat.dev, bn);
+	if (err)
+		return err;
+	
+	memset(b->data, 0, NAT_BSIZE(fs));
+	b->valid = 1;
+	b->dirty = 1;
+	blk_put(b);
+	return 0;
+}
+
+static int nat_ext_put(struct fso *fso, struct nat_ext_pos *pos)
+{
+	struct nat_extblk *xb;
+	struct block *b;
+	int err;
+	
+	if (!pos->blk)
+	{
+		NAT_EXTENTS(fso->nat.bmap)[pos->i] = pos->ext;
+		fso->dirty = 1;
+		return 0;
+	}
+	
+	err = blk_read(&b, fso->fs->nat.dev, pos->blk);
+	if (err)
+		return err;
+	xb = (void *)b->data;
+	
+	xb->ext[pos->i] = pos->ext;
+	b->dirty = 1;
+	err = nat_log_add(fso->fs, b->nr);
+	blk_put(b);
+	return err;
+}
+
+static int nat_ext_append(struct fso *fso, struct nat_extent *ext)
+{
+	int count = fso->nat.bmap[NAT_EXT_COUNT];
+	struct nat_ext_pos pos;
+	struct nat_extblk *xb;
+	struct block *b;
+	blk_t prev = 0;
+	blk_t bn;
+	int err;
+	int i;
+	
+	pos.ext = *ext;
+	pos.blk = 0;
+	pos.i	= count;
+	
+	if (count >= NAT_EXT_INLINE)
+	{
+		count -= NAT_EXT_INLINE;
+		
+		bn = fso->nat.bmap[NAT_EXT_NEXT];
+		for (i = count / NAT_EXT_PER_BLOCK; i; i--)
+		{
+			prev = bn;
+			err  = blk_pread(fso->fs->nat.dev, prev, offsetof(struct nat_extblk, next), sizeof bn, &bn);
+			if (err)
+				return err;
+		}
+		
+		if (!(count % NAT_EXT_PER_BLOCK))
+		{
+			err = nat_balloc(fso->fs, &bn);
+			if (err)
+				return err;
+			
+			err = blk_get(&b, fso->fs->nat.dev, bn);
+			if (err)
+			{
+				nat_bfree(fso->fs, bn);
+				return err;
+			}
+			memset(b->data, 0, NAT_BSIZE(fso->fs));
+			b->valid = 1;
+			b->dirty = 1;
+			err = nat_log_add(fso->fs, bn);
+			blk_put(b);
+			if (err)
+				return err;
+			
+			if (prev)
+			{
+				err = blk_read(&b, fso->fs->nat.dev, prev);
+				if (err)
+					return err;
+				xb = (void *)b->data;
+				
+				xb->next = bn;
+				b->dirty = 1;
+				err = nat_log_add(fso->fs, prev);
+				blk_put(b);
+				if (err)
+					return err;
+			}
+			else
+				fso->nat.bmap[NAT_EXT_NEXT] = bn;
+			fso->blocks++;
+		}
+		
+		pos.blk = bn;
+		pos.i	= count % NAT_EXT_PER_BLOCK;
+	}
+	
+	err = nat_ext_put(fso, &pos);
+	if (err)
+		return err;
+	
+	fso->nat.bmap[NAT_EXT_COUNT]++;
+	fso->dirty = 1;
+	return 0;
+}
+
+static int nat_ext_alloc(struct fso *fso, blk_t log, struct nat_ext_pos *adj, blk_t *phys)
+{
+	struct nat_extent ext;
+	blk_t bn;
+	int err;
+	
+	if (adj->i >= 0 && !nat_balloc_at(fso->fs, adj->ext.phys + adj->ext.len))
+	{
+		bn = adj->ext.phys + adj->ext.len;
+		
+		adj->ext.len++;
+		err = nat_ext_put(fso, adj);
+		if (err)
+		{
+			nat_bfree(fso->fs, bn);
+			return err;
+		}
+	}
+	else
+	{
+		err = nat_balloc(fso->fs, &bn);
+		if (err)
+			return err;
+		
+		ext.log	 = log;
+		ext.phys = bn;
+		ext.len	 = 1;
+		err = nat_ext_append(fso, &ext);
+		if (err)
+		{
+			nat_bfree(fso->fs, bn);
+			return err;
+		}
+	}
+	
+	fso->blocks++;
+	fso->dirty = 1;
+	
+	*phys = bn;
+	return nat_ext_zero(fso->fs, bn);
+}
+
+int nat_ext_bmap(struct fso *fso, blk_t log, int alloc)
+{
+	struct nat_ext_pos adj;
+	blk_t phys;
+	blk_t run;
+	int err;
+	
+	err = nat_ext_lookup(fso, log, &phys, &run, &adj);
+	if (err)
+		return err;
+	
+	if (!phys && alloc)
+	{
+		err = nat_ext_alloc(fso, log, &adj, &phys);
+		if (err)
+			return err;
+	}
+	
+	fso->nat.bmap_phys  = phys;
+	fso->nat.bmap_run   = run;
+	fso->nat.bmap_log   = log;
+	fso->nat.bmap_valid = 1;
+	return 0;
+}
+
+/*
+ * Unlink overflow block k of the chain from its predecessor and free
+ * it.  The chain is only ever cut at its end.
+ */
+static int nat_ext_unchain(struct fso *fso, blk_t *chain, int k)
+{
+	struct nat_extblk *xb;
+	struct block *b;
+	int err;
+	
+	if (k)
+	{
+		err = blk_read(&b, fso->fs->nat.dev, chain[k - 1]);
+		if (err)
+			return err;
+		xb = (void *)b->data;
+		
+		xb->next = 0;
+		b->dirty = 1;
+		err = nat_log_add(fso->fs, b->nr);
+		blk_put(b);
+		if (err)
+			return err;
+	}
+	else
+		fso->nat.bmap[NAT_EXT_NEXT] = 0;
+	
+	fso->blocks--;
+	fso->dirty = 1;
+	return nat_bfree(fso->fs, chain[k]);
+}
+
+/*
+ * Extents are freed from the last one back and the count is lowered
+ * after each, so that the truncation of a large file can be split into
+ * several commits without leaving freed blocks referenced.
+ */
+int nat_ext_trunc(struct fso *fso)
+{
+	int count = fso->nat.bmap[NAT_EXT_COUNT];
+	struct nat_extent e;
+	blk_t *chain = NULL;
+	int nchain = 0;
+	blk_t bn;
+	blk_t i;
+	int err;
+	int k, x;
+	
+	nat_bmc_clear(fso);
+	
+	if (count > NAT_EXT_INLINE)
+	{
+		nchain = (count - NAT_EXT_INLINE + NAT_EXT_PER_BLOCK - 1) / NAT_EXT_PER_BLOCK;
+		
+		err = kmalloc(&chain, nchain * sizeof *chain, "natext");
+		if (err)
+			return err;
+		
+		bn = fso->nat.bmap[NAT_EXT_NEXT];
+		for (k = 0; k < nchain; k++)
+		{
+			if (!bn)
+			{
+				err = EINVAL;
+				goto fini;
+			}
+			chain[k] = bn;
+			
+			err = blk_pread(fso->fs->nat.dev, bn, offsetof(struct nat_extblk, next), sizeof bn, &bn);
+			if (err)
+				goto fini;
+		}
+	}
+	
+	while (count)
+	{
+		x = --count;
+		
+		if (x < NAT_EXT_INLINE)
+			e = NAT_EXTENTS(fso->nat.bmap)[x];
+		else
+		{
+			x -= NAT_EXT_INLINE;
+			k  = x / NAT_EXT_PER_BLOCK;
+			x %= NAT_EXT_PER_BLOCK;
+			
+			err = blk_pread(fso->fs->nat.dev, chain[k], x * sizeof e, sizeof e, &e);
+			if (err)
+				goto fini;
+		}
+		
+		for (i = 0; i < e.len; i++)
+		{
+			err = nat_bfree(fso->fs, e.phys + i);
+			if (err)
+				goto fini;
+		}
+		
+		fso->nat.bmap[NAT_EXT_COUNT] = count;
+		fso->blocks -= e.len;
+		fso->dirty = 1;
+		
+		if (count >= NAT_EXT_INLINE && !x)
+		{
+			err = nat_ext_unchain(fso, chain, k);
+			if (err)
+				goto fini;
+		}
+		
+		err = nat_log_split(fso->fs);
+		if (err)
+			goto fini;
+	}
+	
+	memset(fso->nat.bmap, 0, sizeof fso->nat.bmap);
+	fso->dirty  = 1;
+	fso->blocks = 1;
+	fso->size   = 0;
+fini:
+	free(chain);
+	return err;
+}
@@ -47,11 +47,20 @@ static mode_t nat_imode(mode_t mode)
 
 int nat_putfso(struct fso *fso)
 {
+	int err;
+	
 	if (!fso->nlink)
 	{
+		if (nat_log_orphan(fso))
+			return 0;
+		
+		err = nat_log_begin(fso->fs);
+		if (err)
+			return err;
 		nat_trunc(fso);
 		nat_bfree(fso->fs, fso->index);
-		return 0;
+		fso->dirty = 0;
+		return nat_log_end(fso->fs);
 	}
 	else
 		return nat_syncfso(fso);
@@ -63,7 +72,7 @@ int nat_getfso(struct fso *fso)
 	struct block *b;
 	int err;
 	
-	err = blk_read(&b, fso->fs->dev, fso->index);
+	err = blk_read(&b, fso->fs->nat.dev, fso->index);
 	if (err)
 		return err;
 	hd = (void *)b->data;
@@ -92,6 +101,8 @@ int nat_getfso(struct fso *fso)
 	memcpy(&fso->nat.bmap, hd->bmap, sizeof fso->nat.bmap);
 	fso->nat.ndirblks  = hd->ndirblks;
 	fso->nat.nindirlev = hd->nindirlev;
+	fso->nat.flags	   = hd->flags;
+	fso->nat.hfree	   = 0;
 	
 	fs_state(fso, R_OK | W_OK);
 	blk_put(b);
@@ -107,11 +118,11 @@ int nat_syncfso(struct fso *fso)
 	if (!fso->dirty)
 		return 0;
 	
-	err = blk_get(&b, fso->fs->dev, fso->index);
+	err = blk_get(&b, fso->fs->nat.dev, fso->index);
 	if (err)
 		return err;
 	
-	memset(b->data, 0, BLK_SIZE);
+	memset(b->data, 0, NAT_BSIZE(fso->fs));
 	hd = (void *)b->data;
 	
 	hd->blocks	= fso->blocks;
@@ -137,10 +148,12 @@ int nat_syncfso(struct fso *fso)
 	memcpy(hd->bmap, &fso->nat.bmap, sizeof fso->nat.bmap);
 	hd->ndirblks  = fso->nat.ndirblks;
 	hd->nindirlev = fso->nat.nindirlev;
+	hd->flags     = fso->nat.flags;
 	
 	fso->dirty	= 0;
 	b->valid	= 1;
 	b->dirty	= 1;
+	err = nat_log_add(fso->fs, fso->index);
 	blk_put(b);
-	return 0;
+	return err;
 }
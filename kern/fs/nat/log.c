@@ -0,0 +1,679 @@
+/* Copyright (c) 2017, Piotr Durlej
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Metadata intent log.
+ *
+ * Every header, directory, indirect and BAM block modified by the
+ * filesystem is pinned in the buffer cache until its image has been
+ * written to the log area.  The images are written in groups; a group
+ * is one or more records, each a header block followed by the block
+ * images, and the last record of a group is marked as the commit.
+ * Groups are written at operation boundaries, so a replayed log never
+ * leaves a half-done operation behind.  An operation that may touch an
+ * unbounded number of blocks, a long write or a truncation, commits at
+ * points of its own where the filesystem is consistent (nat_log_split);
+ * any other operation that would overflow the pinned set fails.
+ *
+ * The log is emptied by a checkpoint: the home blocks are written and
+ * the superblock is advanced past the last record.  Mount replays the
+ * complete groups found after the checkpoint and discards the rest.
+ *
+ * A replay writes the logged images back over their home blocks, so a
+ * block logged since the last checkpoint must not be reused for file
+ * data until the next checkpoint; the allocator skips such blocks
+ * (nat_log_held).  A read-only mount does not write the images back;
+ * it reads them from the log in place of their home blocks instead
+ * (nat_log_overlay) and leaves the log for a read-write mount or fsck.
+ */
+
+#include <kern/printk.h>
+#include <kern/block.h>
+#include <kern/natfs.h>
+#include <kern/errno.h>
+#include <kern/lib.h>
+#include <kern/fs.h>
+#include <os386.h>
+
+#define NAT_LOG_MAXPIN	(2 * NAT_LOG_NBLK)
+#define NAT_LOG_RESERVE	64
+#define NAT_LOG_GROUP	64
+#define NAT_LOG_MAXUSE	16384
+
+static uint32_t nat_log_sum(uint32_t sum, const void *buf, unsigned len)
+{
+	const uint32_t *p = buf;
+	int i;
+	
+	for (i = 0; i < len / 4; i++)
+		sum = ((sum << 1) | (sum >> 31)) + p[i];
+	return sum;
+}
+
+static unsigned nat_log_hash(blk_t nr, unsigned mask)
+{
+	return (nr * 2654435761U) & mask;
+}
+
+/*
+ * Remember that the image of block nr is in the log.  The map holds
+ * at most log_size + NAT_LOG_MAXPIN blocks and is twice that size, so
+ * it never fills up.
+ */
+static void nat_log_mark(struct fs *fs, blk_t nr)
+{
+	blk_t *map = fs->nat.log_map;
+	unsigned i;
+	
+	if (!map)
+		return;
+	
+	for (i = nat_log_hash(nr, fs->nat.log_mapmask); map[i]; i = (i + 1) & fs->nat.log_mapmask)
+		if (map[i] == nr)
+			return;
+	map[i] = nr;
+}
+
+/*
+ * Check if block nr has been logged since the last checkpoint.
+ */
+int nat_log_held(struct fs *fs, blk_t nr)
+{
+	blk_t *map = fs->nat.log_map;
+	unsigned i;
+	
+	if (!map)
+		return 0;
+	
+	for (i = nat_log_hash(nr, fs->nat.log_mapmask); map[i]; i = (i + 1) & fs->nat.log_mapmask)
+		if (map[i] == nr)
+			return 1;
+	return 0;
+}
+
+/*
+ * Write len bytes of data to block nr, zeroing the rest of the block.
+ */
+static int nat_log_put(struct fs *fs, blk_t nr, const void *data, unsigned len)
+{
+	struct block *b;
+	int err;
+	
+	err = blk_get(&b, fs->nat.dev, nr);
+	if (err)
+		return err;
+	
+	memcpy(b->data, data, len);
+	memset(b->data + len, 0, NAT_BSIZE(fs) - len);
+	b->valid = 1;
+	b->dirty = 1;
+	err = blk_write(b);
+	blk_put(b);
+	return err;
+}
+
+static int nat_log_super(struct fs *fs)
+{
+	struct nat_super *sb;
+	struct block *b;
+	int err;
+	
+	err = blk_read(&b, fs->dev, 1);
+	if (err)
+		return err;
+	
+	sb = (void *)b->data;
+	sb->log_seq = fs->nat.log_seq;
+	b->dirty = 1;
+	err = blk_write(b);
+	blk_put(b);
+	return err;
+}
+
+static int nat_log_checkpoint(struct fs *fs)
+{
+	blk_syncdev(fs->nat.dev, SYNC_WRITE);
+	fs->nat.log_head = 0;
+	fs->nat.log_ckpt = 0;
+	
+	if (fs->nat.log_map)
+		memset(fs->nat.log_map, 0, (fs->nat.log_mapmask + 1) * sizeof *fs->nat.log_map);
+	return nat_log_super(fs);
+}
+
+static int nat_log_write(struct fs *fs)
+{
+	struct nat_log_head hd;
+	struct block **pin;
+	int count = fs->nat.log_count;
+	int err = 0;
+	int nrec;
+	blk_t pos;
+	int i, n;
+	
+	nrec = (count + NAT_LOG_NBLK - 1) / NAT_LOG_NBLK;
+	if (fs->nat.log_head + nrec + count > fs->nat.log_size)
+	{
+		err = nat_log_checkpoint(fs);
+		if (err)
+			goto fini;
+	}
+	
+	pos = fs->nat.log_block + fs->nat.log_head;
+	pin = fs->nat.log_pin;
+	for (; count; count -= n, pin += n)
+	{
+		n = count;
+		if (n > NAT_LOG_NBLK)
+			n = NAT_LOG_NBLK;
+		
+		memset(&hd, 0, sizeof hd);
+		hd.magic  = NAT_LOG_MAGIC;
+		hd.seq	  = fs->nat.log_seq;
+		hd.count  = n;
+		hd.commit = n == count;
+		for (i = 0; i < n; i++)
+		{
+			hd.blocks[i] = pin[i]->nr;
+			nat_log_mark(fs, pin[i]->nr);
+		}
+		
+		hd.sum = nat_log_sum(0, &hd, sizeof hd);
+		for (i = 0; i < n; i++)
+		{
+			hd.sum = nat_log_sum(hd.sum, pin[i]->data, NAT_BSIZE(fs));
+			
+			err = nat_log_put(fs, pos + 1 + i, pin[i]->data, NAT_BSIZE(fs));
+			if (err)
+				goto fini;
+		}
+		
+		err = nat_log_put(fs, pos, &hd, sizeof hd);
+		if (err)
+			goto fini;
+		
+		fs->nat.log_seq++;
+		pos += n + 1;
+	}
+	fs->nat.log_head = pos - fs->nat.log_block;
+fini:
+	if (err)
+		printk("nat_log_write: %s: error %i\n", fs->dev->name, err);
+	
+	for (i = 0; i < fs->nat.log_count; i++)
+		blk_put(fs->nat.log_pin[i]);
+	fs->nat.log_count = 0;
+	return err;
+}
+
+/*
+ * Read the record header at pos into hd and verify the sequence number
+ * and the checksum of the whole record.
+ */
+static int nat_log_check(struct fs *fs, blk_t pos, unsigned seq, struct nat_log_head *hd)
+{
+	struct block *b;
+	uint32_t sum;
+	int err;
+	int i;
+	
+	err = blk_pread(fs->nat.dev, fs->nat.log_block + pos, 0, sizeof *hd, hd);
+	if (err)
+		return err;
+	
+	if (hd->magic != NAT_LOG_MAGIC || hd->seq != seq)
+		return ENOENT;
+	if (hd->count > NAT_LOG_NBLK || pos + 1 + hd->count > fs->nat.log_size)
+		return ENOENT;
+	
+	sum	= hd->sum;
+	hd->sum	= 0;
+	hd->sum	= nat_log_sum(0, hd, sizeof *hd);
+	
+	for (i = 0; i < hd->count; i++)
+	{
+		err = blk_read(&b, fs->nat.dev, fs->nat.log_block + pos + 1 + i);
+		if (err)
+			return err;
+		hd->sum = nat_log_sum(hd->sum, b->data, NAT_BSIZE(fs));
+		blk_put(b);
+	}
+	
+	if (hd->sum != sum)
+		return ENOENT;
+	return 0;
+}
+
+static int nat_log_apply(struct fs *fs, blk_t pos, blk_t end)
+{
+	struct nat_log_head hd;
+	struct block *b;
+	int err;
+	int i;
+	
+	while (pos < end)
+	{
+		err = blk_pread(fs->nat.dev, fs->nat.log_block + pos, 0, sizeof hd, &hd);
+		if (err)
+			return err;
+		
+		for (i = 0; i < hd.count; i++)
+		{
+			err = blk_read(&b, fs->nat.dev, fs->nat.log_block + pos + 1 + i);
+			if (err)
+				return err;
+			err = nat_log_put(fs, hd.blocks[i], b->data, NAT_BSIZE(fs));
+			blk_put(b);
+			if (err)
+				return err;
+		}
+		pos += hd.count + 1;
+	}
+	return 0;
+}
+
+/*
+ * Find the log block holding the image of block nr, for reads through
+ * the view of a read-only mount.
+ */
+static blk_t nat_log_remap(struct bdev *dev, blk_t nr)
+{
+	struct fs *fs = dev->remap_data;
+	blk_t *ovl = fs->nat.log_ovl;
+	unsigned i;
+	
+	for (i = nat_log_hash(nr, fs->nat.log_ovlmask); ovl[2 * i]; i = (i + 1) & fs->nat.log_ovlmask)
+		if (ovl[2 * i] == nr)
+			return ovl[2 * i + 1];
+	return nr;
+}
+
+/*
+ * Map the home blocks of the nimg images in the log up to end to their
+ * latest images, and read the filesystem through a view that follows
+ * the map.  The map is twice the size of the image count, so it never
+ * fills up.
+ */
+static int nat_log_overlay(struct fs *fs, blk_t end, int nimg)
+{
+	struct nat_log_head hd;
+	struct bdev *view;
+	blk_t *ovl;
+	unsigned mask;
+	unsigned n;
+	unsigned i;
+	blk_t pos;
+	int err;
+	int k;
+	
+	for (n = 1; n < 2 * nimg; n *= 2)
+		;
+	mask = n - 1;
+	
+	err = kmalloc(&ovl, 2 * n * sizeof *ovl, "natovl");
+	if (err)
+		return err;
+	memset(ovl, 0, 2 * n * sizeof *ovl);
+	
+	for (pos = 0; pos < end; pos += hd.count + 1)
+	{
+		err = blk_pread(fs->nat.dev, fs->nat.log_block + pos, 0, sizeof hd, &hd);
+		if (err)
+			goto fail;
+		
+		for (k = 0; k < hd.count; k++)
+		{
+			i = nat_log_hash(hd.blocks[k], mask);
+			while (ovl[2 * i] && ovl[2 * i] != hd.blocks[k])
+				i = (i + 1) & mask;
+			
+			ovl[2 * i]     = hd.blocks[k];
+			ovl[2 * i + 1] = fs->nat.log_block + pos + 1 + k;
+		}
+	}
+	
+	if (fs->nat.dev == fs->dev)
+	{
+		err = blk_view(&view, fs->dev, 0);
+		if (err)
+			goto fail;
+		fs->nat.dev = view;
+	}
+	
+	fs->nat.log_ovl	    = ovl;
+	fs->nat.log_ovlmask = mask;
+	fs->nat.dev->remap_data = fs;
+	fs->nat.dev->remap	= nat_log_remap;
+	return 0;
+fail:
+	free(ovl);
+	return err;
+}
+
+static int nat_log_replay(struct fs *fs)
+{
+	struct nat_log_head hd;
+	blk_t end = 0;
+	blk_t pos = 0;
+	int replayed = 0;
+	int records = 0;
+	int nimg = 0;
+	int cnt = 0;
+	int err;
+	
+	while (pos < fs->nat.log_size)
+	{
+		err = nat_log_check(fs, pos, fs->nat.log_seq, &hd);
+		if (err == ENOENT)
+			break;
+		if (err)
+			return err;
+		
+		fs->nat.log_seq++;
+		pos += hd.count + 1;
+		cnt += hd.count;
+		records++;
+		
+		if (!hd.commit)
+			continue;
+		
+		replayed = records;
+		nimg	 = cnt;
+		end	 = pos;
+	}
+	
+	if (!records)
+		return 0;
+	
+	if (fs->read_only)
+	{
+		printk("natfs: %s: read-only, using %i log records in place, ignoring %i\n",
+			fs->dev->name, replayed, records - replayed);
+		if (!nimg)
+			return 0;
+		return nat_log_overlay(fs, end, nimg);
+	}
+	
+	err = nat_log_apply(fs, 0, end);
+	if (err)
+		return err;
+	
+	printk("natfs: %s: replayed %i log records, discarded %i\n",
+		fs->dev->name, replayed, records - replayed);
+	return nat_log_checkpoint(fs);
+}
+
+int nat_log_mount(struct fs *fs, struct nat_super *sb)
+{
+	unsigned n;
+	int err;
+	
+	fs->nat.log_pin = NULL;
+	fs->nat.log_map = NULL;
+	fs->nat.log_ovl = NULL;
+	fs->nat.log_ckpt    = 0;
+	fs->nat.log_count   = 0;
+	fs->nat.log_active  = 0;
+	fs->nat.log_head    = 0;
+	fs->nat.log_norphan = 0;
+	
+	if (!(NAT_FEATURES(sb) & NAT_F_LOG))
+		return 0;
+	
+	if (sb->log_size < NAT_LOG_MIN ||
+	    sb->log_block < sb->data_block ||
+	    sb->log_block + sb->log_size > sb->data_block + sb->data_size)
+	{
+		printk("natfs: %s: bad log area\n", fs->dev->name);
+		return EINVAL;
+	}
+	
+	fs->nat.log_block = sb->log_block;
+	fs->nat.log_size  = sb->log_size;
+	fs->nat.log_seq	  = sb->log_seq;
+	
+	err = nat_log_replay(fs);
+	if (err)
+		return err;
+	
+	if (fs->read_only)
+		return 0;
+	sb->log_seq = fs->nat.log_seq;
+	
+	/* the log is empty now, a large area need not be used in full */
+	if (fs->nat.log_size > NAT_LOG_MAXUSE)
+		fs->nat.log_size = NAT_LOG_MAXUSE;
+	
+	for (n = 1; n < 2 * (fs->nat.log_size + NAT_LOG_MAXPIN); n *= 2)
+		;
+	
+	err = kmalloc(&fs->nat.log_map, n * sizeof *fs->nat.log_map, "natlog");
+	if (err)
+		return err;
+	memset(fs->nat.log_map, 0, n * sizeof *fs->nat.log_map);
+	fs->nat.log_mapmask = n - 1;
+	
+	err = kmalloc(&fs->nat.log_pin, NAT_LOG_MAXPIN * sizeof *fs->nat.log_pin, "natlog");
+	if (err)
+	{
+		free(fs->nat.log_map);
+		fs->nat.log_map = NULL;
+	}
+	return err;
+}
+
+int nat_log_umount(struct fs *fs)
+{
+	int err;
+	
+	if (!fs->nat.log_pin)
+		return 0;
+	
+	err = nat_log_commit(fs);
+	blk_syncdev(fs->nat.dev, SYNC_WRITE);
+	fs->nat.log_head = 0;
+	
+	free(fs->nat.log_pin);
+	free(fs->nat.log_map);
+	fs->nat.log_pin = NULL;
+	fs->nat.log_map = NULL;
+	return err;
+}
+
+/*
+ * Pin a modified metadata block until the next commit.  The block is
+ * copied to the log when the group is written, so the change may be
+ * made in the buffer cache before or after the call; pinning first
+ * lets the caller back out cleanly when the log is full.
+ */
+int nat_log_add(struct fs *fs, blk_t nr)
+{
+	struct block *b;
+	int err;
+	int i;
+	
+	if (!fs->nat.log_pin)
+		return 0;
+	
+	for (i = fs->nat.log_count - 1; i >= 0; i--)
+		if (fs->nat.log_pin[i]->nr == nr)
+			return 0;
+	
+	if (fs->nat.log_count >= NAT_LOG_MAXPIN)
+	{
+		/* outside an operation every change pinned is complete */
+		if (fs->nat.log_active)
+		{
+			printk("nat_log_add: %s: operation too large for the log\n", fs->dev->name);
+			return ENOSPC;
+		}
+		
+		err = nat_log_write(fs);
+		if (err)
+			return err;
+	}
+	
+	err = blk_get(&b, fs->nat.dev, nr);
+	if (err)
+		return err;
+	if (!b->valid)
+	{
+		blk_put(b);
+		return EIO;
+	}
+	
+	fs->nat.log_pin[fs->nat.log_count++] = b;
+	nat_log_mark(fs, nr);
+	return 0;
+}
+
+/*
+ * Write out everything pinned.  The caller guarantees that the
+ * filesystem is consistent, so for the duration the pinned set may be
+ * written whenever it fills up, as outside an operation.
+ */
+static int nat_log_flush(struct fs *fs)
+{
+	int active = fs->nat.log_active;
+	struct fso *p;
+	int err = 0;
+	int i;
+	
+	fs->nat.log_active = 0;
+	for (i = 0; i < fs_fso_high; i++)
+	{
+		p = &fs_fso[i];
+		if (p->fs == fs && p->refcnt && p->dirty)
+		{
+			err = nat_syncfso(p);
+			if (err)
+				goto fini;
+		}
+	}
+	err = nat_sync_bam(fs);
+	if (err)
+		goto fini;
+	
+	if (fs->nat.log_count)
+		err = nat_log_write(fs);
+	if (!err && fs->nat.log_ckpt)
+		err = nat_log_checkpoint(fs);
+fini:
+	fs->nat.log_active = active;
+	return err;
+}
+
+int nat_log_commit(struct fs *fs)
+{
+	if (!fs->nat.log_pin || fs->nat.log_active)
+		return nat_sync_bam(fs);
+	return nat_log_flush(fs);
+}
+
+/*
+ * Called by long operations between steps that leave the filesystem
+ * consistent.  Commits what has been done so far if the rest of the
+ * operation might not fit in the pinned set.
+ */
+int nat_log_split(struct fs *fs)
+{
+	if (!fs->nat.log_pin || fs->nat.log_active != 1)
+		return 0;
+	if (fs->nat.log_count < NAT_LOG_MAXPIN - NAT_LOG_RESERVE)
+		return 0;
+	return nat_log_flush(fs);
+}
+
+/*
+ * An inode that loses its last link within an operation is freed after
+ * the operation, as an operation of its own, so that its truncation can
+ * be split.  Returns zero if the inode must be freed right away.
+ */
+int nat_log_orphan(struct fso *fso)
+{
+	struct fs *fs = fso->fs;
+	
+	if (!fs->nat.log_pin || !fs->nat.log_active)
+		return 0;
+	if (fs->nat.log_norphan >= NAT_LOG_ORPHANS)
+		return 0;
+	if (nat_syncfso(fso))
+		return 0;
+	
+	fs->nat.log_orphan[fs->nat.log_norphan++] = fso->index;
+	return 1;
+}
+
+static void nat_log_reap(struct fs *fs)
+{
+	struct fso *f;
+	blk_t nr;
+	
+	while (fs->nat.log_norphan)
+	{
+		nr = fs->nat.log_orphan[--fs->nat.log_norphan];
+		
+		if (fs_getfso(&f, fs, nr))
+		{
+			printk("natfs: %s: cannot free inode %i\n", fs->dev->name, nr);
+			continue;
+		}
+		fs_putfso(f);
+	}
+}
+
+/*
+ * Start an operation.  The outermost operation makes sure there is
+ * room for it in the pinned set.
+ */
+int nat_log_begin(struct fs *fs)
+{
+	int err;
+	
+	if (fs->nat.log_pin && !fs->nat.log_active &&
+	    fs->nat.log_count > NAT_LOG_MAXPIN - NAT_LOG_RESERVE)
+	{
+		err = nat_log_flush(fs);
+		if (err)
+			return err;
+	}
+	
+	fs->nat.log_active++;
+	return 0;
+}
+
+int nat_log_end(struct fs *fs)
+{
+	fs->nat.log_active--;
+	if (fs->nat.log_active)
+		return 0;
+	
+	nat_log_reap(fs);
+	
+	if (fs->nat.log_count < NAT_LOG_GROUP && !fs->nat.log_ckpt)
+		return 0;
+	return nat_log_commit(fs);
+}
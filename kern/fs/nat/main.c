@@ -37,28 +37,130 @@
 #include <sys/types.h>
 #include <sys/ioctl.h>
 
+/*
+ * Operations that modify metadata are bracketed so that the intent
+ * log is never committed in the middle of one, other than where a long
+ * operation splits itself with nat_log_split.
+ */
+static int log_creat(struct fso **f, struct fs *fs, const char *name, mode_t mode, dev_t rdev)
+{
+	int err;
+	
+	err = nat_log_begin(fs);
+	if (err)
+		return err;
+	err = nat_creat(f, fs, name, mode, rdev);
+	nat_log_end(fs);
+	return err;
+}
+
+static int log_write(struct fs_rwreq *req)
+{
+	struct fs *fs = req->fso->fs;
+	int err;
+	
+	err = nat_log_begin(fs);
+	if (err)
+		return err;
+	err = nat_write(req);
+	nat_log_end(fs);
+	return err;
+}
+
+static int log_trunc(struct fso *fso)
+{
+	int err;
+	
+	err = nat_log_begin(fso->fs);
+	if (err)
+		return err;
+	err = nat_trunc(fso);
+	nat_log_end(fso->fs);
+	return err;
+}
+
+static int log_link(struct fso *f, const char *name)
+{
+	int err;
+	
+	err = nat_log_begin(f->fs);
+	if (err)
+		return err;
+	err = nat_link(f, name);
+	nat_log_end(f->fs);
+	return err;
+}
+
+static int log_unlink(struct fs *fs, const char *name)
+{
+	int err;
+	
+	err = nat_log_begin(fs);
+	if (err)
+		return err;
+	err = nat_unlink(fs, name);
+	nat_log_end(fs);
+	return err;
+}
+
+static int log_rename(struct fs *fs, const char *oldname, const char *newname)
+{
+	int err;
+	
+	err = nat_log_begin(fs);
+	if (err)
+		return err;
+	err = nat_rename(fs, oldname, newname);
+	nat_log_end(fs);
+	return err;
+}
+
+static int log_mkdir(struct fs *fs, const char *name, mode_t mode)
+{
+	int err;
+	
+	err = nat_log_begin(fs);
+	if (err)
+		return err;
+	err = nat_mkdir(fs, name, mode);
+	nat_log_end(fs);
+	return err;
+}
+
+static int log_rmdir(struct fs *fs, const char *name)
+{
+	int err;
+	
+	err = nat_log_begin(fs);
+	if (err)
+		return err;
+	err = nat_rmdir(fs, name);
+	nat_log_end(fs);
+	return err;
+}
+
 static struct fstype fstype =
 {
 	.name		= "native",
 	.mount		= nat_mount,
 	.umount		= nat_umount,
 	.lookup		= nat_lookup,
-	.creat		= nat_creat,
+	.creat		= log_creat,
 	.getfso		= nat_getfso,
 	.putfso		= nat_putfso,
 	.syncfso	= nat_syncfso,
 	.readdir	= nat_readdir,
 	.ioctl		= nat_ioctl,
 	.read		= nat_read,
-	.write		= nat_write,
-	.trunc		= nat_trunc,
+	.write		= log_write,
+	.trunc		= log_trunc,
 	.chk_perm	= nat_chk_perm,
-	.link		= nat_link,
-	.unlink		= nat_unlink,
-	.rename		= nat_rename,
+	.link		= log_link,
+	.unlink		= log_unlink,
+	.rename		= log_rename,
 	.chdir		= nat_chdir,
-	.mkdir		= nat_mkdir,
-	.rmdir		= nat_rmdir,
+	.mkdir		= log_mkdir,
+	.rmdir		= log_rmdir,
 	.statfs		= nat_statfs,
 	.sync		= nat_sync,
 };
@@ -76,12 +178,18 @@ int nat_chk_perm(struct fso *fso, int mode, uid_t uid, gid_t gid)
 
 int nat_sync(struct fs *fs)
 {
-	return nat_sync_bam(fs);
+	return nat_log_commit(fs);
 }
 
+/*
+ * FIOCBMAP works in 512-byte sectors regardless of the block size,
+ * the sector is translated to the file system block that holds it.
+ */
 int nat_ioctl(struct fso *fso, int cmd, void *buf)
 {
+	int bshift = fso->fs->bshift;
 	blk_t blk;
+	blk_t sec;
 	int err;
 	
 	if (cmd != FIOCBMAP)
@@ -95,11 +203,15 @@ int nat_ioctl(struct fso *fso, int cmd, void *buf)
 	if (err)
 		return err;
 	
-	err = nat_bmap(fso, blk, 0);
+	sec = blk & ((1 << bshift) - 1);
+	
+	err = nat_bmap(fso, blk >> bshift, 0);
 	if (err)
 		return err;
 	
 	blk = fso->nat.bmap_phys;
+	if (blk)
+		blk = blk << bshift | sec;
 	return tucpy(buf, &blk, sizeof blk);
 }
 
@@ -115,7 +227,7 @@ static int popcnt(uint32_t v)
 
 int nat_statfs(struct fs *fs, struct statfs *st)
 {
-	uint32_t *ebam = (void *)(fs->nat.bam_buf + BLK_SIZE);
+	uint32_t *ebam = (void *)(fs->nat.bam_buf + NAT_BSIZE(fs));
 	uint32_t *bamp;
 	blk_t i;
 	int err;
@@ -136,5 +248,9 @@ int nat_statfs(struct fs *fs, struct statfs *st)
 			st->blk_free += popcnt(~*bamp);
 		}
 	}
+	
+	/* statfs counts 512-byte blocks */
+	st->blk_total <<= fs->bshift;
+	st->blk_free  <<= fs->bshift;
 	return 0;
 }
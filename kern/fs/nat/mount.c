@@ -57,6 +57,35 @@ int nat_mount(struct fs *fs)
 		return EINVAL;
 	}
 	
+	fs->bshift = 0;
+	if (NAT_FEATURES(sb) & NAT_F_BSIZE)
+	{
+		if (sb->bshift > NAT_BSHIFT_MAX || sb->bshift > BLK_MAXSHIFT)
+		{
+#if VERBOSE
+			printk("mount.c: nat_mount: bad block size\n");
+#endif
+			blk_put(sbb);
+			return EINVAL;
+		}
+		fs->bshift = sb->bshift;
+	}
+	
+	fs->nat.dev = fs->dev;
+	if (fs->bshift)
+	{
+		err = blk_view(&fs->nat.dev, fs->dev, fs->bshift);
+		if (err)
+		{
+			blk_put(sbb);
+			return err;
+		}
+	}
+	
+	err = kmalloc(&fs->nat.bam_buf, NAT_BSIZE(fs), "natbam");
+	if (err)
+		goto fail;
+	
 #if VERBOSE
 	printk("nat_mount: sb->bam_block  = %i\n", sb->bam_block);
 	printk("           sb->bam_size   = %i\n", sb->bam_size);
@@ -65,6 +94,7 @@ int nat_mount(struct fs *fs)
 	printk("           sb->root_block = %i\n", sb->root_block);
 	printk("           sb->ndirblks   = %i\n", sb->ndirblks);
 	printk("           sb->nindirlev  = %i\n", sb->nindirlev);
+	printk("           block size     = %i\n", NAT_BSIZE(fs));
 #endif
 	
 	fs->nat.bam_block  = sb->bam_block;
@@ -79,6 +109,12 @@ int nat_mount(struct fs *fs)
 	
 	fs->nat.ndirblks   = sb->ndirblks;
 	fs->nat.nindirlev  = sb->nindirlev;
+	fs->nat.hdir	   = !!(NAT_FEATURES(sb) & NAT_F_HDIR);
+	fs->nat.extent	   = !!(NAT_FEATURES(sb) & NAT_F_EXTENT);
+	
+	err = nat_log_mount(fs, sb);
+	if (err)
+		goto fail;
 	
 	if (!fs->read_only)
 	{
@@ -90,6 +126,32 @@ int nat_mount(struct fs *fs)
 	
 	blk_put(sbb);
 	return 0;
+fail:
+	free(fs->nat.bam_buf);
+	fs->nat.bam_buf = NULL;
+	if (fs->nat.dev != fs->dev)
+		blk_unview(fs->nat.dev);
+	fs->nat.dev = NULL;
+	blk_put(sbb);
+	return err;
+}
+
+/*
+ * Release the block size view, the log overlay and the BAM buffer.
+ * Releasing the view flushes it, so this must precede marking the
+ * superblock clean.
+ */
+static void nat_release(struct fs *fs)
+{
+	if (fs->nat.dev != fs->dev)
+		blk_unview(fs->nat.dev);
+	fs->nat.dev = NULL;
+	
+	free(fs->nat.log_ovl);
+	fs->nat.log_ovl = NULL;
+	
+	free(fs->nat.bam_buf);
+	fs->nat.bam_buf = NULL;
 }
 
 int nat_umount(struct fs *fs)
@@ -101,6 +163,8 @@ int nat_umount(struct fs *fs)
 	if (!fs->read_only)
 	{
 		nat_sync_bam(fs);
+		nat_log_umount(fs);
+		nat_release(fs);
 		
 		err = blk_read(&sbb, fs->dev, 1);
 		if (err)
@@ -113,11 +177,15 @@ int nat_umount(struct fs *fs)
 		
 		sb = (void *)sbb->data;
 		
+		if (NAT_FEATURES(sb) & NAT_F_LOG)
+			sb->log_seq = fs->nat.log_seq;
 		sb->dirty  = 0;
 		sbb->dirty = 1;
 		
 		blk_write(sbb);
 		blk_put(sbb);
 	}
+	else
+		nat_release(fs);
 	return 0;
 }
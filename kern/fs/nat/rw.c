@@ -80,38 +80,42 @@ int nat_read(struct fs_rwreq *req)
 	while (count)
 	{
 		struct block *b;
+		blk_t phys;
+		blk_t run;
 		unsigned l;
 		unsigned s;
 		
-		s = off % BLK_SIZE;
-		
-		if (count > BLK_SIZE - s)
-			l = BLK_SIZE - s;
-		else
-			l = count;
-		
-		err = nat_bmap(fso, off / BLK_SIZE, 0);
+		err = nat_bmap(fso, off / NAT_BSIZE(fso->fs), 0);
 		if (err)
 			return err;
 		
-		if (!fso->nat.bmap_phys)
-			memset(bp, 0, l);
-		else
+		phys = fso->nat.bmap_phys;
+		for (run = fso->nat.bmap_run; run && count; run--)
 		{
-			err = blk_read(&b, fso->fs->dev, fso->nat.bmap_phys);
-			if (err)
-				return err;
+			s = off % NAT_BSIZE(fso->fs);
 			
-			memcpy(bp, b->data + s, l);
+			if (count > NAT_BSIZE(fso->fs) - s)
+				l = NAT_BSIZE(fso->fs) - s;
+			else
+				l = count;
 			
-			blk_put(b);
-			if (err)
-				return err;
+			if (!phys)
+				memset(bp, 0, l);
+			else
+			{
+				err = blk_read(&b, fso->fs->nat.dev, phys++);
+				if (err)
+					return err;
+				
+				memcpy(bp, b->data + s, l);
+				
+				blk_put(b);
+			}
+			
+			count -= l;
+			off   += l;
+			bp    += l;
 		}
-		
-		count -= l;
-		off   += l;
-		bp    += l;
 	}
 	
 	return 0;
@@ -153,47 +157,55 @@ int nat_write(struct fs_rwreq *req)
 	while (count)
 	{
 		struct block *b;
+		blk_t phys;
+		blk_t run;
 		unsigned l;
 		unsigned s;
 		
-		s = off % BLK_SIZE;
-		
-		if (count > BLK_SIZE - s)
-			l = BLK_SIZE - s;
-		else
-			l = count;
+		err = nat_log_split(fso->fs);
+		if (err)
+			return err;
 		
-		err = nat_bmap(fso, off / BLK_SIZE, 1);
+		err = nat_bmap(fso, off / NAT_BSIZE(fso->fs), 1);
 		if (err)
 			return err;
 		
 		if (!fso->nat.bmap_phys)
 			panic("nat_write: !fso->nat.bmap_phys");
 		
-		if (off + l > fso->size)
+		phys = fso->nat.bmap_phys;
+		for (run = fso->nat.bmap_run; run && count; run--)
 		{
-			fso->size = off + l;
-			fso->dirty = 1;
+			s = off % NAT_BSIZE(fso->fs);
+			
+			if (count > NAT_BSIZE(fso->fs) - s)
+				l = NAT_BSIZE(fso->fs) - s;
+			else
+				l = count;
+			
+			if (off + l > fso->size)
+			{
+				fso->size = off + l;
+				fso->dirty = 1;
+			}
+			
+			if (l != NAT_BSIZE(fso->fs))
+				err = blk_read(&b, fso->fs->nat.dev, phys++);
+			else
+				err = blk_get(&b, fso->fs->nat.dev, phys++);
+			if (err)
+				return err;
+			
+			memcpy(b->data + s, bp, l);
+			
+			b->valid = 1;
+			b->dirty = 1;
+			blk_put(b);
+			
+			count -= l;
+			off   += l;
+			bp    += l;
 		}
-		
-		if (l != BLK_SIZE)
-			err = blk_read(&b, fso->fs->dev, fso->nat.bmap_phys);
-		else
-			err = blk_get(&b, fso->fs->dev, fso->nat.bmap_phys);
-		if (err)
-			return err;
-		
-		memcpy(b->data + s, bp, l);
-		
-		b->valid = 1;
-		b->dirty = 1;
-		blk_put(b);
-		if (err)
-			return err;
-		
-		count -= l;
-		off   += l;
-		bp    += l;
 	}
 	
 	return 0;
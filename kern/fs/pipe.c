@@ -34,6 +34,7 @@
 #include <kern/umem.h>
 #include <kern/lib.h>
 #include <kern/fs.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <errno.h>
 
@@ -57,12 +58,17 @@ static int pipe_creat(struct fso **f, struct fs *fs, const char *name, mode_t mo
 	return ENOSYS;
 }
 
+/*
+ * Blocked writers are only woken once half of the buffer is free, so that
+ * a writer and a reader do not take turns moving a few bytes each.
+ * A full pipe is still writable while its buffer can grow.
+ */
 static void pipe_ustate(struct fso *f)
 {
 	struct task *t;
 	int st = 0;
 	
-	if (f->size < PIPE_BUF)
+	if (f->size < f->pipe.buf_size || f->pipe.buf_size < f->pipe.buf_max)
 		st |= W_OK;
 	if (f->size)
 		st |= R_OK;
@@ -73,11 +79,55 @@ static void pipe_ustate(struct fso *f)
 		while (t = task_dequeue(&f->pipe.readers), t)
 			task_resume(t);
 	
-	if (st & W_OK)
+	if (f->pipe.buf_size - f->size >= f->pipe.buf_size / 2)
 		while (t = task_dequeue(&f->pipe.writers), t)
 			task_resume(t);
 }
 
+static int pipe_resize(struct fso *f, int size)
+{
+	char *buf;
+	int err;
+	int l;
+	
+	err = kmalloc(&buf, size, "pipe");
+	if (err)
+		return err;
+	
+	l = f->size;
+	if (l > f->pipe.buf_size - f->pipe.read_p)
+		l = f->pipe.buf_size - f->pipe.read_p;
+	
+	memcpy(buf, f->pipe.buf + f->pipe.read_p, l);
+	memcpy(buf + l, f->pipe.buf, f->size - l);
+	free(f->pipe.buf);
+	
+	f->pipe.buf	 = buf;
+	f->pipe.buf_size = size;
+	f->pipe.read_p	 = 0;
+	f->pipe.write_p	 = f->size % size;
+	return 0;
+}
+
+/*
+ * Doubles the buffer of a full pipe, up to buf_max. The buffer starts
+ * at PIPE_BUF, so pipes that never fill up stay small, and buf_max
+ * starts at PIPE_SIZE_DEF, so a slow reader does not pin much memory
+ * unless PIOCSSIZE asked for a larger buffer.
+ */
+static int pipe_grow(struct fso *f)
+{
+	int size;
+	
+	if (f->pipe.buf_size >= f->pipe.buf_max)
+		return ENOSPC;
+	
+	size = f->pipe.buf_size * 2;
+	if (size > f->pipe.buf_max)
+		size = f->pipe.buf_max;
+	return pipe_resize(f, size);
+}
+
 static int pipe_getfso(struct fso *f)
 {
 	int err;
@@ -90,9 +140,11 @@ static int pipe_getfso(struct fso *f)
 	}
 	task_qinit(&f->pipe.readers, "piperd");
 	task_qinit(&f->pipe.writers, "pipewr");
-	f->pipe.write_p	= 0;
-	f->pipe.read_p	= 0;
-	f->size		= 0;
+	f->pipe.write_p	 = 0;
+	f->pipe.read_p	 = 0;
+	f->pipe.buf_size = PIPE_BUF;
+	f->pipe.buf_max	 = PIPE_SIZE_DEF;
+	f->size		 = 0;
 	f->mode		= S_IFIFO | 0600;
 	f->uid		= curr->euid;
 	f->gid		= curr->egid;
@@ -145,24 +197,29 @@ static int pipe_read(struct fs_rwreq *req)
 		cnt = req->count = f->size;
 	
 	l = cnt;
-	if (l + f->pipe.read_p > PIPE_BUF)
-		l = PIPE_BUF - f->pipe.read_p;
+	if (l + f->pipe.read_p > f->pipe.buf_size)
+		l = f->pipe.buf_size - f->pipe.read_p;
 	
 	memcpy(req->buf, f->pipe.buf + f->pipe.read_p, l);
 	memcpy(req->buf + l, f->pipe.buf, cnt - l);
 	
 	f->pipe.read_p	+= cnt;
-	f->pipe.read_p	%= PIPE_BUF;
+	f->pipe.read_p	%= f->pipe.buf_size;
 	f->size		-= cnt;
 	pipe_ustate(f);
 	return 0;
 }
 
+/*
+ * Writes of at most PIPE_BUF bytes wait until they fit in the buffer as
+ * a whole, so that they are not interleaved with data from other writers.
+ */
 static int pipe_write(struct fs_rwreq *req)
 {
 	struct fso *f = req->fso;
 	char *buf = req->buf;
 	size_t resid;
+	size_t need;
 	size_t cnt;
 	size_t l;
 	int err;
@@ -176,8 +233,12 @@ static int pipe_write(struct fs_rwreq *req)
 	resid = req->count;
 	while (resid)
 	{
-		while (f->size >= PIPE_BUF)
+		need = req->count <= PIPE_BUF ? resid : 1;
+		
+		while (f->pipe.buf_size - f->size < need)
 		{
+			if (!pipe_grow(f))
+				continue;
 			if (req->no_delay)
 			{
 				req->count -= resid;
@@ -194,22 +255,18 @@ static int pipe_write(struct fs_rwreq *req)
 		}
 		
 		cnt = resid;
-		
-		if (cnt > PIPE_BUF)
-			cnt = PIPE_BUF;
-		
-		if (cnt + f->size > PIPE_BUF)
-			cnt = PIPE_BUF - f->size;
+		if (cnt + f->size > f->pipe.buf_size)
+			cnt = f->pipe.buf_size - f->size;
 		
 		l = cnt;
-		if (l + f->pipe.write_p > PIPE_BUF)
-			l = PIPE_BUF - f->pipe.write_p;
+		if (l + f->pipe.write_p > f->pipe.buf_size)
+			l = f->pipe.buf_size - f->pipe.write_p;
 		
 		memcpy(f->pipe.buf + f->pipe.write_p, buf, l);
 		memcpy(f->pipe.buf, buf + l, cnt - l);
 		
 		f->pipe.write_p	+= cnt;
-		f->pipe.write_p	%= PIPE_BUF;
+		f->pipe.write_p	%= f->pipe.buf_size;
 		f->size		+= cnt;
 		resid		-= cnt;
 		buf		+= cnt;
@@ -271,6 +328,37 @@ static int pipe_sync(struct fs *fs)
 
 static int pipe_ioctl(struct fso *f, int cmd,  void *p)
 {
+	unsigned max;
+	int err;
+	
+	switch (cmd)
+	{
+	case PIOCGSIZE:
+		max = f->pipe.buf_max;
+		return tucpy(p, &max, sizeof max);
+	case PIOCSSIZE:
+		err = fucpy(&max, p, sizeof max);
+		if (err)
+			return err;
+		if (max < PIPE_BUF || max > PIPE_SIZE_MAX)
+			return EINVAL;
+		if (max > PIPE_SIZE && curr->euid)
+			return EPERM;
+		
+		if (f->pipe.buf_size > max)
+		{
+			if (f->size > max)
+				return EBUSY;
+			err = pipe_resize(f, max);
+			if (err)
+				return err;
+		}
+		f->pipe.buf_max = max;
+		pipe_ustate(f);
+		return 0;
+	default:
+		;
+	}
 	return ENOTTY;
 }
 
@@ -38,6 +38,7 @@
 #include <kern/lib.h>
 #include <kern/fs.h>
 #include <termios.h>
+#include <ringbuf.h>
 #include <os386.h>
 
 #define ROOT_INDEX	1
@@ -45,6 +46,8 @@
 #define PTM_INDEX	3
 #define PTS_INDEX	(PTM_INDEX + PTY_MAX)
 
+#define PTY_CHUNK	256
+
 struct pty
 {
 	struct task_queue ptm_readers;
@@ -70,13 +73,8 @@ struct pty
 	int canon_intr;
 	int canon_eot;
 	
-	int in_count;
-	int in_p0;
-	int in_p1;
-	
-	int out_count;
-	int out_p0;
-	int out_p1;
+	struct ringbuf in;
+	struct ringbuf out;
 } *pty[PTY_MAX];
 
 static int pty_mounted;
@@ -165,6 +163,9 @@ static int pty_lookup(struct fso **f, struct fs *fs, const char *name)
 				
 				memset(pty[i], 0, sizeof *pty[i]);
 				
+				rb_init(&pty[i]->in,  pty[i]->in_buf,  sizeof pty[i]->in_buf);
+				rb_init(&pty[i]->out, pty[i]->out_buf, sizeof pty[i]->out_buf);
+				
 				task_qinit(&pty[i]->ptm_readers, "ptmrd");
 				task_qinit(&pty[i]->ptm_writers, "ptmwr");
 				task_qinit(&pty[i]->pts_readers, "ptsrd");
@@ -263,9 +264,9 @@ static int pty_getfso(struct fso *f)
 		f->uid	   = pty[i]->ptm_fso->uid;
 		f->gid	   = pty[i]->ptm_fso->gid;
 		f->no_seek = 1;
-		if (pty[i]->out_count < sizeof pty[i]->out_buf)
+		if (pty[i]->out.util < pty[i]->out.size)
 			state |= W_OK;
-		if (pty[i]->in_count)
+		if (pty[i]->in.util)
 			state |= R_OK;
 		fs_setstate(f, state);
 		
@@ -480,15 +481,13 @@ static int pty_ioctl(struct fso *fso, int cmd, void *buf)
 static int ptm_read(struct fs_rwreq *req)
 {
 	struct pty *pp = pty[req->fso->index - PTM_INDEX];
-	char *buf = req->buf;
-	int left;
+	size_t cnt;
 	int err;
-	char ch;
 	
 	if (!pp)
 		panic("ptm_read: !pp");
 	
-	while (!pp->out_count)
+	while (!pp->out.util)
 	{
 		if (req->no_delay)
 			return EAGAIN;
@@ -497,22 +496,13 @@ static int ptm_read(struct fs_rwreq *req)
 			return err;
 	}
 	
-	if (req->count > pp->out_count)
-		req->count = pp->out_count;
-	left = req->count;
+	cnt = req->count;
+	err = rb_uread(&pp->out, req->buf, &cnt);
+	if (err)
+		return err;
+	req->count = cnt;
 	
-	while (left)
-	{
-		ch = pp->out_buf[pp->out_p1];
-		*buf = ch;
-		
-		pp->out_count--;
-		pp->out_p1++;
-		pp->out_p1 %= sizeof pp->out_buf;
-		left--;
-		buf++;
-	}
-	if (!pp->out_count)
+	if (!pp->out.util)
 		fs_clrstate(pp->ptm_fso, R_OK);
 	pty_resume_pts_w(pp);
 	return 0;
@@ -521,10 +511,8 @@ static int ptm_read(struct fs_rwreq *req)
 static int pts_read(struct fs_rwreq *req)
 {
 	struct pty *pp = pty[req->fso->index - PTS_INDEX];
-	char *buf = req->buf;
-	int left;
+	size_t cnt;
 	int err;
-	char ch;
 	
 	if (!pp)
 		panic("pts_read: !pp");
@@ -544,7 +532,7 @@ restart:
 		return EINTR;
 	}
 	
-	while (!pp->in_count)
+	while (!pp->in.util)
 	{
 		if (req->no_delay)
 		{
@@ -563,22 +551,13 @@ restart:
 			return err;
 	}
 	
-	if (req->count > pp->in_count)
-		req->count = pp->in_count;
-	left = req->count;
+	cnt = req->count;
+	err = rb_uread(&pp->in, req->buf, &cnt);
+	if (err)
+		return err;
+	req->count = cnt;
 	
-	while (left)
-	{
-		ch = pp->in_buf[pp->in_p1];
-		*buf = ch;
-		
-		pp->in_count--;
-		pp->in_p1++;
-		pp->in_p1 %= sizeof pp->in_buf;
-		left--;
-		buf++;
-	}
-	if (!pp->in_count)
+	if (!pp->in.util)
 		fs_clrstate(pp->pts_fso, R_OK);
 	pty_resume_ptm_w(pp);
 	return 0;
@@ -599,17 +578,15 @@ static int pty_read(struct fs_rwreq *req)
 	return EPERM;
 }
 
-static void pty_echo(struct pty *pp, char ch)
+static void pty_echon(struct pty *pp, const char *data, size_t cnt)
 {
-	if (pp->out_count != sizeof pp->out_buf)
-	{
-		pp->out_buf[pp->out_p0] = ch;
-		pp->out_count++;
-		pp->out_p0++;
-		pp->out_p0 %= sizeof pp->out_buf;
-		
+	if (rb_write(&pp->out, data, cnt))
 		pty_resume_ptm_r(pp);
-	}
+}
+
+static void pty_echo(struct pty *pp, char ch)
+{
+	pty_echon(pp, &ch, 1);
 }
 
 static void pty_cecho(struct pty *pp, char ch)
@@ -769,16 +746,7 @@ static void pty_canon_input(struct pty *pp, char ch)
 			if (pp->tio.c_lflag & (ECHO | ECHONL))
 				pty_echo(pp, '\n');
 		}
-		for (i = 0; i < pp->canon_count; i++)
-		{
-			if (pp->in_count >= sizeof pp->in_buf)
-				break;
-			
-			pp->in_buf[pp->in_p0] = pp->canon_buf[i];
-			pp->in_p0++;
-			pp->in_p0 %= sizeof pp->in_buf;
-			pp->in_count++;
-		}
+		rb_write(&pp->in, pp->canon_buf, pp->canon_count);
 		pp->canon_count = 0;
 		pty_resume_pts_r(pp);
 		return;
@@ -792,60 +760,104 @@ static void pty_canon_input(struct pty *pp, char ch)
 	}
 }
 
+/*
+ * Add the leading run of ordinary characters in data to the line being
+ * edited and return its length; the run ends at the first character
+ * that pty_canon_input must handle individually.
+ */
+static size_t pty_canon_run(struct pty *pp, const char *data, size_t cnt)
+{
+	cc_t *cc = pp->tio.c_cc;
+	size_t room;
+	size_t n;
+	char ch;
+	
+	for (n = 0; n < cnt; n++)
+	{
+		ch = data[n];
+		
+		if ((unsigned char)ch < 0x20 || ch == 127)
+			break;
+		if (ch == cc[VKILL] || ch == cc[VEOF] || ch == cc[VINTR] ||
+		    ch == cc[VREPRINT] || ch == cc[VQUIT] || ch == cc[VERASE])
+			break;
+	}
+	
+	room = MAX_CANON - pp->canon_count;
+	if (room > n)
+		room = n;
+	
+	memcpy(pp->canon_buf + pp->canon_count, data, room);
+	pp->canon_count += room;
+	if (pp->tio.c_lflag & ECHO)
+		pty_echon(pp, data, room);
+	return n;
+}
+
 static int ptm_write(struct fs_rwreq *req)
 {
 	struct pty *pp = pty[req->fso->index - PTM_INDEX];
+	char chunk[PTY_CHUNK];
 	char *buf = req->buf;
 	int left = req->count;
+	size_t cnt;
+	size_t i;
+	size_t n;
 	int err;
-	char ch;
 	
 	if (!left)
 		return 0;
 	
 	while (left)
 	{
-		if ((err = fucpy(&ch, buf, 1)))
+		cnt = left;
+		if (cnt > sizeof chunk)
+			cnt = sizeof chunk;
+		
+		if ((err = fucpy(chunk, buf, cnt)))
 			goto fail;
 		
-		if (pp->tio.c_lflag & ICANON)
-			pty_canon_input(pp, ch);
-		else
+		for (i = 0; i < cnt; i += n)
 		{
-			while (pp->in_count >= sizeof pp->in_buf)
+			if (pp->tio.c_lflag & ICANON)
 			{
-				if (req->no_delay)
+				n = pty_canon_run(pp, chunk + i, cnt - i);
+				if (!n)
 				{
-					req->count -= left;
-					goto fini;
+					pty_canon_input(pp, chunk[i]);
+					n = 1;
 				}
-				if (curr->signal_pending)
+			}
+			else
+			{
+				while (pp->in.util >= pp->in.size)
 				{
-					err = EINTR;
-					goto fail;
+					if (req->no_delay)
+						goto fini;
+					if (curr->signal_pending)
+					{
+						err = EINTR;
+						goto fail;
+					}
+					pty_resume_pts_r(pp);
+					err = task_suspend(&pp->ptm_writers, WAIT_INTR);
+					if (err)
+						goto fail;
 				}
-				pty_resume_pts_r(pp);
-				err = task_suspend(&pp->ptm_writers, WAIT_INTR);
-				if (err)
-					goto fail;
+				
+				n = rb_write(&pp->in, chunk + i, cnt - i);
+				if (pp->tio.c_lflag & ECHO)
+					pty_echon(pp, chunk + i, n);
 			}
-			
-			pp->in_buf[pp->in_p0] = ch;
-			pp->in_count++;
-			pp->in_p0++;
-			pp->in_p0 %= sizeof pp->in_buf;
-			
-			if (pp->tio.c_lflag & ECHO)
-				pty_echo(pp, ch);
+			left -= n;
+			buf  += n;
 		}
-		left--;
-		buf++;
 	}
 	
 fini:
 	err = 0;
 fail:
-	if (pp->in_count >= sizeof pp->in_buf)
+	if (pp->in.util >= pp->in.size)
 		fs_clrstate(pp->ptm_fso, W_OK);
 	pty_resume_pts_r(pp);
 	
@@ -860,23 +872,21 @@ static int pts_write(struct fs_rwreq *req)
 	struct pty *pp = pty[req->fso->index - PTS_INDEX];
 	char *buf = req->buf;
 	int left = req->count;
+	size_t cnt;
 	int err;
-	char ch;
 	
 	if (!left)
 		return 0;
 	
 	while (left)
 	{
-		if ((err = fucpy(&ch, buf, 1)))
-			goto fail;
-		
-		while (pp->out_count >= sizeof pp->out_buf)
+		while (pp->out.util >= pp->out.size)
 		{
 			if (!pp->ptm_fso)
 			{
 				signal_raise(SIGHUP);
 				req->count = 0;
+				left = 0;
 				goto fini;
 			}
 			if (pp->canon_intr)
@@ -899,18 +909,18 @@ static int pts_write(struct fs_rwreq *req)
 				goto fail;
 		}
 		
-		pp->out_buf[pp->out_p0] = ch;
-		pp->out_count++;
-		pp->out_p0++;
-		pp->out_p0 %= sizeof pp->out_buf;
-		left--;
-		buf++;
+		cnt = left;
+		err = rb_uwrite(&pp->out, buf, &cnt);
+		if (err)
+			goto fail;
+		left -= cnt;
+		buf  += cnt;
 	}
 
 fini:
 	err = 0;
 fail:
-	if (pp->out_count >= sizeof pp->out_buf)
+	if (pp->out.util >= pp->out.size)
 		fs_clrstate(pp->pts_fso, W_OK);
 	pty_resume_ptm_r(pp);
 	
@@ -45,11 +45,6 @@
 #include <mount.h>
 #include <os386.h>
 
-struct task_queue fs_pollq =
-{
-	.name	= "poll",
-};
-
 char *sys_getcwd(char *path, int len)
 {
 	int err;
@@ -555,8 +550,8 @@ int sys_fstat(int fd, struct stat *st)
 	st->st_uid	= fso->uid;
 	st->st_gid	= fso->gid;
 	st->st_size	= fso->size;
-	st->st_blksize	= BLK_SIZE;
-	st->st_blocks	= fso->blocks;
+	st->st_blksize	= BLK_SIZE << fso->fs->bshift;
+	st->st_blocks	= fso->blocks << fso->fs->bshift;
 	st->st_atime	= fso->atime;
 	st->st_ctime	= fso->ctime;
 	st->st_mtime	= fso->mtime;
@@ -883,41 +878,9 @@ int sys__mtab(struct _mtab *buf, int len)
 	return 0;
 }
 
-static void unpoll1(struct fso *f)
-{
-	int s;
-	
-	if (!f->pollcnt)
-		panic("unpoll1: !f->pollcnt");
-	s = intr_dis();
-	if (f->polling == curr)
-		f->polling = NULL;
-	f->pollcnt--;
-	intr_res(s);
-}
-
-static void poll1(struct fso *f)
-{
-	int s;
-	
-	if (f->pollcnt)
-	{
-		s = intr_dis();
-		curr->multipoll = 1;
-		f->polling->multipoll = 1;
-		f->polling = NULL;
-		f->pollcnt++;
-		intr_res(s);
-		return;
-	}
-	s = intr_dis();
-	f->polling = curr;
-	f->pollcnt = 1;
-	intr_res(s);
-}
-
 int sys__poll(struct pollfd *pfd, int cnt, int ndelay)
 {
+	struct fs_pollent *pe = NULL;
 	struct fso *f;
 	int rcnt;
 	int err;
@@ -932,22 +895,34 @@ int sys__poll(struct pollfd *pfd, int cnt, int ndelay)
 	}
 	
 	for (i = 0; i < cnt; i++)
+	{
 		err = fs_fdaccess(pfd[i].fd, pfd[i].events);
 		if (err)
 		{
 			uerr(err);
 			return -1;
 		}
+	}
 	
-	if (!ndelay)
+	if (!ndelay && cnt)
+	{
+		err = kmalloc(&pe, sizeof *pe * cnt, "poll");
+		if (err)
+		{
+			uerr(err);
+			return -1;
+		}
+		memset(pe, 0, sizeof *pe * cnt);
+		
 		for (i = 0; i < cnt; i++)
 		{
-			err = fs_fdaccess(pfd[i].fd, pfd[i].events);
-			if (err)
-				panic("sys_poll: fs_fdaccess failed");
-			
-			poll1(curr->file_desc[pfd[i].fd].file->fso);
+			pe[i].fso    = curr->file_desc[pfd[i].fd].file->fso;
+			pe[i].task   = curr;
+			pe[i].fd     = pfd[i].fd;
+			pe[i].events = pfd[i].events;
+			fs_pollreg(&pe[i]);
 		}
+	}
 	
 	rcnt = 0;
 	/* err  = 0; */
@@ -964,7 +939,9 @@ int sys__poll(struct pollfd *pfd, int cnt, int ndelay)
 			break;
 		}
 		
-		err = task_suspend(&fs_pollq, WAIT_INTR);
+		curr->pollwait = 1;
+		err = task_suspend(NULL, WAIT_INTR);
+		curr->pollwait = 0;
 		intr_res(s);
 		if (err)
 			break;
@@ -973,14 +950,14 @@ int sys__poll(struct pollfd *pfd, int cnt, int ndelay)
 	for (i = 0; i < cnt; i++)
 	{
 		f = curr->file_desc[pfd[i].fd].file->fso;
-		if (!ndelay)
-			unpoll1(f);
+		if (pe != NULL)
+			fs_pollunreg(&pe[i]);
 		
 		s = intr_dis();
 		pfd[i].revents = f->state & pfd[i].events;
 		intr_res(s);
 	}
-	curr->multipoll = 0;
+	free(pe);
 	
 	if (rcnt)
 		return rcnt;
@@ -989,6 +966,122 @@ int sys__poll(struct pollfd *pfd, int cnt, int ndelay)
 	return 0;
 }
 
+int sys__pset_ctl(int fd, int events, int flags)
+{
+	struct fs_pollent *pe;
+	int err;
+	
+	if (flags & ~PS_EDGE)
+	{
+		uerr(EINVAL);
+		return -1;
+	}
+	
+	for (pe = curr->pset; pe != NULL; pe = pe->tnext)
+		if (pe->fd == fd)
+			break;
+	
+	if (!events)
+	{
+		if (pe == NULL)
+		{
+			uerr(ENOENT);
+			return -1;
+		}
+		fs_psetclose(fd);
+		return 0;
+	}
+	
+	err = fs_fdaccess(fd, events);
+	if (err)
+	{
+		uerr(err);
+		return -1;
+	}
+	
+	if (pe != NULL)
+	{
+		pe->events  = events;
+		pe->flags   = flags;
+		pe->pending = 0;
+		return 0;
+	}
+	
+	err = kmalloc(&pe, sizeof *pe, "pset");
+	if (err)
+	{
+		uerr(err);
+		return -1;
+	}
+	memset(pe, 0, sizeof *pe);
+	
+	pe->fso	   = curr->file_desc[fd].file->fso;
+	pe->task   = curr;
+	pe->fd	   = fd;
+	pe->events = events;
+	pe->flags  = flags;
+	
+	pe->tnext  = curr->pset;
+	curr->pset = pe;
+	fs_pollreg(pe);
+	return 0;
+}
+
+int sys__pset_wait(struct pollfd *pfd, int cnt, int ndelay)
+{
+	struct fs_pollent *pe;
+	int rcnt;
+	int err;
+	int st;
+	int s;
+	
+	err = uaa(&pfd, sizeof *pfd, cnt, UA_WRITE);
+	if (err)
+	{
+		uerr(err);
+		return -1;
+	}
+	
+	for (;;)
+	{
+		rcnt = 0;
+		
+		s = intr_dis();
+		for (pe = curr->pset; pe != NULL && rcnt < cnt; pe = pe->tnext)
+		{
+			st = pe->fso->state & pe->events;
+			
+			/* an edge may have been followed by the condition clearing again */
+			if (pe->flags & PS_EDGE)
+			{
+				if (!pe->pending)
+					continue;
+				pe->pending = 0;
+			}
+			if (!st)
+				continue;
+			
+			pfd[rcnt].fd	  = pe->fd;
+			pfd[rcnt].events  = pe->events;
+			pfd[rcnt].revents = st;
+			rcnt++;
+		}
+		
+		if (rcnt || ndelay || !cnt)
+		{
+			intr_res(s);
+			return rcnt;
+		}
+		
+		curr->pollwait = 1;
+		err = task_suspend(NULL, WAIT_INTR);
+		curr->pollwait = 0;
+		intr_res(s);
+		if (err)
+			return 0;
+	}
+}
+
 int sys__ctty(const char *pathname)
 {
 	int err;
@@ -26,6 +26,10 @@
 #
 
 ARCH_O := ../lib/arch-amd64/io.o	\
+	  ../lib/string-amd64/memcpy.o	\
+	  ../lib/string-amd64/memmove.o	\
+	  ../lib/string-amd64/memset.o	\
+	  ../lib/string-amd64/cpu.o	\
 	  arch-amd64/switch.o		\
 	  arch-amd64/syscall.o		\
 	  arch-amd64/intr_regs.o	\
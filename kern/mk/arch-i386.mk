@@ -36,4 +36,7 @@ ARCH_O := ../lib/arch-i386/io.o		\
 	  arch-i386/page.o		\
 	  arch-i386/page_asm.o		\
 	  panic_i386.o			\
-	  lib/printk_i386.o
+	  lib/printk_i386.o		\
+	  lib/memmove.o			\
+	  lib/memcpy.o			\
+	  lib/memset.o
@@ -31,8 +31,7 @@ COMMON_LIB_O := lib/strcpy.o	lib/strcmp.o		\
                 lib/strcat.o	lib/strchr.o		\
                 lib/strrchr.o	lib/strlen.o		\
                 lib/strncpy.o	lib/strncmp.o		\
-                lib/memmove.o	lib/memcmp.o		\
-                lib/memcpy.o	lib/memset.o		\
+                lib/memcmp.o				\
                 lib/list.o	lib/ringbuf.o		\
                 lib/ringbuf_kern.o
 
@@ -40,7 +39,7 @@ LIB_O := lib/malloc.o lib/phys_map.o \
          lib/printk.o lib/panic.o
 
 NATFS_O := fs/nat/main.o fs/nat/dir.o fs/nat/mount.o fs/nat/rw.o \
-           fs/nat/bmap.o fs/nat/fso.o
+           fs/nat/bmap.o fs/nat/fso.o fs/nat/log.o fs/nat/extent.o
 
 BFS_O := fs/bfs/bfs.o
 
@@ -100,6 +100,7 @@ static struct ksym
 	{ "clock_delay",		clock_delay		},
 	{ "clock_hz",			clock_hz		},
 	{ "clock_ihand",		clock_ihand		},
+	{ "clock_iunhand",		clock_iunhand		},
 	{ "clock_intr",			clock_intr		},
 	
 	{ "outb",			outb			},
@@ -871,6 +871,8 @@ int sys__taskinfo(struct taskinfo *buf)
 			lbuf.size  = task[i]->pg_count + PAGES_PER_TASK;
 			lbuf.size *= PAGE_SIZE;
 			lbuf.maxev = task[i]->event_high;
+			lbuf.evmerged  = task[i]->event_merged;
+			lbuf.evdropped = task[i]->event_dropped;
 			lbuf.prio  = task[i]->priority;
 			s = intr_dis();
 			lbuf.cpu   = task[i]->cputime;
@@ -152,12 +152,14 @@ extern int sys__evt_wait();
 extern int sys_evt_signal();
 extern int sys__bdev_stat();
 extern int sys__bdev_max();
+extern int sys__pset_ctl();
+extern int sys__pset_wait();
 
 struct syscall
 {
 	void *	proc;
 	int	uidz;
-} syscall_tab[151] = 
+} syscall_tab[153] = 
 {
 	[0]	= { sys__sysmesg,		1 },
 	[1]	= { sys__iopl,			1 },
@@ -310,4 +312,6 @@ struct syscall
 	[148]	= { sys_evt_signal,		0 },
 	[149]	= { sys__bdev_stat,		1 },
 	[150]	= { sys__bdev_max,		1 },
+	[151]	= { sys__pset_ctl,		0 },
+	[152]	= { sys__pset_wait,		0 },
 };
@@ -1 +1 @@
-#define NR_SYS	151
+#define NR_SYS	153
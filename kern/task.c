@@ -272,6 +272,8 @@ int task_creat(const char *name, const void *arg, int arg_size, pid_t *pid)
 	p->event_count	 = 0;
 	p->first_event	 = 0;
 	p->last_event	 = -1;
+	p->event_merged	 = 0;
+	p->event_dropped = 0;
 	p->pg_count	 = 0;
 	
 	err = pg_newdir(p->pg_dir);
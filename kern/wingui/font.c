@@ -35,6 +35,69 @@
 
 struct win_font win_font[FONT_MAX];
 
+static struct win_gcache win_gcache[GCACHE_MAX];
+static unsigned win_gcache_stamp;
+
+static int win_rfont(struct win_font *f, unsigned x, unsigned y)
+{
+	return (f->bitmap[x / 8 + y * f->linelen] >> (x & 7)) & 1;
+}
+
+static unsigned scan_spans(struct win_font *f, struct win_glyph *gl, unsigned y, struct win_span *sp)
+{
+	unsigned cnt = 0;
+	unsigned x, x0;
+	
+	for (x = 0; x < gl->width; )
+	{
+		if (!win_rfont(f, gl->pos + x, y))
+		{
+			x++;
+			continue;
+		}
+		
+		for (x0 = x; x < gl->width && win_rfont(f, gl->pos + x, y); x++)
+			;
+		
+		if (sp)
+		{
+			sp[cnt].x   = x0;
+			sp[cnt].len = x - x0;
+		}
+		cnt++;
+	}
+	return cnt;
+}
+
+static void init_spans(struct win_font *f)
+{
+	unsigned cnt = 0;
+	unsigned c, y, i;
+	
+	for (c = 0; c < 256; c++)
+		for (y = 0; y < f->height; y++)
+			cnt += scan_spans(f, f->glyph[c], y, NULL);
+	
+	if (kmalloc(&f->span_index, sizeof *f->span_index * (256 * f->height + 1), "font: spans"))
+		return;
+	
+	if (kmalloc(&f->span, sizeof *f->span * (cnt + 1), "font: spans"))
+	{
+		free(f->span_index);
+		f->span_index = NULL;
+		return;
+	}
+	
+	i = 0;
+	for (c = 0; c < 256; c++)
+		for (y = 0; y < f->height; y++)
+		{
+			f->span_index[c * f->height + y] = i;
+			i += scan_spans(f, f->glyph[c], y, f->span + i);
+		}
+	f->span_index[256 * f->height] = i;
+}
+
 static int init_font(struct win_font *f, int size)
 {
 	struct win_glyph *gl = (struct win_glyph *)f->data;
@@ -75,10 +138,84 @@ static int init_font(struct win_font *f, int size)
 	
 	f->bitmap  = (uint8_t *)(gl + 1);
 	f->linelen = totw / 8;
+	f->height  = f->glyph[0]->height;
 	
+	init_spans(f);
 	return 0;
 }
 
+struct win_gcache *win_gcache_get(struct win_font *f, win_color bg, win_color fg)
+{
+	struct win_gcache *lru = win_gcache;
+	struct win_gcache *gc;
+	unsigned sz;
+	int i;
+	
+	for (gc = win_gcache; gc < win_gcache + GCACHE_MAX; gc++)
+	{
+		if (gc->font == f && gc->bg == bg && gc->fg == fg)
+		{
+			gc->stamp = ++win_gcache_stamp;
+			return gc;
+		}
+		
+		if (gc->stamp < lru->stamp)
+			lru = gc;
+	}
+	
+	if (ov_mul_u(f->linelen * 8, f->height))
+		return NULL;
+	sz = f->linelen * 8 * f->height;
+	if (sz > GCACHE_MAXSZ / sizeof *gc->pixels)
+		return NULL;
+	sz *= sizeof *gc->pixels;
+	
+	gc = lru;
+	if (gc->font && gc->font->linelen * 8 * gc->font->height * sizeof *gc->pixels != sz)
+	{
+		free(gc->pixels);
+		gc->font = NULL;
+	}
+	
+	if (!gc->font && kmalloc(&gc->pixels, sz, "font: gcache"))
+		return NULL;
+	
+	for (i = 0; i < sizeof gc->valid / sizeof *gc->valid; i++)
+		gc->valid[i] = 0;
+	
+	gc->font   = f;
+	gc->bg	   = bg;
+	gc->fg	   = fg;
+	gc->stride = f->linelen * 8;
+	gc->stamp  = ++win_gcache_stamp;
+	return gc;
+}
+
+const win_color *win_gcache_glyph(struct win_gcache *gc, unsigned ch)
+{
+	struct win_font *f = gc->font;
+	struct win_glyph *gl;
+	win_color *p;
+	unsigned x, y;
+	
+	ch &= 255;
+	gl  = f->glyph[ch];
+	
+	if (gc->valid[ch / 32] & (1U << (ch & 31)))
+		return gc->pixels + gl->pos;
+	
+	for (y = 0; y < f->height; y++)
+	{
+		p = gc->pixels + gl->pos + y * gc->stride;
+		
+		for (x = 0; x < gl->width; x++)
+			*p++ = win_rfont(f, gl->pos + x, y) ? gc->fg : gc->bg;
+	}
+	
+	gc->valid[ch / 32] |= 1U << (ch & 31);
+	return gc->pixels + gl->pos;
+}
+
 int win_chk_ftd(int ftd)
 {
 	struct win_desktop *d = curr->win_task.desktop;
@@ -27,8 +27,13 @@
 #include <kern/wingui.h>
 #include <kern/printk.h>
 #include <kern/task.h>
+#include <kern/lib.h>
 #include <errno.h>
 
+#define WIN_LINEBUF	1024
+
+static win_color win_linebuf[WIN_LINEBUF];
+
 struct win_request
 {
 	int (*proc)(struct win_request *rq);
@@ -504,13 +509,56 @@ static int win_rfont(struct win_font *font, int x, int y)
 	return (font->bitmap[x / 8 + y * font->linelen] >> (x & 7)) & 1;
 }
 
-static int win_autoclip_glyph(struct win_request *rq, int x0, int y0, struct win_glyph *gl, struct win_font *font)
+static int win_autoclip_glyph_spans(struct win_request *rq, int x0, int y0, unsigned ch, struct win_font *font)
+{
+	void *dd = rq->display->data;
+	struct win_span *sp, *ep;
+	unsigned *si;
+	int sx0, sx1;
+	int y, y1;
+	
+	y  = y0;
+	y1 = y0 + font->height;
+	
+	if (y < rq->clip_y0)
+		y = rq->clip_y0;
+	if (y1 > rq->clip_y1)
+		y1 = rq->clip_y1;
+	
+	si = font->span_index + ch * font->height - y0;
+	for (; y < y1; y++)
+	{
+		sp = font->span + si[y];
+		ep = font->span + si[y + 1];
+		
+		for (; sp < ep; sp++)
+		{
+			sx0 = x0 + sp->x;
+			sx1 = sx0 + sp->len;
+			
+			if (sx0 < rq->clip_x0)
+				sx0 = rq->clip_x0;
+			if (sx1 > rq->clip_x1)
+				sx1 = rq->clip_x1;
+			
+			if (sx0 < sx1)
+				rq->display->hline(dd, sx0, y, sx1 - sx0, rq->color);
+		}
+	}
+	return 0;
+}
+
+static int win_autoclip_glyph(struct win_request *rq, int x0, int y0, unsigned ch, struct win_font *font)
 {
+	struct win_glyph *gl = font->glyph[ch];
 	void *dd = rq->display->data;
 	int i = 0;
 	int x;
 	int y;
 	
+	if (font->span_index)
+		return win_autoclip_glyph_spans(rq, x0, y0, ch, font);
+	
 	for (y = 0; y < gl->height; y++)
 		for (x = 0; x < gl->width; x++, i++)
 		{
@@ -573,13 +621,56 @@ static int win_autoclip_bglyph_fast(struct win_request *rq, int x0, int y0, stru
 	return 0;
 }
 
-static int win_autoclip_bglyph(struct win_request *rq, int x0, int y0, struct win_glyph *gl, struct win_font *font)
+static struct win_gcache *win_autoclip_gcache(struct win_request *rq)
+{
+	if (!rq->display->span)
+		return NULL;
+	
+	return win_gcache_get(rq->font, rq->bg_color, rq->color);
+}
+
+static int win_autoclip_bglyph_cached(struct win_request *rq, struct win_gcache *gc, int x0, int y0, unsigned ch)
+{
+	struct win_glyph *gl = gc->font->glyph[ch];
+	void *dd = rq->display->data;
+	const win_color *p;
+	int cx0 = x0;
+	int cy0 = y0;
+	int cx1 = x0 + gl->width;
+	int cy1 = y0 + gc->font->height;
+	int y;
+	
+	if (cx0 < rq->clip_x0)
+		cx0 = rq->clip_x0;
+	if (cy0 < rq->clip_y0)
+		cy0 = rq->clip_y0;
+	if (cx1 > rq->clip_x1)
+		cx1 = rq->clip_x1;
+	if (cy1 > rq->clip_y1)
+		cy1 = rq->clip_y1;
+	
+	if (cx0 >= cx1)
+		return 0;
+	
+	p = win_gcache_glyph(gc, ch) + (cx0 - x0);
+	for (y = cy0; y < cy1; y++)
+		rq->display->span(dd, cx0, y, cx1 - cx0, p + (y - y0) * gc->stride);
+	return 0;
+}
+
+static int win_autoclip_bglyph(struct win_request *rq, int x0, int y0, unsigned ch, struct win_font *font)
 {
+	struct win_glyph *gl = font->glyph[ch];
 	void *dd = rq->display->data;
+	struct win_gcache *gc;
 	int i = 0;
 	int x;
 	int y;
 	
+	gc = win_autoclip_gcache(rq);
+	if (gc)
+		return win_autoclip_bglyph_cached(rq, gc, x0, y0, ch);
+	
 	if (x0 >= rq->clip_x0 && y0 >= rq->clip_y0 && x0 + gl->width <= rq->clip_x1 && y0 + gl->height <= rq->clip_y1)
 		return win_autoclip_bglyph_fast(rq, x0, y0, gl, font);
 	
@@ -625,7 +716,7 @@ static int win_autoclip_text(struct win_request *rq)
 		default:
 			gl = rq->font->glyph[*p];
 			
-			win_autoclip_glyph(rq, x, y, gl, rq->font);
+			win_autoclip_glyph(rq, x, y, *p, rq->font);
 			x += gl->width;
 		}
 		
@@ -635,13 +726,105 @@ static int win_autoclip_text(struct win_request *rq)
 	return 0;
 }
 
+static void win_autoclip_bline(struct win_request *rq, struct win_gcache *gc, const unsigned char *text, int len, int x0, int y0)
+{
+	struct win_font *font = gc->font;
+	void *dd = rq->display->data;
+	struct win_glyph *gl;
+	const win_color *sp;
+	int gx0, gx1, gw;
+	int cx, bx, n;
+	int y, y1;
+	int i;
+	
+	y  = y0;
+	y1 = y0 + font->height;
+	
+	if (y < rq->clip_y0)
+		y = rq->clip_y0;
+	if (y1 > rq->clip_y1)
+		y1 = rq->clip_y1;
+	
+	for (; y < y1; y++)
+	{
+		cx = x0;
+		bx = 0;
+		n  = 0;
+		
+		for (i = 0; i < len && cx < rq->clip_x1; i++)
+		{
+			if (text[i] == '\r')
+				continue;
+			
+			gl  = font->glyph[text[i]];
+			gx0 = cx;
+			gx1 = cx + gl->width;
+			
+			if (gx0 < rq->clip_x0)
+				gx0 = rq->clip_x0;
+			if (gx1 > rq->clip_x1)
+				gx1 = rq->clip_x1;
+			
+			if (gx0 < gx1)
+			{
+				gw = gx1 - gx0;
+				sp = win_gcache_glyph(gc, text[i]) + (y - y0) * gc->stride + (gx0 - cx);
+				
+				if (n + gw > WIN_LINEBUF)
+				{
+					if (n)
+						rq->display->span(dd, bx, y, n, win_linebuf);
+					n = 0;
+				}
+				
+				if (gw > WIN_LINEBUF)
+					rq->display->span(dd, gx0, y, gw, sp);
+				else
+				{
+					if (!n)
+						bx = gx0;
+					
+					memcpy(win_linebuf + n, sp, gw * sizeof *sp);
+					n += gw;
+				}
+			}
+			
+			cx += gl->width;
+		}
+		
+		if (n)
+			rq->display->span(dd, bx, y, n, win_linebuf);
+	}
+}
+
 static int win_autoclip_btext(struct win_request *rq)
 {
 	unsigned char *p = rq->text;
+	struct win_gcache *gc;
 	struct win_glyph *gl;
+	unsigned char *e;
 	int x = rq->rect.x;
 	int y = rq->rect.y;
 	
+	gc = win_autoclip_gcache(rq);
+	if (gc)
+	{
+		for (;;)
+		{
+			for (e = p; *e && *e != '\n'; e++)
+				;
+			
+			win_autoclip_bline(rq, gc, p, e - p, x, y);
+			if (!*e)
+				break;
+			
+			y += rq->font->height;
+			p  = e + 1;
+		}
+		
+		return 0;
+	}
+	
 	while (*p)
 	{
 		switch (*p)
@@ -655,7 +838,7 @@ static int win_autoclip_btext(struct win_request *rq)
 			default:
 				gl = rq->font->glyph[*p];
 				
-				win_autoclip_bglyph(rq, x, y, gl, rq->font);
+				win_autoclip_bglyph(rq, x, y, *p, rq->font);
 				x += gl->width;
 		}
 		
@@ -667,15 +850,55 @@ static int win_autoclip_btext(struct win_request *rq)
 
 static int win_autoclip_chr(struct win_request *rq)
 {
-	win_autoclip_glyph(rq, rq->rect.x, rq->rect.y,
-		rq->font->glyph[rq->ch], rq->font);
+	win_autoclip_glyph(rq, rq->rect.x, rq->rect.y, rq->ch, rq->font);
 	return 0;
 }
 
 static int win_autoclip_bchr(struct win_request *rq)
 {
-	win_autoclip_bglyph(rq, rq->rect.x, rq->rect.y,
-		rq->font->glyph[rq->ch], rq->font);
+	win_autoclip_bglyph(rq, rq->rect.x, rq->rect.y, rq->ch, rq->font);
+	return 0;
+}
+
+static int win_autoclip_bitmap_spans(struct win_request *rq)
+{
+	win_color tr = rq->display->transparent;
+	void *dd = rq->display->data;
+	const win_color *p;
+	int x0 = rq->rect.x;
+	int y0 = rq->rect.y;
+	int x1 = rq->rect.x + rq->rect.w;
+	int y1 = rq->rect.y + rq->rect.h;
+	int x, sx;
+	int y;
+	
+	if (x0 < rq->clip_x0)
+		x0 = rq->clip_x0;
+	if (y0 < rq->clip_y0)
+		y0 = rq->clip_y0;
+	if (x1 > rq->clip_x1)
+		x1 = rq->clip_x1;
+	if (y1 > rq->clip_y1)
+		y1 = rq->clip_y1;
+	
+	for (y = y0; y < y1; y++)
+	{
+		p = rq->bitmap + (y - rq->rect.y) * rq->rect.w - rq->rect.x;
+		
+		for (x = x0; x < x1; )
+		{
+			if (p[x] == tr)
+			{
+				x++;
+				continue;
+			}
+			
+			for (sx = x; x < x1 && p[x] != tr; x++)
+				;
+			rq->display->span(dd, sx, y, x - sx, p + sx);
+		}
+	}
+	
 	return 0;
 }
 
@@ -691,6 +914,9 @@ static int win_autoclip_bitmap(struct win_request *rq)
 	int y;
 	int i;
 	
+	if (rq->display->span)
+		return win_autoclip_bitmap_spans(rq);
+	
 	i = 0;
 	for (y = y0; y < y1; y++)
 		for (x = x0; x < x1; x++, i++)
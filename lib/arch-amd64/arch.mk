@@ -28,12 +28,14 @@
 STRING_O = string/strncat.o string/strncmp.o string/strncpy.o \
 	   string/strpbrk.o string/strrchr.o string/strspn.o \
 	   string/memccpy.o \
-	   string/memchr.o string/memcmp.o string/memmove.o \
+	   string/memchr.o string/memcmp.o \
 	   string/strcat.o string/strchr.o string/strcmp.o \
-	   string/strcpy.o string/strcspn.o string/strlen.o \
+	   string/strcpy.o string/strcspn.o \
 	   string/strdup.o string/strstr.o string/strtok.o \
 	   string/bzero.o string/bcopy.o \
-	   string/memcpy.o string/memset.o
+	   string-amd64/memcpy.o string-amd64/memmove.o \
+	   string-amd64/memset.o string-amd64/strlen.o \
+	   string-amd64/cpu.o
 
 MATH_O =
 
@@ -33,264 +33,441 @@
 #endif
 #include <string.h>
 #include <stdlib.h>
-#include <limits.h>
 #include <stdio.h>
-#include <errno.h>
 #include <err.h>
 
 #define SYMBOL(sym)	sym
 
 #if !REGEXP_DEBUG
 #define stdout		_get_stdout()
-#define errno		_get_errno()
 #endif
 
-#if REGEXP_DEBUG
-#define DPRINTF		warnx
-#else
-#define DPRINTF(x, ...)
-#endif
+/*
+ * Patterns are parsed into a tree of nodes, which is then compiled into
+ * a Thompson NFA program. regexec runs the program as a lazily built DFA:
+ * each DFA state is the set of NFA threads alive after some input and
+ * its transitions are computed the first time they are taken, so matching
+ * is linear in the length of the string.
+ *
+ * Before the DFA runs, the string is searched for the longest literal
+ * every match must contain, which rejects most non-matching lines.
+ *
+ * The DFA only answers whether the string matches. When the pattern has
+ * subexpressions, a matching string is run once more through a Pike VM,
+ * which tracks the subexpression bounds per thread and fills in startp
+ * and endp the way the backtracking matcher did.
+ */
 
-struct piece
+#define N_EMPTY		0
+#define N_CHAR		1
+#define N_ANY		2
+#define N_BOL		3
+#define N_EOL		4
+#define N_CAT		5
+#define N_ALT		6
+#define N_STAR		7
+#define N_PLUS		8
+#define N_QUEST		9
+#define N_SUBX		10
+
+#define MAX_NEST	32
+
+struct node
 {
-	int		min_rep, max_rep;
 	int		type;
-	struct piece *	next;
-	struct piece *	prev;
-	struct piece *	subx;
-	struct piece *	nextbr;
-	struct piece *	endbr;
-	int		sbxi;
-	const char *	start;
-	const char *	end;
-};
-
-struct regexp
-{
-	char *startp[NSUBEXP];
-	char *endp[NSUBEXP];
-	
-	struct piece	root;
+	int		c;
+	struct node *	left;
+	struct node *	right;
 };
 
-struct rcptrs
+struct parser
 {
-	struct piece *	piece;
-	struct piece *	lastp;
+	struct node *	node;
 	const char *	str;
 	int		nest;
-	int		sbxi;
+	int		nsub;
 };
 
-#define SI_BACKTRACK	0
-#define SI_RESTORE	1
+#define OP_CHAR		1
+#define OP_ANY		2
+#define OP_BOL		3
+#define OP_EOL		4
+#define OP_SPLIT	5
+#define OP_JMP		6
+#define OP_MATCH	7
+#define OP_SAVE		8
 
-struct rx
+struct inst
 {
-	struct piece *	piece;
-	const char *	spos;
-	const char *	str;
-	struct regexp *	rx;
+	int	op;
+	int	c;
+	int	x, y;
 };
 
-#define PT_GUARD	1
-#define PT_STRING	2
-#define PT_WILDCARD	3
-#define PT_SUBX		4
-#define PT_SOL		5
-#define PT_EOL		6
-#define PT_BRANCH	7
+#define DS_BOL		1
+#define DS_MATCH	2
+#define DS_DEAD		4
+#define DS_EOLDONE	8
+#define DS_EOLMATCH	16
+#define DS_EOL		32
 
-#define MAX_REP		INT_MAX
+#define DFA_MAX		128
+#define DFA_HASH	128
 
-static struct piece *	newpiece(struct rcptrs *rp, struct piece *list, int type);
-static struct piece *	SYMBOL(regcomp_str)(struct rcptrs *rp, struct piece *list);
-static struct piece *	SYMBOL(regcomp_split)(struct rcptrs *rp, struct piece *pc);
-static int		SYMBOL(regcomp_1)(struct rcptrs *rp, struct piece *list);
-
-static int		SYMBOL(regexec_p1)(struct rx *rx);
-static int		SYMBOL(regexec_p)(struct rx *rx);
-static int		SYMBOL(regexec_br)(struct rx *rx);
-static int		SYMBOL(regexec_m)(struct rx *rx);
-static int		SYMBOL(regexec_s)(struct regexp *rxp, const char *str);
+struct dstate
+{
+	struct dstate *	next[256];
+	struct dstate *	hnext;
+	unsigned	hash;
+	int		flags;
+	int		cnt;
+	int		pc[];
+};
 
-static struct piece *newpiece(struct rcptrs *rp, struct piece *list, int type)
+struct dfa
 {
-	struct piece *pc = rp->piece++;
-	
-	memset(pc, 0, sizeof *pc);
-	pc->min_rep	= pc->max_rep = 1;
-	pc->type	= type;
-	
-	if (list != NULL)
-	{
-		pc->next	= list;
-		pc->prev	= list->prev;
-		pc->next->prev	= pc;
-		pc->prev->next	= pc;
-	}
-	else
-		pc->next = pc->prev = pc;
+	struct dstate *	hash[DFA_HASH];
+	struct dstate *	start;
+	unsigned	epoch;
+	int		nstates;
 	
-	rp->lastp   = pc;
-	return rp->lastp;
-}
+	unsigned	gen;
+	unsigned *	mark;
+	int *		stack;
+	int *		set;
+	int		cnt;
+};
+
+#define NCAP		(2 * NSUBEXP)
 
-static struct piece *SYMBOL(regcomp_str)(struct rcptrs *rp, struct piece *list)
+struct vm
 {
-	struct piece *pc;
+	const char *	str;
+	unsigned	gen;
+	unsigned *	mark;
+	int *		pc[2];
+	const char **	cap[2];
+	int		cnt[2];
+};
+
+struct regexp
+{
+	char *startp[NSUBEXP];
+	char *endp[NSUBEXP];
 	
-	pc = newpiece(rp, list, PT_STRING);
-	pc->start = rp->str - 1;
-	pc->end   = rp->str + strcspn(rp->str, ".+*?()^$|");
+	struct inst *	prog;
+	int		ninst;
+	int		nsub;
+	char *		must;
+	struct dfa *	dfa;
+	struct vm *	vm;
+};
+
+static struct node *	SYMBOL(regcomp_alt)(struct parser *pp);
+
+static struct node *newnode(struct parser *pp, int type, struct node *left, struct node *right)
+{
+	struct node *n = pp->node++;
 	
-	rp->str = pc->end;
-	return pc;
+	n->type	 = type;
+	n->c	 = 0;
+	n->left	 = left;
+	n->right = right;
+	return n;
 }
 
-static struct piece *SYMBOL(regcomp_split)(struct rcptrs *rp, struct piece *pc)
+static struct node *SYMBOL(regcomp_atom)(struct parser *pp)
 {
-	struct piece *n;
+	struct node *n;
+	int c = *pp->str++;
+	int i;
 	
-	switch (pc->type)
+	switch (c)
 	{
-	case PT_STRING:
-		if (pc->start + 1 >= pc->end)
-			return pc;
-		
-		n = newpiece(rp, pc->next, PT_STRING);
-		n->start = pc->end - 1;
-		n->end   = pc->end;
-		pc->end  = n->start;
-		
+	case '(':
+		if (pp->nest++ >= MAX_NEST)
+			return NULL;
+		i = pp->nsub++;
+		n = SYMBOL(regcomp_alt)(pp);
+		if (n == NULL || *pp->str++ != ')')
+			return NULL;
+		pp->nest--;
+		if (i >= NSUBEXP)
+			return n;
+		n = newnode(pp, N_SUBX, n, NULL);
+		n->c = i;
 		return n;
+	case '.':
+		return newnode(pp, N_ANY, NULL, NULL);
+	case '^':
+		return newnode(pp, N_BOL, NULL, NULL);
+	case '$':
+		return newnode(pp, N_EOL, NULL, NULL);
+	case '*':
+	case '+':
+	case '?':
+		return NULL;
 	default:
-		;
+		n = newnode(pp, N_CHAR, NULL, NULL);
+		n->c = (unsigned char)c;
+		return n;
 	}
-	return pc;
 }
 
-int SYMBOL(regcomp_1)(struct rcptrs *rp, struct piece *list)
+static struct node *SYMBOL(regcomp_rep)(struct parser *pp)
 {
-	struct piece *sob = rp->piece;
-	struct piece *lt = NULL;
-	struct piece *pc, *pc1;
-	int c;
-	int n;
+	struct node *n;
 	
-	if (rp->nest >= 4)
-		return -1;
+	n = SYMBOL(regcomp_atom)(pp);
+	if (n == NULL)
+		return NULL;
 	
-	while (c = *rp->str++, c)
-	{
-		switch (c)
+	for (;;)
+		switch (*pp->str)
 		{
-		case '(':
-			pc  = newpiece(rp, list, PT_SUBX);
-			pc1 = newpiece(rp, NULL, PT_GUARD);
-			
-			pc->sbxi = rp->sbxi++;
-			pc->subx = pc1;
-			
-			n = rp->nest++;
-			if (SYMBOL(regcomp_1)(rp, pc1))
-				goto bad;
-			if (n != rp->nest)
-				goto bad;
-			break;
-		case ')':
-			if (!rp->nest--)
-				goto bad;
-			goto fini;
 		case '*':
-			if (lt == NULL)
-				goto bad;
-			
-			pc1 = SYMBOL(regcomp_split)(rp, lt);
-			pc1->min_rep = 0;
-			pc1->max_rep = MAX_REP;
+			n = newnode(pp, N_STAR, n, NULL);
+			pp->str++;
 			break;
 		case '+':
-			if (lt == NULL)
-				goto bad;
-			
-			pc1 = SYMBOL(regcomp_split)(rp, lt);
-			pc1->max_rep = MAX_REP;
+			n = newnode(pp, N_PLUS, n, NULL);
+			pp->str++;
 			break;
 		case '?':
-			if (lt == NULL)
-				goto bad;
-			
-			pc1 = SYMBOL(regcomp_split)(rp, lt);
-			pc1->min_rep--;
-			break;
-		case '.':
-			if (rp->lastp != NULL && rp->lastp->type == PT_WILDCARD)
-			{
-				if (pc->min_rep != MAX_REP)
-					rp->lastp->min_rep++;
-				if (pc->max_rep != MAX_REP)
-					rp->lastp->max_rep++;
-				break;
-			}
-			
-			pc = newpiece(rp, list, PT_WILDCARD);
-			break;
-		case '^':
-			pc = newpiece(rp, list, PT_SOL);
-			break;
-		case '$':
-			pc = newpiece(rp, list, PT_EOL);
-			break;
-		case '|':
-			pc = newpiece(rp, list, PT_BRANCH);
-			sob->nextbr = pc;
+			n = newnode(pp, N_QUEST, n, NULL);
+			pp->str++;
 			break;
 		default:
-			pc = SYMBOL(regcomp_str)(rp, list);
+			return n;
 		}
-		lt = pc;
+}
+
+static struct node *SYMBOL(regcomp_cat)(struct parser *pp)
+{
+	struct node *n = NULL;
+	struct node *r;
+	
+	while (*pp->str && *pp->str != '|' && *pp->str != ')')
+	{
+		r = SYMBOL(regcomp_rep)(pp);
+		if (r == NULL)
+			return NULL;
+		n = n != NULL ? newnode(pp, N_CAT, n, r) : r;
 	}
-fini:
-	return 0;
-bad:
-	DPRINTF("bad");
-	return -1;
+	
+	if (n == NULL)
+		n = newnode(pp, N_EMPTY, NULL, NULL);
+	return n;
+}
+
+static struct node *SYMBOL(regcomp_alt)(struct parser *pp)
+{
+	struct node *n, *r;
+	
+	n = SYMBOL(regcomp_cat)(pp);
+	while (n != NULL && *pp->str == '|')
+	{
+		pp->str++;
+		r = SYMBOL(regcomp_cat)(pp);
+		if (r == NULL)
+			return NULL;
+		n = newnode(pp, N_ALT, n, r);
+	}
+	return n;
+}
+
+static int SYMBOL(regcomp_len)(struct node *n)
+{
+	switch (n->type)
+	{
+	case N_EMPTY:
+		return 0;
+	case N_CAT:
+		return regcomp_len(n->left) + regcomp_len(n->right);
+	case N_ALT:
+		return regcomp_len(n->left) + regcomp_len(n->right) + 2;
+	case N_STAR:
+		return regcomp_len(n->left) + 2;
+	case N_PLUS:
+	case N_QUEST:
+		return regcomp_len(n->left) + 1;
+	case N_SUBX:
+		return regcomp_len(n->left) + 2;
+	default:
+		return 1;
+	}
+}
+
+static struct inst *SYMBOL(regcomp_emit)(struct inst *prog, struct inst *ip, struct node *n)
+{
+	struct inst *i0, *i1;
+	
+	switch (n->type)
+	{
+	case N_EMPTY:
+		break;
+	case N_CHAR:
+		ip->op = OP_CHAR;
+		ip->c  = n->c;
+		ip++;
+		break;
+	case N_ANY:
+		ip++->op = OP_ANY;
+		break;
+	case N_BOL:
+		ip++->op = OP_BOL;
+		break;
+	case N_EOL:
+		ip++->op = OP_EOL;
+		break;
+	case N_CAT:
+		ip = regcomp_emit(prog, ip, n->left);
+		ip = regcomp_emit(prog, ip, n->right);
+		break;
+	case N_ALT:
+		i0 = ip++;
+		i0->op = OP_SPLIT;
+		i0->x  = ip - prog;
+		ip = regcomp_emit(prog, ip, n->left);
+		i1 = ip++;
+		i1->op = OP_JMP;
+		i0->y  = ip - prog;
+		ip = regcomp_emit(prog, ip, n->right);
+		i1->x  = ip - prog;
+		break;
+	case N_STAR:
+		i0 = ip++;
+		i0->op = OP_SPLIT;
+		i0->x  = ip - prog;
+		ip = regcomp_emit(prog, ip, n->left);
+		ip->op = OP_JMP;
+		ip->x  = i0 - prog;
+		ip++;
+		i0->y  = ip - prog;
+		break;
+	case N_PLUS:
+		i0 = ip;
+		ip = regcomp_emit(prog, ip, n->left);
+		ip->op = OP_SPLIT;
+		ip->x  = i0 - prog;
+		ip->y  = ip - prog + 1;
+		ip++;
+		break;
+	case N_QUEST:
+		i0 = ip++;
+		i0->op = OP_SPLIT;
+		i0->x  = ip - prog;
+		ip = regcomp_emit(prog, ip, n->left);
+		i0->y  = ip - prog;
+		break;
+	case N_SUBX:
+		ip->op = OP_SAVE;
+		ip->x  = 2 * n->c;
+		ip++;
+		ip = regcomp_emit(prog, ip, n->left);
+		ip->op = OP_SAVE;
+		ip->x  = 2 * n->c + 1;
+		ip++;
+		break;
+	}
+	return ip;
+}
+
+/*
+ * Finds the longest run of literal characters in the top-level
+ * concatenation. Zero-width anchors do not break a run, and x+ ends
+ * a run with x.
+ */
+static void SYMBOL(regcomp_must)(struct node *n, char *run, int *rlen, char *must)
+{
+	switch (n->type)
+	{
+	case N_CAT:
+		regcomp_must(n->left,  run, rlen, must);
+		regcomp_must(n->right, run, rlen, must);
+		return;
+	case N_SUBX:
+		regcomp_must(n->left, run, rlen, must);
+		return;
+	case N_BOL:
+	case N_EOL:
+	case N_EMPTY:
+		return;
+	case N_CHAR:
+		run[(*rlen)++] = n->c;
+		break;
+	case N_PLUS:
+		if (n->left->type != N_CHAR)
+		{
+			*rlen = 0;
+			return;
+		}
+		run[(*rlen)++] = n->left->c;
+		break;
+	default:
+		*rlen = 0;
+		return;
+	}
+	
+	if (*rlen > strlen(must))
+	{
+		memcpy(must, run, *rlen);
+		must[*rlen] = 0;
+	}
+	if (n->type == N_PLUS)
+		*rlen = 0;
 }
 
 struct regexp *SYMBOL(regcomp_int)(const char *rxs)
 {
-	struct rcptrs rp;
+	struct node *nodes, *root;
+	struct parser pp;
 	struct regexp *rx;
-	size_t sbxc;
-	size_t pcc;
+	struct inst *ip;
+	size_t len;
 	size_t sz;
+	char *run;
+	int rlen;
+	int ni;
+	
+	len = strlen(rxs);
 	
-	sbxc = pcc = strlen(rxs); /* XXX */
+	nodes = malloc((4 * len + 2) * sizeof *nodes + len + 1);
+	if (nodes == NULL)
+		return NULL;
+	
+	memset(&pp, 0, sizeof pp);
+	pp.node = nodes;
+	pp.str	= rxs;
+	
+	root = regcomp_alt(&pp);
+	if (root == NULL || *pp.str)
+		goto bad;
 	
+	ni  = regcomp_len(root) + 1;
 	sz  = sizeof *rx;
-	sz += pcc * sizeof(struct piece); /* XXX overflow */
-	sz += pcc + 1;
+	sz += ni * sizeof *rx->prog;
+	sz += len + 1;
 	rx = calloc(1, sz);
 	if (rx == NULL)
-		return NULL;
+		goto bad;
 	
-	memset(&rp, 0, sizeof rp);
-	rp.piece = (void *)(rx + 1);
-	rp.str	 = (char *)(rx + 1) + pcc * sizeof(struct piece);
-	strcpy((void *)rp.str, rxs);
+	rx->prog  = (void *)(rx + 1);
+	rx->ninst = ni;
+	rx->nsub  = pp.nsub < NSUBEXP ? pp.nsub : NSUBEXP;
+	rx->must  = (char *)(rx->prog + ni);
 	
-	rx->root.min_rep = rx->root.max_rep = 1;
-	rx->root.next	 = &rx->root;
-	rx->root.prev	 = &rx->root;
-	rx->root.type	 = PT_GUARD;
+	ip = regcomp_emit(rx->prog, rx->prog, root);
+	ip->op = OP_MATCH;
 	
-	if (SYMBOL(regcomp_1)(&rp, &rx->root))
-		goto bad;
+	run  = (char *)(nodes + 4 * len + 2);
+	rlen = 0;
+	regcomp_must(root, run, &rlen, rx->must);
 	
+	free(nodes);
 	return rx;
 bad:
-	free(rx);
+	free(nodes);
 	return NULL;
 }
 
@@ -299,237 +476,452 @@ regexp *regcomp(const char *rxs)
 	return (regexp *)regcomp_int(rxs);
 }
 
-static int SYMBOL(regexec_p1)(struct rx *rx)
+static void dfa_flush(struct dfa *d)
 {
-	struct piece *pc = rx->piece;
-	const char *osp;
-	int sr;
+	struct dstate *s, *n;
+	int i;
 	
-	switch (pc->type)
+	for (i = 0; i < DFA_HASH; i++)
 	{
-	case PT_STRING:
-		if (strncmp(rx->spos, pc->start, pc->end - pc->start))
-			return 0;
-		rx->spos += pc->end - pc->start;
-		return 1;
-	case PT_WILDCARD:
-		if (!*rx->spos)
-			return 0;
-		rx->spos++;
-		return 1;
-	case PT_SOL:
-		if (rx->spos != rx->str)
-			return 0;
-		return 1;
-	case PT_EOL:
-		if (*rx->spos)
-			return 0;
-		return 1;
-	case PT_SUBX:
-		DPRINTF("regex_p1: entering subexpression");
-		rx->piece = pc->subx->next;
-		osp = rx->spos;
-		sr  = SYMBOL(regexec_m)(rx);
-		rx->piece = pc;
-		if (pc->sbxi < NSUBEXP)
+		for (s = d->hash[i]; s != NULL; s = n)
 		{
-			rx->rx->startp[pc->sbxi] = (char *)osp;
-			rx->rx->endp[pc->sbxi]	 = (char *)rx->spos;
+			n = s->hnext;
+			free(s);
 		}
-		DPRINTF("regex_p1: leaving subexpression");
-		return sr;
-	default:
-		errx(1, "regex_p1: %p: bad opc %i", pc, pc->type);
+		d->hash[i] = NULL;
 	}
+	d->start   = NULL;
+	d->nstates = 0;
+	d->epoch++;
 }
 
-static int SYMBOL(regexec_p)(struct rx *rx)
+static struct dfa *dfa_alloc(struct regexp *rx)
 {
-	struct piece *pc = rx->piece;
-	const char *osp  = rx->spos;
-	int i, cnt = pc->max_rep;
+	struct dfa *d;
 	
-	DPRINTF("i_regexec_p: pc = %p, spos = \"%s\", pc->type = %i", pc, rx->spos, pc->type);
+	d = calloc(1, sizeof *d + rx->ninst * (sizeof *d->mark + sizeof *d->stack + sizeof *d->set));
+	if (d == NULL)
+		return NULL;
 	
-	if (pc->type == PT_GUARD || pc->type == PT_BRANCH)
-		return 1;
+	d->mark	 = (void *)(d + 1);
+	d->stack = (void *)(d->mark + rx->ninst);
+	d->set	 = d->stack + rx->ninst;
+	return d;
+}
+
+/*
+ * Adds the threads reachable from pc to the set under construction.
+ * Each instruction is pushed at most once per generation, which bounds
+ * the stack and cuts loops of empty-width instructions.
+ */
+static void dfa_add(struct regexp *rx, struct dfa *d, int pc, int flags)
+{
+	struct inst *ip;
+	int sp = 0;
 	
-	if (pc->min_rep == 1 && pc->max_rep == 1)
+	d->stack[sp++] = pc;
+	while (sp)
 	{
-		if (SYMBOL(regexec_p1)(rx))
+		pc = d->stack[--sp];
+		if (d->mark[pc] == d->gen)
+			continue;
+		d->mark[pc] = d->gen;
+		
+		ip = &rx->prog[pc];
+		switch (ip->op)
 		{
-			rx->piece = pc->next;
-			return 1;
+		case OP_JMP:
+			d->stack[sp++] = ip->x;
+			break;
+		case OP_SAVE:
+			d->stack[sp++] = pc + 1;
+			break;
+		case OP_SPLIT:
+			if (d->mark[ip->y] != d->gen)
+				d->stack[sp++] = ip->y;
+			if (d->mark[ip->x] != d->gen)
+				d->stack[sp++] = ip->x;
+			break;
+		case OP_BOL:
+			if (flags & DS_BOL)
+				d->stack[sp++] = pc + 1;
+			break;
+		case OP_EOL:
+			if (flags & DS_EOL)
+				d->stack[sp++] = pc + 1;
+			else
+				d->set[d->cnt++] = pc;
+			break;
+		default:
+			d->set[d->cnt++] = pc;
 		}
-		return 0;
 	}
+}
+
+static void dfa_begin(struct dfa *d)
+{
+	d->cnt = 0;
+	if (!++d->gen)
+	{
+		memset(d->mark, 0, (char *)d->stack - (char *)d->mark);
+		d->gen = 1;
+	}
+}
+
+static struct dstate *dfa_state(struct regexp *rx, struct dfa *d, int flags)
+{
+	struct dstate *s;
+	unsigned h;
+	int i, j;
+	int t;
+	
+	for (i = 1; i < d->cnt; i++)
+		for (j = i; j > 0 && d->set[j - 1] > d->set[j]; j--)
+		{
+			t = d->set[j];
+			d->set[j] = d->set[j - 1];
+			d->set[j - 1] = t;
+		}
+	
+	h = flags;
+	for (i = 0; i < d->cnt; i++)
+		h = h * 31 + d->set[i];
+	
+	for (s = d->hash[h % DFA_HASH]; s != NULL; s = s->hnext)
+		if (s->hash == h && (s->flags & DS_BOL) == flags && s->cnt == d->cnt &&
+		    !memcmp(s->pc, d->set, d->cnt * sizeof *d->set))
+			return s;
+	
+	if (d->nstates >= DFA_MAX)
+		dfa_flush(d);
+	
+	s = calloc(1, sizeof *s + d->cnt * sizeof *d->set);
+	if (s == NULL)
+		return NULL;
+	memcpy(s->pc, d->set, d->cnt * sizeof *d->set);
+	s->cnt	 = d->cnt;
+	s->hash	 = h;
+	s->flags = flags;
+	
+	for (i = 0; i < d->cnt; i++)
+		if (rx->prog[s->pc[i]].op == OP_MATCH)
+			s->flags |= DS_MATCH;
+	if (!d->cnt)
+		s->flags |= DS_DEAD;
+	
+	s->hnext = d->hash[h % DFA_HASH];
+	d->hash[h % DFA_HASH] = s;
+	d->nstates++;
+	return s;
+}
+
+static struct dstate *dfa_step(struct regexp *rx, struct dfa *d, struct dstate *s, int c)
+{
+	struct inst *ip;
+	int i;
+	
+	dfa_begin(d);
+	for (i = 0; i < s->cnt; i++)
+	{
+		ip = &rx->prog[s->pc[i]];
+		if (ip->op == OP_ANY || (ip->op == OP_CHAR && ip->c == c))
+			dfa_add(rx, d, s->pc[i] + 1, 0);
+	}
+	dfa_add(rx, d, 0, 0);
+	return dfa_state(rx, d, 0);
+}
+
+static int dfa_eol(struct regexp *rx, struct dfa *d, struct dstate *s)
+{
+	int i;
+	
+	if (s->flags & DS_EOLDONE)
+		return !!(s->flags & DS_EOLMATCH);
+	
+	dfa_begin(d);
+	for (i = 0; i < s->cnt; i++)
+		if (rx->prog[s->pc[i]].op == OP_EOL)
+			dfa_add(rx, d, s->pc[i] + 1, (s->flags & DS_BOL) | DS_EOL);
+	
+	s->flags |= DS_EOLDONE;
+	for (i = 0; i < d->cnt; i++)
+		if (rx->prog[d->set[i]].op == OP_MATCH)
+			s->flags |= DS_EOLMATCH;
+	return !!(s->flags & DS_EOLMATCH);
+}
+
+static struct vm *vm_alloc(struct regexp *rx)
+{
+	struct vm *vm;
+	size_t n = rx->ninst;
+	
+	vm = calloc(1, sizeof *vm + n * (2 * NCAP * sizeof *vm->cap[0] +
+		2 * sizeof *vm->pc[0] + sizeof *vm->mark));
+	if (vm == NULL)
+		return NULL;
+	
+	vm->cap[0] = (void *)(vm + 1);
+	vm->cap[1] = vm->cap[0] + n * NCAP;
+	vm->pc[0]  = (void *)(vm->cap[1] + n * NCAP);
+	vm->pc[1]  = vm->pc[0] + n;
+	vm->mark   = (void *)(vm->pc[1] + n);
+	return vm;
+}
+
+static void vm_begin(struct regexp *rx, struct vm *vm)
+{
+	if (!++vm->gen)
+	{
+		memset(vm->mark, 0, rx->ninst * sizeof *vm->mark);
+		vm->gen = 1;
+	}
+}
+
+/*
+ * Adds a thread at pc to list l, following empty-width instructions in
+ * priority order. The subexpression bounds in cap are restored before
+ * returning and copied into the list for every thread added.
+ */
+static void vm_add(struct regexp *rx, struct vm *vm, int l, int pc, const char **cap, const char *sp)
+{
+	struct inst *ip;
+	const char *o;
+	int i;
+	
+	if (vm->mark[pc] == vm->gen)
+		return;
+	vm->mark[pc] = vm->gen;
+	
+	ip = &rx->prog[pc];
+	switch (ip->op)
+	{
+	case OP_JMP:
+		vm_add(rx, vm, l, ip->x, cap, sp);
+		break;
+	case OP_SPLIT:
+		vm_add(rx, vm, l, ip->x, cap, sp);
+		vm_add(rx, vm, l, ip->y, cap, sp);
+		break;
+	case OP_BOL:
+		if (sp == vm->str)
+			vm_add(rx, vm, l, pc + 1, cap, sp);
+		break;
+	case OP_EOL:
+		if (!*sp)
+			vm_add(rx, vm, l, pc + 1, cap, sp);
+		break;
+	case OP_SAVE:
+		o = cap[ip->x];
+		cap[ip->x] = sp;
+		vm_add(rx, vm, l, pc + 1, cap, sp);
+		cap[ip->x] = o;
+		break;
+	default:
+		i = vm->cnt[l]++;
+		vm->pc[l][i] = pc;
+		memcpy(vm->cap[l] + i * NCAP, cap, 2 * rx->nsub * sizeof *cap);
+	}
+}
+
+/*
+ * Runs the program as a Pike VM to find the subexpression bounds of the
+ * leftmost match. Threads are kept in priority order and a thread that
+ * matches cuts off the ones behind it, so the bounds are the ones the
+ * backtracking matcher found.
+ */
+static void vm_run(struct regexp *rx, struct vm *vm, const char *str)
+{
+	const char *cap[NCAP];
+	const char **tc;
+	const char *sp;
+	struct inst *ip;
+	int matched = 0;
+	int c = 0;
+	int i, j;
+	
+	memset(cap, 0, sizeof cap);
+	vm->str	   = str;
+	vm->cnt[0] = 0;
+	vm_begin(rx, vm);
+	vm_add(rx, vm, 0, 0, cap, str);
 	
-	while (cnt >= pc->min_rep)
+	for (sp = str; vm->cnt[c]; sp++)
 	{
-		rx->piece = pc;
-		rx->spos  = osp;
+		vm->cnt[!c] = 0;
+		vm_begin(rx, vm);
 		
-		DPRINTF("i_regexec_p: cnt = %i, min_rep = %i", cnt, pc->min_rep);
-		for (i = 0; i < cnt; i++)
-			if (!SYMBOL(regexec_p1)(rx))
+		for (i = 0; i < vm->cnt[c]; i++)
+		{
+			ip = &rx->prog[vm->pc[c][i]];
+			tc = vm->cap[c] + i * NCAP;
+			
+			if (ip->op == OP_MATCH)
 			{
-				cnt = i;
+				for (j = 0; j < rx->nsub; j++)
+				{
+					rx->startp[j] = (char *)tc[2 * j];
+					rx->endp[j]   = (char *)tc[2 * j + 1];
+				}
+				matched = 1;
 				break;
 			}
-		DPRINTF("i_regexec_p:  cnt = %i, min_rep = %i", cnt, pc->min_rep);
-		
-		if (i < pc->min_rep)
+			
+			if (*sp && (ip->op == OP_ANY || (ip->op == OP_CHAR && ip->c == (unsigned char)*sp)))
+				vm_add(rx, vm, !c, vm->pc[c][i] + 1, tc, sp + 1);
+		}
+		if (!*sp)
 			break;
 		
-		rx->piece = rx->piece->next;
-		if (SYMBOL(regexec_p)(rx))
-		{
-			DPRINTF("i_regexec_p: match succeeded");
-			return 1;
-		}
-		rx->piece = rx->piece->prev;
-		cnt--;
+		if (!matched)
+			vm_add(rx, vm, !c, 0, cap, sp + 1);
+		c = !c;
 	}
-	rx->piece = pc;
-	rx->spos  = osp;
-	DPRINTF("i_regexec_p: match failed");
-	return 0;
 }
 
-static int SYMBOL(regexec_br)(struct rx *rx)
+static int dfa_exec(struct regexp *rx, const char *str)
 {
-	DPRINTF("i_regexp: entering branch, pc = %p, spos = \"%s\"", rx->piece, rx->spos);
-	while (rx->piece->type != PT_GUARD)
+	const unsigned char *p;
+	struct dstate *s, *n;
+	struct dfa *d;
+	unsigned e;
+	
+	if (*rx->must && strstr(str, rx->must) == NULL)
+		return 0;
+	
+	d = rx->dfa;
+	if (d == NULL)
 	{
-		if (rx->piece->type == PT_BRANCH)
+		d = rx->dfa = dfa_alloc(rx);
+		if (d == NULL)
+			return 0;
+	}
+	
+	s = d->start;
+	if (s == NULL)
+	{
+		dfa_begin(d);
+		dfa_add(rx, d, 0, DS_BOL);
+		s = d->start = dfa_state(rx, d, DS_BOL);
+		if (s == NULL)
+			return 0;
+	}
+	
+	for (p = (const unsigned char *)str; *p; p++)
+	{
+		if (s->flags & (DS_MATCH | DS_DEAD))
 			break;
 		
-		DPRINTF("i_regexec_br: pc = %p, spos = \"%s\"",
-			rx->piece, rx->spos);
-		
-		if (!SYMBOL(regexec_p)(rx))
+		n = s->next[*p];
+		if (n == NULL)
 		{
-			DPRINTF("i_regexec_br: branch failed");
-			return 0;
+			e = d->epoch;
+			n = dfa_step(rx, d, s, *p);
+			if (n == NULL)
+				return 0;
+			if (e == d->epoch)
+				s->next[*p] = n;
 		}
-		// rx->piece = rx->piece->next;
+		s = n;
 	}
-	DPRINTF("i_regexec_br: branch succeeded, spos = \"%s\"", rx->spos);
-	return 1;
+	
+	if (s->flags & DS_MATCH)
+		return 1;
+	if (s->flags & DS_DEAD)
+		return 0;
+	return dfa_eol(rx, d, s);
 }
 
-static int SYMBOL(regexec_m)(struct rx *rx)
+int SYMBOL(regexec_int)(struct regexp *rx, const char *str)
 {
-	struct piece *pc = rx->piece;
-	const char *osp  = rx->spos;
+	int i;
 	
-	for (;;)
+	if (!dfa_exec(rx, str))
+		return 0;
+	
+	for (i = 0; i < NSUBEXP; i++)
 	{
-		if (SYMBOL(regexec_br)(rx))
-			return 1;
-		if (pc->nextbr == NULL)
-			break;
-		pc = pc->nextbr->next;
-		
-		rx->piece = pc;
-		rx->spos  = osp;
+		rx->startp[i] = NULL;
+		rx->endp[i]   = NULL;
 	}
+	if (!rx->nsub)
+		return 1;
 	
-	rx->piece = pc;
-	rx->spos  = osp;
-	return 0;
+	if (rx->vm == NULL)
+	{
+		rx->vm = vm_alloc(rx);
+		if (rx->vm == NULL)
+			return 1;
+	}
+	vm_run(rx, rx->vm, str);
+	return 1;
 }
 
-static int SYMBOL(regexec_s)(struct regexp *rxp, const char *str)
+int regexec(regexp *rx, const char *str)
 {
-	struct rx rx;
-	
-	DPRINTF("i_regexec_s");
-	
-	memset(&rx, 0, sizeof rx);
-	rx.piece = rxp->root.next;
-	rx.str	 = str;
-	rx.spos	 = str;
-	rx.rx	 = rxp;
-	
-	return SYMBOL(regexec_m)(&rx);
+	return regexec_int((struct regexp *)rx, str);
 }
 
-int SYMBOL(regexec_int)(struct regexp *rx, const char *str)
+void SYMBOL(regfree_int)(struct regexp *rx)
 {
-	if (rx->root.next->type == PT_SOL)
-		return SYMBOL(regexec_s)(rx, str);
+	if (rx == NULL)
+		return;
 	
-	while (*str)
+	if (rx->dfa != NULL)
 	{
-		if (SYMBOL(regexec_s)(rx, str))
-			return 1;
-		str++;
+		dfa_flush(rx->dfa);
+		free(rx->dfa);
 	}
-	return SYMBOL(regexec_s)(rx, "");
+	free(rx->vm);
+	free(rx);
 }
 
-int regexec(regexp *rx, const char *str)
+void regfree(regexp *rx)
 {
-	return regexec_int((struct regexp *)rx, str);
+	regfree_int((struct regexp *)rx);
 }
 
-static void SYMBOL(regdump_1)(struct piece *p, int nest)
+void SYMBOL(regdump_int)(struct regexp *rx)
 {
-	const char *cp;
+	struct inst *ip;
 	int i;
 	
-	do
+	for (i = 0; i < rx->ninst; i++)
 	{
-		printf("%p ", p);
-		for (i = 0; i < nest; i++)
-			putchar(' ');
+		ip = &rx->prog[i];
+		printf("%4i ", i);
 		
-		switch (p->type)
+		switch (ip->op)
 		{
-		case PT_WILDCARD:
-			fputs("PT_WILDCARD ", stdout);
+		case OP_CHAR:
+			printf("CHAR   '%c'\n", ip->c);
+			break;
+		case OP_ANY:
+			fputs("ANY\n", stdout);
 			break;
-		case PT_STRING:
-			printf("PT_STRING   \"");
-			for (cp = p->start; cp < p->end; cp++)
-				putchar(*cp);
-			printf("\" @ %p", p->start);
+		case OP_BOL:
+			fputs("BOL\n", stdout);
 			break;
-		case PT_SUBX:
-			fputs("PT_SUBX     ", stdout);
+		case OP_EOL:
+			fputs("EOL\n", stdout);
 			break;
-		case PT_SOL:
-			fputs("PT_SOL      ", stdout);
+		case OP_SPLIT:
+			printf("SPLIT  %i, %i\n", ip->x, ip->y);
 			break;
-		case PT_EOL:
-			fputs("PT_EOL      ", stdout);
+		case OP_JMP:
+			printf("JMP    %i\n", ip->x);
 			break;
-		case PT_GUARD:
-			fputs("PT_GUARD    ", stdout);
+		case OP_MATCH:
+			fputs("MATCH\n", stdout);
 			break;
-		case PT_BRANCH:
-			fputs("PT_BRANCH   ", stdout);
+		case OP_SAVE:
+			printf("SAVE   %i\n", ip->x);
 			break;
 		default:
-			fputs("** BAD **   ", stdout);
+			fputs("** BAD **\n", stdout);
 		}
-		if (p->min_rep != 1 || p->max_rep != 1)
-			printf("{ %i, %i }", p->min_rep, p->max_rep);
-		if (p->nextbr != NULL)
-			printf("nextbr %p ", p->nextbr);
-		putchar('\n');
-		
-		if (p->type == PT_SUBX)
-			SYMBOL(regdump_1)(p->subx, nest + 1);
-		
-		p = p->next;
-	} while (p->type != PT_GUARD);
-}
-
-void SYMBOL(regdump_int)(struct regexp *rx)
-{
-	SYMBOL(regdump_1)(&rx->root, 0);
+	}
+	if (*rx->must)
+		printf("must \"%s\"\n", rx->must);
 }
 
 void regdump(regexp *rx)
@@ -555,6 +947,15 @@ struct rxtest
 	{ "^(ab|cd)+x",	"ababcdabx",	1 },
 	{ "a*",		"",		1 },
 	{ "a*^",	"",		1 },
+	{ "x(a|b)*y$",	"zzxababy",	1 },
+	{ "x(a|b)*y$",	"zzxabcby",	0 },
+	{ "(a*)*b",	"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaac", 0 },
+	{ "foo.*bar",	"a foo and a bar",	1 },
+	{ "foo.*bar",	"a bar and a foo",	0 },
+	{ "colou?r",	"color",	1 },
+	{ "colou?r",	"colouur",	0 },
+	{ "()",		"",		1 },
+	{ "(|x)y",	"y",		1 },
 };
 
 int main(int argc, char **argv)
@@ -573,6 +974,7 @@ int main(int argc, char **argv)
 		
 		if (!!regexec(rx, rxt[i].string) != rxt[i].result)
 			errx(1, "mismatch for pattern \"%s\", string \"%s\"", rxt[i].pattern, rxt[i].string);
+		regfree(rx);
 	}
 	return 0;
 }
@@ -51,7 +51,11 @@ int rb_uwrite(struct ringbuf *rb, const void *data, size_t *szp)
 			return err;
 	}
 	else
-		memcpy(rb->buf + tail, data, sz);
+	{
+		err = fucpy(rb->buf + tail, data, sz);
+		if (err)
+			return err;
+	}
 	
 	rb->util += sz;
 	*szp = sz;
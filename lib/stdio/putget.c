@@ -65,18 +65,37 @@ int fflush(FILE *f)
 		f->buf_pos = 0;
 		while (resid)
 		{
-			rcnt = write(f->fd, f->buf, resid);
+			rcnt = write(f->fd, p, resid);
 			if (rcnt < 0)
 			{
 				f->err = 1;
 				return EOF;
 			}
 			resid -= rcnt;
+			p     += rcnt;
 		}
 	}
 	return 0;
 }
 
+int __libc_fbuf(FILE *f)
+{
+	if (f->buf)
+		return 0;
+	
+	if (!f->buf_size)
+		f->buf_size = BUFSIZ;
+	
+	f->buf = malloc(f->buf_size);
+	if (!f->buf)
+	{
+		f->err = 1;
+		return EOF;
+	}
+	f->buf_malloc = 1;
+	return 0;
+}
+
 int __libc_putc_nbf(int c, FILE *f)
 {
 	if (write(f->fd, &c, 1) == 1)
@@ -93,17 +112,8 @@ int __libc_putc_fbf(int c, FILE *f)
 		f->buf_insize = 0;
 		f->buf_pos    = 0;
 	}
-	if (!f->buf)
-	{
-		f->buf = malloc(BUFSIZ);
-		if (!f->buf)
-		{
-			f->err = 1;
-			return EOF;
-		}
-		f->buf_size   = BUFSIZ;
-		f->buf_malloc = 1;
-	}
+	if (__libc_fbuf(f))
+		return EOF;
 	if (f->buf_pos == f->buf_size && fflush(f))
 		return EOF;
 	f->buf[f->buf_pos] = c;
@@ -158,17 +168,8 @@ int __libc_getc_fbf(FILE *f)
 {
 	if (f->buf_write)
 		fflush(f);
-	if (!f->buf)
-	{
-		f->buf = malloc(BUFSIZ);
-		if (!f->buf)
-		{
-			f->err = 1;
-			return EOF;
-		}
-		f->buf_size   = BUFSIZ;
-		f->buf_malloc = 1;
-	}
+	if (__libc_fbuf(f))
+		return EOF;
 	if (f->buf_pos == f->buf_insize)
 	{
 		if (f->tty)
@@ -24,16 +24,143 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <priv/stdio.h>
 #include <sys/types.h>
+#include <unistd.h>
+#include <string.h>
 #include <errno.h>
 #include <stdio.h>
 
+/*
+ * Buffered streams are read and written a buffer at a time. Whatever is
+ * already in the buffer is moved with memcpy; requests at least as large
+ * as the buffer bypass it and go straight to read or write.
+ */
+
+static size_t fread_fbf(char *cp, size_t l, FILE *f)
+{
+	size_t done = 0;
+	ssize_t cnt;
+	size_t n;
+	
+	if (f->buf_write)
+		fflush(f);
+	
+	if (f->ungotc != EOF && l)
+	{
+		*cp++ = f->ungotc;
+		f->ungotc = EOF;
+		done++;
+	}
+	
+	if (f->buf && f->buf_pos < f->buf_insize)
+	{
+		n = f->buf_insize - f->buf_pos;
+		if (n > l - done)
+			n = l - done;
+		memcpy(cp, f->buf + f->buf_pos, n);
+		f->buf_pos += n;
+		done += n;
+		cp   += n;
+	}
+	
+	while (done < l)
+	{
+		if (f->tty)
+			fflush(NULL);
+		
+		if (__libc_fbuf(f))
+			break;
+		
+		if (l - done >= f->buf_size)
+		{
+			cnt = read(f->fd, cp, l - done);
+			n = cnt;
+		}
+		else
+		{
+			f->buf_pos    = 0;
+			f->buf_insize = 0;
+			
+			cnt = read(f->fd, f->buf, f->buf_size);
+			if (cnt > 0)
+			{
+				f->buf_insize = cnt;
+				
+				n = cnt;
+				if (n > l - done)
+					n = l - done;
+				memcpy(cp, f->buf, n);
+				f->buf_pos = n;
+			}
+		}
+		
+		if (cnt < 0)
+		{
+			f->err = 1;
+			break;
+		}
+		if (!cnt)
+		{
+			f->eof = 1;
+			break;
+		}
+		
+		done += n;
+		cp   += n;
+	}
+	
+	return done;
+}
+
+static size_t fwrite_fbf(const char *cp, size_t l, FILE *f)
+{
+	size_t done = 0;
+	ssize_t cnt;
+	
+	if (!f->buf_write)
+	{
+		f->buf_write  = 1;
+		f->buf_insize = 0;
+		f->buf_pos    = 0;
+	}
+	if (__libc_fbuf(f))
+		return 0;
+	
+	if (l > f->buf_size - f->buf_pos)
+	{
+		if (fflush(f))
+			return 0;
+		
+		while (done < l && l - done >= f->buf_size)
+		{
+			cnt = write(f->fd, cp + done, l - done);
+			if (cnt < 0)
+			{
+				f->err = 1;
+				return done;
+			}
+			done += cnt;
+		}
+	}
+	
+	memcpy(f->buf + f->buf_pos, cp + done, l - done);
+	f->buf_pos += l - done;
+	
+	if (f->buf_mode == _IOLBF && memchr(cp, '\n', l) && fflush(f))
+		return done;
+	return l;
+}
+
 size_t fread(void *ptr, size_t size, size_t nmemb, FILE *f)
 {
 	size_t l = size * nmemb;
 	size_t i;
 	char *cp = ptr;
 	
+	if (!size || !nmemb)
+		return 0;
+	
 	if (l / size != nmemb)
 	{
 		_set_errno(EFBIG);
@@ -41,6 +168,16 @@ size_t fread(void *ptr, size_t size, size_t nmemb, FILE *f)
 		return 0;
 	}
 	
+	if (!(f->mode & __LIBC_FMODE_R))
+	{
+		_set_errno(EBADF);
+		f->err = 1;
+		return 0;
+	}
+	
+	if (f->fgetc == __libc_getc_fbf)
+		return fread_fbf(cp, l, f) / size;
+	
 	for (i = 0; i < l; i++, cp++)
 	{
 		int c;
@@ -60,6 +197,9 @@ size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f)
 	size_t i;
 	const char *cp = ptr;
 	
+	if (!size || !nmemb)
+		return 0;
+	
 	if (l / size != nmemb)
 	{
 		_set_errno(EFBIG);
@@ -67,6 +207,16 @@ size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f)
 		return 0;
 	}
 	
+	if (!(f->mode & __LIBC_FMODE_W))
+	{
+		_set_errno(EBADF);
+		f->err = 1;
+		return 0;
+	}
+	
+	if (f->fputc == __libc_putc_fbf)
+		return fwrite_fbf(cp, l, f) / size;
+	
 	for (i = 0; i < l; i++, cp++)
 		if (fputc(*cp, f) == EOF)
 			return i / size;
@@ -55,6 +55,13 @@ int setvbuf(FILE *f, char *buf, int mode, size_t size)
 		return -1;
 	}
 	
+	if (mode != _IONBF && buf && !size)
+	{
+		_set_errno(EINVAL);
+		f->err = 1;
+		return -1;
+	}
+	
 	if (f->buf_write)
 		fflush(f);
 	
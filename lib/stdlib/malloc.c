@@ -41,50 +41,145 @@
 
 #define CHECK_PTRS	0
 
-#define NR_SMALL_PAGES	256
 #define MMAGIC		0x0ace3860
 
 #define PAGE_SIZE	4096 /* XXX */
 
-#define MAP_PAGES	(PAGE_HEAP_END - PAGE_HEAP + 4095) / 4096 /* XXX */
+/*
+ * The heap is laid out as follows:
+ *
+ *   page_map	one byte per heap page, tells what the page is used for
+ *   page_bmp	one bit per heap page, set if the page is in use
+ *   page_sum	one bit per page_bmp word, set if all 64 pages are in use
+ *
+ * followed by the heap pages proper. page_map and page_bmp are allocated
+ * as the heap grows, HEAP_CHUNK heap pages at a time.
+ *
+ * Small requests are rounded up to one of SMALL_CLASSES size classes. Each
+ * class has a LIFO free list of objects carved from runs of pages; runs
+ * are never returned to the page allocator.
+ *
+ * Large requests are given whole pages, found by first-fit search of
+ * page_bmp. Fully used 64-page words are skipped using page_sum.
+ */
+
+#define HEAP_PAGES	(PAGE_HEAP_END - PAGE_HEAP)
+#define MAP_PAGES	((HEAP_PAGES + 4095) / 4096)
+#define BMP_PAGES	((HEAP_PAGES / 8 + 4095) / 4096)
+#define SUM_PAGES	((HEAP_PAGES / 512 + 4095) / 4096)
+
+#define PM_FREE		0
+#define PM_LARGE	1
+#define PM_SMALL	2
+
+#define SMALL_MAX	3584
+#define SMALL_CLASSES	27
+#define SMALL_RUN_MIN	8
+
+#define HEAP_CHUNK	65536
 
 struct small_head
 {
-	unsigned magic;
-	size_t	 size;
-	unsigned free;
-	unsigned last;
+	uint32_t magic;
+	uint32_t cls;
+	uint32_t free;
+	uint32_t pad;
+};
+
+struct small_free
+{
+	struct small_head	head;
+	struct small_free *	next;
+};
+
+struct small_class
+{
+	size_t			size;
+	unsigned		run_pages;
+	struct small_free *	free;
+	unsigned long		runs;
+	unsigned long		used;
 };
 
-static const unsigned first_page = PAGE_HEAP + MAP_PAGES + 1 + NR_SMALL_PAGES;
-static const unsigned small_page = PAGE_HEAP + MAP_PAGES + 1;
 static const unsigned map_page   = PAGE_HEAP;
-static char *const    page_map   = pg2vap(PAGE_HEAP);
+static const unsigned bmp_page   = PAGE_HEAP + MAP_PAGES;
+static const unsigned sum_page   = PAGE_HEAP + MAP_PAGES + BMP_PAGES;
+static const unsigned first_page = PAGE_HEAP + MAP_PAGES + BMP_PAGES + SUM_PAGES;
+static const unsigned heap_pages = HEAP_PAGES - MAP_PAGES - BMP_PAGES - SUM_PAGES;
 
-static struct small_head *small_heap;
+static unsigned char *const page_map = pg2vap(PAGE_HEAP);
+static uint64_t *const	    page_bmp = pg2vap(PAGE_HEAP + MAP_PAGES);
+static uint64_t *const	    page_sum = pg2vap(PAGE_HEAP + MAP_PAGES + BMP_PAGES);
+
+static unsigned heap_limit;
+static unsigned page_hint;
+
+static struct small_class small_class[SMALL_CLASSES];
+static unsigned char	  small_index[SMALL_MAX / 16 + 1];
+
+static unsigned long large_cnt;
+static unsigned long large_pages;
+static unsigned long small_pages;
 
 static int trace = 0;
 
 #define align_size(size)	(((size) + 15) & ~15)
-#define is_small(p)		(((uintptr_t)(p) >> 12) < first_page)
+#define page_index(p)		(((uintptr_t)(p) >> 12) - first_page)
+#define in_heap(p)		(((uintptr_t)(p) >> 12) >= first_page && page_index(p) < heap_limit)
+#define is_small(p)		(in_heap(p) && page_map[page_index(p)] == PM_SMALL)
 
-void __libc_malloc_init(void)
+static void small_init(void)
 {
-	if (_pg_alloc(map_page, map_page + 4096))
+	struct small_class *sc;
+	size_t size = 16;
+	size_t step = 16;
+	unsigned i, n;
+	
+	for (i = 0; i < SMALL_CLASSES; i++)
 	{
-		_sysmesg("__libc_malloc_init: extremely low memory\n");
-		_exit(255);
+		sc = &small_class[i];
+		sc->size = size;
+		sc->run_pages = (SMALL_RUN_MIN * (size + sizeof(struct small_head)) + PAGE_SIZE - 1) / PAGE_SIZE;
+		
+		if (size >= 8 * step)
+			step *= 2;
+		size += step;
 	}
-	if (_pg_alloc(small_page, small_page + NR_SMALL_PAGES))
+	
+	for (i = n = 0; i <= SMALL_MAX / 16; i++)
+	{
+		while (small_class[n].size < i * 16)
+			n++;
+		small_index[i] = n;
+	}
+}
+
+static int heap_grow(void)
+{
+	unsigned n = heap_limit + HEAP_CHUNK;
+	
+	if (heap_limit >= heap_pages)
+		return ENOMEM;
+	if (n > heap_pages)
+		n = heap_pages;
+	
+	if (_pg_alloc(map_page + heap_limit / 4096, map_page + (n + 4095) / 4096))
+		return ENOMEM;
+	if (_pg_alloc(bmp_page + heap_limit / 32768, bmp_page + (n + 32767) / 32768))
+		return ENOMEM;
+	
+	heap_limit = n;
+	return 0;
+}
+
+void __libc_malloc_init(void)
+{
+	if (_pg_alloc(sum_page, first_page) || heap_grow())
 	{
 		_sysmesg("__libc_malloc_init: extremely low memory\n");
 		_exit(255);
 	}
-	small_heap = pg2vap(small_page);
-	small_heap->magic = MMAGIC;
-	small_heap->size  = pg2size(NR_SMALL_PAGES);
-	small_heap->free  = 1;
-	small_heap->last  = 1;
+	small_init();
 }
 
 #if CHECK_PTRS
@@ -94,13 +189,12 @@ void __libc_malloc_init(void)
 static m_check_ptr(void *ptr, const char *func, int line)
 {
 	uintptr_t p = ptr;
-	unsigned pg = p >> PAGE_SHIFT;
 	char buf[80];
 	
-	if (pg >= small_page && pg < first_page)
+	if (in_heap(ptr) && page_map[page_index(ptr)] == PM_SMALL)
 		return;
 	
-	if (pg >= first_page && pg < PAGE_HEAP_END)
+	if (in_heap(ptr) && page_map[page_index(ptr)] == PM_LARGE)
 	{
 		if ((p & PAGE_PMASK) != sizeof(size_t))
 		{
@@ -117,72 +211,184 @@ static m_check_ptr(void *ptr, const char *func, int line)
 #define check_ptr(ptr)	do {} while (0);
 #endif
 
-static void *small_malloc(size_t size)
+/* ---- page allocator ----------------------------------------------------- */
+
+static void page_mark(unsigned start, unsigned count, int used)
 {
-	struct small_head *p = small_heap;
-	struct small_head *n;
-	char msg[256];
+	unsigned end = start + count;
+	uint64_t m;
+	unsigned w;
+	unsigned i;
 	
-	size += sizeof(struct small_head);
-	for (;;)
+	for (i = start; i < end; i = (i | 63) + 1)
 	{
-		if (p->magic != MMAGIC)
-			__libc_panic("heap corruption detected (small_malloc:0)");
-		while (!p->last)
+		w = i >> 6;
+		
+		if (end - (i & ~63) >= 64)
+			m = ~(uint64_t)0 << (i & 63);
+		else
+			m = (((uint64_t)1 << (end - i)) - 1) << (i & 63);
+		
+		if (used)
+			page_bmp[w] |= m;
+		else
+			page_bmp[w] &= ~m;
+		
+		if (page_bmp[w] == ~(uint64_t)0)
+			page_sum[w >> 6] |=  (uint64_t)1 << (w & 63);
+		else
+			page_sum[w >> 6] &= ~((uint64_t)1 << (w & 63));
+	}
+}
+
+static int page_find(unsigned count, unsigned *start)
+{
+	unsigned i = page_hint;
+	unsigned s = i;
+	unsigned n = 0;
+	uint64_t b;
+	
+	while (i < heap_limit)
+	{
+		if (!(i & 63))
 		{
-			n = (void *)((char *)p + p->size);
-			if (p->magic != MMAGIC || n->magic != MMAGIC)
-				__libc_panic("heap corruption detected (small_malloc:1)");
-			if (p->free && n->free)
+			if (!(i & 4095) && page_sum[i >> 12] == ~(uint64_t)0)
 			{
-				p->size += n->size;
-				p->last  = n->last;
+				i += 4096;
+				s  = i;
+				n  = 0;
+				continue;
 			}
-			else
-				break;
-		}
-		if (p->free)
-		{
-			if (p->size == size)
+			
+			b = page_bmp[i >> 6];
+			if (b == ~(uint64_t)0)
 			{
-				if (trace)
-				{
-					sprintf(msg, "%s: small_malloc: %p, %i\n", __libc_argv[0], p + 1, size);
-					_sysmesg(msg);
-				}
-				p->free = 0;
-				return p + 1;
+				i += 64;
+				s  = i;
+				n  = 0;
+				continue;
 			}
-			if (p->size >= size + sizeof(struct small_head))
+			if (!b)
 			{
-				n = (struct small_head *) ((char *)p + size);
-				n->magic = MMAGIC;
-				n->last	 = p->last;
-				n->free	 = 1;
-				n->size	 = p->size - size;
-				p->size	 = size;
-				p->last	 = 0;
-				p->free	 = 0;
-				if (trace)
-				{
-					sprintf(msg, "%s: small_malloc: %p, %i\n", __libc_argv[0], p + 1, size);
-					_sysmesg(msg);
-				}
-				return p + 1;
+				i += 64;
+				n += 64;
+				if (n >= count)
+					goto found;
+				continue;
 			}
 		}
-		if (p->last)
+		
+		if (page_bmp[i >> 6] & ((uint64_t)1 << (i & 63)))
+		{
+			i++;
+			s = i;
+			n = 0;
+			continue;
+		}
+		
+		i++;
+		if (++n >= count)
+			goto found;
+	}
+	return ENOMEM;
+found:
+	if (s + count > heap_limit)
+		return ENOMEM;
+	*start = s;
+	return 0;
+}
+
+static void *page_alloc(unsigned count, int type)
+{
+	unsigned start;
+	
+	while (page_find(count, &start))
+		if (heap_grow())
 			return NULL;
-		p = (void *)((char *)p + p->size);
+	
+	if (_pg_alloc(first_page + start, first_page + start + count))
+		return NULL;
+	
+	page_mark(start, count, 1);
+	memset(page_map + start, type, count);
+	
+	if (start == page_hint)
+		page_hint = start + count;
+	return pg2vap(first_page + start);
+}
+
+static void page_free(void *p, unsigned count)
+{
+	unsigned start = page_index(p);
+	
+	page_mark(start, count, 0);
+	memset(page_map + start, PM_FREE, count);
+	_pg_free(first_page + start, first_page + start + count);
+	
+	if (start < page_hint)
+		page_hint = start;
+}
+
+/* ---- small objects ------------------------------------------------------ */
+
+static int small_refill(struct small_class *sc)
+{
+	struct small_free *f;
+	size_t osize;
+	char *p, *e;
+	
+	p = page_alloc(sc->run_pages, PM_SMALL);
+	if (p == NULL)
+		return -1;
+	
+	osize = sc->size + sizeof(struct small_head);
+	e = p + pg2size(sc->run_pages) - osize;
+	for (; p <= e; p += osize)
+	{
+		f = (void *)p;
+		f->head.magic = MMAGIC;
+		f->head.cls   = sc - small_class;
+		f->head.free  = 1;
+		f->next	      = sc->free;
+		sc->free      = f;
+	}
+	
+	small_pages += sc->run_pages;
+	sc->runs++;
+	return 0;
+}
+
+static void *small_malloc(size_t size)
+{
+	struct small_class *sc = &small_class[small_index[size >> 4]];
+	struct small_free *f;
+	char msg[256];
+	
+	if (!sc->free && small_refill(sc))
+		return NULL;
+	
+	f = sc->free;
+	if (f->head.magic != MMAGIC || !f->head.free)
+		__libc_panic("heap corruption detected (small_malloc)");
+	sc->free = f->next;
+	f->head.free = 0;
+	sc->used++;
+	
+	if (trace)
+	{
+		sprintf(msg, "%s: small_malloc: %p, %i\n", __libc_argv[0], &f->head + 1, (int)size);
+		_sysmesg(msg);
 	}
+	return &f->head + 1;
 }
 
 static void small_free(void *ptr)
 {
-	struct small_head *h;
+	struct small_class *sc;
+	struct small_free *f;
 	
-	h = (struct small_head *)ptr - 1;
-	if (h->magic != MMAGIC)
+	f = (struct small_free *)((struct small_head *)ptr - 1);
+	if (f->head.magic != MMAGIC || f->head.free || f->head.cls >= SMALL_CLASSES)
 	{
 		if (trace)
 		{
@@ -193,18 +399,23 @@ static void small_free(void *ptr)
 		}
 		__libc_panic("heap corruption detected (small_free)");
 	}
-	h->free = 1;
+	
+	sc = &small_class[f->head.cls];
+	f->head.free = 1;
+	f->next	     = sc->free;
+	sc->free     = f;
+	sc->used--;
 }
 
+/* ---- public interface --------------------------------------------------- */
+
 void *malloc(size_t size)
 {
-	unsigned start = first_page;
-	unsigned count = 0;
-	unsigned i;
-	void *p;
+	unsigned count;
+	size_t *p;
 	
 	size = align_size(size);
-	if (size < 4092)
+	if (size <= SMALL_MAX)
 	{
 		p = small_malloc(size);
 		if (p)
@@ -212,43 +423,32 @@ void *malloc(size_t size)
 			check_ptr(p);
 			return p;
 		}
+		_set_errno(ENOMEM);
+		return NULL;
 	}
 	
-	for (i = first_page; i < PAGE_HEAP_END; i++)
-		if (!page_map[i - first_page])
-		{
-			count++;
-			if ((size_t)count << 12 >= size + sizeof(size_t))
-			{
-				size_t *p = pg2vap(start);
-				
-				for (i = start; i < start + count; i++)
-					page_map[i - first_page] = 1;
-				
-				if (_pg_alloc(start, start + count))
-					return NULL;
-				
-				*p = size + sizeof *p;
-				check_ptr(p + 1);
-				return p + 1;
-			}
-		}
-		else
-		{
-			start = i + 1;
-			count = 0;
-		}
+	if (size > pg2size(heap_pages))
+		goto nomem;
+	count = (size + sizeof *p + PAGE_SIZE - 1) / PAGE_SIZE;
 	
+	p = page_alloc(count, PM_LARGE);
+	if (p == NULL)
+		goto nomem;
+	large_pages += count;
+	large_cnt++;
+	
+	*p = size + sizeof *p;
+	check_ptr(p + 1);
+	return p + 1;
+nomem:
 	_set_errno(ENOMEM);
 	return NULL;
 }
 
 void free(void *ptr)
 {
-	unsigned start;
-	unsigned end;
-	size_t * p;
-	unsigned i;
+	unsigned count;
+	size_t *p;
 	
 	if (!ptr)
 		return;
@@ -261,20 +461,22 @@ void free(void *ptr)
 		return;
 	}
 	
-	p	= (size_t *)ptr - 1;
-	start	= (uintptr_t)p >> 12;
-	end	= start + ((*p + 4095) >> 12);
+	p     = (size_t *)ptr - 1;
+	count = (*p + PAGE_SIZE - 1) / PAGE_SIZE;
 	
-	for (i = start; i < end; i++)
-		page_map[i - first_page] = 0;
+	if (!in_heap(p) || page_map[page_index(p)] != PM_LARGE)
+		__libc_panic("heap corruption detected (free)");
 	
-	_pg_free(start, end);
+	page_free(p, count);
+	large_pages -= count;
+	large_cnt--;
 }
 
 void *realloc(void *ptr, size_t size)
 {
 	struct small_head *she;
 	size_t old_size;
+	size_t *lp;
 	void *nptr;
 	
 	if (!ptr)
@@ -282,18 +484,28 @@ void *realloc(void *ptr, size_t size)
 	
 	check_ptr(ptr);
 	
+	size = align_size(size);
 	if (is_small(ptr))
 	{
 		she = ptr;
 		she--;
-		old_size = she->size - sizeof *she;
+		old_size = small_class[she->cls].size;
+		
+		if (size <= SMALL_MAX && small_index[size >> 4] == she->cls)
+			return ptr;
 	}
 	else
-		old_size = *((size_t *)ptr - 1) - sizeof(size_t);
-	
-	size = align_size(size);
-	if (old_size == size)
-		return ptr;
+	{
+		lp = (size_t *)ptr - 1;
+		old_size = *lp - sizeof *lp;
+		
+		if (size > SMALL_MAX &&
+		    (size + sizeof *lp + PAGE_SIZE - 1) / PAGE_SIZE == (*lp + PAGE_SIZE - 1) / PAGE_SIZE)
+		{
+			*lp = size + sizeof *lp;
+			return ptr;
+		}
+	}
 	
 	nptr = malloc(size);
 	if (!nptr)
@@ -324,3 +536,29 @@ void *calloc(size_t n, size_t m)
 	memset(ptr, 0, size);
 	return ptr;
 }
+
+void malloc_stats(void)
+{
+	struct small_class sc[SMALL_CLASSES];
+	unsigned long lcnt = large_cnt;
+	unsigned long lpg  = large_pages;
+	unsigned long spg  = small_pages;
+	unsigned long per_run;
+	int i;
+	
+	memcpy(sc, small_class, sizeof sc);
+	
+	fprintf(stderr, "SIZE  RUNS   USED     FREE\n");
+	for (i = 0; i < SMALL_CLASSES; i++)
+	{
+		if (!sc[i].runs)
+			continue;
+		
+		per_run = pg2size(sc[i].run_pages) / (sc[i].size + sizeof(struct small_head));
+		fprintf(stderr, "%-5lu %-6lu %-8lu %lu\n",
+			(unsigned long)sc[i].size, sc[i].runs, sc[i].used,
+			sc[i].runs * per_run - sc[i].used);
+	}
+	fprintf(stderr, "small pages: %lu\n", spg);
+	fprintf(stderr, "large pages: %lu in %lu blocks\n", lpg, lcnt);
+}
@@ -25,13 +25,34 @@
  */
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 
+#define ISORT_MAX	16
+
+typedef int cmp_func(const void *a, const void *b);
+
 static void swap(char *p0, char *p1, size_t size)
 {
+	long *w0, *w1;
+	long w;
 	char t;
 	
+	if (!(((uintptr_t)p0 | (uintptr_t)p1 | size) & (sizeof(long) - 1)))
+	{
+		w0 = (long *)p0;
+		w1 = (long *)p1;
+		
+		for (size /= sizeof(long); size--; w0++, w1++)
+		{
+			w   = *w0;
+			*w0 = *w1;
+			*w1 = w;
+		}
+		return;
+	}
+	
 	while (size--)
 	{
 		t   = *p0;
@@ -43,32 +64,138 @@ static void swap(char *p0, char *p1, size_t size)
 	}
 }
 
-static void sub_sort(char *start, char *end, size_t size, int (*cmp)(const void *a, const void *b))
+static void isort(char *start, size_t cnt, size_t size, cmp_func *cmp)
 {
-	char *p0 = start;
-	char *p1 = end;
+	char *end = start + cnt * size;
+	char *p0, *p1;
 	
-	if (start > end - size)
-		return;
+	for (p0 = start + size; p0 < end; p0 += size)
+		for (p1 = p0; p1 > start && cmp(p1 - size, p1) > 0; p1 -= size)
+			swap(p1 - size, p1, size);
+}
+
+static void sift(char *start, size_t i, size_t cnt, size_t size, cmp_func *cmp)
+{
+	size_t c;
+	
+	while ((c = 2 * i + 1) < cnt)
+	{
+		if (c + 1 < cnt && cmp(start + c * size, start + (c + 1) * size) < 0)
+			c++;
+		if (cmp(start + i * size, start + c * size) >= 0)
+			return;
+		swap(start + i * size, start + c * size, size);
+		i = c;
+	}
+}
+
+static void hsort(char *start, size_t cnt, size_t size, cmp_func *cmp)
+{
+	size_t i;
+	
+	for (i = cnt / 2; i--; )
+		sift(start, i, cnt, size, cmp);
 	
-	while (p0 < p1)
+	while (--cnt)
 	{
-		while (cmp(p0, start) <= 0 && p0 < end)
-			p0 += size;
-		while (cmp(p1, start) >= 0 && p1 > start)
-			p1 -= size;
-		if (p0 < p1)
+		swap(start, start + cnt * size, size);
+		sift(start, 0, cnt, size, cmp);
+	}
+}
+
+static char *median3(char *a, char *b, char *c, cmp_func *cmp)
+{
+	if (cmp(a, b) < 0)
+	{
+		if (cmp(b, c) < 0)
+			return b;
+		return cmp(a, c) < 0 ? c : a;
+	}
+	
+	if (cmp(b, c) > 0)
+		return b;
+	return cmp(a, c) > 0 ? c : a;
+}
+
+/*
+ * Introsort: quicksort with a median-of-three pivot (ninther for large
+ * partitions) that falls back to heap sort once the recursion gets
+ * deeper than 2 * log2(cnt). Only the smaller partition is recursed into,
+ * so the stack depth stays logarithmic.
+ */
+static void sub_sort(char *start, size_t cnt, size_t size, cmp_func *cmp, int depth)
+{
+	char *p0, *p1, *pv;
+	char *last;
+	size_t n0;
+	size_t s;
+	
+	while (cnt > ISORT_MAX)
+	{
+		if (!depth--)
+		{
+			hsort(start, cnt, size, cmp);
+			return;
+		}
+		
+		last = start + (cnt - 1) * size;
+		pv   = start + (cnt / 2) * size;
+		if (cnt > 64)
+		{
+			s = (cnt / 8) * size;
+			
+			p0 = median3(start, start + s, start + 2 * s, cmp);
+			pv = median3(pv - s, pv, pv + s, cmp);
+			p1 = median3(last - 2 * s, last - s, last, cmp);
+			pv = median3(p0, pv, p1, cmp);
+		}
+		else
+			pv = median3(start, pv, last, cmp);
+		swap(start, pv, size);
+		
+		p0 = start;
+		p1 = last + size;
+		for (;;)
+		{
+			do
+				p0 += size;
+			while (p0 <= last && cmp(p0, start) < 0);
+			do
+				p1 -= size;
+			while (cmp(p1, start) > 0);
+			
+			if (p0 >= p1)
+				break;
 			swap(p0, p1, size);
+		}
+		swap(start, p1, size);
+		
+		n0 = (p1 - start) / size;
+		if (n0 < cnt - n0 - 1)
+		{
+			sub_sort(start, n0, size, cmp, depth);
+			start = p1 + size;
+			cnt  -= n0 + 1;
+		}
+		else
+		{
+			sub_sort(p1 + size, cnt - n0 - 1, size, cmp, depth);
+			cnt = n0;
+		}
 	}
-	swap(start, p1, size);
 	
-	sub_sort(start, p1, size, cmp);
-	sub_sort(p1 + size, end, size, cmp);
+	isort(start, cnt, size, cmp);
 }
 
 void qsort(void *data, size_t cnt, size_t size, int (*cmp)(const void *a, const void *b))
 {
-	if (cnt == 0)
+	size_t n;
+	int depth = 0;
+	
+	if (cnt < 2 || !size)
 		return;
-	sub_sort(data, (char *)data + (cnt - 1) * size, size, cmp);
+	
+	for (n = cnt; n > 1; n >>= 1)
+		depth += 2;
+	sub_sort(data, cnt, size, cmp, depth);
 }
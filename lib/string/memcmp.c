@@ -25,19 +25,40 @@
  */
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <string.h>
+#include "word.h"
 
 int memcmp(const void *s1, const void *s2, size_t n)
 {
 	const unsigned char *u1 = s1,
 			    *u2 = s2;
-	int i;
 	
-	for (i = 0; i < n; i++)
+	if (n >= 2 * WSIZE && !(((uintptr_t)u1 ^ (uintptr_t)u2) & WMASK))
 	{
-		if (u1[i] < u2[i])
+		while ((uintptr_t)u1 & WMASK)
+		{
+			if (*u1 != *u2)
+				break;
+			u1++;
+			u2++;
+			n--;
+		}
+		
+		/* the byte loop below finds the difference within the word */
+		while (n >= WSIZE && *(const word_t *)u1 == *(const word_t *)u2)
+		{
+			u1 += WSIZE;
+			u2 += WSIZE;
+			n  -= WSIZE;
+		}
+	}
+	
+	for (; n; n--, u1++, u2++)
+	{
+		if (*u1 < *u2)
 			return -1;
-		if (u1[i] > u2[i])
+		if (*u1 > *u2)
 			return 1;
 	}
 	
@@ -25,13 +25,30 @@
  */
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <string.h>
+#include "word.h"
 
 void *memcpy(void *dest, const void *src, size_t n)
 {
 	const char *s = src;
 	char *d = dest;
 	
+	if (n >= 2 * WSIZE && !(((uintptr_t)d ^ (uintptr_t)s) & WMASK))
+	{
+		while ((uintptr_t)d & WMASK)
+		{
+			*d++ = *s++;
+			n--;
+		}
+		while (n >= WSIZE)
+		{
+			*(word_t *)d = *(const word_t *)s;
+			d += WSIZE;
+			s += WSIZE;
+			n -= WSIZE;
+		}
+	}
 	while (n--)
 		*d++ = *s++;
 	return dest;
@@ -25,7 +25,9 @@
  */
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <string.h>
+#include "word.h"
 
 static void *memcpy_rev(char *dest, const char *src, size_t n)
 {
@@ -34,6 +36,21 @@ static void *memcpy_rev(char *dest, const char *src, size_t n)
 	
 	d = dest + n;
 	s = src + n;
+	if (n >= 2 * WSIZE && !(((uintptr_t)d ^ (uintptr_t)s) & WMASK))
+	{
+		while ((uintptr_t)d & WMASK)
+		{
+			*--d = *--s;
+			n--;
+		}
+		while (n >= WSIZE)
+		{
+			d -= WSIZE;
+			s -= WSIZE;
+			n -= WSIZE;
+			*(word_t *)d = *(const word_t *)s;
+		}
+	}
 	while (n--)
 		*--d = *--s;
 	return dest;
@@ -41,6 +58,8 @@ static void *memcpy_rev(char *dest, const char *src, size_t n)
 
 void *memmove(void *dest, const void *src, size_t n)
 {
+	if (dest == src)
+		return dest;
 	if (dest < src)
 		return memcpy(dest, src, n);
 	return memcpy_rev(dest, src, n);
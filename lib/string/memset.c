@@ -25,15 +25,33 @@
  */
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <string.h>
+#include "word.h"
 
 void *memset(void *s, int c, size_t n)
 {
+	word_t w;
 	char *e;
 	char *p;
 	
 	p = s;
 	e = p + n;
+	if (n >= 2 * WSIZE)
+	{
+		w  = (unsigned char)c;
+		w |= w << 8;
+		w |= w << 16;
+		w |= (w << 16) << 16;
+		
+		while ((uintptr_t)p & WMASK)
+			*p++ = c;
+		while (p + WSIZE <= e)
+		{
+			*(word_t *)p = w;
+			p += WSIZE;
+		}
+	}
 	while (p < e)
 		*p++ = c;
 	
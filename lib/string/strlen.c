@@ -24,12 +24,28 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdint.h>
 #include <string.h>
+#include "word.h"
 
+#define ONES	((word_t)-1 / 0xff)
+#define HIGHS	(ONES << 7)
+
+/*
+ * Aligned words never cross a page boundary, so reading past the
+ * terminating NUL within the last word is safe.
+ */
 int strlen(const char *s)
 {
-	int i = 0;
+	const word_t *w;
+	const char *p;
+	
+	for (p = s; (uintptr_t)p & WMASK; p++)
+		if (!*p)
+			return p - s;
+	
+	for (w = (const word_t *)p; !((*w - ONES) & ~*w & HIGHS); w++);
 	
-	while (s[i++]);
-	return i - 1;
+	for (p = (const char *)w; *p; p++);
+	return p - s;
 }
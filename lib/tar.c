@@ -186,3 +186,294 @@ ssize_t tar_read(const struct tar *tar, const struct tar_file *file, void *buf,
 	
 	return read(tar->fd, buf, isz);
 }
+
+struct tar_stream *tar_sopen(int fd, int wr)
+{
+	struct tar_stream *ts;
+	struct stat st;
+	
+	ts = calloc(1, sizeof *ts);
+	if (ts == NULL)
+		return NULL;
+	
+	ts->buf = malloc(TAR_BUFSIZE);
+	if (ts->buf == NULL)
+	{
+		free(ts);
+		return NULL;
+	}
+	
+	if (!fstat(fd, &st) && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)))
+		ts->seekable = 1;
+	
+	ts->fd = fd;
+	ts->wr = wr;
+	return ts;
+}
+
+static int tar_sfill(struct tar_stream *ts)
+{
+	ssize_t rcnt;
+	
+	if (ts->pos < ts->len)
+		return 0;
+	
+	do
+		rcnt = read(ts->fd, ts->buf, TAR_BUFSIZE);
+	while (rcnt < 0 && errno == EINTR);
+	if (rcnt < 0)
+		return -1;
+	if (!rcnt)
+	{
+		_set_errno(ENOEXEC);
+		return -1;
+	}
+	
+	ts->pos = 0;
+	ts->len = rcnt;
+	return 0;
+}
+
+static int tar_sskip(struct tar_stream *ts, off_t cnt)
+{
+	off_t l;
+	
+	l = ts->len - ts->pos;
+	if (l > cnt)
+		l = cnt;
+	ts->pos += l;
+	ts->off += l;
+	cnt	-= l;
+	
+	if (!cnt)
+		return 0;
+	
+	if (ts->seekable && lseek(ts->fd, cnt, SEEK_CUR) >= 0)
+	{
+		ts->off += cnt;
+		return 0;
+	}
+	
+	while (cnt)
+	{
+		if (tar_sfill(ts))
+			return -1;
+		
+		l = ts->len - ts->pos;
+		if (l > cnt)
+			l = cnt;
+		ts->pos += l;
+		ts->off += l;
+		cnt	-= l;
+	}
+	return 0;
+}
+
+static int tar_sget(struct tar_stream *ts, void *buf, size_t cnt)
+{
+	char *p = buf;
+	size_t l;
+	
+	while (cnt)
+	{
+		if (tar_sfill(ts))
+			return -1;
+		
+		l = ts->len - ts->pos;
+		if (l > cnt)
+			l = cnt;
+		memcpy(p, ts->buf + ts->pos, l);
+		ts->pos += l;
+		ts->off += l;
+		p	+= l;
+		cnt	-= l;
+	}
+	return 0;
+}
+
+int tar_snext(struct tar_stream *ts, const struct tar_file **file)
+{
+	union
+	{
+		struct tar_hdr hd;
+		char buf[TAR_BLKSIZE];
+	} u;
+	struct tar_file *tf = &ts->file;
+	off_t size;
+	
+	if (ts->wr)
+	{
+		_set_errno(EBADF);
+		return -1;
+	}
+	
+	if (tar_sskip(ts, ts->left + ts->pad))
+		return -1;
+	ts->left = 0;
+	ts->pad	 = 0;
+	
+	if (ts->eof)
+		return 0;
+	
+	for (;;)
+	{
+		if (!ts->zero)
+			ts->append_offset = ts->off;
+		if (tar_sfill(ts))
+		{
+			/* a missing end of archive is not an error */
+			if (errno == ENOEXEC)
+			{
+				ts->eof = 1;
+				return 0;
+			}
+			return -1;
+		}
+		if (tar_sget(ts, u.buf, sizeof u.buf))
+			return -1;
+		
+		if (*u.hd.pathname)
+			break;
+		
+		/* two zero blocks end the archive */
+		if (ts->zero)
+		{
+			ts->eof = 1;
+			return 0;
+		}
+		ts->zero = 1;
+	}
+	ts->zero = 0;
+	
+	memcpy(ts->pathname, u.hd.pathname, sizeof u.hd.pathname);
+	memcpy(ts->link,     u.hd.link,	    sizeof u.hd.link);
+	
+	size = strtoul(u.hd.size, NULL, 8);
+	
+	tf->pathname	= ts->pathname;
+	tf->link	= ts->link;
+	tf->mode	= strtoul(u.hd.mode,  NULL, 8);
+	tf->owner	= strtoul(u.hd.owner, NULL, 8);
+	tf->group	= strtoul(u.hd.group, NULL, 8);
+	tf->size	= size;
+	tf->mtime	= strtoul(u.hd.mtime, NULL, 8);
+	tf->link_type	= u.hd.link_type;
+	tf->offset	= ts->off;
+	
+	ts->left = size;
+	ts->pad	 = -size & (TAR_BLKSIZE - 1);
+	
+	*file = tf;
+	return 1;
+}
+
+ssize_t tar_sdata(struct tar_stream *ts, const void **buf)
+{
+	size_t l;
+	
+	if (!ts->left)
+		return 0;
+	
+	if (tar_sfill(ts))
+		return -1;
+	
+	l = ts->len - ts->pos;
+	if (l > ts->left)
+		l = ts->left;
+	
+	*buf = ts->buf + ts->pos;
+	ts->pos	 += l;
+	ts->off	 += l;
+	ts->left -= l;
+	return l;
+}
+
+static int tar_sflush(struct tar_stream *ts)
+{
+	ssize_t wcnt;
+	size_t l = 0;
+	
+	while (l < ts->pos)
+	{
+		wcnt = write(ts->fd, ts->buf + l, ts->pos - l);
+		if (wcnt < 0 && errno == EINTR)
+			continue;
+		if (wcnt < 0)
+			return -1;
+		if (!wcnt)
+		{
+			_set_errno(EIO);
+			return -1;
+		}
+		l += wcnt;
+	}
+	ts->pos = 0;
+	return 0;
+}
+
+int tar_swrite(struct tar_stream *ts, const void *buf, size_t len)
+{
+	const char *p = buf;
+	size_t l;
+	
+	if (!ts->wr)
+	{
+		_set_errno(EBADF);
+		return -1;
+	}
+	
+	while (len)
+	{
+		if (ts->pos == TAR_BUFSIZE && tar_sflush(ts))
+			return -1;
+		
+		l = TAR_BUFSIZE - ts->pos;
+		if (l > len)
+			l = len;
+		if (p)
+		{
+			memcpy(ts->buf + ts->pos, p, l);
+			p += l;
+		}
+		else
+			memset(ts->buf + ts->pos, 0, l);
+		ts->pos += l;
+		ts->off += l;
+		len	-= l;
+	}
+	return 0;
+}
+
+int tar_swrhdr(struct tar_stream *ts, const struct tar_hdr *hd)
+{
+	if (tar_spad(ts))
+		return -1;
+	if (tar_swrite(ts, hd, sizeof *hd))
+		return -1;
+	return tar_spad(ts);
+}
+
+int tar_spad(struct tar_stream *ts)
+{
+	return tar_swrite(ts, NULL, -ts->off & (TAR_BLKSIZE - 1));
+}
+
+int tar_sclose(struct tar_stream *ts)
+{
+	int err = 0;
+	
+	if (ts == NULL)
+		return 0;
+	
+	if (ts->wr)
+	{
+		if (tar_spad(ts) || tar_swrite(ts, NULL, 2 * TAR_BLKSIZE))
+			err = -1;
+		else
+			err = tar_sflush(ts);
+	}
+	
+	free(ts->buf);
+	free(ts);
+	return err;
+}
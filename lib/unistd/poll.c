@@ -24,6 +24,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <priv/libc.h>
 #include <priv/sys.h>
 #include <sys/types.h>
 #include <sys/poll.h>
@@ -35,7 +36,8 @@ static void poll_alrm(int nr)
 {
 }
 
-int poll(struct pollfd *pfd, unsigned cnt, int timeout)
+int __libc_poll_wait(int (*wait)(struct pollfd *pfd, int cnt, int ndelay),
+		     struct pollfd *pfd, unsigned cnt, int timeout)
 {
 	void *ah;
 	int se;
@@ -46,7 +48,7 @@ int poll(struct pollfd *pfd, unsigned cnt, int timeout)
 		ah = signal(SIGALRM, poll_alrm);
 		ualarm(timeout * 1000L, 0);
 	}
-	r  = _poll(pfd, cnt, !timeout);
+	r  = wait(pfd, cnt, !timeout);
 	se = _get_errno();
 	if (timeout > 0)
 	{
@@ -57,3 +59,8 @@ int poll(struct pollfd *pfd, unsigned cnt, int timeout)
 	
 	return r;
 }
+
+int poll(struct pollfd *pfd, unsigned cnt, int timeout)
+{
+	return __libc_poll_wait(_poll, pfd, cnt, timeout);
+}
@@ -23,7 +23,7 @@ make_zinit()
 	${STRIP} zinit.tmp/sbin/*
 	
 	cross/mkbfs   zinit.tmp/lib/sys/root.img 0 128 tree.tmp
-	cross/zpipe < zinit.tmp/lib/sys/root.img > zinit.tmp/lib/sys/root
+	cross/mkzimg < zinit.tmp/lib/sys/root.img > zinit.tmp/lib/sys/root
 	rm -f zinit.tmp/lib/sys/root.img
 	
 	dd status=none if=boot-pc/fdboot.bin	of=disks/zinit.img
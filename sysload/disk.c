@@ -47,3 +47,22 @@ int disk_read(struct disk *dk, blk_t blk, void *buf)
 		return EINVAL;
 	return dk->read(dk, blk + dk->offset, buf);
 }
+
+int disk_readn(struct disk *dk, blk_t blk, unsigned cnt, void *buf)
+{
+	char *p = buf;
+	int err;
+	
+	if (dk->size > 0 && (blk >= dk->size || cnt > dk->size - blk))
+		return EINVAL;
+	if (dk->readn)
+		return dk->readn(dk, blk + dk->offset, cnt, buf);
+	
+	for (; cnt; cnt--, blk++, p += 512)
+	{
+		err = dk->read(dk, blk + dk->offset, p);
+		if (err)
+			return err;
+	}
+	return 0;
+}
@@ -79,26 +79,25 @@ static int fs_boot_lookup(struct file *f, struct fs *fs, const char *pathname)
 static int fs_boot_load(struct file *f, void *buf, size_t sz)
 {
 	char lbuf[512];
-	off_t resid;
+	unsigned cnt;
 	blk_t blk;
-	char *p;
 	int err;
-	int cl;
 	
-	resid = sz;
-	blk   = f->index + 1;
-	p     = buf;
-	while (resid)
+	blk = f->index + 1;
+	cnt = sz / 512;
+	if (cnt)
 	{
-		err = disk_read(f->fs->disk, blk, lbuf);
+		err = disk_readn(f->fs->disk, blk, cnt, buf);
 		if (err)
 			return err;
-		cl = min(resid, 512);
-		memcpy(p, lbuf, cl);
-		
-		resid -= cl;
-		p += cl;
-		blk++;
+	}
+	
+	if (sz % 512)
+	{
+		err = disk_read(f->fs->disk, blk + cnt, lbuf);
+		if (err)
+			return err;
+		memcpy((char *)buf + cnt * 512, lbuf, sz % 512);
 	}
 	return 0;
 }
@@ -67,70 +67,144 @@ static int fs_native_mount(struct fs *fs)
 	fs->sb = *(struct nat_super *)buf;
 	if (memcmp(&fs->sb.magic, NAT_MAGIC, sizeof fs->sb.magic))
 		return EINVAL;
+	
+	fs->bshift = 0;
+	if (NAT_FEATURES(&fs->sb) & NAT_F_BSIZE)
+	{
+		if (fs->sb.bshift > NAT_BSHIFT_MAX)
+			return EINVAL;
+		fs->bshift = fs->sb.bshift;
+	}
 	return 0;
 }
 
-static int fs_native_read_bmap(struct disk *disk, blk_t block, int level, void *bufp)
+/*
+ * Read sector sec of the disk through the map block cache.  Blocks
+ * larger than a sector are read one sector at a time.
+ */
+static int fs_native_read_bmap(struct disk *disk, blk_t sec, int level, void *bufp)
 {
 	struct fs_native_bce *bce = &fs_native_cache[level % 4];
 	int err;
 	
-	if (bce->disk == disk && bce->block == block)
+	if (bce->disk == disk && bce->block == sec)
 		goto fini;
 	
-	err = disk_read(disk, block, bce->buf);
+	err = disk_read(disk, sec, bce->buf);
 	if (err)
 		return err;
 	
-	bce->block = block;
+	bce->block = sec;
 	bce->disk  = disk;
 fini:
 	*(void **)bufp = bce->buf;
 	return 0;
 }
 
+static int fs_native_ext_find(struct nat_extent *e, int n, blk_t log, blk_t *phys)
+{
+	for (; n; n--, e++)
+		if (log >= e->log && log - e->log < e->len)
+		{
+			*phys = e->phys + log - e->log;
+			return 1;
+		}
+	return 0;
+}
+
+static int fs_native_ext_bmap(struct file *f, struct nat_header *hd, blk_t log, blk_t *phys)
+{
+	int count = hd->bmap[NAT_EXT_COUNT];
+	struct nat_extblk *xb;
+	blk_t bn;
+	int err;
+	int n;
+	
+	*phys = 0;
+	
+	n = min(count, NAT_EXT_INLINE);
+	if (fs_native_ext_find(NAT_EXTENTS(hd->bmap), n, log, phys))
+		return 0;
+	count -= n;
+	
+	for (bn = hd->bmap[NAT_EXT_NEXT]; bn && count > 0; bn = xb->next)
+	{
+		err = fs_native_read_bmap(f->fs->disk, bn << f->fs->bshift, 1, &xb);
+		if (err)
+			return err;
+		
+		n = min(count, NAT_EXT_PER_BLOCK);
+		if (fs_native_ext_find(xb->ext, n, log, phys))
+			return 0;
+		count -= n;
+	}
+	return 0;
+}
+
 static int fs_native_bmap(struct file *f, blk_t log, blk_t *phys)
 {
 	struct nat_header *hd;
 	struct fs *fs = f->fs;
 	uint32_t *buf;
 	blk_t bn;
+	blk_t ix;
 	int shift;
 	int indl;
 	int err;
 	int il;
 	int i;
 	
-	err = fs_native_read_bmap(fs->disk, f->index, 0, &hd);
+	err = fs_native_read_bmap(fs->disk, f->index << fs->bshift, 0, &hd);
 	if (err)
 		return err;
 	
+	if (hd->flags & NAT_HF_EXTENT)
+		return fs_native_ext_bmap(f, hd, log, phys);
+	
 	if (log < hd->ndirblks)
 	{
 		*phys = hd->bmap[log];
 		return 0;
 	}
 	
-	shift  = 7 * hd->nindirlev;
-	i      = hd->ndirblks + (log >> shift);
+	shift  = (7 + fs->bshift) * hd->nindirlev;
+	i      = hd->ndirblks + (shift < 32 ? log >> shift : 0);
 	bn     = hd->bmap[i];
-	shift -= 7;
+	shift -= 7 + fs->bshift;
 	il     = 1;
 	
 	while (bn && shift >= 0)
 	{
-		err = fs_native_read_bmap(fs->disk, bn, il++, &buf);
+		ix = (log >> shift) & ((128 << fs->bshift) - 1);
+		
+		err = fs_native_read_bmap(fs->disk, (bn << fs->bshift) + ix / 128, il++, &buf);
 		if (err)
 			return err;
 		
-		bn = buf[(log >> shift) & 127];
-		shift -= 7;
+		bn = buf[ix % 128];
+		shift -= 7 + fs->bshift;
 	}
 	
 	*phys = bn;
 	return 0;
 }
 
+/*
+ * Map sector sec of a file to a disk sector, or to zero for a hole.
+ */
+static int fs_native_smap(struct file *f, blk_t sec, blk_t *phys)
+{
+	int bshift = f->fs->bshift;
+	int err;
+	
+	err = fs_native_bmap(f, sec >> bshift, phys);
+	if (err)
+		return err;
+	if (*phys)
+		*phys = *phys << bshift | (sec & ((1 << bshift) - 1));
+	return 0;
+}
+
 static int fs_native_find_entry(struct file *f, blk_t *bp, const char *name)
 {
 	union
@@ -145,7 +219,7 @@ static int fs_native_find_entry(struct file *f, blk_t *bp, const char *name)
 	int err;
 	int i;
 	
-	err = disk_read(fs->disk, phys, &u.hd);
+	err = disk_read(fs->disk, phys << fs->bshift, &u.hd);
 	if (err)
 		return err;
 	if (!S_ISDIR(u.hd.mode))
@@ -154,7 +228,7 @@ static int fs_native_find_entry(struct file *f, blk_t *bp, const char *name)
 	
 	for (log = 0; log < size; log++)
 	{
-		err = fs_native_bmap(f, log, &phys);
+		err = fs_native_smap(f, log, &phys);
 		if (err)
 			return err;
 		if (!phys)
@@ -166,6 +240,8 @@ static int fs_native_find_entry(struct file *f, blk_t *bp, const char *name)
 		
 		for (i = 0; i < NAT_D_PER_BLOCK; i++)
 		{
+			if (!u.de[i].first_block)
+				continue;
 			if (u.de[i].name[NAT_NAME_MAX])
 				return EINVAL;
 			if (!strcmp(u.de[i].name, name))
@@ -217,7 +293,7 @@ static int fs_native_lookup(struct file *f, struct fs *fs, const char *pathname)
 		dir.index = b;
 	}
 	
-	err = disk_read(fs->disk, b, u.buf);
+	err = disk_read(fs->disk, b << fs->bshift, u.buf);
 	if (err)
 		return err;
 	
@@ -227,11 +303,18 @@ static int fs_native_lookup(struct file *f, struct fs *fs, const char *pathname)
 	return 0;
 }
 
+/*
+ * Physically contiguous runs of whole sectors are read with a single
+ * disk_readn call straight into the destination buffer; only a partial
+ * last sector goes through lbuf.
+ */
 static int fs_native_load(struct file *f, void *buf, size_t sz)
 {
 	char lbuf[512];
-	off_t resid;
+	size_t resid;
+	unsigned cnt;
 	blk_t phys;
+	blk_t next;
 	blk_t log;
 	char *p;
 	int err;
@@ -242,25 +325,47 @@ static int fs_native_load(struct file *f, void *buf, size_t sz)
 	log   = 0;
 	while (resid)
 	{
-		err = fs_native_bmap(f, log, &phys);
+		err = fs_native_smap(f, log, &phys);
 		if (err)
 			return err;
 		
-		if (phys)
+		if (!phys)
+		{
+			cl = min(resid, 512);
+			memset(p, 0, cl);
+			
+			resid -= cl;
+			p += cl;
+			log++;
+			continue;
+		}
+		
+		if (resid < 512)
 		{
 			err = disk_read(f->fs->disk, phys, lbuf);
 			if (err)
 				return err;
 			
-			cl = min(resid, 512);
-			memcpy(p, lbuf, cl);
+			memcpy(p, lbuf, resid);
+			break;
 		}
-		else
-			memset(p, 0, min(resid, 512));
 		
-		resid -= cl;
-		p += cl;
-		log++;
+		for (cnt = 1; (cnt + 1) * 512 <= resid; cnt++)
+		{
+			err = fs_native_smap(f, log + cnt, &next);
+			if (err)
+				return err;
+			if (next != phys + cnt)
+				break;
+		}
+		
+		err = disk_readn(f->fs->disk, phys, cnt, p);
+		if (err)
+			return err;
+		
+		resid -= cnt * 512;
+		p += cnt * 512;
+		log += cnt;
 	}
 	return 0;
 }
@@ -39,6 +39,10 @@
 
 #define DEBUG		0
 
+#define XFER_MAX	127	/* sectors per EDD transfer */
+
+#define min(a, b)	((a) < (b) ? (a) : (b))
+
 struct pc_part
 {
 	uint8_t	 boot;
@@ -55,6 +59,14 @@ struct pc_part
 
 struct disk *disk_boot, *disk_ownpart, *disk_actpart;
 
+/*
+ * Multi-sector transfers go through a buffer in conventional memory
+ * at conv_mem_lbrk; it is 64 KiB aligned, so no transfer crosses a DMA
+ * boundary.
+ */
+static char *	 disk_xfer;
+static unsigned	 disk_xfer_max;
+
 static int disk_read_chs(struct disk *dk, blk_t blk, void *buf)
 {
 	long c, h, s, t;
@@ -81,6 +93,44 @@ static int disk_read_chs(struct disk *dk, blk_t blk, void *buf)
 	return 0;
 }
 
+static int disk_readn_chs(struct disk *dk, blk_t blk, unsigned cnt, void *buf)
+{
+	long c, h, s, t;
+	char *p = buf;
+	unsigned n;
+	
+	if (!dk->nsect || !dk->nhead)
+		return EINVAL;
+	
+	while (cnt)
+	{
+		s = blk % dk->nsect;
+		t = blk / dk->nsect;
+		h = t	% dk->nhead;
+		c = t	/ dk->nhead;
+		
+		n = min(cnt, dk->nsect - s);
+		n = min(n, disk_xfer_max);
+		s++;
+		
+		bcp.eax	 = 0x0200 | n;
+		bcp.ecx	 = (c << 8) | s | ((c & 0x300) >> 2);
+		bcp.edx	 = (h << 8) | dk->unit;
+		bcp.es	 = (intptr_t)disk_xfer >> 4;
+		bcp.ebx	 = (intptr_t)disk_xfer & 15;
+		bcp.intr = 0x13;
+		bioscall();
+		if (bcp.eflags & 1)
+			return EIO;
+		memcpy(p, disk_xfer, n * 512);
+		
+		blk += n;
+		cnt -= n;
+		p   += n * 512;
+	}
+	return 0;
+}
+
 struct edd_dap
 {
 	uint8_t		size;
@@ -120,6 +170,44 @@ static int disk_read_edd(struct disk *dk, blk_t blk, void *buf)
 	return 0;
 }
 
+static int disk_readn_edd(struct disk *dk, blk_t blk, unsigned cnt, void *buf)
+{
+	static struct edd_dap dap =
+	{
+		.size	 = sizeof dap,
+		.buf_off = 0xffff,
+		.buf_seg = 0xffff,
+	};
+	char *p = buf;
+	unsigned n;
+	
+	while (cnt)
+	{
+		n = min(cnt, disk_xfer_max);
+		
+		dap.count   = n;
+		dap.buf_off = (intptr_t)disk_xfer & 15;
+		dap.buf_seg = (intptr_t)disk_xfer >> 4;
+		dap.blk	    = blk;
+		
+		bcp.intr = 0x13;
+		bcp.eax	 = 0x4200;
+		bcp.edx	 = dk->unit;
+		bcp.esi	 = (intptr_t)&dap & 15;
+		bcp.ds	 = (intptr_t)&dap >> 4;
+		bioscall();
+		
+		if (bcp.eflags & 1)
+			return EIO;
+		memcpy(p, disk_xfer, n * 512);
+		
+		blk += n;
+		cnt -= n;
+		p   += n * 512;
+	}
+	return 0;
+}
+
 static int disk_read_cdrom(struct disk *dk, blk_t blk, void *buf)
 {
 	static struct edd_dap dap =
@@ -147,6 +235,48 @@ static int disk_read_cdrom(struct disk *dk, blk_t blk, void *buf)
 	return 0;
 }
 
+static int disk_readn_cdrom(struct disk *dk, blk_t blk, unsigned cnt, void *buf)
+{
+	static struct edd_dap dap =
+	{
+		.size	 = sizeof dap,
+		.buf_off = 0xffff,
+		.buf_seg = 0xffff,
+	};
+	char *p = buf;
+	unsigned skip;
+	unsigned n;
+	
+	while (cnt)
+	{
+		skip = blk % 4;
+		n    = min(cnt + skip, disk_xfer_max & ~3);
+		
+		dap.count   = (n + 3) / 4;
+		dap.buf_off = (intptr_t)disk_xfer & 15;
+		dap.buf_seg = (intptr_t)disk_xfer >> 4;
+		dap.blk	    = blk / 4;
+		
+		bcp.intr = 0x13;
+		bcp.eax	 = 0x4200;
+		bcp.edx	 = dk->unit;
+		bcp.esi	 = (intptr_t)&dap & 15;
+		bcp.ds	 = (intptr_t)&dap >> 4;
+		bioscall();
+		
+		if (bcp.eflags & 1)
+			return EIO;
+		
+		n -= skip;
+		memcpy(p, disk_xfer + skip * 512, n * 512);
+		
+		blk += n;
+		cnt -= n;
+		p   += n * 512;
+	}
+	return 0;
+}
+
 static void disk_cpart(struct disk *dk, int nr, blk_t start, blk_t size, int type, int act)
 {
 	struct disk *dkp;
@@ -257,6 +387,8 @@ static void disk_chk_edd(struct disk *dk)
 #endif
 	dk->size = dpb.blocks;
 	dk->read = disk_read_edd;
+	if (disk_xfer_max)
+		dk->readn = disk_readn_edd;
 }
 
 void disk_init_chs(int unit)
@@ -291,6 +423,8 @@ void disk_init_chs(int unit)
 	dk->size *= dk->nsect;
 	dk->unit  = unit;
 	dk->read  = disk_read_chs;
+	if (disk_xfer_max)
+		dk->readn = disk_readn_chs;
 	
 	if (unit < 128)
 	{
@@ -346,6 +480,8 @@ static void disk_init_cdrom(int unit)
 	dk->size = 16384; /* XXX */
 	dk->unit = unit;
 	dk->read = disk_read_cdrom;
+	if (disk_xfer_max >= 4)
+		dk->readn = disk_readn_cdrom;
 	
 	strcpy(dk->name, "cdrom0");
 	
@@ -378,6 +514,11 @@ void disk_init(void)
 	con_putc('\n');
 #endif
 	
+	disk_xfer     = (char *)(uintptr_t)conv_mem_lbrk;
+	disk_xfer_max = (conv_mem_hbrk - conv_mem_lbrk) / 512;
+	if (disk_xfer_max > XFER_MAX)
+		disk_xfer_max = XFER_MAX;
+	
 	for (i = 0; i < 4; i++)
 		disk_init_chs(i);
 	for (i = 128; i < 132; i++)
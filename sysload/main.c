@@ -109,6 +109,8 @@ static uint8_t *	splash;
 
 #define min(a, b)	((a) < (b) ? (a) : (b))
 
+#define RD_CHUNK	508	/* sectors read per ramdisk progress update */
+
 static void fbconf(void);
 
 void diskview(void);
@@ -119,6 +121,39 @@ void fail(const char *s, const char *s1)
 	halt();
 }
 
+static void load_time(const char *name, long t)
+{
+	static int y = 3;
+	char buf[16];
+	
+	if (!verbose_flag)
+		return;
+	
+	t = t * 1000 / clock_hz();
+	itoa(t, buf);
+	
+	con_setattr(0, 7, 0);
+	con_rect(2, y, 76, 1);
+	con_putsxy(2, y, name);
+	con_putsxy(60, y, buf);
+	con_puts(" ms");
+	
+	if (++y >= 19)
+		y = 3;
+}
+
+static int load_file(struct file *f, void *buf, const char *name)
+{
+	long t;
+	int err;
+	
+	t   = clock_time();
+	err = fs_load(f, buf);
+	if (!err)
+		load_time(name, clock_time() - t);
+	return err;
+}
+
 static void copyright(void)
 {
 	con_gotoxy(0, 0);
@@ -666,7 +701,7 @@ static void load_kern(void)
 		fail("Invalid kernel image ", boot_params.image);
 	
 	kern_base = mem_alloc(kh.size, MA_KERN);
-	if (fs_load(&f, kern_base))
+	if (load_file(&f, kern_base, boot_params.image))
 		fail("Unable to load ", boot_params.image);
 	
 	con_status("", "");
@@ -693,7 +728,7 @@ static void load_dev(struct device *dev)
 	
 	memset(desc, 0, sizeof *desc);
 	
-	if (fs_load(&f, image))
+	if (load_file(&f, image, dev->driver))
 		fail("Unable to load ", dev->driver);
 	memcpy(args, dev, sizeof *dev);
 	desc->next	= NULL;
@@ -746,7 +781,7 @@ static void load_devs(void)
 	cnt = f.size / sizeof *devs;
 	
 	devs = mem_alloc(f.size, MA_SYSLOAD);
-	if (fs_load(&f, devs))
+	if (load_file(&f, devs, boot_params.dev_db))
 		fail("Unable to load ", boot_params.dev_db);
 	
 	con_status("", "");
@@ -775,8 +810,10 @@ static void load_devs(void)
 
 static void load_rd(void)
 {
+	unsigned cnt;
 	blk_t i;
 	char *p;
+	long t;
 	
 	if (!boot_params.rd_size)
 		return;
@@ -787,16 +824,17 @@ static void load_rd(void)
 		fail("Ramdisk too big to fit in memory.", "");
 	
 	con_status("Loading ramdisk ...", "");
-	for (p = rd_base, i = 0; i < rd_size; p += 512, i++)
+	t = clock_time();
+	for (p = rd_base, i = 0; i < rd_size; p += cnt * 512, i += cnt)
 	{
-		if (i % 36 == 35)
-		{
-			con_setattr(0, 7, BOLD);
-			con_progress(2, 22, 76, i, rd_size);
-		}
-		if (disk_read(dk, i, p))
+		con_setattr(0, 7, BOLD);
+		con_progress(2, 22, 76, i, rd_size);
+		
+		cnt = min(rd_size - i, RD_CHUNK);
+		if (disk_readn(dk, i, cnt, p))
 			fail("Unable to load ramdisk.", "");
 	}
+	load_time("ramdisk", clock_time() - t);
 	con_setattr(0, 7, BOLD);
 	con_progress(2, 22, 76, 1, 1);
 	con_status("Ramdisk loaded.", "");